@@ -11,7 +11,14 @@
  *
  * Functions of interest for libsvgtiny use are:
  *  main() - loads an SVG using svgtiny_create() and svgtiny_parse()
- *  event_diagram_expose() - renders the SVG by stepping through the shapes
+ *  render_diagram() - renders the SVG by stepping through the shapes
+ *  benchmark() - times render_diagram() against svgtiny_render_threads()
+ *
+ * With -b, the SVG is rendered COUNT times at SCALE to an image surface by
+ * cairo, and then to a buffer by svgtiny_render_threads() with 1, 2, 4, 8,
+ * and 16 threads, and the time taken by each is printed, without opening a
+ * window:
+ *  svgtiny_display_x11 -b FILE [COUNT [SCALE]]
  *
  * Compile using:
  *  gcc -g -W -Wall -o svgtiny_display_x11 svgtiny_display_x11.c \
@@ -23,9 +30,11 @@
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/keysym.h>
@@ -49,7 +58,11 @@ void update_window_title(void);
 void gui_poll(void);
 void event_diagram_key_press(XKeyEvent *key_event);
 void event_diagram_expose(const XExposeEvent *expose_event);
+void render_diagram(cairo_t *cr);
 void render_path(cairo_t *cr, float scale, struct svgtiny_shape *path);
+void render_mesh(cairo_t *cr, float scale, struct svgtiny_shape *shape);
+void benchmark(unsigned int count);
+double seconds(void);
 void die(const char *message);
 
 
@@ -64,12 +77,23 @@ int main(int argc, char *argv[])
 	size_t size;
 	size_t n;
 	svgtiny_code code;
-
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+	unsigned int bench_count = 0;
+
+	if (3 <= argc && argc <= 5 && strcmp(argv[1], "-b") == 0) {
+		bench_count = 4 <= argc ? atoi(argv[3]) : 10;
+		if (bench_count == 0)
+			bench_count = 1;
+		if (argc == 5 && 0 < atof(argv[4]))
+			scale = atof(argv[4]);
+		svg_path = argv[2];
+	} else if (argc == 2) {
+		svg_path = argv[1];
+	} else {
+		fprintf(stderr, "Usage: %s FILE\n"
+				"       %s -b FILE [COUNT [SCALE]]\n",
+				argv[0], argv[0]);
 		return 1;
 	}
-	svg_path = argv[1];
 
 	/* load file into memory buffer */
 	fd = fopen(svg_path, "rb");
@@ -107,6 +131,11 @@ int main(int argc, char *argv[])
 	}
 
 	/* parse */
+	/* cairo draws linear gradients itself, and shades meshes for radial
+	 * gradients */
+	svgtiny_set_options(diagram, svgtiny_NATIVE_GRADIENTS |
+			svgtiny_MESH_GRADIENTS | svgtiny_PACKED_PATHS);
+
 	code = svgtiny_parse(diagram, buffer, size, svg_path, 1000, 1000);
 	if (code != svgtiny_OK) {
 		fprintf(stderr, "svgtiny_parse failed: ");
@@ -114,8 +143,8 @@ int main(int argc, char *argv[])
 		case svgtiny_OUT_OF_MEMORY:
 			fprintf(stderr, "svgtiny_OUT_OF_MEMORY");
 			break;
-		case svgtiny_LIBXML_ERROR:
-			fprintf(stderr, "svgtiny_LIBXML_ERROR");
+		case svgtiny_LIBDOM_ERROR:
+			fprintf(stderr, "svgtiny_LIBDOM_ERROR");
 			break;
 		case svgtiny_NOT_SVG:
 			fprintf(stderr, "svgtiny_NOT_SVG");
@@ -137,6 +166,12 @@ int main(int argc, char *argv[])
 	/*printf("viewbox 0 0 %u %u\n",
 			diagram->width, diagram->height);*/
 
+	if (bench_count) {
+		benchmark(bench_count);
+		svgtiny_free(diagram);
+		return 0;
+	}
+
 	gui_init();
 
 	while (!quit) {
@@ -318,7 +353,6 @@ void event_diagram_expose(const XExposeEvent *expose_event)
 	cairo_surface_t *surface;
 	cairo_t *cr;
 	cairo_status_t status;
-	unsigned int i;
 
 	if (expose_event->count != 0)
 		return;
@@ -341,13 +375,39 @@ void event_diagram_expose(const XExposeEvent *expose_event)
 		return;
 	}
 
+	render_diagram(cr);
+
+	status = cairo_status(cr);
+	if (status != CAIRO_STATUS_SUCCESS) {
+		fprintf(stderr, "cairo error: %s\n",
+				cairo_status_to_string(status));
+		cairo_destroy(cr);
+		cairo_surface_destroy(surface);
+		return;
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+}
+
+
+/**
+ * Render the diagram on white using cairo.
+ */
+void render_diagram(cairo_t *cr)
+{
+	unsigned int i;
+
 	cairo_set_source_rgb(cr, 1, 1, 1);
 	cairo_paint(cr);
 
 	for (i = 0; i != diagram->shape_count; i++) {
-		if (diagram->shape[i].path) {
+		if (diagram->shape[i].path || diagram->shape[i].path_op) {
 			render_path(cr, scale, &diagram->shape[i]);
 
+		} else if (diagram->shape[i].mesh) {
+			render_mesh(cr, scale, &diagram->shape[i]);
+
 		} else if (diagram->shape[i].text) {
 			cairo_set_source_rgb(cr,
 				svgtiny_RED(diagram->shape[i].stroke) / 255.0,
@@ -359,18 +419,6 @@ void event_diagram_expose(const XExposeEvent *expose_event)
 			cairo_show_text(cr, diagram->shape[i].text);
 		}
 	}
-
-	status = cairo_status(cr);
-	if (status != CAIRO_STATUS_SUCCESS) {
-		fprintf(stderr, "cairo error: %s\n",
-				cairo_status_to_string(status));
-		cairo_destroy(cr);
-		cairo_surface_destroy(surface);
-		return;
-	}
-
-	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
 }
 
 
@@ -379,43 +427,59 @@ void event_diagram_expose(const XExposeEvent *expose_event)
  */
 void render_path(cairo_t *cr, float scale, struct svgtiny_shape *path)
 {
+	struct svgtiny_path_iterator iterator;
+	struct svgtiny_path_segment segment;
 	unsigned int j;
 
 	cairo_new_path(cr);
-	for (j = 0; j != path->path_length; ) {
-		switch ((int) path->path[j]) {
+	svgtiny_path_begin(&iterator, path);
+	while (svgtiny_path_next(&iterator, &segment)) {
+		const float *point = segment.point;
+		switch (segment.type) {
 		case svgtiny_PATH_MOVE:
-			cairo_move_to(cr,
-					scale * path->path[j + 1],
-					scale * path->path[j + 2]);
-			j += 3;
+			cairo_move_to(cr, scale * point[0], scale * point[1]);
 			break;
 		case svgtiny_PATH_CLOSE:
 			cairo_close_path(cr);
-			j += 1;
 			break;
 		case svgtiny_PATH_LINE:
-			cairo_line_to(cr,
-					scale * path->path[j + 1],
-					scale * path->path[j + 2]);
-			j += 3;
+			cairo_line_to(cr, scale * point[0], scale * point[1]);
 			break;
 		case svgtiny_PATH_BEZIER:
 			cairo_curve_to(cr,
-					scale * path->path[j + 1],
-					scale * path->path[j + 2],
-					scale * path->path[j + 3],
-					scale * path->path[j + 4],
-					scale * path->path[j + 5],
-					scale * path->path[j + 6]);
-			j += 7;
+					scale * point[0], scale * point[1],
+					scale * point[2], scale * point[3],
+					scale * point[4], scale * point[5]);
 			break;
-		default:
-			printf("error ");
-			j += 1;
 		}
 	}
-	if (path->fill != svgtiny_TRANSPARENT) {
+	cairo_set_fill_rule(cr, path->fill_rule == svgtiny_FILL_EVENODD ?
+			CAIRO_FILL_RULE_EVEN_ODD : CAIRO_FILL_RULE_WINDING);
+	if (path->fill_gradient) {
+		const struct svgtiny_linear_gradient *gradient =
+				path->fill_gradient;
+		cairo_pattern_t *pattern;
+		pattern = cairo_pattern_create_linear(
+				scale * gradient->x1, scale * gradient->y1,
+				scale * gradient->x2, scale * gradient->y2);
+		for (j = 0; j != gradient->stop_count; j++)
+			cairo_pattern_add_color_stop_rgb(pattern,
+				gradient->stop[j].offset,
+				svgtiny_RED(gradient->stop[j].color) / 255.0,
+				svgtiny_GREEN(gradient->stop[j].color) / 255.0,
+				svgtiny_BLUE(gradient->stop[j].color) / 255.0);
+		if (gradient->spread == svgtiny_SPREAD_REFLECT)
+			cairo_pattern_set_extend(pattern,
+					CAIRO_EXTEND_REFLECT);
+		else if (gradient->spread == svgtiny_SPREAD_REPEAT)
+			cairo_pattern_set_extend(pattern,
+					CAIRO_EXTEND_REPEAT);
+		else
+			cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+		cairo_set_source(cr, pattern);
+		cairo_fill_preserve(cr);
+		cairo_pattern_destroy(pattern);
+	} else if (path->fill != svgtiny_TRANSPARENT) {
 		cairo_set_source_rgb(cr,
 				svgtiny_RED(path->fill) / 255.0,
 				svgtiny_GREEN(path->fill) / 255.0,
@@ -433,6 +497,109 @@ void render_path(cairo_t *cr, float scale, struct svgtiny_shape *path)
 }
 
 
+/**
+ * Render an svgtiny triangle mesh using a cairo mesh pattern.
+ */
+void render_mesh(cairo_t *cr, float scale, struct svgtiny_shape *shape)
+{
+	const struct svgtiny_mesh *mesh = shape->mesh;
+	cairo_pattern_t *pattern;
+	unsigned int j, k;
+
+	pattern = cairo_pattern_create_mesh();
+	for (j = 0; j + 2 < mesh->index_count; j += 3) {
+		cairo_mesh_pattern_begin_patch(pattern);
+		for (k = 0; k != 3; k++) {
+			unsigned int v = mesh->index[j + k];
+			if (k == 0)
+				cairo_mesh_pattern_move_to(pattern,
+						scale * mesh->vertex[2 * v],
+						scale * mesh->vertex[2 * v + 1]);
+			else
+				cairo_mesh_pattern_line_to(pattern,
+						scale * mesh->vertex[2 * v],
+						scale * mesh->vertex[2 * v + 1]);
+			cairo_mesh_pattern_set_corner_color_rgb(pattern, k,
+					svgtiny_RED(mesh->colour[v]) / 255.0,
+					svgtiny_GREEN(mesh->colour[v]) / 255.0,
+					svgtiny_BLUE(mesh->colour[v]) / 255.0);
+		}
+		cairo_mesh_pattern_end_patch(pattern);
+	}
+	cairo_set_source(cr, pattern);
+	cairo_paint(cr);
+	cairo_pattern_destroy(pattern);
+}
+
+
+/**
+ * Time rendering the diagram with cairo and with svgtiny_render().
+ */
+void benchmark(unsigned int count)
+{
+	int width = diagram->width * scale;
+	int height = diagram->height * scale;
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	unsigned char *buffer;
+	unsigned int i, threads;
+	double start, cairo_time, svgtiny_time, one_thread_time = 0;
+
+	if (width <= 0 || height <= 0)
+		die("diagram is empty");
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			width, height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+		die("cairo_image_surface_create failed");
+	start = seconds();
+	for (i = 0; i != count; i++) {
+		cr = cairo_create(surface);
+		render_diagram(cr);
+		cairo_destroy(cr);
+	}
+	cairo_surface_flush(surface);
+	cairo_time = seconds() - start;
+	cairo_surface_destroy(surface);
+
+	printf("%i x %i, %u times\n", width, height, count);
+	printf("cairo                       %10.3f ms\n",
+			1000 * cairo_time / count);
+
+	buffer = malloc((size_t) width * height * 4);
+	if (!buffer)
+		die("out of memory");
+	for (threads = 1; threads <= 16; threads *= 2) {
+		start = seconds();
+		for (i = 0; i != count; i++) {
+			memset(buffer, 0xff, (size_t) width * height * 4);
+			if (svgtiny_render_threads(diagram, buffer, width * 4,
+					width, height, scale, threads) !=
+					svgtiny_OK)
+				die("svgtiny_render_threads failed");
+		}
+		svgtiny_time = seconds() - start;
+		if (threads == 1)
+			one_thread_time = svgtiny_time;
+		printf("svgtiny_render, %2u threads %10.3f ms  %5.2fx\n",
+				threads, 1000 * svgtiny_time / count,
+				one_thread_time / svgtiny_time);
+	}
+	free(buffer);
+}
+
+
+/**
+ * Get a monotonic time in seconds.
+ */
+double seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
 /**
  * Exit with fatal error.
  */
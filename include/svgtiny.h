@@ -8,6 +8,8 @@
 #ifndef SVGTINY_H
 #define SVGTINY_H
 
+#include <stdint.h>
+
 typedef int svgtiny_colour;
 #define svgtiny_TRANSPARENT 0x1000000
 #ifdef __riscos__
@@ -22,6 +24,38 @@ typedef int svgtiny_colour;
 #define svgtiny_BLUE(c) ((c) & 0xff)
 #endif
 
+struct svgtiny_mesh {
+	unsigned int vertex_count;
+	float *vertex;			/* x, y of each vertex */
+	svgtiny_colour *colour;		/* colour of each vertex */
+	unsigned int index_count;
+	unsigned int *index;		/* 3 vertices for each triangle */
+};
+
+struct svgtiny_gradient_stop {
+	float offset;
+	svgtiny_colour color;
+};
+
+enum {
+	svgtiny_SPREAD_PAD,
+	svgtiny_SPREAD_REFLECT,
+	svgtiny_SPREAD_REPEAT
+};
+
+/* how the inside of a path is found, from the fill-rule property */
+enum {
+	svgtiny_FILL_NONZERO,
+	svgtiny_FILL_EVENODD
+};
+
+struct svgtiny_linear_gradient {
+	float x1, y1, x2, y2;		/* gradient vector in pixels */
+	unsigned int stop_count;
+	struct svgtiny_gradient_stop *stop;
+	int spread;			/* svgtiny_SPREAD_* */
+};
+
 struct svgtiny_shape {
 	float *path;
 	unsigned int path_length;
@@ -30,6 +64,22 @@ struct svgtiny_shape {
 	svgtiny_colour fill;
 	svgtiny_colour stroke;
 	int stroke_width;
+	int fill_rule;			/* svgtiny_FILL_* */
+	struct svgtiny_mesh *mesh;
+	struct svgtiny_linear_gradient *fill_gradient;
+	/* the path with svgtiny_PACKED_PATHS, instead of path */
+	unsigned char *path_op;		/* svgtiny_PATH_* of each segment */
+	unsigned int path_op_count;
+	float *path_point;		/* x, y of the points of the segments */
+	unsigned int path_point_count;
+	/* the points with svgtiny_FIXED_PATHS, instead of path_point */
+	int32_t *path_fixed;		/* x, y in fixed point */
+	/* or with svgtiny_SHORT_FIXED_PATHS, when they fit in 16 bits */
+	int16_t *path_short;		/* x, y in fixed point from origin */
+	int32_t path_origin_x, path_origin_y;
+	/* extent of the path, mesh, or text position in pixels, without
+	   the stroke */
+	float bbox_x0, bbox_y0, bbox_x1, bbox_y1;
 };
 
 struct svgtiny_diagram {
@@ -57,6 +107,35 @@ enum {
 	svgtiny_PATH_BEZIER
 };
 
+/* options for svgtiny_set_options() */
+enum {
+	svgtiny_NATIVE_GRADIENTS = 1,
+	svgtiny_LINEAR_RGB_GRADIENTS = 2,
+	svgtiny_PACKED_PATHS = 4,
+	svgtiny_FIXED_PATHS = 8,
+	svgtiny_SHORT_FIXED_PATHS = 16,
+	svgtiny_CLIP_PATHS = 32,
+	svgtiny_MESH_GRADIENTS = 64
+};
+
+/* a segment of a path, from svgtiny_path_next() */
+struct svgtiny_path_segment {
+	int type;			/* svgtiny_PATH_* */
+	const float *point;		/* x, y of 1 point, or of 3 for
+					   svgtiny_PATH_BEZIER */
+	const int32_t *fixed;		/* or the points in fixed point */
+	const int16_t *fixed_short;	/* or in fixed point from origin */
+};
+
+/* a position in a path of either layout, from svgtiny_path_begin() */
+struct svgtiny_path_iterator {
+	const float *path, *path_end;
+	const unsigned char *op, *op_end;
+	const float *point;
+	const int32_t *fixed;
+	const int16_t *fixed_short;
+};
+
 struct svgtiny_named_color {
 	const char *name;
 	svgtiny_colour color;
@@ -64,13 +143,72 @@ struct svgtiny_named_color {
 
 
 struct svgtiny_diagram *svgtiny_create(void);
+svgtiny_code svgtiny_reserve(struct svgtiny_diagram *diagram,
+		unsigned int shape_count);
+void svgtiny_set_options(struct svgtiny_diagram *diagram,
+		unsigned int options);
+void svgtiny_set_tolerance(struct svgtiny_diagram *diagram,
+		float colour, float flatness);
+void svgtiny_set_fixed_point(struct svgtiny_diagram *diagram,
+		unsigned int fraction_bits);
+void svgtiny_set_clip(struct svgtiny_diagram *diagram,
+		float x0, float y0, float x1, float y1);
+void svgtiny_set_threads(struct svgtiny_diagram *diagram,
+		unsigned int threads);
 svgtiny_code svgtiny_parse(struct svgtiny_diagram *diagram,
 		const char *buffer, size_t size, const char *url,
 		int width, int height);
 void svgtiny_free(struct svgtiny_diagram *svg);
 
+void svgtiny_path_begin(struct svgtiny_path_iterator *iterator,
+		const struct svgtiny_shape *shape);
+int svgtiny_path_next(struct svgtiny_path_iterator *iterator,
+		struct svgtiny_path_segment *segment);
+svgtiny_code svgtiny_flatten(struct svgtiny_diagram *diagram,
+		float tolerance);
+svgtiny_code svgtiny_render(const struct svgtiny_diagram *diagram,
+		unsigned char *buffer, unsigned int stride,
+		unsigned int width, unsigned int height, float scale);
+svgtiny_code svgtiny_render_threads(const struct svgtiny_diagram *diagram,
+		unsigned char *buffer, unsigned int stride,
+		unsigned int width, unsigned int height, float scale,
+		unsigned int threads);
+svgtiny_code svgtiny_render_sdf(const struct svgtiny_diagram *diagram,
+		unsigned char *buffer, unsigned int stride,
+		unsigned int width, unsigned int height, float scale,
+		float range, unsigned int threads);
+
 svgtiny_code svgtiny_parse_dom(const char *buffer, size_t size, const char *url, dom_document **output_dom);
 svgtiny_code svgtiny_parse_svg_from_dom(struct svgtiny_diagram *diagram, dom_document *dom, int width, int height);
 void svgtiny_free_dom(dom_document *dom);
 
+struct svgtiny_stream;
+
+struct svgtiny_stream *svgtiny_stream_create(struct svgtiny_diagram *diagram,
+		const char *url, int width, int height);
+svgtiny_code svgtiny_stream_parse_chunk(struct svgtiny_stream *stream,
+		const char *buffer, size_t size);
+svgtiny_code svgtiny_stream_completed(struct svgtiny_stream *stream);
+void svgtiny_stream_free(struct svgtiny_stream *stream);
+svgtiny_code svgtiny_parse_stream(struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+
+struct svgtiny_index;
+
+struct svgtiny_index *svgtiny_index_create(
+		const struct svgtiny_diagram *diagram);
+unsigned int svgtiny_index_query(const struct svgtiny_index *index,
+		float x0, float y0, float x1, float y1, unsigned int *shape);
+void svgtiny_index_free(struct svgtiny_index *index);
+
+struct svgtiny_context;
+
+struct svgtiny_context *svgtiny_context_create(void);
+svgtiny_code svgtiny_parse_ctx(struct svgtiny_context *ctx,
+		struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+void svgtiny_context_free(struct svgtiny_context *ctx);
+
 #endif
@@ -26,8 +26,50 @@
 
 #define KAPPA		0.5522847498
 
+/* an element whose children are being parsed */
+struct svgtiny_parse_frame {
+	dom_node *child;	/* next child to parse, or NULL */
+	bool text;		/* <text> or <tspan>, else <svg>, <g>, or <a> */
+	float text_x, text_y;	/* position of text content */
+	struct svgtiny_parse_state state;
+};
+
+/* the children of the root element, parsed by several threads, each into a
+ * diagram of its own, which are joined in document order at the end */
+struct svgtiny_parse_job {
+	const struct svgtiny_parse_context *context;
+	const struct svgtiny_parse_state *state;	/* of the root */
+
+	/* element children of the root, and the diagram which each was
+	 * parsed into, or NULL if it was not parsed, and the result */
+	dom_node **child;
+	struct svgtiny_diagram **part;
+	svgtiny_code *code;
+	unsigned int child_count;
+};
+
+static svgtiny_code svgtiny_parse_tree(dom_element *svg,
+		const struct svgtiny_parse_state *state);
+static svgtiny_code svgtiny_parse_frames(struct svgtiny_list *stack,
+		unsigned int depth);
+static void svgtiny_free_frames(struct svgtiny_list *stack);
+static svgtiny_code svgtiny_parse_parallel(struct svgtiny_list *stack,
+		unsigned int threads);
+static svgtiny_code svgtiny_parse_children(struct svgtiny_parse_frame *root,
+		struct svgtiny_parse_job *job);
+static void svgtiny_parse_work(struct svgtiny_threads *threads, void *pw);
+static svgtiny_code svgtiny_parse_subtree(struct svgtiny_parse_job *job,
+		struct svgtiny_threads *threads, unsigned int i);
+static void svgtiny_parse_lock(const struct svgtiny_parse_context *context);
+static void svgtiny_parse_unlock(
+		const struct svgtiny_parse_context *context);
+static svgtiny_code svgtiny_push_frame(struct svgtiny_list *stack,
+		dom_element *element, const struct svgtiny_parse_state *parent,
+		bool text);
+static svgtiny_code svgtiny_parse_child(struct svgtiny_list *stack,
+		dom_node *child);
 static svgtiny_code svgtiny_parse_svg(dom_element *svg,
-		struct svgtiny_parse_state state);
+		struct svgtiny_parse_state *state);
 static svgtiny_code svgtiny_parse_path(dom_element *path,
 		struct svgtiny_parse_state state);
 static svgtiny_code svgtiny_parse_rect(dom_element *rect,
@@ -41,65 +83,41 @@ static svgtiny_code svgtiny_parse_line(dom_element *line,
 static svgtiny_code svgtiny_parse_poly(dom_element *poly,
 		struct svgtiny_parse_state state, bool polygon);
 static svgtiny_code svgtiny_parse_text(dom_element *text,
-		struct svgtiny_parse_state state);
+		struct svgtiny_parse_frame *frame);
 static void svgtiny_parse_position_attributes(dom_element *node,
 		const struct svgtiny_parse_state state,
 		float *x, float *y, float *width, float *height);
 static void svgtiny_parse_paint_attributes(dom_element *node,
 		struct svgtiny_parse_state *state);
+static void svgtiny_parse_paint(const char *s, svgtiny_colour *c,
+		struct svgtiny_parse_state *state);
 static void svgtiny_parse_font_attributes(dom_element *node,
 		struct svgtiny_parse_state *state);
 static void svgtiny_parse_transform_attributes(dom_element *node,
 		struct svgtiny_parse_state *state);
-static svgtiny_code svgtiny_add_path(float *p, unsigned int n,
-		struct svgtiny_parse_state *state);
-static void _svgtiny_parse_color(const char *s, svgtiny_colour *c,
-		struct svgtiny_parse_state *state);
+static bool svgtiny_path_culled(const float *p, unsigned int n,
+		const struct svgtiny_parse_state *state);
 
 /**
  * Set the local externally-stored parts of a parse state.
  * Call this in functions that made a new state on the stack.
- * Doesn't make own copy of global state, such as the interned string list.
+ * The new state borrows any gradient from the state it was copied from.
  */
-static void svgtiny_setup_state_local(struct svgtiny_parse_state *state)
+void svgtiny_setup_state_local(struct svgtiny_parse_state *state)
 {
-	if (state->gradient_x1 != NULL) {
-		dom_string_ref(state->gradient_x1);
-	}
-	if (state->gradient_y1 != NULL) {
-		dom_string_ref(state->gradient_y1);
-	}
-	if (state->gradient_x2 != NULL) {
-		dom_string_ref(state->gradient_x2);
-	}
-	if (state->gradient_y2 != NULL) {
-		dom_string_ref(state->gradient_y2);
-	}
+	state->gradient_owned = false;
 }
 
 /**
  * Cleanup the local externally-stored parts of a parse state.
  * Call this in functions that made a new state on the stack.
- * Doesn't cleanup global state, such as the interned string list.
  */
-static void svgtiny_cleanup_state_local(struct svgtiny_parse_state *state)
+void svgtiny_cleanup_state_local(struct svgtiny_parse_state *state)
 {
-	if (state->gradient_x1 != NULL) {
-		dom_string_unref(state->gradient_x1);
-		state->gradient_x1 = NULL;
-	}
-	if (state->gradient_y1 != NULL) {
-		dom_string_unref(state->gradient_y1);
-		state->gradient_y1 = NULL;
-	}
-	if (state->gradient_x2 != NULL) {
-		dom_string_unref(state->gradient_x2);
-		state->gradient_x2 = NULL;
-	}
-	if (state->gradient_y2 != NULL) {
-		dom_string_unref(state->gradient_y2);
-		state->gradient_y2 = NULL;
-	}
+	if (state->gradient_owned)
+		svgtiny_gradient_free(state->gradient);
+	state->gradient = NULL;
+	state->gradient_owned = false;
 }
 
 
@@ -109,17 +127,191 @@ static void svgtiny_cleanup_state_local(struct svgtiny_parse_state *state)
 
 struct svgtiny_diagram *svgtiny_create(void)
 {
-	struct svgtiny_diagram *diagram;
+	struct svgtiny_diagram_internal *internal;
 
-	diagram = calloc(sizeof(*diagram), 1);
-	if (!diagram)
+	internal = calloc(sizeof(*internal), 1);
+	if (!internal)
 		return 0;
+	internal->colour_tolerance = svgtiny_DEFAULT_COLOUR_TOLERANCE;
+	internal->flatness = svgtiny_DEFAULT_FLATNESS;
+	internal->fraction_bits = svgtiny_DEFAULT_FRACTION_BITS;
+	internal->threads = 1;
+
+	return &internal->diagram;
+}
+
+
+/**
+ * Allocate space for a number of shapes in a diagram.
+ *
+ * Parsing grows the shape array as needed, so this is only a hint to avoid
+ * reallocation when the number of shapes is known in advance.
+ *
+ * \param  diagram      diagram returned by svgtiny_create()
+ * \param  shape_count  total number of shapes expected
+ * \return  svgtiny_OK or svgtiny_OUT_OF_MEMORY
+ */
+
+svgtiny_code svgtiny_reserve(struct svgtiny_diagram *diagram,
+		unsigned int shape_count)
+{
+	struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(diagram);
+	struct svgtiny_shape *shape;
+
+	if (shape_count <= internal->shape_allocated)
+		return svgtiny_OK;
+
+	if (internal->compact)
+		return svgtiny_arena_detach(diagram, shape_count);
+
+	shape = realloc(diagram->shape, shape_count * sizeof *shape);
+	if (!shape)
+		return svgtiny_OUT_OF_MEMORY;
+	diagram->shape = shape;
+	internal->shape_allocated = shape_count;
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Set options for parsing into a diagram.
+ *
+ * Gradient fills are normally added as triangles filled with flat colours.
+ * With svgtiny_MESH_GRADIENTS, each is instead added as one shape with mesh
+ * set, for renderers which shade triangles smoothly.
+ *
+ * With svgtiny_NATIVE_GRADIENTS, a path filled with a linear gradient is added
+ * once with fill_gradient set, for renderers which draw gradients themselves,
+ * instead of as triangles approximating the gradient. Radial gradients are
+ * always added as triangles.
+ *
+ * With svgtiny_LINEAR_RGB_GRADIENTS, gradient colours are interpolated in
+ * linear light instead of between sRGB values.
+ *
+ * With svgtiny_PACKED_PATHS, paths are stored as segment types in path_op and
+ * points in path_point, instead of in path.
+ *
+ * With svgtiny_FIXED_PATHS, paths are stored as with svgtiny_PACKED_PATHS but
+ * with the points rounded to fixed point in path_fixed, instead of in
+ * path_point. With svgtiny_SHORT_FIXED_PATHS, the points of a shape are
+ * instead stored in path_short as 16 bit offsets from path_origin_x and
+ * path_origin_y, if they fit, and otherwise in path_fixed.
+ *
+ * With svgtiny_CLIP_PATHS, paths are clipped to the rectangle given by
+ * svgtiny_set_clip(), so that their parts outside it are not stored.
+ *
+ * \param  diagram  diagram returned by svgtiny_create()
+ * \param  options  svgtiny_NATIVE_GRADIENTS, svgtiny_LINEAR_RGB_GRADIENTS,
+ *                  svgtiny_PACKED_PATHS, svgtiny_FIXED_PATHS,
+ *                  svgtiny_SHORT_FIXED_PATHS, svgtiny_CLIP_PATHS, and
+ *                  svgtiny_MESH_GRADIENTS combined, or 0
+ */
+
+void svgtiny_set_options(struct svgtiny_diagram *diagram,
+		unsigned int options)
+{
+	svgtiny_diagram_internal(diagram)->options = options;
+}
+
+
+/**
+ * Set how closely gradient meshes approximate gradients.
+ *
+ * Fewer triangles are needed for larger tolerances. The colour of a mesh
+ * differs from the gradient by at most about colour in each channel, and the
+ * edges of the mesh from the curves of the path by at most flatness pixels.
+ *
+ * \param  diagram   diagram returned by svgtiny_create()
+ * \param  colour    largest channel error, from 0 to 255 (default 1)
+ * \param  flatness  largest distance in pixels (default 0.5)
+ */
+
+void svgtiny_set_tolerance(struct svgtiny_diagram *diagram,
+		float colour, float flatness)
+{
+	struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(diagram);
+
+	if (!(0 <= colour))
+		colour = 0;
+	if (!(svgtiny_MIN_FLATNESS <= flatness))
+		flatness = svgtiny_MIN_FLATNESS;
+	internal->colour_tolerance = colour;
+	internal->flatness = flatness;
+}
+
+
+/**
+ * Set the precision of fixed point paths.
+ *
+ * \param  diagram        diagram returned by svgtiny_create()
+ * \param  fraction_bits  bits after the binary point, up to 16 (default 8,
+ *                        for 24.8 fixed point)
+ */
+
+void svgtiny_set_fixed_point(struct svgtiny_diagram *diagram,
+		unsigned int fraction_bits)
+{
+	if (svgtiny_MAX_FRACTION_BITS < fraction_bits)
+		fraction_bits = svgtiny_MAX_FRACTION_BITS;
+	svgtiny_diagram_internal(diagram)->fraction_bits = fraction_bits;
+}
+
+
+/**
+ * Set a clip rectangle, outside which shapes are left out of a diagram.
+ *
+ * A path, and its stroke, which falls entirely outside the rectangle is
+ * dropped as it is parsed, before it is stored or a gradient fill is
+ * tessellated. Shapes which may be partly inside are kept whole. Text is
+ * always kept, as its extent is not known.
+ *
+ * \param  diagram  diagram returned by svgtiny_create()
+ * \param  x0       left edge of the rectangle, in pixels
+ * \param  y0       top edge
+ * \param  x1       right edge
+ * \param  y1       bottom edge
+ */
+
+void svgtiny_set_clip(struct svgtiny_diagram *diagram,
+		float x0, float y0, float x1, float y1)
+{
+	struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(diagram);
+
+	internal->clip = true;
+	internal->clip_x0 = x0;
+	internal->clip_y0 = y0;
+	internal->clip_x1 = x1;
+	internal->clip_y1 = y1;
+}
+
+
+/**
+ * Set how many threads svgtiny_parse() uses.
+ *
+ * With more than one, the children of the root <svg> element, such as the
+ * <g> layers of a large drawing, are parsed by several threads at once, each
+ * into shapes of its own, which are then joined in document order. The
+ * diagram, and any error, are the same as parsing on one thread. As libdom
+ * is not thread safe, only one thread uses the document at a time, and the
+ * others meanwhile turn path data into shapes. The streaming parsers always
+ * use one thread, as do builds without POSIX threads.
+ *
+ * \param  diagram  diagram returned by svgtiny_create()
+ * \param  threads  number of threads, including the calling thread, or 0 for
+ *                  one for each processor (default 1)
+ */
 
-	return diagram;
-	free(diagram);
-	return NULL;
+void svgtiny_set_threads(struct svgtiny_diagram *diagram,
+		unsigned int threads)
+{
+	svgtiny_diagram_internal(diagram)->threads = threads;
 }
 
+
 static void ignore_msg(uint32_t severity, void *ctx, const char *msg, ...)
 {
 	UNUSED(severity);
@@ -216,6 +408,11 @@ svgtiny_code svgtiny_parse_svg_from_dom(struct svgtiny_diagram *diagram,
     dom_element *svg;
     dom_exception exc;
 	svgtiny_code code;
+	struct svgtiny_parse_context context;
+	struct svgtiny_parse_state state;
+	float x, y, width, height;
+
+	assert(diagram);
 
     exc = dom_document_get_document_element(document, &svg);
 	if (exc != DOM_NO_ERR) {
@@ -223,27 +420,18 @@ svgtiny_code svgtiny_parse_svg_from_dom(struct svgtiny_diagram *diagram,
 		return svgtiny_LIBDOM_ERROR;
 	}
 
-	struct svgtiny_parse_state state;
-	float x, y, width, height;
-
-	assert(diagram);
-
-	state.gradient_x1 = NULL;
-	state.gradient_y1 = NULL;
-	state.gradient_x2 = NULL;
-	state.gradient_y2 = NULL;
-
-
-	/* get graphic dimensions */
-	memset(&state, 0, sizeof(state));
-	state.diagram = diagram;
-	state.document = document;
-	state.viewport_width = viewport_width;
-	state.viewport_height = viewport_height;
+	memset(&context, 0, sizeof(context));
+	context.diagram = diagram;
+	context.document = document;
+	context.gradient_cache = svgtiny_gradient_cache_create();
+	if (context.gradient_cache == NULL) {
+		code = svgtiny_OUT_OF_MEMORY;
+		goto cleanup;
+	}
 
 #define SVGTINY_STRING_ACTION2(s,n)					\
 	if (dom_string_create_interned((const uint8_t *) #n,		\
-				       strlen(#n), &state.interned_##s)	\
+				       strlen(#n), &context.interned_##s)	\
 	    != DOM_NO_ERR) {						\
 		code = svgtiny_LIBDOM_ERROR;				\
 		goto cleanup;						\
@@ -251,6 +439,12 @@ svgtiny_code svgtiny_parse_svg_from_dom(struct svgtiny_diagram *diagram,
 #include "svgtiny_strings.h"
 #undef SVGTINY_STRING_ACTION2
 
+	/* get graphic dimensions */
+	memset(&state, 0, sizeof(state));
+	state.context = &context;
+	state.viewport_width = viewport_width;
+	state.viewport_height = viewport_height;
+
 	svgtiny_parse_position_attributes(svg, state, &x, &y, &width, &height);
 	diagram->width = width;
 	diagram->height = height;
@@ -269,18 +463,18 @@ svgtiny_code svgtiny_parse_svg_from_dom(struct svgtiny_diagram *diagram,
 	state.fill = 0x000000;
 	state.stroke = svgtiny_TRANSPARENT;
 	state.stroke_width = 1;
-	state.linear_gradient_stop_count = 0;
+	state.fill_rule = svgtiny_FILL_NONZERO;
 
 	/* parse tree */
-	code = svgtiny_parse_svg(svg, state);
-
-	dom_node_unref(svg);
+	code = svgtiny_parse_tree(svg, &state);
+	svgtiny_compact_diagram(diagram);
 
 cleanup:
-	svgtiny_cleanup_state_local(&state);
+	svgtiny_gradient_cache_free(context.gradient_cache);
+	dom_node_unref(svg);
 #define SVGTINY_STRING_ACTION2(s,n)			\
-	if (state.interned_##s != NULL)			\
-		dom_string_unref(state.interned_##s);
+	if (context.interned_##s != NULL)		\
+		dom_string_unref(context.interned_##s);
 #include "svgtiny_strings.h"
 #undef SVGTINY_STRING_ACTION2
 	return code;
@@ -313,381 +507,1089 @@ void svgtiny_free_dom(dom_document *dom) {
 
 
 /**
- * Parse a <svg> or <g> element node.
+ * Parse the elements below the root <svg> element.
+ *
+ * Rather than recursing, each element whose children are being parsed (<svg>,
+ * <g>, <a>, <text>, or <tspan>) has a frame on an explicit stack, holding its
+ * state and the next child to visit.
  */
 
-svgtiny_code svgtiny_parse_svg(dom_element *svg,
-		struct svgtiny_parse_state state)
+svgtiny_code svgtiny_parse_tree(dom_element *svg,
+		const struct svgtiny_parse_state *state)
 {
-	float x, y, width, height;
-	dom_string *view_box;
-	dom_element *child;
-	dom_exception exc;
+	struct svgtiny_list *stack;
+	svgtiny_code code;
 
-	svgtiny_setup_state_local(&state);
+	stack = svgtiny_list_create(sizeof (struct svgtiny_parse_frame));
+	if (!stack)
+		return svgtiny_OUT_OF_MEMORY;
 
-	svgtiny_parse_position_attributes(svg, state, &x, &y, &width, &height);
-	svgtiny_parse_paint_attributes(svg, &state);
-	svgtiny_parse_font_attributes(svg, &state);
+	code = svgtiny_push_frame(stack, svg, state, false);
+	if (code == svgtiny_OK)
+		code = svgtiny_parse_parallel(stack, svgtiny_diagram_internal(
+				state->context->diagram)->threads);
+	if (code == svgtiny_OK)
+		code = svgtiny_parse_frames(stack, 0);
 
-	exc = dom_element_get_attribute(svg, state.interned_viewBox,
-					&view_box);
-	if (exc != DOM_NO_ERR) {
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_LIBDOM_ERROR;
-	}
+	svgtiny_free_frames(stack);
+	svgtiny_list_free(stack);
 
-	if (view_box) {
-		char *s = strndup(dom_string_data(view_box),
-				  dom_string_byte_length(view_box));
-		float min_x, min_y, vwidth, vheight;
-		if (sscanf(s, "%f,%f,%f,%f",
-				&min_x, &min_y, &vwidth, &vheight) == 4 ||
-				sscanf(s, "%f %f %f %f",
-				&min_x, &min_y, &vwidth, &vheight) == 4) {
-			state.ctm.a = (float) state.viewport_width / vwidth;
-			state.ctm.d = (float) state.viewport_height / vheight;
-			state.ctm.e += -min_x * state.ctm.a;
-			state.ctm.f += -min_y * state.ctm.d;
+	return code;
+}
+
+
+/**
+ * Parse the children of the frames on a stack until it is down to a depth.
+ */
+
+svgtiny_code svgtiny_parse_frames(struct svgtiny_list *stack,
+		unsigned int depth)
+{
+	struct svgtiny_parse_frame *frame;
+	svgtiny_code code = svgtiny_OK;
+	unsigned int n;
+
+	while (code == svgtiny_OK && depth < (n = svgtiny_list_size(stack))) {
+		dom_node *child;
+		dom_exception exc;
+
+		frame = svgtiny_list_get(stack, n - 1);
+		child = frame->child;
+		if (child == NULL) {
+			/* no more children */
+			svgtiny_cleanup_state_local(&frame->state);
+			svgtiny_list_resize(stack, n - 1);
+			continue;
 		}
-		free(s);
-		dom_string_unref(view_box);
+
+		exc = dom_node_get_next_sibling(child, &frame->child);
+		if (exc != DOM_NO_ERR) {
+			frame->child = child;
+			code = svgtiny_LIBDOM_ERROR;
+			break;
+		}
+
+		code = svgtiny_parse_child(stack, child);
+		dom_node_unref(child);
 	}
 
-	svgtiny_parse_transform_attributes(svg, &state);
+	return code;
+}
 
-	exc = dom_node_get_first_child(svg, (dom_node **) (void *) &child);
-	if (exc != DOM_NO_ERR) {
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_LIBDOM_ERROR;
+
+/**
+ * Release the frames left on a stack, by an error or at the end of a subtree.
+ */
+
+void svgtiny_free_frames(struct svgtiny_list *stack)
+{
+	struct svgtiny_parse_frame *frame;
+	unsigned int n;
+
+	for (n = svgtiny_list_size(stack); n != 0; n--) {
+		frame = svgtiny_list_get(stack, n - 1);
+		if (frame->child != NULL)
+			dom_node_unref(frame->child);
+		svgtiny_cleanup_state_local(&frame->state);
 	}
-	while (child != NULL) {
-		dom_element *next;
-		dom_node_type nodetype;
-		svgtiny_code code = svgtiny_OK;
+	svgtiny_list_resize(stack, 0);
+}
 
-		exc = dom_node_get_node_type(child, &nodetype);
-		if (exc != DOM_NO_ERR) {
-			dom_node_unref(child);
-			return svgtiny_LIBDOM_ERROR;
+
+/**
+ * Parse the children of the root element with several threads.
+ *
+ * Each child is parsed by the next thread free, into a diagram of its own,
+ * with a copy of the root state and of the context. The diagrams are then
+ * joined in document order, up to and including the first child which
+ * failed, so that the diagram and result are those of parsing on one thread.
+ *
+ * \param  stack    stack holding only the frame of the root element, whose
+ *                  children are all parsed on return
+ * \param  threads  number of threads, including the calling thread, or 0 for
+ *                  one for each processor
+ */
+
+svgtiny_code svgtiny_parse_parallel(struct svgtiny_list *stack,
+		unsigned int threads)
+{
+	struct svgtiny_parse_frame *root = svgtiny_list_get(stack, 0);
+	struct svgtiny_diagram *diagram = root->state.context->diagram;
+	struct svgtiny_parse_job job;
+	unsigned int i;
+	svgtiny_code code;
+
+	if (svgtiny_threads_count(threads) <= 1)
+		return svgtiny_OK;
+
+	job.context = root->state.context;
+	job.state = &root->state;
+	code = svgtiny_parse_children(root, &job);
+	if (code == svgtiny_OK) {
+		job.part = calloc(job.child_count + 1, sizeof job.part[0]);
+		job.code = calloc(job.child_count + 1, sizeof job.code[0]);
+		if (!job.part || !job.code)
+			code = svgtiny_OUT_OF_MEMORY;
+	}
+
+	/* the result of each child is kept in job.code */
+	if (code == svgtiny_OK)
+		svgtiny_threads_run(threads, job.child_count,
+				svgtiny_parse_work, &job);
+
+	for (i = 0; i != job.child_count; i++) {
+		struct svgtiny_diagram *part = job.part ? job.part[i] : NULL;
+		if (code == svgtiny_OK && part) {
+			code = svgtiny_arena_join(diagram, part);
+			if (code == svgtiny_OK && job.code[i] != svgtiny_OK) {
+				diagram->error_line = part->error_line;
+				diagram->error_message = part->error_message;
+			}
 		}
-		if (nodetype == DOM_ELEMENT_NODE) {
-			dom_string *nodename;
-			exc = dom_node_get_node_name(child, &nodename);
-			if (exc != DOM_NO_ERR) {
-				dom_node_unref(child);
-				svgtiny_cleanup_state_local(&state);
-				return svgtiny_LIBDOM_ERROR;
+		if (code == svgtiny_OK && job.code)
+			code = job.code[i];
+		if (part)
+			svgtiny_free(part);
+		dom_node_unref(job.child[i]);
+	}
+	free(job.child);
+	free(job.part);
+	free(job.code);
+
+	return code;
+}
+
+
+/**
+ * Take the element children of the root element for a job.
+ *
+ * The root frame is left with no children to parse.
+ */
+
+svgtiny_code svgtiny_parse_children(struct svgtiny_parse_frame *root,
+		struct svgtiny_parse_job *job)
+{
+	dom_node *child = root->child;
+	unsigned int allocated = 0;
+	svgtiny_code code = svgtiny_OK;
+
+	root->child = NULL;
+	job->child = NULL;
+	job->child_count = 0;
+	job->part = NULL;
+	job->code = NULL;
+
+	while (child != NULL && code == svgtiny_OK) {
+		dom_node *next = NULL;
+		dom_node_type nodetype;
+
+		if (dom_node_get_node_type(child, &nodetype) != DOM_NO_ERR ||
+				dom_node_get_next_sibling(child, &next) !=
+				DOM_NO_ERR) {
+			code = svgtiny_LIBDOM_ERROR;
+			next = NULL;
+		} else if (nodetype == DOM_ELEMENT_NODE) {
+			if (job->child_count == allocated) {
+				dom_node **children;
+				allocated = allocated * 2 + 16;
+				children = realloc(job->child, allocated *
+						sizeof children[0]);
+				if (!children)
+					code = svgtiny_OUT_OF_MEMORY;
+				else
+					job->child = children;
+			}
+			if (code == svgtiny_OK) {
+				job->child[job->child_count++] = child;
+				child = NULL;
 			}
-			if (dom_string_caseless_isequal(state.interned_svg,
-							nodename))
-				code = svgtiny_parse_svg(child, state);
-			else if (dom_string_caseless_isequal(state.interned_g,
-							     nodename))
-				code = svgtiny_parse_svg(child, state);
-			else if (dom_string_caseless_isequal(state.interned_a,
-							     nodename))
-				code = svgtiny_parse_svg(child, state);
-			else if (dom_string_caseless_isequal(state.interned_path,
-							     nodename))
-				code = svgtiny_parse_path(child, state);
-			else if (dom_string_caseless_isequal(state.interned_rect,
-							     nodename))
-				code = svgtiny_parse_rect(child, state);
-			else if (dom_string_caseless_isequal(state.interned_circle,
-							     nodename))
-				code = svgtiny_parse_circle(child, state);
-			else if (dom_string_caseless_isequal(state.interned_ellipse,
-							     nodename))
-				code = svgtiny_parse_ellipse(child, state);
-			else if (dom_string_caseless_isequal(state.interned_line,
-							     nodename))
-				code = svgtiny_parse_line(child, state);
-			else if (dom_string_caseless_isequal(state.interned_polyline,
-							     nodename))
-				code = svgtiny_parse_poly(child, state, false);
-			else if (dom_string_caseless_isequal(state.interned_polygon,
-							     nodename))
-				code = svgtiny_parse_poly(child, state, true);
-			else if (dom_string_caseless_isequal(state.interned_text,
-							     nodename))
-				code = svgtiny_parse_text(child, state);
-			dom_string_unref(nodename);
 		}
-		if (code != svgtiny_OK) {
+		if (child != NULL)
 			dom_node_unref(child);
-			svgtiny_cleanup_state_local(&state);
-			return code;
-		}
-		exc = dom_node_get_next_sibling(child,
-						(dom_node **) (void *) &next);
-		dom_node_unref(child);
-		if (exc != DOM_NO_ERR) {
-			svgtiny_cleanup_state_local(&state);
-			return svgtiny_LIBDOM_ERROR;
-		}
 		child = next;
 	}
+	if (child != NULL)
+		dom_node_unref(child);
 
-	svgtiny_cleanup_state_local(&state);
-	return svgtiny_OK;
+	return code;
 }
 
 
-
 /**
- * Parse a <path> element node.
+ * Parse children of the root for a job until there are none left, or one
+ * has failed.
  *
- * http://www.w3.org/TR/SVG11/paths#PathElement
+ * As children are taken in order, every child before one which failed has
+ * been taken.
  */
 
-svgtiny_code svgtiny_parse_path(dom_element *path,
-		struct svgtiny_parse_state state)
+void svgtiny_parse_work(struct svgtiny_threads *threads, void *pw)
 {
-	svgtiny_code err;
-	dom_string *path_d_str;
-	dom_exception exc;
-	char *s, *path_d;
-	float *p;
+	struct svgtiny_parse_job *job = pw;
+	svgtiny_code code = svgtiny_OK;
 	unsigned int i;
-	float last_x = 0, last_y = 0;
-	float last_cubic_x = 0, last_cubic_y = 0;
-	float last_quad_x = 0, last_quad_y = 0;
 
-	svgtiny_setup_state_local(&state);
+	while (svgtiny_threads_next(threads, &i, code)) {
+		svgtiny_threads_lock(threads);
+		code = job->code[i] = svgtiny_parse_subtree(job, threads, i);
+		svgtiny_threads_unlock(threads);
+	}
+}
 
-	svgtiny_parse_paint_attributes(path, &state);
-	svgtiny_parse_transform_attributes(path, &state);
 
-	/* read d attribute */
-	exc = dom_element_get_attribute(path, state.interned_d, &path_d_str);
-	if (exc != DOM_NO_ERR) {
-		state.diagram->error_line = -1; /* path->line; */
-		state.diagram->error_message = "path: error retrieving d attribute";
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_SVG_ERROR;
-	}
+/**
+ * Parse a child of the root into a diagram of its own.
+ *
+ * Called with the mutex of the threads locked.
+ */
 
-	if (path_d_str == NULL) {
-		state.diagram->error_line = -1; /* path->line; */
-		state.diagram->error_message = "path: missing d attribute";
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_SVG_ERROR;
-	}
+svgtiny_code svgtiny_parse_subtree(struct svgtiny_parse_job *job,
+		struct svgtiny_threads *threads, unsigned int i)
+{
+	const struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(job->context->diagram);
+	struct svgtiny_diagram_internal *part_internal;
+	struct svgtiny_parse_context context = *job->context;
+	struct svgtiny_parse_frame *frame;
+	struct svgtiny_list *stack;
+	svgtiny_code code;
 
-	s = path_d = strndup(dom_string_data(path_d_str),
-			     dom_string_byte_length(path_d_str));
-	dom_string_unref(path_d_str);
-	if (s == NULL) {
-		svgtiny_cleanup_state_local(&state);
+	context.diagram = svgtiny_create();
+	if (!context.diagram)
 		return svgtiny_OUT_OF_MEMORY;
-	}
-	/* allocate space for path: it will never have more elements than d */
-	p = malloc(sizeof p[0] * strlen(s));
-	if (!p) {
-		free(path_d);
-		svgtiny_cleanup_state_local(&state);
+	context.threads = threads;
+	job->part[i] = context.diagram;
+	part_internal = svgtiny_diagram_internal(context.diagram);
+	part_internal->options = internal->options;
+	part_internal->colour_tolerance = internal->colour_tolerance;
+	part_internal->flatness = internal->flatness;
+	part_internal->fraction_bits = internal->fraction_bits;
+	part_internal->clip = internal->clip;
+	part_internal->clip_x0 = internal->clip_x0;
+	part_internal->clip_y0 = internal->clip_y0;
+	part_internal->clip_x1 = internal->clip_x1;
+	part_internal->clip_y1 = internal->clip_y1;
+
+	stack = svgtiny_list_create(sizeof *frame);
+	if (!stack)
+		return svgtiny_OUT_OF_MEMORY;
+	frame = svgtiny_list_push(stack);
+	if (!frame) {
+		svgtiny_list_free(stack);
 		return svgtiny_OUT_OF_MEMORY;
 	}
+	/* a copy of the root frame, borrowing its gradient */
+	frame->child = NULL;
+	frame->text = false;
+	frame->text_x = frame->text_y = 0;
+	frame->state = *job->state;
+	frame->state.context = &context;
+	svgtiny_setup_state_local(&frame->state);
 
-	/* parse d and build path */
-	for (i = 0; s[i]; i++)
-		if (s[i] == ',')
-			s[i] = ' ';
-	i = 0;
-	while (*s) {
-		char command[2];
-		int plot_command;
-		float x, y, x1, y1, x2, y2, rx, ry, rotation, large_arc, sweep;
-		int n;
+	code = svgtiny_parse_child(stack, job->child[i]);
+	if (code == svgtiny_OK)
+		code = svgtiny_parse_frames(stack, 1);
 
-		/* moveto (M, m), lineto (L, l) (2 arguments) */
-		if (sscanf(s, " %1[MmLl] %f %f %n", command, &x, &y, &n) == 3) {
-			/*LOG(("moveto or lineto"));*/
-			if (*command == 'M' || *command == 'm')
-				plot_command = svgtiny_PATH_MOVE;
-			else
-				plot_command = svgtiny_PATH_LINE;
-			do {
-				p[i++] = plot_command;
-				if ('a' <= *command) {
-					x += last_x;
-					y += last_y;
-				}
-				p[i++] = last_cubic_x = last_quad_x = last_x
-						= x;
-				p[i++] = last_cubic_y = last_quad_y = last_y
-						= y;
-				s += n;
-				plot_command = svgtiny_PATH_LINE;
-			} while (sscanf(s, "%f %f %n", &x, &y, &n) == 2);
+	svgtiny_free_frames(stack);
+	svgtiny_list_free(stack);
 
-		/* closepath (Z, z) (no arguments) */
-		} else if (sscanf(s, " %1[Zz] %n", command, &n) == 1) {
-			/*LOG(("closepath"));*/
-			p[i++] = svgtiny_PATH_CLOSE;
-			s += n;
+	return code;
+}
 
-		/* horizontal lineto (H, h) (1 argument) */
-		} else if (sscanf(s, " %1[Hh] %f %n", command, &x, &n) == 2) {
-			/*LOG(("horizontal lineto"));*/
-			do {
-				p[i++] = svgtiny_PATH_LINE;
-				if (*command == 'h')
-					x += last_x;
-				p[i++] = last_cubic_x = last_quad_x = last_x
-						= x;
-				p[i++] = last_cubic_y = last_quad_y = last_y;
-				s += n;
-			} while (sscanf(s, "%f %n", &x, &n) == 1);
 
-		/* vertical lineto (V, v) (1 argument) */
-		} else if (sscanf(s, " %1[Vv] %f %n", command, &y, &n) == 2) {
-			/*LOG(("vertical lineto"));*/
-			do {
-				p[i++] = svgtiny_PATH_LINE;
-				if (*command == 'v')
-					y += last_y;
-				p[i++] = last_cubic_x = last_quad_x = last_x;
-				p[i++] = last_cubic_y = last_quad_y = last_y
-						= y;
-				s += n;
-			} while (sscanf(s, "%f %n", &x, &n) == 1);
+/**
+ * Lock the document and gradients of a parse by several threads.
+ */
 
-		/* curveto (C, c) (6 arguments) */
-		} else if (sscanf(s, " %1[Cc] %f %f %f %f %f %f %n", command,
-				&x1, &y1, &x2, &y2, &x, &y, &n) == 7) {
-			/*LOG(("curveto"));*/
-			do {
-				p[i++] = svgtiny_PATH_BEZIER;
-				if (*command == 'c') {
-					x1 += last_x;
-					y1 += last_y;
-					x2 += last_x;
-					y2 += last_y;
-					x += last_x;
-					y += last_y;
-				}
-				p[i++] = x1;
-				p[i++] = y1;
-				p[i++] = last_cubic_x = x2;
-				p[i++] = last_cubic_y = y2;
-				p[i++] = last_quad_x = last_x = x;
-				p[i++] = last_quad_y = last_y = y;
-				s += n;
-			} while (sscanf(s, "%f %f %f %f %f %f %n",
-					&x1, &y1, &x2, &y2, &x, &y, &n) == 6);
+void svgtiny_parse_lock(const struct svgtiny_parse_context *context)
+{
+	if (context->threads)
+		svgtiny_threads_lock(context->threads);
+}
 
-		/* shorthand/smooth curveto (S, s) (4 arguments) */
-		} else if (sscanf(s, " %1[Ss] %f %f %f %f %n", command,
-				&x2, &y2, &x, &y, &n) == 5) {
-			/*LOG(("shorthand/smooth curveto"));*/
-			do {
-				p[i++] = svgtiny_PATH_BEZIER;
-				x1 = last_x + (last_x - last_cubic_x);
-				y1 = last_y + (last_y - last_cubic_y);
-				if (*command == 's') {
-					x2 += last_x;
-					y2 += last_y;
-					x += last_x;
-					y += last_y;
-				}
-				p[i++] = x1;
-				p[i++] = y1;
-				p[i++] = last_cubic_x = x2;
-				p[i++] = last_cubic_y = y2;
-				p[i++] = last_quad_x = last_x = x;
-				p[i++] = last_quad_y = last_y = y;
-				s += n;
-			} while (sscanf(s, "%f %f %f %f %n",
-					&x2, &y2, &x, &y, &n) == 4);
 
-		/* quadratic Bezier curveto (Q, q) (4 arguments) */
-		} else if (sscanf(s, " %1[Qq] %f %f %f %f %n", command,
-				&x1, &y1, &x, &y, &n) == 5) {
-			/*LOG(("quadratic Bezier curveto"));*/
-			do {
-				p[i++] = svgtiny_PATH_BEZIER;
-				last_quad_x = x1;
-				last_quad_y = y1;
-				if (*command == 'q') {
-					x1 += last_x;
-					y1 += last_y;
-					x += last_x;
-					y += last_y;
-				}
-				p[i++] = 1./3 * last_x + 2./3 * x1;
-				p[i++] = 1./3 * last_y + 2./3 * y1;
-				p[i++] = 2./3 * x1 + 1./3 * x;
-				p[i++] = 2./3 * y1 + 1./3 * y;
-				p[i++] = last_cubic_x = last_x = x;
-				p[i++] = last_cubic_y = last_y = y;
-				s += n;
-			} while (sscanf(s, "%f %f %f %f %n",
-					&x1, &y1, &x, &y, &n) == 4);
+/**
+ * Unlock the document and gradients of a parse by several threads.
+ *
+ * Each thread holds the lock while it reads the document, and unlocks it
+ * while it parses strings already read and adds shapes to its own diagram.
+ */
 
-		/* shorthand/smooth quadratic Bezier curveto (T, t)
+void svgtiny_parse_unlock(const struct svgtiny_parse_context *context)
+{
+	if (context->threads)
+		svgtiny_threads_unlock(context->threads);
+}
+
+
+/**
+ * Push a frame for an element with children to parse.
+ *
+ * \param  stack    stack of frames
+ * \param  element  <svg>, <g>, <a>, <text>, or <tspan> element
+ * \param  parent   state inherited from the parent element
+ * \param  text     element is <text> or <tspan>
+ */
+
+svgtiny_code svgtiny_push_frame(struct svgtiny_list *stack,
+		dom_element *element, const struct svgtiny_parse_state *parent,
+		bool text)
+{
+	/* parent may be in the stack, which moves as it grows */
+	struct svgtiny_parse_state state = *parent;
+	struct svgtiny_parse_frame *frame;
+	svgtiny_code code;
+	dom_exception exc;
+
+	frame = svgtiny_list_push(stack);
+	if (!frame)
+		return svgtiny_OUT_OF_MEMORY;
+	frame->child = NULL;
+	frame->text = text;
+	frame->state = state;
+	svgtiny_setup_state_local(&frame->state);
+
+	if (text)
+		code = svgtiny_parse_text(element, frame);
+	else
+		code = svgtiny_parse_svg(element, &frame->state);
+	if (code != svgtiny_OK)
+		return code;
+
+	exc = dom_node_get_first_child(element, &frame->child);
+	if (exc != DOM_NO_ERR) {
+		frame->child = NULL;
+		return svgtiny_LIBDOM_ERROR;
+	}
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Parse a child node of the element in the innermost frame.
+ *
+ * The element name is looked up once in the perfect hash generated from
+ * elements.gperf, so that unknown elements cost a single hash.
+ */
+
+svgtiny_code svgtiny_parse_child(struct svgtiny_list *stack, dom_node *child)
+{
+	struct svgtiny_parse_frame *frame;
+	const struct svgtiny_element_name *name;
+	dom_element *element;
+	dom_node_type nodetype;
+	dom_string *nodename;
+	dom_exception exc;
+	svgtiny_code code = svgtiny_OK;
+
+	frame = svgtiny_list_get(stack, svgtiny_list_size(stack) - 1);
+
+	exc = dom_node_get_node_type(child, &nodetype);
+	if (exc != DOM_NO_ERR)
+		return svgtiny_LIBDOM_ERROR;
+
+	if (nodetype == DOM_TEXT_NODE) {
+		dom_string *content;
+		if (!frame->text)
+			return svgtiny_OK;
+		exc = dom_text_get_whole_text(child, &content);
+		if (exc != DOM_NO_ERR)
+			return svgtiny_LIBDOM_ERROR;
+		if (content != NULL) {
+			code = svgtiny_add_text(dom_string_data(content),
+					dom_string_byte_length(content),
+					frame->text_x, frame->text_y,
+					&frame->state);
+			dom_string_unref(content);
+		} else {
+			code = svgtiny_add_text("", 0,
+					frame->text_x, frame->text_y,
+					&frame->state);
+		}
+		return code;
+	}
+
+	if (nodetype != DOM_ELEMENT_NODE)
+		return svgtiny_OK;
+
+	exc = dom_node_get_node_name(child, &nodename);
+	if (exc != DOM_NO_ERR)
+		return svgtiny_LIBDOM_ERROR;
+
+	name = svgtiny_element_lookup(dom_string_data(nodename),
+			dom_string_byte_length(nodename));
+	dom_string_unref(nodename);
+	if (name == NULL)
+		return svgtiny_OK;
+	element = (dom_element *) child;
+
+	if (frame->text) {
+		if (name->element == svgtiny_ELEMENT_TSPAN)
+			code = svgtiny_push_frame(stack, element,
+					&frame->state, true);
+		return code;
+	}
+
+	switch (name->element) {
+	case svgtiny_ELEMENT_SVG:
+	case svgtiny_ELEMENT_G:
+	case svgtiny_ELEMENT_A:
+		code = svgtiny_push_frame(stack, element, &frame->state, false);
+		break;
+	case svgtiny_ELEMENT_PATH:
+		code = svgtiny_parse_path(element, frame->state);
+		break;
+	case svgtiny_ELEMENT_RECT:
+		code = svgtiny_parse_rect(element, frame->state);
+		break;
+	case svgtiny_ELEMENT_CIRCLE:
+		code = svgtiny_parse_circle(element, frame->state);
+		break;
+	case svgtiny_ELEMENT_ELLIPSE:
+		code = svgtiny_parse_ellipse(element, frame->state);
+		break;
+	case svgtiny_ELEMENT_LINE:
+		code = svgtiny_parse_line(element, frame->state);
+		break;
+	case svgtiny_ELEMENT_POLYLINE:
+		code = svgtiny_parse_poly(element, frame->state, false);
+		break;
+	case svgtiny_ELEMENT_POLYGON:
+		code = svgtiny_parse_poly(element, frame->state, true);
+		break;
+	case svgtiny_ELEMENT_TEXT:
+		code = svgtiny_push_frame(stack, element, &frame->state, true);
+		break;
+	case svgtiny_ELEMENT_TSPAN:
+		/* only within <text> */
+		break;
+	}
+
+	return code;
+}
+
+
+/**
+ * Parse a <svg>, <g>, or <a> element node, and set up the state for its
+ * children.
+ */
+
+svgtiny_code svgtiny_parse_svg(dom_element *svg,
+		struct svgtiny_parse_state *state)
+{
+	const struct svgtiny_parse_context *context = state->context;
+	dom_string *view_box;
+	dom_exception exc;
+
+	svgtiny_parse_paint_attributes(svg, state);
+	svgtiny_parse_font_attributes(svg, state);
+
+	exc = dom_element_get_attribute(svg, context->interned_viewBox,
+					&view_box);
+	if (exc != DOM_NO_ERR)
+		return svgtiny_LIBDOM_ERROR;
+
+	if (view_box) {
+		const char *s = dom_string_data(view_box);
+		svgtiny_parse_viewbox(s, s + dom_string_byte_length(view_box),
+				state);
+		dom_string_unref(view_box);
+	}
+
+	svgtiny_parse_transform_attributes(svg, state);
+
+	return svgtiny_OK;
+}
+
+
+
+/**
+ * Parse an elliptical arc flag from path data.
+ *
+ * Flags are a single 0 or 1 and need no separator, as in "a1 1 0 0110 10".
+ */
+
+static bool svgtiny_path_flag(const char **sp, const char *end, float *v)
+{
+	const char *s = *sp;
+
+	if (s == end || (*s != '0' && *s != '1'))
+		return false;
+	*v = *s - '0';
+	*sp = s + 1;
+	return true;
+}
+
+
+/**
+ * Make room for more elements in a path being built.
+ *
+ * The path doubles in size when full, so that it stays within twice the
+ * size of its contents whatever the length of the input.
+ *
+ * \param  p          path allocated with malloc(), updated
+ * \param  allocated  number of elements allocated, updated
+ * \param  needed     number of elements which must fit
+ * \return  true on success, false if memory runs out (p is still valid)
+ */
+
+static bool svgtiny_path_reserve(float **p, unsigned int *allocated,
+		unsigned int needed)
+{
+	unsigned int size = *allocated;
+	float *q;
+
+	if (needed <= size)
+		return true;
+
+	while (size < needed)
+		size = size < 16 ? 16 : size * 2;
+	q = realloc(*p, size * sizeof q[0]);
+	if (!q)
+		return false;
+	*p = q;
+	*allocated = size;
+	return true;
+}
+
+
+/**
+ * Parse path data into a path.
+ *
+ * Single pass over d: each command letter selects an argument count, and
+ * further argument groups after it repeat the command (a moveto repeats as
+ * lineto). A group is only emitted once all of its arguments have parsed.
+ *
+ * \param  s          start of d
+ * \param  end        end of d
+ * \param  pp         output path allocated with malloc(), grown as needed
+ * \param  allocated  number of elements allocated in *pp, updated
+ * \param  n          updated to number of elements written to *pp
+ * \return  svgtiny_OK or svgtiny_OUT_OF_MEMORY
+ */
+
+static svgtiny_code svgtiny_parse_path_data(const char *s, const char *end,
+		float **pp, unsigned int *allocated, unsigned int *n)
+{
+	float *p = *pp;
+	unsigned int i = 0;
+	char command = 0;
+	float last_x = 0, last_y = 0;
+	float last_cubic_x = 0, last_cubic_y = 0;
+	float last_quad_x = 0, last_quad_y = 0;
+
+	while (1) {
+		const char *group;
+		float a[7];
+		unsigned int args, k;
+		float x, y, x1, y1, x2, y2;
+
+		s = svgtiny_skip_comma_wsp(s, end);
+		if (s == end)
+			break;
+		group = s;
+
+		switch (*s) {
+		case 'M': case 'm': case 'Z': case 'z':
+		case 'L': case 'l': case 'H': case 'h':
+		case 'V': case 'v': case 'C': case 'c':
+		case 'S': case 's': case 'Q': case 'q':
+		case 'T': case 't': case 'A': case 'a':
+			command = *s++;
+			s = svgtiny_skip_comma_wsp(s, end);
+			break;
+		default:
+			/* implicit repeat of the previous command */
+			if (command == 0 || command == 'Z' || command == 'z')
+				goto fail;
+			if (command == 'M')
+				command = 'L';
+			else if (command == 'm')
+				command = 'l';
+		}
+
+		switch (command) {
+		case 'Z': case 'z':
+			args = 0;
+			break;
+		case 'H': case 'h': case 'V': case 'v':
+			args = 1;
+			break;
+		case 'M': case 'm': case 'L': case 'l': case 'T': case 't':
+			args = 2;
+			break;
+		case 'S': case 's': case 'Q': case 'q':
+			args = 4;
+			break;
+		case 'C': case 'c':
+			args = 6;
+			break;
+		default: /* 'A', 'a' */
+			args = 7;
+		}
+
+		for (k = 0; k != args; k++) {
+			if (k != 0)
+				s = svgtiny_skip_comma_wsp(s, end);
+			if ((command == 'A' || command == 'a') &&
+					(k == 3 || k == 4)) {
+				if (!svgtiny_path_flag(&s, end, &a[k]))
+					goto fail;
+			} else if (!svgtiny_parse_number(&s, end, &a[k]))
+				goto fail;
+		}
+
+		/* a group emits at most 7 elements */
+		if (*allocated - i < 7) {
+			if (!svgtiny_path_reserve(pp, allocated, i + 7)) {
+				*n = i;
+				return svgtiny_OUT_OF_MEMORY;
+			}
+			p = *pp;
+		}
+
+		switch (command) {
+		/* moveto (M, m), lineto (L, l) (2 arguments) */
+		case 'M': case 'm': case 'L': case 'l':
+			x = a[0];
+			y = a[1];
+			if (command == 'M' || command == 'm')
+				p[i++] = svgtiny_PATH_MOVE;
+			else
+				p[i++] = svgtiny_PATH_LINE;
+			if ('a' <= command) {
+				x += last_x;
+				y += last_y;
+			}
+			p[i++] = last_cubic_x = last_quad_x = last_x = x;
+			p[i++] = last_cubic_y = last_quad_y = last_y = y;
+			break;
+
+		/* closepath (Z, z) (no arguments) */
+		case 'Z': case 'z':
+			p[i++] = svgtiny_PATH_CLOSE;
+			break;
+
+		/* horizontal lineto (H, h) (1 argument) */
+		case 'H': case 'h':
+			x = a[0];
+			p[i++] = svgtiny_PATH_LINE;
+			if (command == 'h')
+				x += last_x;
+			p[i++] = last_cubic_x = last_quad_x = last_x = x;
+			p[i++] = last_cubic_y = last_quad_y = last_y;
+			break;
+
+		/* vertical lineto (V, v) (1 argument) */
+		case 'V': case 'v':
+			y = a[0];
+			p[i++] = svgtiny_PATH_LINE;
+			if (command == 'v')
+				y += last_y;
+			p[i++] = last_cubic_x = last_quad_x = last_x;
+			p[i++] = last_cubic_y = last_quad_y = last_y = y;
+			break;
+
+		/* curveto (C, c) (6 arguments) */
+		case 'C': case 'c':
+			x1 = a[0];
+			y1 = a[1];
+			x2 = a[2];
+			y2 = a[3];
+			x = a[4];
+			y = a[5];
+			p[i++] = svgtiny_PATH_BEZIER;
+			if (command == 'c') {
+				x1 += last_x;
+				y1 += last_y;
+				x2 += last_x;
+				y2 += last_y;
+				x += last_x;
+				y += last_y;
+			}
+			p[i++] = x1;
+			p[i++] = y1;
+			p[i++] = last_cubic_x = x2;
+			p[i++] = last_cubic_y = y2;
+			p[i++] = last_quad_x = last_x = x;
+			p[i++] = last_quad_y = last_y = y;
+			break;
+
+		/* shorthand/smooth curveto (S, s) (4 arguments) */
+		case 'S': case 's':
+			x2 = a[0];
+			y2 = a[1];
+			x = a[2];
+			y = a[3];
+			p[i++] = svgtiny_PATH_BEZIER;
+			x1 = last_x + (last_x - last_cubic_x);
+			y1 = last_y + (last_y - last_cubic_y);
+			if (command == 's') {
+				x2 += last_x;
+				y2 += last_y;
+				x += last_x;
+				y += last_y;
+			}
+			p[i++] = x1;
+			p[i++] = y1;
+			p[i++] = last_cubic_x = x2;
+			p[i++] = last_cubic_y = y2;
+			p[i++] = last_quad_x = last_x = x;
+			p[i++] = last_quad_y = last_y = y;
+			break;
+
+		/* quadratic Bezier curveto (Q, q) (4 arguments) */
+		case 'Q': case 'q':
+			x1 = a[0];
+			y1 = a[1];
+			x = a[2];
+			y = a[3];
+			p[i++] = svgtiny_PATH_BEZIER;
+			last_quad_x = x1;
+			last_quad_y = y1;
+			if (command == 'q') {
+				x1 += last_x;
+				y1 += last_y;
+				x += last_x;
+				y += last_y;
+			}
+			p[i++] = 1./3 * last_x + 2./3 * x1;
+			p[i++] = 1./3 * last_y + 2./3 * y1;
+			p[i++] = 2./3 * x1 + 1./3 * x;
+			p[i++] = 2./3 * y1 + 1./3 * y;
+			p[i++] = last_cubic_x = last_x = x;
+			p[i++] = last_cubic_y = last_y = y;
+			break;
+
+		/* shorthand/smooth quadratic Bezier curveto (T, t)
 		   (2 arguments) */
-		} else if (sscanf(s, " %1[Tt] %f %f %n", command,
-				&x, &y, &n) == 3) {
-			/*LOG(("shorthand/smooth quadratic Bezier curveto"));*/
-			do {
-				p[i++] = svgtiny_PATH_BEZIER;
-				x1 = last_x + (last_x - last_quad_x);
-				y1 = last_y + (last_y - last_quad_y);
-				last_quad_x = x1;
-				last_quad_y = y1;
-				if (*command == 't') {
-					x1 += last_x;
-					y1 += last_y;
-					x += last_x;
-					y += last_y;
-				}
-				p[i++] = 1./3 * last_x + 2./3 * x1;
-				p[i++] = 1./3 * last_y + 2./3 * y1;
-				p[i++] = 2./3 * x1 + 1./3 * x;
-				p[i++] = 2./3 * y1 + 1./3 * y;
-				p[i++] = last_cubic_x = last_x = x;
-				p[i++] = last_cubic_y = last_y = y;
-				s += n;
-			} while (sscanf(s, "%f %f %n",
-					&x, &y, &n) == 2);
+		case 'T': case 't':
+			x = a[0];
+			y = a[1];
+			p[i++] = svgtiny_PATH_BEZIER;
+			x1 = last_x + (last_x - last_quad_x);
+			y1 = last_y + (last_y - last_quad_y);
+			last_quad_x = x1;
+			last_quad_y = y1;
+			if (command == 't') {
+				x1 += last_x;
+				y1 += last_y;
+				x += last_x;
+				y += last_y;
+			}
+			p[i++] = 1./3 * last_x + 2./3 * x1;
+			p[i++] = 1./3 * last_y + 2./3 * y1;
+			p[i++] = 2./3 * x1 + 1./3 * x;
+			p[i++] = 2./3 * y1 + 1./3 * y;
+			p[i++] = last_cubic_x = last_x = x;
+			p[i++] = last_cubic_y = last_y = y;
+			break;
+
+		/* elliptical arc (A, a) (7 arguments) */
+		default:
+			x = a[5];
+			y = a[6];
+			p[i++] = svgtiny_PATH_LINE;
+			if (command == 'a') {
+				x += last_x;
+				y += last_y;
+			}
+			p[i++] = last_cubic_x = last_quad_x = last_x = x;
+			p[i++] = last_cubic_y = last_quad_y = last_y = y;
+		}
+		continue;
+
+fail:
+		fprintf(stderr, "parse failed at \"%.*s\"\n",
+				(int) (end - group), group);
+		break;
+	}
+
+	*n = i;
+	return svgtiny_OK;
+}
+
+
+/**
+ * Parse path data and add the path to the svgtiny_diagram.
+ */
+
+svgtiny_code svgtiny_add_path_data(const char *s, const char *end,
+		struct svgtiny_parse_state *state)
+{
+	float *p = NULL;
+	unsigned int allocated = 0;
+	unsigned int i;
+	svgtiny_code code;
+
+	/* start with room for typical path data, which has about one element
+	 * for every 4 bytes of d, and grow as needed */
+	if (!svgtiny_path_reserve(&p, &allocated, (end - s) / 4 + 8))
+		return svgtiny_OUT_OF_MEMORY;
+
+	/* parse d and build path */
+	code = svgtiny_parse_path_data(s, end, &p, &allocated, &i);
+	if (code != svgtiny_OK) {
+		free(p);
+		return code;
+	}
+
+	if (i <= 4) {
+		/* no real segments in path */
+		free(p);
+		return svgtiny_OK;
+	}
+
+	return svgtiny_add_path(p, i, state);
+}
+
+
+/**
+ * Add a rectangle to the svgtiny_diagram.
+ */
+
+svgtiny_code svgtiny_add_rect(float x, float y, float width, float height,
+		struct svgtiny_parse_state *state)
+{
+	float *p;
+
+	p = malloc(13 * sizeof p[0]);
+	if (!p)
+		return svgtiny_OUT_OF_MEMORY;
+
+	p[0] = svgtiny_PATH_MOVE;
+	p[1] = x;
+	p[2] = y;
+	p[3] = svgtiny_PATH_LINE;
+	p[4] = x + width;
+	p[5] = y;
+	p[6] = svgtiny_PATH_LINE;
+	p[7] = x + width;
+	p[8] = y + height;
+	p[9] = svgtiny_PATH_LINE;
+	p[10] = x;
+	p[11] = y + height;
+	p[12] = svgtiny_PATH_CLOSE;
+
+	return svgtiny_add_path(p, 13, state);
+}
+
+
+/**
+ * Add an ellipse (or a circle, when rx == ry) to the svgtiny_diagram.
+ */
+
+svgtiny_code svgtiny_add_ellipse(float x, float y, float rx, float ry,
+		struct svgtiny_parse_state *state)
+{
+	float *p;
+
+	p = malloc(32 * sizeof p[0]);
+	if (!p)
+		return svgtiny_OUT_OF_MEMORY;
+
+	p[0] = svgtiny_PATH_MOVE;
+	p[1] = x + rx;
+	p[2] = y;
+	p[3] = svgtiny_PATH_BEZIER;
+	p[4] = x + rx;
+	p[5] = y + ry * KAPPA;
+	p[6] = x + rx * KAPPA;
+	p[7] = y + ry;
+	p[8] = x;
+	p[9] = y + ry;
+	p[10] = svgtiny_PATH_BEZIER;
+	p[11] = x - rx * KAPPA;
+	p[12] = y + ry;
+	p[13] = x - rx;
+	p[14] = y + ry * KAPPA;
+	p[15] = x - rx;
+	p[16] = y;
+	p[17] = svgtiny_PATH_BEZIER;
+	p[18] = x - rx;
+	p[19] = y - ry * KAPPA;
+	p[20] = x - rx * KAPPA;
+	p[21] = y - ry;
+	p[22] = x;
+	p[23] = y - ry;
+	p[24] = svgtiny_PATH_BEZIER;
+	p[25] = x + rx * KAPPA;
+	p[26] = y - ry;
+	p[27] = x + rx;
+	p[28] = y - ry * KAPPA;
+	p[29] = x + rx;
+	p[30] = y;
+	p[31] = svgtiny_PATH_CLOSE;
+
+	return svgtiny_add_path(p, 32, state);
+}
+
+
+/**
+ * Add a line to the svgtiny_diagram.
+ */
+
+svgtiny_code svgtiny_add_line(float x1, float y1, float x2, float y2,
+		struct svgtiny_parse_state *state)
+{
+	float *p;
+
+	p = malloc(7 * sizeof p[0]);
+	if (!p)
+		return svgtiny_OUT_OF_MEMORY;
+
+	p[0] = svgtiny_PATH_MOVE;
+	p[1] = x1;
+	p[2] = y1;
+	p[3] = svgtiny_PATH_LINE;
+	p[4] = x2;
+	p[5] = y2;
+	p[6] = svgtiny_PATH_CLOSE;
+
+	return svgtiny_add_path(p, 7, state);
+}
+
+
+/**
+ * Parse a points list and add the polyline or polygon to the svgtiny_diagram.
+ */
+
+svgtiny_code svgtiny_add_poly(const char *s, const char *end, bool polygon,
+		struct svgtiny_parse_state *state)
+{
+	float *p = NULL;
+	unsigned int allocated = 0;
+	unsigned int i;
+
+	/* start with room for typical points, about one element for every
+	 * 4 bytes, and grow as needed */
+	if (!svgtiny_path_reserve(&p, &allocated, (end - s) / 4 + 8))
+		return svgtiny_OUT_OF_MEMORY;
+
+	/* parse points and build path */
+	i = 0;
+	while (1) {
+		float x, y;
+
+		s = svgtiny_skip_comma_wsp(s, end);
+		if (!svgtiny_parse_number(&s, end, &x))
+			break;
+		s = svgtiny_skip_comma_wsp(s, end);
+		if (!svgtiny_parse_number(&s, end, &y))
+			break;
+		/* 3 elements for the point and 1 for a close */
+		if (!svgtiny_path_reserve(&p, &allocated, i + 4)) {
+			free(p);
+			return svgtiny_OUT_OF_MEMORY;
+		}
+		if (i == 0)
+			p[i++] = svgtiny_PATH_MOVE;
+		else
+			p[i++] = svgtiny_PATH_LINE;
+		p[i++] = x;
+		p[i++] = y;
+	}
+	if (polygon)
+		p[i++] = svgtiny_PATH_CLOSE;
+
+	return svgtiny_add_path(p, i, state);
+}
+
+
+/**
+ * Add a text fragment to the svgtiny_diagram.
+ */
+
+svgtiny_code svgtiny_add_text(const char *text, size_t len, float x, float y,
+		struct svgtiny_parse_state *state)
+{
+	struct svgtiny_shape *shape;
+
+	if (state->fill_pending || state->stroke_pending)
+		return svgtiny_stream_defer_text(text, len, x, y, state);
+
+	shape = svgtiny_add_shape(state);
+	if (!shape)
+		return svgtiny_OUT_OF_MEMORY;
+	shape->text = svgtiny_arena_alloc(state->context->diagram, len + 1);
+	if (!shape->text)
+		return svgtiny_OUT_OF_MEMORY;
+	memcpy(shape->text, text, len);
+	shape->text[len] = 0;
+	shape->text_x = shape->bbox_x0 = shape->bbox_x1 = x;
+	shape->text_y = shape->bbox_y0 = shape->bbox_y1 = y;
+	state->context->diagram->shape_count++;
+	return svgtiny_OK;
+}
+
+
+/**
+ * Parse a viewBox attribute and apply it to the current transformation matrix.
+ */
+
+void svgtiny_parse_viewbox(const char *s, const char *end,
+		struct svgtiny_parse_state *state)
+{
+	float v[4];
+	unsigned int k;
+
+	for (k = 0; k != 4; k++) {
+		s = svgtiny_skip_comma_wsp(s, end);
+		if (!svgtiny_parse_number(&s, end, &v[k]))
+			return;
+	}
+
+	/* min-x, min-y, width, height */
+	state->ctm.a = (float) state->viewport_width / v[2];
+	state->ctm.d = (float) state->viewport_height / v[3];
+	state->ctm.e += -v[0] * state->ctm.a;
+	state->ctm.f += -v[1] * state->ctm.d;
+}
+
+
+/**
+ * Parse a <path> element node.
+ *
+ * http://www.w3.org/TR/SVG11/paths#PathElement
+ */
+
+svgtiny_code svgtiny_parse_path(dom_element *path,
+		struct svgtiny_parse_state state)
+{
+	const struct svgtiny_parse_context *context = state.context;
+	svgtiny_code err;
+	dom_string *path_d_str;
+	dom_exception exc;
+	const char *s;
 
-		/* elliptical arc (A, a) (7 arguments) */
-		} else if (sscanf(s, " %1[Aa] %f %f %f %f %f %f %f %n", command,
-				&rx, &ry, &rotation, &large_arc, &sweep,
-				&x, &y, &n) == 8) {
-			do {
-				p[i++] = svgtiny_PATH_LINE;
-				if (*command == 'a') {
-					x += last_x;
-					y += last_y;
-				}
-				p[i++] = last_cubic_x = last_quad_x = last_x
-						= x;
-				p[i++] = last_cubic_y = last_quad_y = last_y
-						= y;
-				s += n;
-			} while (sscanf(s, "%f %f %f %f %f %f %f %n",
-				&rx, &ry, &rotation, &large_arc, &sweep,
-				&x, &y, &n) == 7);
+	svgtiny_setup_state_local(&state);
 
-		} else {
-			fprintf(stderr, "parse failed at \"%s\"\n", s);
-			break;
-		}
-	}
+	svgtiny_parse_paint_attributes(path, &state);
+	svgtiny_parse_transform_attributes(path, &state);
 
-	free(path_d);
+	/* read d attribute */
+	exc = dom_element_get_attribute(path, context->interned_d, &path_d_str);
+	if (exc != DOM_NO_ERR) {
+		context->diagram->error_line = -1; /* path->line; */
+		context->diagram->error_message = "path: error retrieving d attribute";
+		svgtiny_cleanup_state_local(&state);
+		return svgtiny_SVG_ERROR;
+	}
 
-	if (i <= 4) {
-		/* no real segments in path */
-		free(p);
+	if (path_d_str == NULL) {
+		context->diagram->error_line = -1; /* path->line; */
+		context->diagram->error_message = "path: missing d attribute";
 		svgtiny_cleanup_state_local(&state);
-		return svgtiny_OK;
+		return svgtiny_SVG_ERROR;
 	}
 
-	err = svgtiny_add_path(p, i, &state);
+	s = dom_string_data(path_d_str);
+	svgtiny_parse_unlock(state.context);
+	err = svgtiny_add_path_data(s, s + dom_string_byte_length(path_d_str),
+			&state);
+	svgtiny_parse_lock(state.context);
+	dom_string_unref(path_d_str);
 
 	svgtiny_cleanup_state_local(&state);
 
@@ -706,7 +1608,6 @@ svgtiny_code svgtiny_parse_rect(dom_element *rect,
 {
 	svgtiny_code err;
 	float x, y, width, height;
-	float *p;
 
 	svgtiny_setup_state_local(&state);
 
@@ -715,27 +1616,9 @@ svgtiny_code svgtiny_parse_rect(dom_element *rect,
 	svgtiny_parse_paint_attributes(rect, &state);
 	svgtiny_parse_transform_attributes(rect, &state);
 
-	p = malloc(13 * sizeof p[0]);
-	if (!p) {
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_OUT_OF_MEMORY;
-	}
-
-	p[0] = svgtiny_PATH_MOVE;
-	p[1] = x;
-	p[2] = y;
-	p[3] = svgtiny_PATH_LINE;
-	p[4] = x + width;
-	p[5] = y;
-	p[6] = svgtiny_PATH_LINE;
-	p[7] = x + width;
-	p[8] = y + height;
-	p[9] = svgtiny_PATH_LINE;
-	p[10] = x;
-	p[11] = y + height;
-	p[12] = svgtiny_PATH_CLOSE;
-
-	err = svgtiny_add_path(p, 13, &state);
+	svgtiny_parse_unlock(state.context);
+	err = svgtiny_add_rect(x, y, width, height, &state);
+	svgtiny_parse_lock(state.context);
 
 	svgtiny_cleanup_state_local(&state);
 
@@ -750,41 +1633,41 @@ svgtiny_code svgtiny_parse_rect(dom_element *rect,
 svgtiny_code svgtiny_parse_circle(dom_element *circle,
 		struct svgtiny_parse_state state)
 {
+	const struct svgtiny_parse_context *context = state.context;
 	svgtiny_code err;
 	float x = 0, y = 0, r = -1;
-	float *p;
 	dom_string *attr;
 	dom_exception exc;
 
 	svgtiny_setup_state_local(&state);
 
-	exc = dom_element_get_attribute(circle, state.interned_cx, &attr);
+	exc = dom_element_get_attribute(circle, context->interned_cx, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		x = svgtiny_parse_length(attr, state.viewport_width, state);
+		x = svgtiny_parse_length(attr, state.viewport_width);
 	}
 	dom_string_unref(attr);
 
-	exc = dom_element_get_attribute(circle, state.interned_cy, &attr);
+	exc = dom_element_get_attribute(circle, context->interned_cy, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		y = svgtiny_parse_length(attr, state.viewport_height, state);
+		y = svgtiny_parse_length(attr, state.viewport_height);
 	}
 	dom_string_unref(attr);
 
-	exc = dom_element_get_attribute(circle, state.interned_r, &attr);
+	exc = dom_element_get_attribute(circle, context->interned_r, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		r = svgtiny_parse_length(attr, state.viewport_width, state);
+		r = svgtiny_parse_length(attr, state.viewport_width);
 	}
 	dom_string_unref(attr);
 
@@ -792,8 +1675,8 @@ svgtiny_code svgtiny_parse_circle(dom_element *circle,
 	svgtiny_parse_transform_attributes(circle, &state);
 
 	if (r < 0) {
-		state.diagram->error_line = -1; /* circle->line; */
-		state.diagram->error_message = "circle: r missing or negative";
+		context->diagram->error_line = -1; /* circle->line; */
+		context->diagram->error_message = "circle: r missing or negative";
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_SVG_ERROR;
 	}
@@ -802,46 +1685,9 @@ svgtiny_code svgtiny_parse_circle(dom_element *circle,
 		return svgtiny_OK;
 	}
 
-	p = malloc(32 * sizeof p[0]);
-	if (!p) {
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_OUT_OF_MEMORY;
-	}
-
-	p[0] = svgtiny_PATH_MOVE;
-	p[1] = x + r;
-	p[2] = y;
-	p[3] = svgtiny_PATH_BEZIER;
-	p[4] = x + r;
-	p[5] = y + r * KAPPA;
-	p[6] = x + r * KAPPA;
-	p[7] = y + r;
-	p[8] = x;
-	p[9] = y + r;
-	p[10] = svgtiny_PATH_BEZIER;
-	p[11] = x - r * KAPPA;
-	p[12] = y + r;
-	p[13] = x - r;
-	p[14] = y + r * KAPPA;
-	p[15] = x - r;
-	p[16] = y;
-	p[17] = svgtiny_PATH_BEZIER;
-	p[18] = x - r;
-	p[19] = y - r * KAPPA;
-	p[20] = x - r * KAPPA;
-	p[21] = y - r;
-	p[22] = x;
-	p[23] = y - r;
-	p[24] = svgtiny_PATH_BEZIER;
-	p[25] = x + r * KAPPA;
-	p[26] = y - r;
-	p[27] = x + r;
-	p[28] = y - r * KAPPA;
-	p[29] = x + r;
-	p[30] = y;
-	p[31] = svgtiny_PATH_CLOSE;
-
-	err = svgtiny_add_path(p, 32, &state);
+	svgtiny_parse_unlock(state.context);
+	err = svgtiny_add_ellipse(x, y, r, r, &state);
+	svgtiny_parse_lock(state.context);
 
 	svgtiny_cleanup_state_local(&state);
 	
@@ -856,51 +1702,51 @@ svgtiny_code svgtiny_parse_circle(dom_element *circle,
 svgtiny_code svgtiny_parse_ellipse(dom_element *ellipse,
 		struct svgtiny_parse_state state)
 {
+	const struct svgtiny_parse_context *context = state.context;
 	svgtiny_code err;
 	float x = 0, y = 0, rx = -1, ry = -1;
-	float *p;
 	dom_string *attr;
 	dom_exception exc;
 
 	svgtiny_setup_state_local(&state);
 
-	exc = dom_element_get_attribute(ellipse, state.interned_cx, &attr);
+	exc = dom_element_get_attribute(ellipse, context->interned_cx, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		x = svgtiny_parse_length(attr, state.viewport_width, state);
+		x = svgtiny_parse_length(attr, state.viewport_width);
 	}
 	dom_string_unref(attr);
 
-	exc = dom_element_get_attribute(ellipse, state.interned_cy, &attr);
+	exc = dom_element_get_attribute(ellipse, context->interned_cy, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		y = svgtiny_parse_length(attr, state.viewport_height, state);
+		y = svgtiny_parse_length(attr, state.viewport_height);
 	}
 	dom_string_unref(attr);
 
-	exc = dom_element_get_attribute(ellipse, state.interned_rx, &attr);
+	exc = dom_element_get_attribute(ellipse, context->interned_rx, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		rx = svgtiny_parse_length(attr, state.viewport_width, state);
+		rx = svgtiny_parse_length(attr, state.viewport_width);
 	}
 	dom_string_unref(attr);
 
-	exc = dom_element_get_attribute(ellipse, state.interned_ry, &attr);
+	exc = dom_element_get_attribute(ellipse, context->interned_ry, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		ry = svgtiny_parse_length(attr, state.viewport_width, state);
+		ry = svgtiny_parse_length(attr, state.viewport_width);
 	}
 	dom_string_unref(attr);
 
@@ -908,8 +1754,8 @@ svgtiny_code svgtiny_parse_ellipse(dom_element *ellipse,
 	svgtiny_parse_transform_attributes(ellipse, &state);
 
 	if (rx < 0 || ry < 0) {
-		state.diagram->error_line = -1; /* ellipse->line; */
-		state.diagram->error_message = "ellipse: rx or ry missing "
+		context->diagram->error_line = -1; /* ellipse->line; */
+		context->diagram->error_message = "ellipse: rx or ry missing "
 				"or negative";
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_SVG_ERROR;
@@ -919,46 +1765,9 @@ svgtiny_code svgtiny_parse_ellipse(dom_element *ellipse,
 		return svgtiny_OK;
 	}
 
-	p = malloc(32 * sizeof p[0]);
-	if (!p) {
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_OUT_OF_MEMORY;
-	}
-
-	p[0] = svgtiny_PATH_MOVE;
-	p[1] = x + rx;
-	p[2] = y;
-	p[3] = svgtiny_PATH_BEZIER;
-	p[4] = x + rx;
-	p[5] = y + ry * KAPPA;
-	p[6] = x + rx * KAPPA;
-	p[7] = y + ry;
-	p[8] = x;
-	p[9] = y + ry;
-	p[10] = svgtiny_PATH_BEZIER;
-	p[11] = x - rx * KAPPA;
-	p[12] = y + ry;
-	p[13] = x - rx;
-	p[14] = y + ry * KAPPA;
-	p[15] = x - rx;
-	p[16] = y;
-	p[17] = svgtiny_PATH_BEZIER;
-	p[18] = x - rx;
-	p[19] = y - ry * KAPPA;
-	p[20] = x - rx * KAPPA;
-	p[21] = y - ry;
-	p[22] = x;
-	p[23] = y - ry;
-	p[24] = svgtiny_PATH_BEZIER;
-	p[25] = x + rx * KAPPA;
-	p[26] = y - ry;
-	p[27] = x + rx;
-	p[28] = y - ry * KAPPA;
-	p[29] = x + rx;
-	p[30] = y;
-	p[31] = svgtiny_PATH_CLOSE;
-	
-	err = svgtiny_add_path(p, 32, &state);
+	svgtiny_parse_unlock(state.context);
+	err = svgtiny_add_ellipse(x, y, rx, ry, &state);
+	svgtiny_parse_lock(state.context);
 
 	svgtiny_cleanup_state_local(&state);
 
@@ -973,72 +1782,60 @@ svgtiny_code svgtiny_parse_ellipse(dom_element *ellipse,
 svgtiny_code svgtiny_parse_line(dom_element *line,
 		struct svgtiny_parse_state state)
 {
+	const struct svgtiny_parse_context *context = state.context;
 	svgtiny_code err;
 	float x1 = 0, y1 = 0, x2 = 0, y2 = 0;
-	float *p;
 	dom_string *attr;
 	dom_exception exc;
 
 	svgtiny_setup_state_local(&state);
 
-	exc = dom_element_get_attribute(line, state.interned_x1, &attr);
+	exc = dom_element_get_attribute(line, context->interned_x1, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		x1 = svgtiny_parse_length(attr, state.viewport_width, state);
+		x1 = svgtiny_parse_length(attr, state.viewport_width);
 	}
 	dom_string_unref(attr);
 
-	exc = dom_element_get_attribute(line, state.interned_y1, &attr);
+	exc = dom_element_get_attribute(line, context->interned_y1, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		y1 = svgtiny_parse_length(attr, state.viewport_height, state);
+		y1 = svgtiny_parse_length(attr, state.viewport_height);
 	}
 	dom_string_unref(attr);
 
-	exc = dom_element_get_attribute(line, state.interned_x2, &attr);
+	exc = dom_element_get_attribute(line, context->interned_x2, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		x2 = svgtiny_parse_length(attr, state.viewport_width, state);
+		x2 = svgtiny_parse_length(attr, state.viewport_width);
 	}
 	dom_string_unref(attr);
 
-	exc = dom_element_get_attribute(line, state.interned_y2, &attr);
+	exc = dom_element_get_attribute(line, context->interned_y2, &attr);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_LIBDOM_ERROR;
 	}
 	if (attr != NULL) {
-		y2 = svgtiny_parse_length(attr, state.viewport_height, state);
+		y2 = svgtiny_parse_length(attr, state.viewport_height);
 	}
 	dom_string_unref(attr);
 
 	svgtiny_parse_paint_attributes(line, &state);
 	svgtiny_parse_transform_attributes(line, &state);
 
-	p = malloc(7 * sizeof p[0]);
-	if (!p) {
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_OUT_OF_MEMORY;
-	}
-
-	p[0] = svgtiny_PATH_MOVE;
-	p[1] = x1;
-	p[2] = y1;
-	p[3] = svgtiny_PATH_LINE;
-	p[4] = x2;
-	p[5] = y2;
-	p[6] = svgtiny_PATH_CLOSE;
-
-	err = svgtiny_add_path(p, 7, &state);
+	svgtiny_parse_unlock(state.context);
+	err = svgtiny_add_line(x1, y1, x2, y2, &state);
+	svgtiny_parse_lock(state.context);
 
 	svgtiny_cleanup_state_local(&state);
 
@@ -1056,19 +1853,18 @@ svgtiny_code svgtiny_parse_line(dom_element *line,
 svgtiny_code svgtiny_parse_poly(dom_element *poly,
 		struct svgtiny_parse_state state, bool polygon)
 {
+	const struct svgtiny_parse_context *context = state.context;
 	svgtiny_code err;
 	dom_string *points_str;
 	dom_exception exc;
-	char *s, *points;
-	float *p;
-	unsigned int i;
+	const char *s;
 
 	svgtiny_setup_state_local(&state);
 
 	svgtiny_parse_paint_attributes(poly, &state);
 	svgtiny_parse_transform_attributes(poly, &state);
 	
-	exc = dom_element_get_attribute(poly, state.interned_points,
+	exc = dom_element_get_attribute(poly, context->interned_points,
 					&points_str);
 	if (exc != DOM_NO_ERR) {
 		svgtiny_cleanup_state_local(&state);
@@ -1076,56 +1872,19 @@ svgtiny_code svgtiny_parse_poly(dom_element *poly,
 	}
 	
 	if (points_str == NULL) {
-		state.diagram->error_line = -1; /* poly->line; */
-		state.diagram->error_message =
+		context->diagram->error_line = -1; /* poly->line; */
+		context->diagram->error_message =
 				"polyline/polygon: missing points attribute";
 		svgtiny_cleanup_state_local(&state);
 		return svgtiny_SVG_ERROR;
 	}
 
-	s = points = strndup(dom_string_data(points_str),
-			     dom_string_byte_length(points_str));
+	s = dom_string_data(points_str);
+	svgtiny_parse_unlock(state.context);
+	err = svgtiny_add_poly(s, s + dom_string_byte_length(points_str),
+			polygon, &state);
+	svgtiny_parse_lock(state.context);
 	dom_string_unref(points_str);
-	/* read points attribute */
-	if (s == NULL) {
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_OUT_OF_MEMORY;
-	}
-	/* allocate space for path: it will never have more elements than s */
-	p = malloc(sizeof p[0] * strlen(s));
-	if (!p) {
-		free(points);
-		svgtiny_cleanup_state_local(&state);
-		return svgtiny_OUT_OF_MEMORY;
-	}
-
-	/* parse s and build path */
-	for (i = 0; s[i]; i++)
-		if (s[i] == ',')
-			s[i] = ' ';
-	i = 0;
-	while (*s) {
-		float x, y;
-		int n;
-
-		if (sscanf(s, "%f %f %n", &x, &y, &n) == 2) {
-			if (i == 0)
-				p[i++] = svgtiny_PATH_MOVE;
-			else
-				p[i++] = svgtiny_PATH_LINE;
-			p[i++] = x;
-			p[i++] = y;
-			s += n;
-                } else {
-                	break;
-                }
-        }
-        if (polygon)
-		p[i++] = svgtiny_PATH_CLOSE;
-
-	free(points);
-
-	err = svgtiny_add_path(p, i, &state);
 
 	svgtiny_cleanup_state_local(&state);
 
@@ -1134,102 +1893,28 @@ svgtiny_code svgtiny_parse_poly(dom_element *poly,
 
 
 /**
- * Parse a <text> or <tspan> element node.
+ * Parse a <text> or <tspan> element node, and set up the frame for its
+ * children.
  */
 
 svgtiny_code svgtiny_parse_text(dom_element *text,
-		struct svgtiny_parse_state state)
+		struct svgtiny_parse_frame *frame)
 {
+	struct svgtiny_parse_state *state = &frame->state;
 	float x, y, width, height;
-	float px, py;
-	dom_node *child;
-	dom_exception exc;
-
-	svgtiny_setup_state_local(&state);
 
-	svgtiny_parse_position_attributes(text, state,
+	svgtiny_parse_position_attributes(text, *state,
 			&x, &y, &width, &height);
-	svgtiny_parse_font_attributes(text, &state);
-	svgtiny_parse_transform_attributes(text, &state);
+	svgtiny_parse_font_attributes(text, state);
+	svgtiny_parse_transform_attributes(text, state);
 
-	px = state.ctm.a * x + state.ctm.c * y + state.ctm.e;
-	py = state.ctm.b * x + state.ctm.d * y + state.ctm.f;
+	frame->text_x = state->ctm.a * x + state->ctm.c * y + state->ctm.e;
+	frame->text_y = state->ctm.b * x + state->ctm.d * y + state->ctm.f;
 /* 	state.ctm.e = px - state.origin_x; */
 /* 	state.ctm.f = py - state.origin_y; */
 
 	/*struct css_style style = state.style;
 	style.font_size.value.length.value *= state.ctm.a;*/
-	
-        exc = dom_node_get_first_child(text, &child);
-	if (exc != DOM_NO_ERR) {
-		return svgtiny_LIBDOM_ERROR;
-		svgtiny_cleanup_state_local(&state);
-	}
-	while (child != NULL) {
-		dom_node *next;
-		dom_node_type nodetype;
-		svgtiny_code code = svgtiny_OK;
-
-		exc = dom_node_get_node_type(child, &nodetype);
-		if (exc != DOM_NO_ERR) {
-			dom_node_unref(child);
-			svgtiny_cleanup_state_local(&state);
-			return svgtiny_LIBDOM_ERROR;
-		}
-		if (nodetype == DOM_ELEMENT_NODE) {
-			dom_string *nodename;
-			exc = dom_node_get_node_name(child, &nodename);
-			if (exc != DOM_NO_ERR) {
-				dom_node_unref(child);
-				svgtiny_cleanup_state_local(&state);
-				return svgtiny_LIBDOM_ERROR;
-			}
-			if (dom_string_caseless_isequal(nodename,
-							state.interned_tspan))
-				code = svgtiny_parse_text((dom_element *)child,
-							  state);
-			dom_string_unref(nodename);
-		} else if (nodetype == DOM_TEXT_NODE) {
-			struct svgtiny_shape *shape = svgtiny_add_shape(&state);
-			dom_string *content;
-			if (shape == NULL) {
-				dom_node_unref(child);
-				svgtiny_cleanup_state_local(&state);
-				return svgtiny_OUT_OF_MEMORY;
-			}
-			exc = dom_text_get_whole_text(child, &content);
-			if (exc != DOM_NO_ERR) {
-				dom_node_unref(child);
-				svgtiny_cleanup_state_local(&state);
-				return svgtiny_LIBDOM_ERROR;
-			}
-			if (content != NULL) {
-				shape->text = strndup(dom_string_data(content),
-						      dom_string_byte_length(content));
-				dom_string_unref(content);
-			} else {
-				shape->text = strdup("");
-			}
-			shape->text_x = px;
-			shape->text_y = py;
-			state.diagram->shape_count++;
-		}
-
-		if (code != svgtiny_OK) {
-			dom_node_unref(child);
-			svgtiny_cleanup_state_local(&state);
-			return code;
-		}
-		exc = dom_node_get_next_sibling(child, &next);
-		dom_node_unref(child);
-		if (exc != DOM_NO_ERR) {
-			svgtiny_cleanup_state_local(&state);
-			return svgtiny_LIBDOM_ERROR;
-		}
-		child = next;
-	}
-
-	svgtiny_cleanup_state_local(&state);
 
 	return svgtiny_OK;
 }
@@ -1243,6 +1928,7 @@ void svgtiny_parse_position_attributes(dom_element *node,
 		const struct svgtiny_parse_state state,
 		float *x, float *y, float *width, float *height)
 {
+	const struct svgtiny_parse_context *context = state.context;
 	dom_string *attr;
 	dom_exception exc;
 
@@ -1251,29 +1937,27 @@ void svgtiny_parse_position_attributes(dom_element *node,
 	*width = state.viewport_width;
 	*height = state.viewport_height;
 
-	exc = dom_element_get_attribute(node, state.interned_x, &attr);
+	exc = dom_element_get_attribute(node, context->interned_x, &attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		*x = svgtiny_parse_length(attr, state.viewport_width, state);
+		*x = svgtiny_parse_length(attr, state.viewport_width);
 		dom_string_unref(attr);
 	}
 
-	exc = dom_element_get_attribute(node, state.interned_y, &attr);
+	exc = dom_element_get_attribute(node, context->interned_y, &attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		*y = svgtiny_parse_length(attr, state.viewport_height, state);
+		*y = svgtiny_parse_length(attr, state.viewport_height);
 		dom_string_unref(attr);
 	}
 
-	exc = dom_element_get_attribute(node, state.interned_width, &attr);
+	exc = dom_element_get_attribute(node, context->interned_width, &attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		*width = svgtiny_parse_length(attr, state.viewport_width,
-					      state);
+		*width = svgtiny_parse_length(attr, state.viewport_width);
 		dom_string_unref(attr);
 	}
 
-	exc = dom_element_get_attribute(node, state.interned_height, &attr);
+	exc = dom_element_get_attribute(node, context->interned_height, &attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		*height = svgtiny_parse_length(attr, state.viewport_height,
-					       state);
+		*height = svgtiny_parse_length(attr, state.viewport_height);
 		dom_string_unref(attr);
 	}
 }
@@ -1283,50 +1967,72 @@ void svgtiny_parse_position_attributes(dom_element *node,
  * Parse a length as a number of pixels.
  */
 
-static float _svgtiny_parse_length(const char *s, int viewport_size,
-				   const struct svgtiny_parse_state state)
+float _svgtiny_parse_length(const char *s, const char *end,
+		int viewport_size)
 {
-	size_t num_length = strspn(s, "0123456789+-.");
-	const char *unit = s + num_length;
-	float n = atof((const char *) s);
+	float n;
+	svgtiny_unit unit;
 	float font_size = 20; /*css_len2px(&state.style.font_size.value.length, 0);*/
 
-	UNUSED(state);
+	s = svgtiny_skip_wsp(s, end);
+	if (!svgtiny_parse_dimension(&s, end, &n, &unit))
+		return 0;
 
-	if (unit[0] == 0) {
+	switch (unit) {
+	case svgtiny_UNIT_NONE:
+	case svgtiny_UNIT_PX:
 		return n;
-	} else if (unit[0] == '%') {
+	case svgtiny_UNIT_PERCENT:
 		return n / 100.0 * viewport_size;
-	} else if (unit[0] == 'e' && unit[1] == 'm') {
+	case svgtiny_UNIT_EM:
 		return n * font_size;
-	} else if (unit[0] == 'e' && unit[1] == 'x') {
+	case svgtiny_UNIT_EX:
 		return n / 2.0 * font_size;
-	} else if (unit[0] == 'p' && unit[1] == 'x') {
-		return n;
-	} else if (unit[0] == 'p' && unit[1] == 't') {
+	case svgtiny_UNIT_PT:
 		return n * 1.25;
-	} else if (unit[0] == 'p' && unit[1] == 'c') {
+	case svgtiny_UNIT_PC:
 		return n * 15.0;
-	} else if (unit[0] == 'm' && unit[1] == 'm') {
+	case svgtiny_UNIT_MM:
 		return n * 3.543307;
-	} else if (unit[0] == 'c' && unit[1] == 'm') {
+	case svgtiny_UNIT_CM:
 		return n * 35.43307;
-	} else if (unit[0] == 'i' && unit[1] == 'n') {
+	case svgtiny_UNIT_IN:
 		return n * 90;
+	default:
+		return 0;
 	}
+}
 
-	return 0;
+float svgtiny_parse_length(dom_string *s, int viewport_size)
+{
+	const char *ss = dom_string_data(s);
+	return _svgtiny_parse_length(ss, ss + dom_string_byte_length(s),
+			viewport_size);
 }
 
-float svgtiny_parse_length(dom_string *s, int viewport_size,
-			   const struct svgtiny_parse_state state)
+/**
+ * Find the value of a property in a style attribute.
+ *
+ * \param  style     style attribute
+ * \param  property  property name including the ':', for example "fill:"
+ * \param  len       updated with length of value
+ * \return  start of value, or NULL if the property is not present
+ */
+
+const char *svgtiny_style_value(const char *style, const char *property,
+		size_t *len)
 {
-	char *ss = strndup(dom_string_data(s), dom_string_byte_length(s));
-	float ret = _svgtiny_parse_length(ss, viewport_size, state);
-	free(ss);
-	return ret;
+	const char *s = strstr(style, property);
+	if (!s)
+		return NULL;
+	s += strlen(property);
+	while (*s == ' ')
+		s++;
+	*len = strcspn(s, "; ");
+	return s;
 }
 
+
 /**
  * Parse paint attributes, if present.
  */
@@ -1334,62 +2040,131 @@ float svgtiny_parse_length(dom_string *s, int viewport_size,
 void svgtiny_parse_paint_attributes(dom_element *node,
 		struct svgtiny_parse_state *state)
 {
+	const struct svgtiny_parse_context *context = state->context;
+	char *fill = NULL, *stroke = NULL, *style = NULL;
 	dom_string *attr;
 	dom_exception exc;
 	
-	exc = dom_element_get_attribute(node, state->interned_fill, &attr);
+	exc = dom_element_get_attribute(node, context->interned_fill, &attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		svgtiny_parse_color(attr, &state->fill, state);
+		fill = strndup(dom_string_data(attr),
+			       dom_string_byte_length(attr));
 		dom_string_unref(attr);
 	}
 
-	exc = dom_element_get_attribute(node, state->interned_stroke, &attr);
+	exc = dom_element_get_attribute(node, context->interned_stroke, &attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		svgtiny_parse_color(attr, &state->stroke, state);
+		stroke = strndup(dom_string_data(attr),
+				 dom_string_byte_length(attr));
 		dom_string_unref(attr);
 	}
 
-	exc = dom_element_get_attribute(node, state->interned_stroke_width, &attr);
+	exc = dom_element_get_attribute(node, context->interned_stroke_width,
+					&attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
 		state->stroke_width = svgtiny_parse_length(attr,
-						state->viewport_width, *state);
+						state->viewport_width);
+		dom_string_unref(attr);
+	}
+
+	exc = dom_element_get_attribute(node, context->interned_fill_rule,
+					&attr);
+	if (exc == DOM_NO_ERR && attr != NULL) {
+		svgtiny_parse_fill_rule(dom_string_data(attr),
+				dom_string_data(attr) +
+				dom_string_byte_length(attr),
+				&state->fill_rule);
 		dom_string_unref(attr);
 	}
 
-	exc = dom_element_get_attribute(node, state->interned_style, &attr);
+	exc = dom_element_get_attribute(node, context->interned_style, &attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		char *style = strndup(dom_string_data(attr),
-				      dom_string_byte_length(attr));
+		style = strndup(dom_string_data(attr),
+				dom_string_byte_length(attr));
+		dom_string_unref(attr);
+	}
+
+	/* the rest reads only the copies, so other threads may use the
+	 * document meanwhile */
+	svgtiny_parse_unlock(context);
+	if (fill)
+		svgtiny_parse_paint(fill, &state->fill, state);
+	if (stroke)
+		svgtiny_parse_paint(stroke, &state->stroke, state);
+	if (style) {
 		const char *s;
 		char *value;
-		if ((s = strstr(style, "fill:"))) {
-			s += 5;
-			while (*s == ' ')
-				s++;
-			value = strndup(s, strcspn(s, "; "));
-			_svgtiny_parse_color(value, &state->fill, state);
+		size_t len;
+		if ((s = svgtiny_style_value(style, "fill:", &len))) {
+			value = strndup(s, len);
+			svgtiny_parse_paint(value, &state->fill, state);
 			free(value);
 		}
-		if ((s = strstr(style, "stroke:"))) {
-			s += 7;
-			while (*s == ' ')
-				s++;
-			value = strndup(s, strcspn(s, "; "));
-			_svgtiny_parse_color(value, &state->stroke, state);
+		if ((s = svgtiny_style_value(style, "stroke:", &len))) {
+			value = strndup(s, len);
+			svgtiny_parse_paint(value, &state->stroke, state);
 			free(value);
 		}
-		if ((s = strstr(style, "stroke-width:"))) {
-			s += 13;
-			while (*s == ' ')
-				s++;
-			value = strndup(s, strcspn(s, "; "));
-			state->stroke_width = _svgtiny_parse_length(value,
-						state->viewport_width, *state);
-			free(value);
+		if ((s = svgtiny_style_value(style, "stroke-width:", &len))) {
+			state->stroke_width = _svgtiny_parse_length(s, s + len,
+						state->viewport_width);
 		}
-		free(style);
-		dom_string_unref(attr);
+		if ((s = svgtiny_style_value(style, "fill-rule:", &len)))
+			svgtiny_parse_fill_rule(s, s + len, &state->fill_rule);
 	}
+	svgtiny_parse_lock(context);
+	free(fill);
+	free(stroke);
+	free(style);
+}
+
+
+/**
+ * Parse a fill or stroke colour, called with the document unlocked.
+ *
+ * Only a gradient is found in the document, so the document is locked for
+ * that alone.
+ */
+
+void svgtiny_parse_paint(const char *s, svgtiny_colour *c,
+		struct svgtiny_parse_state *state)
+{
+	bool url = strncmp(s, "url(", 4) == 0;
+
+	if (url)
+		svgtiny_parse_lock(state->context);
+	_svgtiny_parse_color(s, c, state);
+	if (url)
+		svgtiny_parse_unlock(state->context);
+}
+
+
+/**
+ * Parse the "r%, g%, b%" arguments of an rgb() colour.
+ */
+
+static bool svgtiny_parse_rgb_percent(const char *s, const char *end,
+		float *r, float *g, float *b)
+{
+	float *component[3];
+	unsigned int k;
+
+	component[0] = r;
+	component[1] = g;
+	component[2] = b;
+	for (k = 0; k != 3; k++) {
+		svgtiny_unit unit;
+		s = svgtiny_skip_wsp(s, end);
+		if (k != 0) {
+			if (s == end || *s != ',')
+				return false;
+			s = svgtiny_skip_wsp(s + 1, end);
+		}
+		if (!svgtiny_parse_dimension(&s, end, component[k], &unit) ||
+				unit != svgtiny_UNIT_PERCENT)
+			return false;
+	}
+	return true;
 }
 
 
@@ -1397,13 +2172,14 @@ void svgtiny_parse_paint_attributes(dom_element *node,
  * Parse a colour.
  */
 
-static void _svgtiny_parse_color(const char *s, svgtiny_colour *c,
+void _svgtiny_parse_color(const char *s, svgtiny_colour *c,
 		struct svgtiny_parse_state *state)
 {
 	unsigned int r, g, b;
 	float rf, gf, bf;
 	size_t len = strlen(s);
 	char *id = 0, *rparen;
+	struct svgtiny_gradient local, *gradient;
 
 	if (len == 4 && s[0] == '#') {
 		if (sscanf(s + 1, "%1x%1x%1x", &r, &g, &b) == 3)
@@ -1417,7 +2193,8 @@ static void _svgtiny_parse_color(const char *s, svgtiny_colour *c,
 			s[3] == '(' && s[len - 1] == ')') {
 		if (sscanf(s + 4, "%u,%u,%u", &r, &g, &b) == 3)
 			*c = svgtiny_RGB(r, g, b);
-		else if (sscanf(s + 4, "%f%%,%f%%,%f%%", &rf, &gf, &bf) == 3) {
+		else if (svgtiny_parse_rgb_percent(s + 4, s + len - 1,
+				&rf, &gf, &bf)) {
 			b = bf * 255 / 100;
 			g = gf * 255 / 100;
 			r = rf * 255 / 100;
@@ -1436,14 +2213,36 @@ static void _svgtiny_parse_color(const char *s, svgtiny_colour *c,
 			rparen = strchr(id, ')');
 			if (rparen)
 				*rparen = 0;
-			svgtiny_find_gradient(id, state);
+			if (c != &state->fill) {
+				/* only fills are drawn with gradients, so
+				 * the one kept in the state is not replaced */
+				memset(&local, 0, sizeof local);
+				gradient = &local;
+			} else if (!state->gradient_owned) {
+				/* replace the gradient borrowed from the
+				 * parent element */
+				gradient = calloc(1, sizeof *gradient);
+				if (!gradient) {
+					free(id);
+					return;
+				}
+				state->gradient = gradient;
+				state->gradient_owned = true;
+			} else {
+				gradient = state->gradient;
+			}
+			svgtiny_find_gradient(id, gradient, state->context);
 			free(id);
-			if (state->linear_gradient_stop_count == 0)
+			if (!gradient->ramp)
 				*c = svgtiny_TRANSPARENT;
-			else if (state->linear_gradient_stop_count == 1)
-				*c = state->gradient_stop[0].color;
+			else if (gradient->ramp->stop_count == 1)
+				*c = gradient->ramp->stop[0].color;
+			else if (gradient->radial)
+				*c = svgtiny_RADIAL_GRADIENT;
 			else
 				*c = svgtiny_LINEAR_GRADIENT;
+			if (gradient == &local)
+				svgtiny_gradient_clear(&local);
 		}
 
 	} else {
@@ -1462,6 +2261,21 @@ void svgtiny_parse_color(dom_string *s, svgtiny_colour *c,
 	free(ss);
 }
 
+/**
+ * Parse a fill-rule value, leaving the rule as it was if the value is not
+ * known.
+ */
+
+void svgtiny_parse_fill_rule(const char *s, const char *end, int *rule)
+{
+	s = svgtiny_skip_wsp(s, end);
+	if (7 <= end - s && strncmp(s, "nonzero", 7) == 0)
+		*rule = svgtiny_FILL_NONZERO;
+	else if (7 <= end - s && strncmp(s, "evenodd", 7) == 0)
+		*rule = svgtiny_FILL_EVENODD;
+}
+
+
 /**
  * Parse font attributes, if present.
  */
@@ -1501,19 +2315,24 @@ void svgtiny_parse_font_attributes(dom_element *node,
 void svgtiny_parse_transform_attributes(dom_element *node,
 		struct svgtiny_parse_state *state)
 {
-	char *transform;
+	const struct svgtiny_parse_context *context = state->context;
+	const char *transform;
 	dom_string *attr;
 	dom_exception exc;
 	
-	exc = dom_element_get_attribute(node, state->interned_transform,
+	exc = dom_element_get_attribute(node, context->interned_transform,
 					&attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		transform = strndup(dom_string_data(attr),
-				    dom_string_byte_length(attr));
-		svgtiny_parse_transform(transform, &state->ctm.a, &state->ctm.b,
+		transform = dom_string_data(attr);
+		/* the string is kept by the reference, so other threads may
+		 * use the document while it is parsed */
+		svgtiny_parse_unlock(context);
+		svgtiny_parse_transform(transform,
+				transform + dom_string_byte_length(attr),
+				&state->ctm.a, &state->ctm.b,
 				&state->ctm.c, &state->ctm.d,
 				&state->ctm.e, &state->ctm.f);
-		free(transform);
+		svgtiny_parse_lock(context);
 		dom_string_unref(attr);
 	}
 }
@@ -1521,66 +2340,89 @@ void svgtiny_parse_transform_attributes(dom_element *node,
 
 /**
  * Parse a transform string.
+ *
+ * A list of transforms such as "translate(10, 20) scale(2)", each a keyword
+ * followed by a parenthesised list of numbers.
  */
 
-void svgtiny_parse_transform(char *s, float *ma, float *mb,
-		float *mc, float *md, float *me, float *mf)
+void svgtiny_parse_transform(const char *s, const char *end,
+		float *ma, float *mb, float *mc, float *md, float *me, float *mf)
 {
 	float a, b, c, d, e, f;
 	float za, zb, zc, zd, ze, zf;
 	float angle, x, y;
-	int n;
-	unsigned int i;
-
-	for (i = 0; s[i]; i++)
-		if (s[i] == ',')
-			s[i] = ' ';
+	float arg[6];
+	const char *name;
+	size_t name_len;
+	unsigned int n;
+
+	while (1) {
+		s = svgtiny_skip_comma_wsp(s, end);
+		for (name = s; s != end && (('a' <= *s && *s <= 'z') ||
+				('A' <= *s && *s <= 'Z')); s++)
+			;
+		name_len = s - name;
+		s = svgtiny_skip_wsp(s, end);
+		if (name_len == 0 || s == end || *s != '(')
+			break;
+		s++;
+		for (n = 0; n != 6; n++) {
+			s = svgtiny_skip_comma_wsp(s, end);
+			if (!svgtiny_parse_number(&s, end, &arg[n]))
+				break;
+		}
+		s = svgtiny_skip_comma_wsp(s, end);
+		if (s == end || *s != ')')
+			break;
+		s++;
 
-	while (*s) {
 		a = d = 1;
 		b = c = 0;
 		e = f = 0;
-		if (sscanf(s, "matrix (%f %f %f %f %f %f) %n",
-					&a, &b, &c, &d, &e, &f, &n) == 6)
-			;
-		else if (sscanf(s, "translate (%f %f) %n",
-					&e, &f, &n) == 2)
-			;
-		else if (sscanf(s, "translate (%f) %n",
-					&e, &n) == 1)
-			;
-		else if (sscanf(s, "scale (%f %f) %n",
-					&a, &d, &n) == 2)
-			;
-		else if (sscanf(s, "scale (%f) %n",
-					&a, &n) == 1)
-			d = a;
-		else if (sscanf(s, "rotate (%f %f %f) %n",
-					&angle, &x, &y, &n) == 3) {
-			angle = angle / 180 * M_PI;
+#define svgtiny_IS_TRANSFORM(str) (name_len == sizeof str - 1 &&	\
+		memcmp(name, str, sizeof str - 1) == 0)
+		if (svgtiny_IS_TRANSFORM("matrix") && n == 6) {
+			a = arg[0];
+			b = arg[1];
+			c = arg[2];
+			d = arg[3];
+			e = arg[4];
+			f = arg[5];
+		} else if (svgtiny_IS_TRANSFORM("translate") && n == 2) {
+			e = arg[0];
+			f = arg[1];
+		} else if (svgtiny_IS_TRANSFORM("translate") && n == 1) {
+			e = arg[0];
+		} else if (svgtiny_IS_TRANSFORM("scale") && n == 2) {
+			a = arg[0];
+			d = arg[1];
+		} else if (svgtiny_IS_TRANSFORM("scale") && n == 1) {
+			a = d = arg[0];
+		} else if (svgtiny_IS_TRANSFORM("rotate") && n == 3) {
+			angle = arg[0] / 180 * M_PI;
+			x = arg[1];
+			y = arg[2];
 			a = cos(angle);
 			b = sin(angle);
 			c = -sin(angle);
 			d = cos(angle);
 			e = -x * cos(angle) + y * sin(angle) + x;
 			f = -x * sin(angle) - y * cos(angle) + y;
-		} else if (sscanf(s, "rotate (%f) %n",
-					&angle, &n) == 1) {
-			angle = angle / 180 * M_PI;
+		} else if (svgtiny_IS_TRANSFORM("rotate") && n == 1) {
+			angle = arg[0] / 180 * M_PI;
 			a = cos(angle);
 			b = sin(angle);
 			c = -sin(angle);
 			d = cos(angle);
-		} else if (sscanf(s, "skewX (%f) %n",
-					&angle, &n) == 1) {
-			angle = angle / 180 * M_PI;
+		} else if (svgtiny_IS_TRANSFORM("skewX") && n == 1) {
+			angle = arg[0] / 180 * M_PI;
 			c = tan(angle);
-		} else if (sscanf(s, "skewY (%f) %n",
-					&angle, &n) == 1) {
-			angle = angle / 180 * M_PI;
+		} else if (svgtiny_IS_TRANSFORM("skewY") && n == 1) {
+			angle = arg[0] / 180 * M_PI;
 			b = tan(angle);
 		} else
 			break;
+#undef svgtiny_IS_TRANSFORM
 		za = *ma * a + *mc * b;
 		zb = *mb * a + *md * b;
 		zc = *ma * c + *mc * d;
@@ -1593,7 +2435,6 @@ void svgtiny_parse_transform(char *s, float *ma, float *mb,
 		*md = zd;
 		*me = ze;
 		*mf = zf;
-		s += n;
 	}
 }
 
@@ -1607,43 +2448,122 @@ svgtiny_code svgtiny_add_path(float *p, unsigned int n,
 {
 	struct svgtiny_shape *shape;
 
-	if (state->fill == svgtiny_LINEAR_GRADIENT)
-		return svgtiny_add_path_linear_gradient(p, n, state);
+	if (svgtiny_path_culled(p, n, state)) {
+		free(p);
+		return svgtiny_OK;
+	}
 
-	svgtiny_transform_path(p, n, state);
+	if (state->fill_pending || state->stroke_pending)
+		return svgtiny_stream_defer_path(p, n, state);
+
+	/* the ramp of the gradient is shared by the threads of a parse, and
+	 * its colour table is made when first used, so that is locked, and
+	 * the rest only reads it */
+	if (state->fill == svgtiny_LINEAR_GRADIENT ||
+			state->fill == svgtiny_RADIAL_GRADIENT) {
+		svgtiny_code code;
+		svgtiny_parse_lock(state->context);
+		code = svgtiny_ramp_lut(state->gradient->ramp,
+				svgtiny_diagram_internal(
+				state->context->diagram)->options &
+				svgtiny_LINEAR_RGB_GRADIENTS);
+		svgtiny_parse_unlock(state->context);
+		if (code != svgtiny_OK) {
+			free(p);
+			return code;
+		}
+		if (state->fill == svgtiny_LINEAR_GRADIENT)
+			return svgtiny_add_path_linear_gradient(p, n, state);
+		return svgtiny_add_path_radial_gradient(p, n, state);
+	}
 
 	shape = svgtiny_add_shape(state);
-	if (!shape) {
+	if (!shape || svgtiny_shape_path(shape, p, n, state) != svgtiny_OK) {
 		free(p);
 		return svgtiny_OUT_OF_MEMORY;
 	}
-	shape->path = p;
-	shape->path_length = n;
-	state->diagram->shape_count++;
+	free(p);
+	state->context->diagram->shape_count++;
 
 	return svgtiny_OK;
 }
 
 
+/**
+ * Check if a path is entirely outside the clip rectangle of the diagram.
+ *
+ * The bounds of the path are grown by the reach of a miter at
+ * svgtiny_MITER_LIMIT, twice the stroke width, scaled by the Frobenius norm of
+ * the transformation, which is at least its largest scale factor.
+ */
+
+bool svgtiny_path_culled(const float *p, unsigned int n,
+		const struct svgtiny_parse_state *state)
+{
+	const struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(state->context->diagram);
+	float x0, y0, x1, y1;
+	float grow = 0;
+
+	if (!internal->clip)
+		return false;
+
+	svgtiny_path_extent(p, n, &state->ctm.a, &x0, &y0, &x1, &y1);
+	if (state->stroke != svgtiny_TRANSPARENT)
+		grow = 0.5f * svgtiny_MITER_LIMIT * state->stroke_width *
+				sqrtf(state->ctm.a * state->ctm.a +
+				state->ctm.b * state->ctm.b +
+				state->ctm.c * state->ctm.c +
+				state->ctm.d * state->ctm.d);
+
+	return x1 + grow < internal->clip_x0 ||
+			internal->clip_x1 < x0 - grow ||
+			y1 + grow < internal->clip_y0 ||
+			internal->clip_y1 < y0 - grow;
+}
+
+
 /**
  * Add a svgtiny_shape to the svgtiny_diagram.
+ *
+ * The shape array doubles in size when full, so that adding n shapes takes
+ * O(n) time. The caller increments shape_count when the shape is complete.
  */
 
 struct svgtiny_shape *svgtiny_add_shape(struct svgtiny_parse_state *state)
 {
-	struct svgtiny_shape *shape = realloc(state->diagram->shape,
-			(state->diagram->shape_count + 1) *
-			sizeof (state->diagram->shape[0]));
-	if (!shape)
-		return 0;
-	state->diagram->shape = shape;
+	struct svgtiny_diagram *diagram = state->context->diagram;
+	struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(diagram);
+	struct svgtiny_shape *shape;
+
+	if (diagram->shape_count == internal->shape_allocated) {
+		unsigned int allocated = internal->shape_allocated * 2;
+		if (allocated < 16)
+			allocated = 16;
+		if (svgtiny_reserve(diagram, allocated) != svgtiny_OK)
+			return 0;
+	}
 
-	shape += state->diagram->shape_count;
+	shape = diagram->shape + diagram->shape_count;
 	shape->path = 0;
 	shape->path_length = 0;
+	shape->path_op = 0;
+	shape->path_op_count = 0;
+	shape->path_point = 0;
+	shape->path_point_count = 0;
+	shape->path_fixed = 0;
+	shape->path_short = 0;
+	shape->path_origin_x = 0;
+	shape->path_origin_y = 0;
+	shape->bbox_x0 = shape->bbox_x1 = 0;
+	shape->bbox_y0 = shape->bbox_y1 = 0;
 	shape->text = 0;
+	shape->mesh = 0;
+	shape->fill_gradient = 0;
 	shape->fill = state->fill;
 	shape->stroke = state->stroke;
+	shape->fill_rule = state->fill_rule;
 	shape->stroke_width = (int)lroundf((float) state->stroke_width *
 			(state->ctm.a + state->ctm.d) / 2.0);
 	if (0 < state->stroke_width && shape->stroke_width == 0)
@@ -1700,17 +2620,13 @@ void svgtiny_transform_path(float *p, unsigned int n,
 
 void svgtiny_free(struct svgtiny_diagram *svg)
 {
-	unsigned int i;
 	assert(svg);
 
-	for (i = 0; i != svg->shape_count; i++) {
-		free(svg->shape[i].path);
-		free(svg->shape[i].text);
-	}
-	
+	/* after parsing, shapes, paths, and text are one block */
+	svgtiny_arena_free(svg);
 	free(svg->shape);
 
-	free(svg);
+	free(svgtiny_diagram_internal(svg));
 }
 
 #ifndef HAVE_STRNDUP
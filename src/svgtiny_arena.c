@@ -0,0 +1,467 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Diagram memory.
+ *
+ * While parsing, paths and text are bump allocated from a chain of blocks
+ * owned by the diagram, instead of a malloc() for each. When parsing ends the
+ * shape array is resized and the paths and text are copied after the shapes,
+ * so that diagram->shape points to a single block:
+ *
+ *   shape[0] ... shape[shape_count - 1] | meshes | gradients | paths |
+ *   packed points | fixed points | short fixed points |
+ *   packed segment types | text
+ *
+ * so that iterating over a diagram touches contiguous memory, and
+ * svgtiny_free() has one block to free.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* sizes of blocks, which double from the smallest up to the largest */
+#define svgtiny_ARENA_MIN 4096
+#define svgtiny_ARENA_MAX (1024 * 1024)
+
+/* alignment of allocations, enough for float and pointers */
+#define svgtiny_ARENA_ALIGN 8
+
+static size_t svgtiny_mesh_size(unsigned int vertex_count,
+		unsigned int index_count);
+static struct svgtiny_mesh *svgtiny_mesh_place(void *memory,
+		unsigned int vertex_count, unsigned int index_count);
+static size_t svgtiny_linear_gradient_size(unsigned int stop_count);
+
+struct svgtiny_arena_block {
+	struct svgtiny_arena_block *next;
+	size_t size;		/* bytes available in data */
+	size_t used;		/* bytes allocated from data */
+	union {
+		double align;
+		char data[1];
+	} u;
+};
+
+
+/**
+ * Allocate memory which lives as long as a diagram.
+ *
+ * The memory can't be freed individually, and moves when the diagram is
+ * compacted at the end of parsing.
+ *
+ * \return  the memory, or NULL if memory runs out
+ */
+
+void *svgtiny_arena_alloc(struct svgtiny_diagram *diagram, size_t size)
+{
+	struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(diagram);
+	struct svgtiny_arena_block *block = internal->arena;
+	void *p;
+
+	size = (size + svgtiny_ARENA_ALIGN - 1) &
+			~(size_t) (svgtiny_ARENA_ALIGN - 1);
+
+	if (!block || block->size - block->used < size) {
+		size_t block_size = svgtiny_ARENA_MIN;
+		if (block)
+			block_size = block->size < svgtiny_ARENA_MAX ?
+					block->size * 2 : svgtiny_ARENA_MAX;
+		if (block_size < size)
+			block_size = size;
+
+		block = malloc(sizeof *block + block_size);
+		if (!block)
+			return NULL;
+		block->size = block_size;
+		block->used = 0;
+
+		if (internal->arena && block_size == size) {
+			/* keep allocating from the current block */
+			block->next = internal->arena->next;
+			internal->arena->next = block;
+		} else {
+			block->next = internal->arena;
+			internal->arena = block;
+		}
+	}
+
+	p = block->u.data + block->used;
+	block->used += size;
+	internal->data_size += size;
+	return p;
+}
+
+
+/**
+ * Copy memory into a diagram's arena.
+ *
+ * \return  the copy, or NULL if memory runs out
+ */
+
+void *svgtiny_arena_copy(struct svgtiny_diagram *diagram, const void *data,
+		size_t size)
+{
+	void *copy = svgtiny_arena_alloc(diagram, size);
+	if (copy)
+		memcpy(copy, data, size);
+	return copy;
+}
+
+
+/**
+ * Allocate a triangle mesh in a diagram's arena.
+ *
+ * The vertices, colours, and indices are allocated with the mesh but are
+ * not initialised.
+ *
+ * \return  the mesh, or NULL if memory runs out
+ */
+
+struct svgtiny_mesh *svgtiny_arena_mesh(struct svgtiny_diagram *diagram,
+		unsigned int vertex_count, unsigned int index_count)
+{
+	void *memory = svgtiny_arena_alloc(diagram,
+			svgtiny_mesh_size(vertex_count, index_count));
+	if (!memory)
+		return NULL;
+	return svgtiny_mesh_place(memory, vertex_count, index_count);
+}
+
+
+/**
+ * Allocate a triangle mesh as svgtiny_arena_mesh() does, but on the heap.
+ *
+ * \return  the mesh, to be freed with free(), or NULL if memory runs out
+ */
+
+struct svgtiny_mesh *svgtiny_mesh_create(unsigned int vertex_count,
+		unsigned int index_count)
+{
+	void *memory = malloc(svgtiny_mesh_size(vertex_count, index_count));
+	if (!memory)
+		return NULL;
+	return svgtiny_mesh_place(memory, vertex_count, index_count);
+}
+
+
+/**
+ * Allocate a linear gradient in a diagram's arena.
+ *
+ * The stops are allocated with the gradient but are not initialised.
+ *
+ * \return  the gradient, or NULL if memory runs out
+ */
+
+struct svgtiny_linear_gradient *svgtiny_arena_linear_gradient(
+		struct svgtiny_diagram *diagram, unsigned int stop_count)
+{
+	struct svgtiny_linear_gradient *gradient;
+
+	gradient = svgtiny_arena_alloc(diagram,
+			svgtiny_linear_gradient_size(stop_count));
+	if (!gradient)
+		return NULL;
+	gradient->stop_count = stop_count;
+	gradient->stop = (struct svgtiny_gradient_stop *) (void *)
+			(gradient + 1);
+	return gradient;
+}
+
+
+/**
+ * Move the meshes, gradients, paths, and text of a diagram to follow its
+ * shapes in one block.
+ *
+ * Called at the end of parsing. If memory runs out the diagram is left as
+ * it was, which is equally valid.
+ */
+
+void svgtiny_compact_diagram(struct svgtiny_diagram *diagram)
+{
+	struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(diagram);
+	unsigned int count = diagram->shape_count;
+	struct svgtiny_shape *shape;
+	unsigned int i;
+	char *next;
+	float *path;
+	int32_t *fixed;
+	int16_t *fixed_short;
+	unsigned char *op;
+	char *text;
+
+	if (internal->compact)
+		return;
+
+	if (count == 0) {
+		svgtiny_arena_free(diagram);
+		free(diagram->shape);
+		diagram->shape = NULL;
+		internal->shape_allocated = 0;
+		internal->data_size = 0;
+		internal->compact = true;
+		return;
+	}
+
+	/* the shapes stay where they are, and realloc() can usually avoid
+	 * copying them, so only what they point to is copied */
+	shape = realloc(diagram->shape,
+			count * sizeof *shape + internal->data_size);
+	if (!shape)
+		return;
+	diagram->shape = shape;
+	internal->shape_allocated = count;
+
+	next = (char *) (void *) (shape + count);
+	for (i = 0; i != count; i++) {
+		const struct svgtiny_mesh *old = shape[i].mesh;
+		size_t size;
+		if (!old)
+			continue;
+		size = svgtiny_mesh_size(old->vertex_count, old->index_count);
+		shape[i].mesh = svgtiny_mesh_place(next, old->vertex_count,
+				old->index_count);
+		memcpy(shape[i].mesh->vertex, old->vertex,
+				old->vertex_count * 2 * sizeof old->vertex[0]);
+		memcpy(shape[i].mesh->colour, old->colour,
+				old->vertex_count * sizeof old->colour[0]);
+		memcpy(shape[i].mesh->index, old->index,
+				old->index_count * sizeof old->index[0]);
+		next += size;
+	}
+	for (i = 0; i != count; i++) {
+		const struct svgtiny_linear_gradient *old =
+				shape[i].fill_gradient;
+		size_t size;
+		if (!old)
+			continue;
+		size = svgtiny_linear_gradient_size(old->stop_count);
+		memcpy(next, old, size);
+		shape[i].fill_gradient = (struct svgtiny_linear_gradient *)
+				(void *) next;
+		shape[i].fill_gradient->stop =
+				(struct svgtiny_gradient_stop *) (void *)
+				(shape[i].fill_gradient + 1);
+		next += size;
+	}
+	path = (float *) (void *) next;
+	for (i = 0; i != count; i++) {
+		if (shape[i].path) {
+			memcpy(path, shape[i].path,
+					shape[i].path_length * sizeof path[0]);
+			shape[i].path = path;
+			path += shape[i].path_length;
+		}
+	}
+	for (i = 0; i != count; i++) {
+		if (shape[i].path_point) {
+			memcpy(path, shape[i].path_point,
+					2 * shape[i].path_point_count *
+					sizeof path[0]);
+			shape[i].path_point = path;
+			path += 2 * shape[i].path_point_count;
+		}
+	}
+	fixed = (int32_t *) (void *) path;
+	for (i = 0; i != count; i++) {
+		if (shape[i].path_fixed) {
+			memcpy(fixed, shape[i].path_fixed,
+					2 * shape[i].path_point_count *
+					sizeof fixed[0]);
+			shape[i].path_fixed = fixed;
+			fixed += 2 * shape[i].path_point_count;
+		}
+	}
+	fixed_short = (int16_t *) (void *) fixed;
+	for (i = 0; i != count; i++) {
+		if (shape[i].path_short) {
+			memcpy(fixed_short, shape[i].path_short,
+					2 * shape[i].path_point_count *
+					sizeof fixed_short[0]);
+			shape[i].path_short = fixed_short;
+			fixed_short += 2 * shape[i].path_point_count;
+		}
+	}
+	op = (unsigned char *) fixed_short;
+	for (i = 0; i != count; i++) {
+		if (shape[i].path_op) {
+			memcpy(op, shape[i].path_op, shape[i].path_op_count);
+			shape[i].path_op = op;
+			op += shape[i].path_op_count;
+		}
+	}
+	text = (char *) op;
+	for (i = 0; i != count; i++) {
+		if (shape[i].text) {
+			size_t len = strlen(shape[i].text) + 1;
+			memcpy(text, shape[i].text, len);
+			shape[i].text = text;
+			text += len;
+		}
+	}
+
+	svgtiny_arena_free(diagram);
+	internal->data_size = text - (char *) (void *) (shape + count);
+	internal->compact = true;
+}
+
+
+/**
+ * Make the shape array separate from paths and text, so that it can grow.
+ *
+ * After compaction, the shape array is the start of the block holding all
+ * meshes, gradients, paths, and text. The block is kept until the next
+ * compaction, and its size stays counted in data_size.
+ */
+
+svgtiny_code svgtiny_arena_detach(struct svgtiny_diagram *diagram,
+		unsigned int shape_count)
+{
+	struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(diagram);
+	struct svgtiny_shape *shape;
+
+	shape = malloc(shape_count * sizeof *shape);
+	if (!shape)
+		return svgtiny_OUT_OF_MEMORY;
+	memcpy(shape, diagram->shape,
+			diagram->shape_count * sizeof *shape);
+
+	internal->retired = diagram->shape;
+	diagram->shape = shape;
+	internal->shape_allocated = shape_count;
+	internal->compact = false;
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Move the shapes of one diagram to the end of another.
+ *
+ * The meshes, gradients, paths, and text of the shapes stay where they are,
+ * and the blocks holding them are moved to the other diagram. part must not
+ * have been compacted, and is left empty.
+ *
+ * \return  svgtiny_OK, or svgtiny_OUT_OF_MEMORY, in which case neither
+ *          diagram is changed
+ */
+
+svgtiny_code svgtiny_arena_join(struct svgtiny_diagram *diagram,
+		struct svgtiny_diagram *part)
+{
+	struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(diagram);
+	struct svgtiny_diagram_internal *part_internal =
+			svgtiny_diagram_internal(part);
+	struct svgtiny_arena_block *last;
+	svgtiny_code code;
+
+	if (part->shape_count == 0)
+		return svgtiny_OK;
+	code = svgtiny_reserve(diagram,
+			diagram->shape_count + part->shape_count);
+	if (code != svgtiny_OK)
+		return code;
+	memcpy(diagram->shape + diagram->shape_count, part->shape,
+			part->shape_count * sizeof *part->shape);
+	diagram->shape_count += part->shape_count;
+	part->shape_count = 0;
+
+	/* the blocks go after the first, which allocation continues from */
+	if (part_internal->arena) {
+		for (last = part_internal->arena; last->next;
+				last = last->next)
+			continue;
+		if (internal->arena) {
+			last->next = internal->arena->next;
+			internal->arena->next = part_internal->arena;
+		} else {
+			internal->arena = part_internal->arena;
+		}
+		part_internal->arena = NULL;
+	}
+	internal->data_size += part_internal->data_size;
+	part_internal->data_size = 0;
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Free the memory allocated by svgtiny_arena_alloc(), but not the shape
+ * array.
+ */
+
+void svgtiny_arena_free(struct svgtiny_diagram *diagram)
+{
+	struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(diagram);
+	struct svgtiny_arena_block *block, *next;
+
+	for (block = internal->arena; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	internal->arena = NULL;
+
+	free(internal->retired);
+	internal->retired = NULL;
+}
+
+
+/**
+ * Size of the memory for a mesh, rounded up to keep the next aligned.
+ */
+
+size_t svgtiny_mesh_size(unsigned int vertex_count, unsigned int index_count)
+{
+	size_t size = sizeof (struct svgtiny_mesh) +
+			vertex_count * (2 * sizeof (float) +
+				sizeof (svgtiny_colour)) +
+			index_count * sizeof (unsigned int);
+	return (size + svgtiny_ARENA_ALIGN - 1) &
+			~(size_t) (svgtiny_ARENA_ALIGN - 1);
+}
+
+
+/**
+ * Lay out a mesh and its arrays in memory of svgtiny_mesh_size().
+ */
+
+struct svgtiny_mesh *svgtiny_mesh_place(void *memory,
+		unsigned int vertex_count, unsigned int index_count)
+{
+	struct svgtiny_mesh *mesh = memory;
+
+	mesh->vertex_count = vertex_count;
+	mesh->vertex = (float *) (void *) (mesh + 1);
+	mesh->colour = (svgtiny_colour *) (void *)
+			(mesh->vertex + 2 * vertex_count);
+	mesh->index_count = index_count;
+	mesh->index = (unsigned int *) (void *)
+			(mesh->colour + vertex_count);
+	return mesh;
+}
+
+
+/**
+ * Size of the memory for a linear gradient, rounded up to keep the next
+ * aligned.
+ */
+
+size_t svgtiny_linear_gradient_size(unsigned int stop_count)
+{
+	size_t size = sizeof (struct svgtiny_linear_gradient) +
+			stop_count * sizeof (struct svgtiny_gradient_stop);
+	return (size + svgtiny_ARENA_ALIGN - 1) &
+			~(size_t) (svgtiny_ARENA_ALIGN - 1);
+}
@@ -0,0 +1,153 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Bezier flattening.
+ *
+ * A cubic Bezier is approximated by lines between points at equal steps of
+ * its parameter. svgtiny_bezier_steps() finds how many steps keep the lines
+ * within a distance of the curve, and svgtiny_bezier_points() finds the
+ * points by forward differencing: the curve is a cubic in its parameter, so
+ * after the first few points each takes three additions per coordinate.
+ * Four points are advanced side by side, each by four steps at a time, with
+ * their x and y coordinates in separate arrays so that each round is a few
+ * vector additions, and every few rounds they are evaluated again to keep
+ * the error small in single precision.
+ */
+
+#include <math.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* most lines to approximate one bezier */
+#define svgtiny_BEZIER_FLATTEN_MAX 65536
+
+/* points advanced side by side, and how many times they are advanced
+ * before being found again from the start */
+#define svgtiny_BEZIER_LANES 4
+#define svgtiny_BEZIER_ROUNDS 16
+
+
+/**
+ * Find how many lines approximate a bezier to within a flatness.
+ *
+ * The distance between a cubic bezier and n lines between points at equal
+ * steps of its parameter is at most 3/4 of its largest second difference
+ * divided by n squared.
+ *
+ * \param  c         x, y of the start point, the two control points, and the
+ *                   end point
+ * \param  m         matrix a, b, c, d from the curve to where the flatness
+ *                   is measured, or NULL for none
+ * \param  flatness  largest distance between the lines and the curve
+ * \return  number of lines, at least 1
+ */
+
+unsigned int svgtiny_bezier_steps(const float *c, const float *m,
+		float flatness)
+{
+	float dx0 = c[0] - 2 * c[2] + c[4], dy0 = c[1] - 2 * c[3] + c[5];
+	float dx1 = c[2] - 2 * c[4] + c[6], dy1 = c[3] - 2 * c[5] + c[7];
+	float d0, d1, steps;
+
+	if (m) {
+		float x0 = m[0] * dx0 + m[2] * dy0, y0 = m[1] * dx0 + m[3] * dy0;
+		float x1 = m[0] * dx1 + m[2] * dy1, y1 = m[1] * dx1 + m[3] * dy1;
+		dx0 = x0;
+		dy0 = y0;
+		dx1 = x1;
+		dy1 = y1;
+	}
+	d0 = sqrtf(dx0 * dx0 + dy0 * dy0);
+	d1 = sqrtf(dx1 * dx1 + dy1 * dy1);
+	steps = ceilf(sqrtf(0.75 * (d0 < d1 ? d1 : d0) / flatness));
+
+	if (!(1 <= steps))
+		return 1;
+	if (svgtiny_BEZIER_FLATTEN_MAX < steps)
+		return svgtiny_BEZIER_FLATTEN_MAX;
+	return steps;
+}
+
+
+/**
+ * Find the points at equal steps along a bezier.
+ *
+ * \param  c      x, y of the start point, the two control points, and the
+ *                end point
+ * \param  steps  number of steps, at least 1
+ * \param  out    updated with x, y of the steps points after the start
+ *                point, the last of which is the end point
+ */
+
+void svgtiny_bezier_points(const float *c, unsigned int steps, float *out)
+{
+	/* each coordinate as a cubic in t, a t^3 + b t^2 + d t + c[k] */
+	const float a[2] = { c[6] - c[0] + 3 * (c[2] - c[4]),
+			c[7] - c[1] + 3 * (c[3] - c[5]) };
+	const float b[2] = { 3 * (c[0] - 2 * c[2] + c[4]),
+			3 * (c[1] - 2 * c[3] + c[5]) };
+	const float d[2] = { 3 * (c[2] - c[0]), 3 * (c[3] - c[1]) };
+	/* the x and y of each lane, and their first, second, and third
+	 * differences over svgtiny_BEZIER_LANES steps, kept apart so that
+	 * each is one vector */
+	float x[svgtiny_BEZIER_LANES], y[svgtiny_BEZIER_LANES];
+	float x1[svgtiny_BEZIER_LANES], y1[svgtiny_BEZIER_LANES];
+	float x2[svgtiny_BEZIER_LANES], y2[svgtiny_BEZIER_LANES];
+	float x3, y3;
+	float h = 1.0f / steps, s = svgtiny_BEZIER_LANES * h;
+	unsigned int i = 0, j, r, rounds;
+
+	x3 = 6 * a[0] * s * s * s;
+	y3 = 6 * a[1] * s * s * s;
+
+	/* differences save nothing for a round or two */
+	while (2 * svgtiny_BEZIER_LANES <= steps - i) {
+		/* start each lane exactly, and then add differences for a
+		 * few rounds, before the rounding errors add up */
+		for (j = 0; j != svgtiny_BEZIER_LANES; j++) {
+			float t = (i + j + 1) * h;
+			float t1 = 3 * t * t * s + 3 * t * s * s + s * s * s;
+			float t2 = 6 * t * s * s + 6 * s * s * s;
+			x[j] = ((a[0] * t + b[0]) * t + d[0]) * t + c[0];
+			y[j] = ((a[1] * t + b[1]) * t + d[1]) * t + c[1];
+			x1[j] = a[0] * t1 + b[0] * (2 * t * s + s * s) +
+					d[0] * s;
+			y1[j] = a[1] * t1 + b[1] * (2 * t * s + s * s) +
+					d[1] * s;
+			x2[j] = a[0] * t2 + b[0] * 2 * s * s;
+			y2[j] = a[1] * t2 + b[1] * 2 * s * s;
+		}
+		/* a single exit and a size_t offset, so that the loop over
+		 * the lanes vectorizes */
+		rounds = (steps - i) / svgtiny_BEZIER_LANES;
+		if (svgtiny_BEZIER_ROUNDS < rounds)
+			rounds = svgtiny_BEZIER_ROUNDS;
+		for (r = 0; r != rounds; r++, i += svgtiny_BEZIER_LANES) {
+			float *point = out + 2 * (size_t) i;
+			for (j = 0; j != svgtiny_BEZIER_LANES; j++) {
+				point[2 * j] = x[j];
+				point[2 * j + 1] = y[j];
+				x[j] += x1[j];
+				y[j] += y1[j];
+				x1[j] += x2[j];
+				y1[j] += y2[j];
+				x2[j] += x3;
+				y2[j] += y3;
+			}
+		}
+	}
+	for (; i != steps; i++) {
+		float t = (i + 1) * h;
+		for (j = 0; j != 2; j++)
+			out[2 * i + j] = ((a[j] * t + b[j]) * t + d[j]) * t +
+					c[j];
+	}
+
+	out[2 * steps - 2] = c[6];
+	out[2 * steps - 1] = c[7];
+}
@@ -0,0 +1,463 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Geometric clipping of paths to the clip rectangle.
+ *
+ * A path is clipped against each edge of the rectangle in turn, in the
+ * manner of Sutherland-Hodgman. Each edge is a half-plane, which is tested
+ * in user space so that the path need not be transformed first. Segments
+ * are split where they cross the edge, solving the cubic of a Bezier for
+ * its crossings, and the parts outside are dropped.
+ *
+ * A closed subpath, or any subpath of a path which is only filled, stays
+ * closed: the points where it leaves and enters the half-plane are joined
+ * along the edge, which keeps the filled area inside the rectangle the same
+ * for either fill rule. An open subpath which is only stroked is cut into
+ * pieces instead. An open subpath which is both filled and stroked can't be
+ * clipped either way, and is kept whole.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* a path in the float layout, being built */
+struct svgtiny_clip_buffer {
+	float *p;
+	unsigned int n;
+	unsigned int allocated;
+};
+
+/* how subpaths are clipped */
+enum svgtiny_clip_mode {
+	svgtiny_CLIP_FILL,		/* all subpaths as closed */
+	svgtiny_CLIP_STROKE,		/* open subpaths cut into pieces */
+	svgtiny_CLIP_FILL_STROKE	/* open subpaths kept whole */
+};
+
+/* subpath being clipped against one half-plane */
+struct svgtiny_clip_subpath {
+	struct svgtiny_clip_buffer *out;
+	const float *plane;	/* a, b, c of a x + b y + c >= 0 */
+	bool closed;
+	bool started;		/* a point has been output */
+	bool inside;		/* the last piece was inside */
+};
+
+static bool svgtiny_clip_plane(const float *p, unsigned int n,
+		const float *plane, enum svgtiny_clip_mode mode,
+		struct svgtiny_clip_buffer *out);
+static bool svgtiny_clip_line(struct svgtiny_clip_subpath *sub,
+		float x0, float y0, float x1, float y1);
+static bool svgtiny_clip_bezier(struct svgtiny_clip_subpath *sub,
+		const float *x, const float *y);
+static unsigned int svgtiny_clip_roots(const float *d, float *t);
+static bool svgtiny_clip_piece(struct svgtiny_clip_subpath *sub,
+		bool inside, float x0, float y0);
+static bool svgtiny_clip_push(struct svgtiny_clip_buffer *out,
+		unsigned int count, float a, float b, float c, float d,
+		float e, float f, float g);
+
+
+/**
+ * Clip a path to the clip rectangle of the diagram.
+ *
+ * The rectangle is grown by 1 pixel, and for stroked paths by the reach of a
+ * miter at svgtiny_MITER_LIMIT, twice the stroke width, so that no new edge
+ * or join shows and no miter of a vertex cut off would have reached inside.
+ *
+ * \param  p        path in the float layout, in user space
+ * \param  n        length of p
+ * \param  state    state of the element, giving the transformation
+ * \param  clipped  updated with the clipped path, allocated with malloc()
+ * \param  length   updated with the length of the clipped path
+ * \return  svgtiny_OK, or svgtiny_OUT_OF_MEMORY
+ */
+
+svgtiny_code svgtiny_clip_path(const float *p, unsigned int n,
+		const struct svgtiny_parse_state *state,
+		float **clipped, unsigned int *length)
+{
+	const struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(state->context->diagram);
+	struct svgtiny_clip_buffer buffer[2] = { { 0, 0, 0 }, { 0, 0, 0 } };
+	enum svgtiny_clip_mode mode = svgtiny_CLIP_FILL;
+	float grow = 1;
+	float plane[4][3];
+	unsigned int i;
+
+	if (state->stroke != svgtiny_TRANSPARENT) {
+		grow += 0.5f * svgtiny_MITER_LIMIT * state->stroke_width *
+				sqrtf(state->ctm.a * state->ctm.a +
+				state->ctm.b * state->ctm.b +
+				state->ctm.c * state->ctm.c +
+				state->ctm.d * state->ctm.d);
+		mode = state->fill == svgtiny_TRANSPARENT ?
+				svgtiny_CLIP_STROKE : svgtiny_CLIP_FILL_STROKE;
+	}
+
+	/* the edges as functions of user space, positive inside */
+	plane[0][0] = state->ctm.a;
+	plane[0][1] = state->ctm.c;
+	plane[0][2] = state->ctm.e - (internal->clip_x0 - grow);
+	plane[1][0] = -state->ctm.a;
+	plane[1][1] = -state->ctm.c;
+	plane[1][2] = internal->clip_x1 + grow - state->ctm.e;
+	plane[2][0] = state->ctm.b;
+	plane[2][1] = state->ctm.d;
+	plane[2][2] = state->ctm.f - (internal->clip_y0 - grow);
+	plane[3][0] = -state->ctm.b;
+	plane[3][1] = -state->ctm.d;
+	plane[3][2] = internal->clip_y1 + grow - state->ctm.f;
+
+	for (i = 0; i != 4; i++) {
+		struct svgtiny_clip_buffer *out = &buffer[i % 2];
+		out->n = 0;
+		if (!svgtiny_clip_plane(p, n, plane[i], mode, out)) {
+			free(buffer[0].p);
+			free(buffer[1].p);
+			return svgtiny_OUT_OF_MEMORY;
+		}
+		p = out->p;
+		n = out->n;
+	}
+
+	/* the last plane was output to buffer[1] */
+	free(buffer[0].p);
+	*clipped = buffer[1].p;
+	*length = buffer[1].n;
+	return svgtiny_OK;
+}
+
+
+/**
+ * Clip a path to one half-plane.
+ *
+ * \return  true on success, false if memory runs out
+ */
+
+bool svgtiny_clip_plane(const float *p, unsigned int n,
+		const float *plane, enum svgtiny_clip_mode mode,
+		struct svgtiny_clip_buffer *out)
+{
+	float start_x = 0, start_y = 0;
+	unsigned int j = 0;
+
+	/* make sure the output is allocated even if it stays empty */
+	if (!svgtiny_clip_push(out, 0, 0, 0, 0, 0, 0, 0, 0))
+		return false;
+
+	while (j != n) {
+		struct svgtiny_clip_subpath sub;
+		unsigned int end, k;
+		float x, y;
+
+		/* a subpath runs from a move, or the start point of the last
+		 * one after a close, to a close or the next move */
+		if ((int) p[j] == svgtiny_PATH_MOVE) {
+			start_x = p[j + 1];
+			start_y = p[j + 2];
+			j += 3;
+		}
+		for (end = j; end != n; ) {
+			int type = (int) p[end];
+			if (type == svgtiny_PATH_MOVE ||
+					type == svgtiny_PATH_CLOSE)
+				break;
+			end += type == svgtiny_PATH_BEZIER ? 7 : 3;
+		}
+
+		sub.out = out;
+		sub.plane = plane;
+		sub.closed = (end != n && (int) p[end] == svgtiny_PATH_CLOSE) ||
+				mode == svgtiny_CLIP_FILL;
+		sub.started = false;
+		sub.inside = false;
+
+		if (!sub.closed && mode == svgtiny_CLIP_FILL_STROKE) {
+			if (!svgtiny_clip_push(out, 3, svgtiny_PATH_MOVE,
+					start_x, start_y, 0, 0, 0, 0))
+				return false;
+			for (k = j; k != end; k++)
+				if (!svgtiny_clip_push(out, 1, p[k],
+						0, 0, 0, 0, 0, 0))
+					return false;
+			j = end;
+			continue;
+		}
+
+		/* a lone move is kept if it is inside, as it may be drawn
+		 * as a dot by a stroke with round caps */
+		x = start_x;
+		y = start_y;
+		if (j == end && !svgtiny_clip_piece(&sub,
+				0 <= plane[0] * x + plane[1] * y + plane[2],
+				x, y))
+			return false;
+
+		for (k = j; k != end; ) {
+			bool ok;
+			if ((int) p[k] == svgtiny_PATH_LINE) {
+				ok = svgtiny_clip_line(&sub, x, y,
+						p[k + 1], p[k + 2]);
+				x = p[k + 1];
+				y = p[k + 2];
+				k += 3;
+			} else {
+				float bx[4] = { x, p[k + 1], p[k + 3],
+						p[k + 5] };
+				float by[4] = { y, p[k + 2], p[k + 4],
+						p[k + 6] };
+				ok = svgtiny_clip_bezier(&sub, bx, by);
+				x = p[k + 5];
+				y = p[k + 6];
+				k += 7;
+			}
+			if (!ok)
+				return false;
+		}
+
+		if (sub.closed) {
+			if ((x != start_x || y != start_y) &&
+					!svgtiny_clip_line(&sub, x, y,
+					start_x, start_y))
+				return false;
+			if (sub.started && !svgtiny_clip_push(out, 1,
+					svgtiny_PATH_CLOSE, 0, 0, 0, 0, 0, 0))
+				return false;
+		}
+
+		j = end;
+		if (j != n && (int) p[j] == svgtiny_PATH_CLOSE)
+			j++;
+	}
+
+	return true;
+}
+
+
+/**
+ * Clip a line segment of a subpath.
+ *
+ * \return  true on success, false if memory runs out
+ */
+
+bool svgtiny_clip_line(struct svgtiny_clip_subpath *sub,
+		float x0, float y0, float x1, float y1)
+{
+	const float *plane = sub->plane;
+	float f0 = plane[0] * x0 + plane[1] * y0 + plane[2];
+	float f1 = plane[0] * x1 + plane[1] * y1 + plane[2];
+
+	if ((f0 < 0) != (f1 < 0)) {
+		/* split where it crosses the edge */
+		float t = f0 / (f0 - f1);
+		float x = x0 + t * (x1 - x0), y = y0 + t * (y1 - y0);
+		if (!svgtiny_clip_piece(sub, 0 <= f0, x0, y0))
+			return false;
+		if (0 <= f0 && !svgtiny_clip_push(sub->out, 3,
+				svgtiny_PATH_LINE, x, y, 0, 0, 0, 0))
+			return false;
+		x0 = x;
+		y0 = y;
+		f0 = f1;
+	}
+
+	if (!svgtiny_clip_piece(sub, 0 <= f0, x0, y0))
+		return false;
+	if (0 <= f0)
+		return svgtiny_clip_push(sub->out, 3, svgtiny_PATH_LINE,
+				x1, y1, 0, 0, 0, 0);
+	return true;
+}
+
+
+/**
+ * Clip a Bezier segment of a subpath.
+ *
+ * \param  x  x of the start point, the two control points, and the end point
+ * \param  y  y of the same points
+ * \return  true on success, false if memory runs out
+ */
+
+bool svgtiny_clip_bezier(struct svgtiny_clip_subpath *sub,
+		const float *x, const float *y)
+{
+	const float *plane = sub->plane;
+	float d[4], t[4];
+	float px[4], py[4];
+	float t0 = 0;
+	unsigned int count, i, k;
+
+	for (k = 0; k != 4; k++)
+		d[k] = plane[0] * x[k] + plane[1] * y[k] + plane[2];
+	count = svgtiny_clip_roots(d, t);
+	t[count++] = 1;
+
+	memcpy(px, x, sizeof px);
+	memcpy(py, y, sizeof py);
+	for (i = 0; i != count; i++) {
+		/* split the rest of the curve, px, py from t0 to 1, at t */
+		float s = t[i] < 1 ? (t[i] - t0) / (1 - t0) : 1;
+		float m = (t0 + t[i]) / 2, mt = 1 - m;
+		float fm = mt * mt * mt * d[0] + 3 * mt * mt * m * d[1] +
+				3 * mt * m * m * d[2] + m * m * m * d[3];
+		float ax = px[0] + s * (px[1] - px[0]);
+		float bx = px[1] + s * (px[2] - px[1]);
+		float cx = px[2] + s * (px[3] - px[2]);
+		float ay = py[0] + s * (py[1] - py[0]);
+		float by = py[1] + s * (py[2] - py[1]);
+		float cy = py[2] + s * (py[3] - py[2]);
+		float abx = ax + s * (bx - ax), aby = ay + s * (by - ay);
+		float bcx = bx + s * (cx - bx), bcy = by + s * (cy - by);
+		float ex = abx + s * (bcx - abx), ey = aby + s * (bcy - aby);
+
+		if (!svgtiny_clip_piece(sub, 0 <= fm, px[0], py[0]))
+			return false;
+		if (0 <= fm && !svgtiny_clip_push(sub->out, 7,
+				svgtiny_PATH_BEZIER, ax, ay, abx, aby, ex, ey))
+			return false;
+
+		px[0] = ex;
+		py[0] = ey;
+		px[1] = bcx;
+		py[1] = bcy;
+		px[2] = cx;
+		py[2] = cy;
+		t0 = t[i];
+	}
+
+	return true;
+}
+
+
+/**
+ * Find where a cubic Bezier crosses zero between 0 and 1.
+ *
+ * \param  d  values at the start point, control points, and end point
+ * \param  t  updated with up to 3 crossings, in increasing order
+ * \return  number of crossings
+ */
+
+unsigned int svgtiny_clip_roots(const float *d, float *t)
+{
+	/* the cubic is a t^3 + b t^2 + c t + d[0] */
+	float a = -d[0] + 3 * d[1] - 3 * d[2] + d[3];
+	float b = 3 * d[0] - 6 * d[1] + 3 * d[2];
+	float c = -3 * d[0] + 3 * d[1];
+	float bound[4];
+	unsigned int bounds = 0, count = 0, i;
+
+	/* the curve is on one side when its control points are */
+	if ((0 <= d[0] && 0 <= d[1] && 0 <= d[2] && 0 <= d[3]) ||
+			(d[0] < 0 && d[1] < 0 && d[2] < 0 && d[3] < 0))
+		return 0;
+
+	/* the cubic is monotonic between its turning points, so each
+	 * interval holds at most one crossing */
+	bound[bounds++] = 0;
+	if (a != 0) {
+		float q = b * b - 3 * a * c;
+		if (0 < q) {
+			float r = sqrtf(q);
+			float s0 = (-b - r) / (3 * a), s1 = (-b + r) / (3 * a);
+			if (s1 < s0) {
+				float swap = s0;
+				s0 = s1;
+				s1 = swap;
+			}
+			if (0 < s0 && s0 < 1)
+				bound[bounds++] = s0;
+			if (0 < s1 && s1 < 1)
+				bound[bounds++] = s1;
+		}
+	} else if (b != 0) {
+		float s = -c / (2 * b);
+		if (0 < s && s < 1)
+			bound[bounds++] = s;
+	}
+	bound[bounds++] = 1;
+
+	for (i = 0; i + 1 != bounds; i++) {
+		float lo = bound[i], hi = bound[i + 1];
+		float flo = ((a * lo + b) * lo + c) * lo + d[0];
+		float fhi = ((a * hi + b) * hi + c) * hi + d[0];
+		unsigned int k;
+		if ((flo < 0) == (fhi < 0))
+			continue;
+		for (k = 0; k != 32; k++) {
+			float mid = (lo + hi) / 2;
+			float fmid = ((a * mid + b) * mid + c) * mid + d[0];
+			if ((fmid < 0) == (flo < 0))
+				lo = mid;
+			else
+				hi = mid;
+		}
+		if (0 < lo && lo < 1 && (count == 0 || t[count - 1] < lo))
+			t[count++] = lo;
+	}
+
+	return count;
+}
+
+
+/**
+ * Start a piece of a subpath, which is inside or outside the half-plane.
+ *
+ * The first piece inside starts the output with a move. A later piece
+ * inside after one outside is joined along the edge if the subpath is
+ * closed, or else starts a new subpath.
+ *
+ * \return  true on success, false if memory runs out
+ */
+
+bool svgtiny_clip_piece(struct svgtiny_clip_subpath *sub,
+		bool inside, float x0, float y0)
+{
+	bool ok = true;
+
+	if (inside && !sub->inside) {
+		ok = svgtiny_clip_push(sub->out, 3,
+				sub->started && sub->closed ?
+				svgtiny_PATH_LINE : svgtiny_PATH_MOVE,
+				x0, y0, 0, 0, 0, 0);
+		sub->started = true;
+	}
+	sub->inside = inside;
+	return ok;
+}
+
+
+/**
+ * Append a segment to a path being built.
+ *
+ * \param  count  number of values to append, from a to g
+ * \return  true on success, false if memory runs out
+ */
+
+bool svgtiny_clip_push(struct svgtiny_clip_buffer *out,
+		unsigned int count, float a, float b, float c, float d,
+		float e, float f, float g)
+{
+	const float value[7] = { a, b, c, d, e, f, g };
+
+	if (out->allocated < out->n + 7) {
+		unsigned int allocated = out->allocated < 64 ?
+				64 : out->allocated * 2;
+		float *p = realloc(out->p, allocated * sizeof p[0]);
+		if (!p)
+			return false;
+		out->p = p;
+		out->allocated = allocated;
+	}
+	memcpy(out->p + out->n, value, count * sizeof value[0]);
+	out->n += count;
+	return true;
+}
@@ -16,209 +16,799 @@
 
 #undef GRADIENT_DEBUG
 
-static svgtiny_code svgtiny_parse_linear_gradient(dom_element *linear,
+/* most lines to approximate a bezier in a gradient mesh */
+#define svgtiny_BEZIER_STEPS_MAX 256
+
+/* pixels by which a band of flat colour overlaps the next, when gradient
+ * meshes are added as paths */
+#define svgtiny_GRADIENT_OVERLAP 1.0f
+
+/* radial gradients: focal points are kept this far inside the end circle, as
+ * a fraction of its radius; wedges and cells are split at most this deep; and
+ * angles closer than this are the same */
+#define svgtiny_RADIAL_FOCAL_MAX 0.99f
+#define svgtiny_RADIAL_DEPTH_MAX 12
+#define svgtiny_RADIAL_ANGLE_MIN 1e-4f
+
+/* a gradient element with an id, and its definition once parsed */
+struct svgtiny_gradient_entry {
+	dom_string *id;
+	dom_element *element;
+	bool radial;		/* <radialGradient>, else <linearGradient> */
+	enum {
+		svgtiny_GRADIENT_UNPARSED,
+		svgtiny_GRADIENT_PARSING,	/* following xlink:href */
+		svgtiny_GRADIENT_PARSED
+	} status;
+	struct svgtiny_gradient gradient;
+};
+
+/* a vertex of a gradient mesh, its distance along the gradient vector, and
+ * its colour */
+struct svgtiny_gradient_point {
+	float x, y, r;
+	svgtiny_colour colour;
+};
+
+/* an edge of the outline of a path with a radial gradient fill, relative to
+ * the focal point in gradient space, and the angles that it covers from
+ * there, with winding -1 if it goes clockwise */
+struct svgtiny_radial_edge {
+	float x0, y0, x1, y1;
+	float angle0, angle1;
+	int winding;
+};
+
+/* an edge and its distance from the focal point along a ray */
+struct svgtiny_radial_hit {
+	const struct svgtiny_radial_edge *edge;
+	float distance;
+};
+
+/* a ray from the focal point across a cell, from its near end, or the focal
+ * point, to its far end, and their positions along the gradient */
+struct svgtiny_radial_ray {
+	float nx, ny, nt;
+	float fx, fy, ft;
+	bool focal;
+};
+
+/* a vertex of a radial gradient mesh on a ray */
+struct svgtiny_radial_vertex {
+	unsigned int index;
+	float t;
+};
+
+/* state for adding a path with a radial gradient fill */
+struct svgtiny_radial {
+	float ex, ey;		/* centre relative to the focal point */
+	float r2;		/* radius squared */
+	float a;		/* ex^2 + ey^2 - r2, which is negative */
+	float m[6];		/* from the focal point in gradient space to
+				   pixels */
+	const struct svgtiny_gradient_ramp *ramp;
+	const struct svgtiny_gradient_stop *bend;
+	unsigned int bend_count;
+	const float *slope;	/* largest channel change per unit between
+				   bends k - 1 and k */
+	float colour_tolerance;
+	float flatness;
+	struct svgtiny_list *pts;	/* of struct svgtiny_gradient_point */
+	struct svgtiny_list *tris;	/* of 3 vertex indices */
+	int focal;		/* vertex index of the focal point, or -1 */
+	struct svgtiny_radial_hit *order;	/* edges along a ray */
+	float *crossing;	/* angles of rays where edges cross rings */
+	struct svgtiny_radial_vertex *last;	/* vertices of the last ray */
+	unsigned int last_count;
+	struct svgtiny_radial_vertex *next;	/* space for the next ray */
+};
+
+/* open addressed hash table of the gradients of a document, by id */
+struct svgtiny_gradient_cache {
+	bool indexed;
+	struct svgtiny_gradient_entry *entry;
+	unsigned int entry_count;
+	unsigned int *table;		/* index into entry + 1, or 0 */
+	unsigned int table_mask;	/* table size - 1 */
+};
+
+static void svgtiny_gradient_defaults(struct svgtiny_gradient *gradient,
+		const struct svgtiny_parse_context *context);
+static void svgtiny_gradient_assign(struct svgtiny_gradient *gradient,
+		const struct svgtiny_gradient *source);
+static void svgtiny_gradient_ref(struct svgtiny_gradient *gradient);
+static struct svgtiny_gradient_entry *svgtiny_gradient_cache_find(
+		const struct svgtiny_parse_context *context, const char *id);
+static void svgtiny_gradient_cache_index(struct svgtiny_gradient_cache *cache,
+		const struct svgtiny_parse_context *context);
+static void svgtiny_gradient_cache_merge(struct svgtiny_gradient_cache *cache,
+		dom_nodelist *linear, dom_nodelist *radial,
+		const struct svgtiny_parse_context *context);
+static dom_node *svgtiny_gradient_item(dom_nodelist *list, uint32_t i);
+static dom_node *svgtiny_gradient_next_node(dom_node *node, dom_node *root);
+static void svgtiny_gradient_cache_add(struct svgtiny_gradient_cache *cache,
+		dom_node *element, bool radial,
+		const struct svgtiny_parse_context *context);
+static unsigned int svgtiny_gradient_id_hash(const char *id, size_t len);
+static svgtiny_code svgtiny_parse_gradient(dom_element *element,
+		bool radial, struct svgtiny_gradient *gradient,
+		const struct svgtiny_parse_context *context);
+static svgtiny_code svgtiny_add_path_native_gradient(float *p, unsigned int n,
+		float x0, float y0, float x1, float y1,
 		struct svgtiny_parse_state *state);
-static float svgtiny_parse_gradient_offset(const char *s);
-static void svgtiny_path_bbox(float *p, unsigned int n,
-		float *x0, float *y0, float *x1, float *y1);
-static void svgtiny_invert_matrix(float *m, float *inv);
+static unsigned int svgtiny_gradient_bends(
+		const struct svgtiny_gradient_stop *knot, unsigned int count,
+		float tolerance, struct svgtiny_gradient_stop *bend);
+static float svgtiny_ramp_error(float offset0, svgtiny_colour colour0,
+		float offset1, svgtiny_colour colour1,
+		const struct svgtiny_gradient_stop *stop);
+static float svgtiny_gradient_position(const float *trans,
+		const float *vector, float x, float y);
+static unsigned int svgtiny_gradient_bezier(float x0, float y0,
+		float c0x, float c0y, float c1x, float c1y, float x1, float y1,
+		float *point, float flatness,
+		const struct svgtiny_parse_state *state);
+static bool svgtiny_gradient_crossings(struct svgtiny_list *pts,
+		const struct svgtiny_gradient_point *from,
+		const struct svgtiny_gradient_point *to,
+		const struct svgtiny_gradient_stop *bend,
+		unsigned int bend_count);
+static bool svgtiny_gradient_push(struct svgtiny_list *pts,
+		const struct svgtiny_gradient_point *point);
+static struct svgtiny_mesh *svgtiny_gradient_mesh(
+		const struct svgtiny_parse_state *state,
+		unsigned int vertex_count, unsigned int index_count);
+static svgtiny_code svgtiny_gradient_add_mesh(struct svgtiny_mesh *mesh,
+		struct svgtiny_list *pts, struct svgtiny_parse_state *state);
+static svgtiny_code svgtiny_gradient_band(const struct svgtiny_mesh *mesh,
+		struct svgtiny_list *pts, float start, float end,
+		svgtiny_colour colour, struct svgtiny_parse_state *state);
+static unsigned int svgtiny_gradient_clip(const float *point, const float *r,
+		unsigned int count, float level, float side,
+		float *clipped, float *clipped_r);
+static unsigned int svgtiny_colour_difference(svgtiny_colour colour0,
+		svgtiny_colour colour1);
+static void svgtiny_invert_matrix(const float *m, float *inv);
+static bool svgtiny_radial_edge(struct svgtiny_list *edges, const float *inv,
+		float fx, float fy, float x0, float y0, float x1, float y1);
+static bool svgtiny_radial_wedge(struct svgtiny_radial *radial,
+		struct svgtiny_radial_edge **active, unsigned int count,
+		float angle0, float angle1, unsigned int depth);
+static float svgtiny_radial_distance(const struct svgtiny_radial_edge *edge,
+		float angle);
+static float svgtiny_radial_crossing(const struct svgtiny_radial_edge *a,
+		const struct svgtiny_radial_edge *b);
+static bool svgtiny_radial_cell(struct svgtiny_radial *radial,
+		const struct svgtiny_radial_edge *near,
+		const struct svgtiny_radial_edge *far,
+		float angle0, float angle1);
+static unsigned int svgtiny_radial_rings(const struct svgtiny_radial *radial,
+		float x0, float y0, float x1, float y1, float ring,
+		float *angle);
+static void svgtiny_radial_ray(const struct svgtiny_radial *radial,
+		const struct svgtiny_radial_edge *near,
+		const struct svgtiny_radial_edge *far,
+		float angle, struct svgtiny_radial_ray *ray);
+static bool svgtiny_radial_span(struct svgtiny_radial *radial,
+		const struct svgtiny_radial_edge *near,
+		const struct svgtiny_radial_edge *far,
+		float angle_a, const struct svgtiny_radial_ray *a,
+		float angle_b, const struct svgtiny_radial_ray *b,
+		unsigned int depth);
+static bool svgtiny_radial_split(const struct svgtiny_radial *radial,
+		const struct svgtiny_radial_ray *a,
+		const struct svgtiny_radial_ray *m,
+		const struct svgtiny_radial_ray *b);
+static float svgtiny_radial_edge_error(const struct svgtiny_radial *radial,
+		float ax, float ay, float at, float mx, float my, float mt,
+		float bx, float by, float bt);
+static float svgtiny_radial_slope(const struct svgtiny_radial *radial,
+		float t0, float t1);
+static float svgtiny_radial_position(const struct svgtiny_radial *radial,
+		float x, float y);
+static float svgtiny_radial_length(const struct svgtiny_radial *radial,
+		float dx, float dy);
+static bool svgtiny_radial_emit(struct svgtiny_radial *radial,
+		const struct svgtiny_radial_ray *ray);
+static bool svgtiny_radial_point(struct svgtiny_radial *radial,
+		float x, float y, float t, svgtiny_colour colour);
+static int svgtiny_radial_compare_edges(const void *a, const void *b);
+static int svgtiny_radial_compare_angles(const void *a, const void *b);
 
 
 /**
  * Find a gradient by id and parse it.
+ *
+ * Each gradient of a document is parsed once, including the gradients that it
+ * inherits from through xlink:href, and copied from the cache after that.
  */
 
-void svgtiny_find_gradient(const char *id, struct svgtiny_parse_state *state)
+void svgtiny_find_gradient(const char *id, struct svgtiny_gradient *gradient,
+		const struct svgtiny_parse_context *context)
 {
-	dom_element *gradient;
-	dom_string *id_str, *name;
-	dom_exception exc;
+	struct svgtiny_gradient_entry *entry;
 
 	#ifdef GRADIENT_DEBUG
 	fprintf(stderr, "svgtiny_find_gradient: id \"%s\"\n", id);
 	#endif
 
-	state->linear_gradient_stop_count = 0;
-	if (state->gradient_x1 != NULL)
-		dom_string_unref(state->gradient_x1);
-	if (state->gradient_y1 != NULL)
-		dom_string_unref(state->gradient_y1);
-	if (state->gradient_x2 != NULL)
-		dom_string_unref(state->gradient_x2);
-	if (state->gradient_y2 != NULL)
-		dom_string_unref(state->gradient_y2);
-	state->gradient_x1 = dom_string_ref(state->interned_zero_percent);
-	state->gradient_y1 = dom_string_ref(state->interned_zero_percent);
-	state->gradient_x2 = dom_string_ref(state->interned_hundred_percent);
-	state->gradient_y2 = dom_string_ref(state->interned_zero_percent);
-	state->gradient_user_space_on_use = false;
-	state->gradient_transform.a = 1;
-	state->gradient_transform.b = 0;
-	state->gradient_transform.c = 0;
-	state->gradient_transform.d = 1;
-	state->gradient_transform.e = 0;
-	state->gradient_transform.f = 0;
-	
-	exc = dom_string_create_interned((const uint8_t *) id,
-			strlen(id), &id_str);
-	if (exc != DOM_NO_ERR)
+	svgtiny_gradient_defaults(gradient, context);
+
+	if (context->stream) {
+		svgtiny_stream_find_gradient(id, gradient, context);
 		return;
-	
-	exc = dom_document_get_element_by_id(state->document, id_str,
-					     &gradient);
-	dom_string_unref(id_str);
-	if (exc != DOM_NO_ERR || gradient == NULL) {
+	}
+
+	entry = svgtiny_gradient_cache_find(context, id);
+	if (entry == NULL) {
 		#ifdef GRADIENT_DEBUG
 		fprintf(stderr, "gradient \"%s\" not found\n", id);
 		#endif
 		return;
 	}
-	
-	exc = dom_node_get_node_name(gradient, &name);
-	if (exc != DOM_NO_ERR) {
-		dom_node_unref(gradient);
+
+	if (entry->status == svgtiny_GRADIENT_PARSING) {
+		/* xlink:href loop */
 		return;
 	}
-	
-	if (dom_string_isequal(name, state->interned_linearGradient))
-		svgtiny_parse_linear_gradient(gradient, state);
-	
-	dom_node_unref(gradient);
-	dom_string_unref(name);
+
+	if (entry->status == svgtiny_GRADIENT_UNPARSED) {
+		entry->status = svgtiny_GRADIENT_PARSING;
+		svgtiny_gradient_defaults(&entry->gradient, context);
+		svgtiny_parse_gradient(entry->element, entry->radial,
+				&entry->gradient, context);
+		entry->status = svgtiny_GRADIENT_PARSED;
+	}
+
+	svgtiny_gradient_assign(gradient, &entry->gradient);
 
 	#ifdef GRADIENT_DEBUG
 	fprintf(stderr, "linear_gradient_stop_count %i\n",
-			state->linear_gradient_stop_count);
+			gradient->ramp ? gradient->ramp->stop_count : 0);
 	#endif
 }
 
 
 /**
- * Parse a <linearGradient> element node.
+ * Reset a gradient to the initial values for a <linearGradient> or
+ * <radialGradient>.
+ */
+
+void svgtiny_gradient_defaults(struct svgtiny_gradient *gradient,
+		const struct svgtiny_parse_context *context)
+{
+	svgtiny_gradient_clear(gradient);
+	gradient->x1 = dom_string_ref(context->interned_zero_percent);
+	gradient->y1 = dom_string_ref(context->interned_zero_percent);
+	gradient->x2 = dom_string_ref(context->interned_hundred_percent);
+	gradient->y2 = dom_string_ref(context->interned_zero_percent);
+	gradient->cx = dom_string_ref(context->interned_fifty_percent);
+	gradient->cy = dom_string_ref(context->interned_fifty_percent);
+	gradient->r = dom_string_ref(context->interned_fifty_percent);
+	gradient->radial = false;
+	gradient->user_space_on_use = false;
+	gradient->spread = svgtiny_SPREAD_PAD;
+	gradient->transform.a = 1;
+	gradient->transform.b = 0;
+	gradient->transform.c = 0;
+	gradient->transform.d = 1;
+	gradient->transform.e = 0;
+	gradient->transform.f = 0;
+}
+
+
+/**
+ * Replace the contents of a gradient with those of another.
+ */
+
+void svgtiny_gradient_assign(struct svgtiny_gradient *gradient,
+		const struct svgtiny_gradient *source)
+{
+	svgtiny_gradient_clear(gradient);
+	*gradient = *source;
+	svgtiny_gradient_ref(gradient);
+}
+
+
+/**
+ * Take references to the stops and strings of a gradient which has just been
+ * copied.
+ */
+
+void svgtiny_gradient_ref(struct svgtiny_gradient *gradient)
+{
+	dom_string **s[] = { &gradient->x1, &gradient->y1, &gradient->x2,
+			&gradient->y2, &gradient->cx, &gradient->cy,
+			&gradient->r, &gradient->fx, &gradient->fy };
+	unsigned int i;
+
+	svgtiny_ramp_ref(gradient->ramp);
+	for (i = 0; i != sizeof s / sizeof s[0]; i++)
+		if (*s[i] != NULL)
+			dom_string_ref(*s[i]);
+}
+
+
+/**
+ * Create an empty gradient cache for a document.
+ *
+ * The cache is filled on the first lookup.
+ */
+
+struct svgtiny_gradient_cache *svgtiny_gradient_cache_create(void)
+{
+	return calloc(1, sizeof (struct svgtiny_gradient_cache));
+}
+
+
+/**
+ * Free a gradient cache.
+ */
+
+void svgtiny_gradient_cache_free(struct svgtiny_gradient_cache *cache)
+{
+	unsigned int i;
+
+	if (cache == NULL)
+		return;
+
+	for (i = 0; i != cache->entry_count; i++) {
+		struct svgtiny_gradient_entry *entry = &cache->entry[i];
+		dom_string_unref(entry->id);
+		dom_node_unref(entry->element);
+		svgtiny_gradient_clear(&entry->gradient);
+	}
+	free(cache->entry);
+	free(cache->table);
+	free(cache);
+}
+
+
+/**
+ * Look up a gradient element by id in the cache.
+ *
+ * The index is built on the first call.
+ *
+ * \return  the entry for the first gradient with the id, or NULL
+ */
+
+struct svgtiny_gradient_entry *svgtiny_gradient_cache_find(
+		const struct svgtiny_parse_context *context, const char *id)
+{
+	struct svgtiny_gradient_cache *cache = context->gradient_cache;
+	size_t len = strlen(id);
+	unsigned int slot;
+
+	if (!cache->indexed)
+		svgtiny_gradient_cache_index(cache, context);
+	if (cache->entry_count == 0)
+		return NULL;
+
+	for (slot = svgtiny_gradient_id_hash(id, len) & cache->table_mask;
+			cache->table[slot] != 0;
+			slot = (slot + 1) & cache->table_mask) {
+		struct svgtiny_gradient_entry *entry =
+				&cache->entry[cache->table[slot] - 1];
+		if (dom_string_byte_length(entry->id) == len &&
+				memcmp(dom_string_data(entry->id), id,
+				len) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Index every <linearGradient> and <radialGradient> element of the document
+ * which has an id.
+ *
+ * If memory runs out, the cache is left empty and no gradients are found.
+ */
+
+void svgtiny_gradient_cache_index(struct svgtiny_gradient_cache *cache,
+		const struct svgtiny_parse_context *context)
+{
+	dom_nodelist *linear = NULL, *radial = NULL;
+	dom_exception exc;
+	uint32_t linear_count = 0, radial_count = 0, count;
+	unsigned int size;
+
+	cache->indexed = true;
+
+	exc = dom_document_get_elements_by_tag_name(context->document,
+			context->interned_linearGradient, &linear);
+	if (exc == DOM_NO_ERR && linear != NULL &&
+			dom_nodelist_get_length(linear, &linear_count) !=
+			DOM_NO_ERR)
+		linear_count = 0;
+	exc = dom_document_get_elements_by_tag_name(context->document,
+			context->interned_radialGradient, &radial);
+	if (exc == DOM_NO_ERR && radial != NULL &&
+			dom_nodelist_get_length(radial, &radial_count) !=
+			DOM_NO_ERR)
+		radial_count = 0;
+	count = linear_count + radial_count;
+	if (count == 0)
+		goto done;
+
+	/* at most half full, so that probe sequences stay short */
+	for (size = 8; size < count * 2; size *= 2)
+		;
+	cache->entry = malloc(count * sizeof cache->entry[0]);
+	cache->table = calloc(size, sizeof cache->table[0]);
+	if (cache->entry == NULL || cache->table == NULL)
+		goto done;
+	cache->table_mask = size - 1;
+
+	svgtiny_gradient_cache_merge(cache, linear, radial, context);
+
+done:
+	if (linear != NULL)
+		dom_nodelist_unref(linear);
+	if (radial != NULL)
+		dom_nodelist_unref(radial);
+}
+
+
+/**
+ * Add the gradients in two lists to the cache, in document order.
+ *
+ * Each list is in document order, so the document is walked until every
+ * element of both has been met. Gradients are usually defined near the start,
+ * so the walk stops early. If libdom fails during the walk, the rest of the
+ * gradients are added list by list.
+ */
+
+void svgtiny_gradient_cache_merge(struct svgtiny_gradient_cache *cache,
+		dom_nodelist *linear, dom_nodelist *radial,
+		const struct svgtiny_parse_context *context)
+{
+	dom_node *next_linear, *next_radial;
+	dom_element *root = NULL;
+	dom_node *node = NULL;
+	uint32_t linear_i = 0, radial_i = 0;
+
+	next_linear = svgtiny_gradient_item(linear, linear_i);
+	next_radial = svgtiny_gradient_item(radial, radial_i);
+
+	if (dom_document_get_document_element(context->document, &root) ==
+			DOM_NO_ERR && root != NULL)
+		node = dom_node_ref(root);
+	while (node != NULL && (next_linear != NULL || next_radial != NULL)) {
+		if (node == next_linear) {
+			svgtiny_gradient_cache_add(cache, next_linear, false,
+					context);
+			next_linear = svgtiny_gradient_item(linear,
+					++linear_i);
+		} else if (node == next_radial) {
+			svgtiny_gradient_cache_add(cache, next_radial, true,
+					context);
+			next_radial = svgtiny_gradient_item(radial,
+					++radial_i);
+		}
+		node = svgtiny_gradient_next_node(node, (dom_node *) root);
+	}
+	if (node != NULL)
+		dom_node_unref(node);
+	if (root != NULL)
+		dom_node_unref(root);
+
+	while (next_linear != NULL) {
+		svgtiny_gradient_cache_add(cache, next_linear, false, context);
+		next_linear = svgtiny_gradient_item(linear, ++linear_i);
+	}
+	while (next_radial != NULL) {
+		svgtiny_gradient_cache_add(cache, next_radial, true, context);
+		next_radial = svgtiny_gradient_item(radial, ++radial_i);
+	}
+}
+
+
+/**
+ * Get an item of a node list, or NULL after the end or on error.
+ */
+
+dom_node *svgtiny_gradient_item(dom_nodelist *list, uint32_t i)
+{
+	dom_node *node;
+	uint32_t count;
+
+	if (list == NULL || dom_nodelist_get_length(list, &count) !=
+			DOM_NO_ERR || count <= i)
+		return NULL;
+	if (dom_nodelist_item(list, i, &node) != DOM_NO_ERR)
+		return NULL;
+	return node;
+}
+
+
+/**
+ * Step to the next node below root in document order.
+ *
+ * The reference to node is given up, and one to the next node returned, or
+ * NULL at the end or on error.
+ */
+
+dom_node *svgtiny_gradient_next_node(dom_node *node, dom_node *root)
+{
+	dom_node *next;
+
+	if (dom_node_get_first_child(node, &next) != DOM_NO_ERR)
+		next = NULL;
+	while (next == NULL && node != root) {
+		if (dom_node_get_next_sibling(node, &next) != DOM_NO_ERR) {
+			next = NULL;
+			break;
+		}
+		if (next == NULL) {
+			dom_node *parent;
+			if (dom_node_get_parent_node(node, &parent) !=
+					DOM_NO_ERR || parent == NULL)
+				break;
+			dom_node_unref(node);
+			node = parent;
+		}
+	}
+	dom_node_unref(node);
+
+	return next;
+}
+
+
+/**
+ * Add a gradient element to the cache, which has room for it.
+ *
+ * The reference to element is given to the cache.
+ */
+
+void svgtiny_gradient_cache_add(struct svgtiny_gradient_cache *cache,
+		dom_node *element, bool radial,
+		const struct svgtiny_parse_context *context)
+{
+	struct svgtiny_gradient_entry *entry;
+	dom_string *id;
+	dom_exception exc;
+	unsigned int slot;
+
+	exc = dom_element_get_attribute(element, context->interned_id, &id);
+	if (exc != DOM_NO_ERR || id == NULL) {
+		dom_node_unref(element);
+		return;
+	}
+
+	/* as with getElementById(), the first definition wins */
+	for (slot = svgtiny_gradient_id_hash(dom_string_data(id),
+				dom_string_byte_length(id)) &
+				cache->table_mask;
+			cache->table[slot] != 0;
+			slot = (slot + 1) & cache->table_mask)
+		if (dom_string_isequal(id,
+				cache->entry[cache->table[slot] - 1].id))
+			break;
+	if (cache->table[slot] != 0) {
+		dom_string_unref(id);
+		dom_node_unref(element);
+		return;
+	}
+
+	entry = &cache->entry[cache->entry_count];
+	memset(entry, 0, sizeof *entry);
+	entry->id = id;
+	entry->element = (dom_element *) element;
+	entry->radial = radial;
+	entry->status = svgtiny_GRADIENT_UNPARSED;
+	cache->table[slot] = ++cache->entry_count;
+}
+
+
+/**
+ * Hash a gradient id (FNV-1a).
+ */
+
+unsigned int svgtiny_gradient_id_hash(const char *id, size_t len)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i != len; i++) {
+		hash ^= (unsigned char) id[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+
+/**
+ * Make a copy of a gradient.
+ */
+
+struct svgtiny_gradient *svgtiny_gradient_copy(
+		const struct svgtiny_gradient *gradient)
+{
+	struct svgtiny_gradient *copy = malloc(sizeof *copy);
+	if (!copy)
+		return NULL;
+	*copy = *gradient;
+	svgtiny_gradient_ref(copy);
+	return copy;
+}
+
+
+/**
+ * Free a gradient.
+ */
+
+void svgtiny_gradient_free(struct svgtiny_gradient *gradient)
+{
+	svgtiny_gradient_clear(gradient);
+	free(gradient);
+}
+
+
+/**
+ * Release the strings and stops of a gradient, leaving it empty.
+ */
+
+void svgtiny_gradient_clear(struct svgtiny_gradient *gradient)
+{
+	dom_string **s[] = { &gradient->x1, &gradient->y1, &gradient->x2,
+			&gradient->y2, &gradient->cx, &gradient->cy,
+			&gradient->r, &gradient->fx, &gradient->fy };
+	unsigned int i;
+
+	svgtiny_ramp_unref(gradient->ramp);
+	gradient->ramp = NULL;
+	for (i = 0; i != sizeof s / sizeof s[0]; i++) {
+		if (*s[i] != NULL)
+			dom_string_unref(*s[i]);
+		*s[i] = NULL;
+	}
+}
+
+
+/**
+ * Parse a <linearGradient> or <radialGradient> element node.
  *
  * http://www.w3.org/TR/SVG11/pservers#LinearGradients
+ * http://www.w3.org/TR/SVG11/pservers#RadialGradients
  */
 
-svgtiny_code svgtiny_parse_linear_gradient(dom_element *linear,
-		struct svgtiny_parse_state *state)
+svgtiny_code svgtiny_parse_gradient(dom_element *element,
+		bool radial, struct svgtiny_gradient *gradient,
+		const struct svgtiny_parse_context *context)
 {
 	unsigned int i = 0;
 	dom_string *attr;
 	dom_exception exc;
 	dom_nodelist *stops;
+	struct svgtiny_gradient_stop *stop = NULL;
+	struct svgtiny_parse_state state;
+
+	/* for parsing stop colours */
+	memset(&state, 0, sizeof state);
+	state.context = context;
 	
-	exc = dom_element_get_attribute(linear, state->interned_href, &attr);
+	exc = dom_element_get_attribute(element, context->interned_href,
+			&attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
 		if (dom_string_data(attr)[0] == (uint8_t) '#') {
 			char *s = strndup(dom_string_data(attr) + 1,
 					  dom_string_byte_length(attr) - 1);
-			svgtiny_find_gradient(s, state);
+			svgtiny_find_gradient(s, gradient, context);
 			free(s);
 		}
 		dom_string_unref(attr);
 	}
+	gradient->radial = radial;
 
-	exc = dom_element_get_attribute(linear, state->interned_x1, &attr);
-	if (exc == DOM_NO_ERR && attr != NULL) {
-		dom_string_unref(state->gradient_x1);
-		state->gradient_x1 = attr;
-		attr = NULL;
-	}
-
-	exc = dom_element_get_attribute(linear, state->interned_y1, &attr);
-	if (exc == DOM_NO_ERR && attr != NULL) {
-		dom_string_unref(state->gradient_y1);
-		state->gradient_y1 = attr;
-		attr = NULL;
+#define svgtiny_GRADIENT_COORDINATE(n)					\
+	exc = dom_element_get_attribute(element, context->interned_##n,	\
+			&attr);						\
+	if (exc == DOM_NO_ERR && attr != NULL) {			\
+		if (gradient->n != NULL)				\
+			dom_string_unref(gradient->n);			\
+		gradient->n = attr;					\
+		attr = NULL;						\
 	}
-
-	exc = dom_element_get_attribute(linear, state->interned_x2, &attr);
-	if (exc == DOM_NO_ERR && attr != NULL) {
-		dom_string_unref(state->gradient_x2);
-		state->gradient_x2 = attr;
-		attr = NULL;
-	}
-
-	exc = dom_element_get_attribute(linear, state->interned_y2, &attr);
-	if (exc == DOM_NO_ERR && attr != NULL) {
-		dom_string_unref(state->gradient_y2);
-		state->gradient_y2 = attr;
-		attr = NULL;
+	if (radial) {
+		svgtiny_GRADIENT_COORDINATE(cx)
+		svgtiny_GRADIENT_COORDINATE(cy)
+		svgtiny_GRADIENT_COORDINATE(r)
+		svgtiny_GRADIENT_COORDINATE(fx)
+		svgtiny_GRADIENT_COORDINATE(fy)
+	} else {
+		svgtiny_GRADIENT_COORDINATE(x1)
+		svgtiny_GRADIENT_COORDINATE(y1)
+		svgtiny_GRADIENT_COORDINATE(x2)
+		svgtiny_GRADIENT_COORDINATE(y2)
 	}
+#undef svgtiny_GRADIENT_COORDINATE
 	
-	exc = dom_element_get_attribute(linear, state->interned_gradientUnits,
-					&attr);
+	exc = dom_element_get_attribute(element,
+			context->interned_gradientUnits, &attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		state->gradient_user_space_on_use = 
+		gradient->user_space_on_use = 
 			dom_string_isequal(attr,
-					   state->interned_userSpaceOnUse);
+					   context->interned_userSpaceOnUse);
 		dom_string_unref(attr);
 	}
 	
-	exc = dom_element_get_attribute(linear,
-					state->interned_gradientTransform,
+	exc = dom_element_get_attribute(element, context->interned_spreadMethod,
 					&attr);
 	if (exc == DOM_NO_ERR && attr != NULL) {
-		float a = 1, b = 0, c = 0, d = 1, e = 0, f = 0;
 		char *s = strndup(dom_string_data(attr),
 				  dom_string_byte_length(attr));
-		if (s == NULL) {
-			dom_string_unref(attr);
-			return svgtiny_OUT_OF_MEMORY;
-		}
-		svgtiny_parse_transform(s, &a, &b, &c, &d, &e, &f);
+		if (s)
+			gradient->spread = svgtiny_parse_spread(s);
 		free(s);
+		dom_string_unref(attr);
+	}
+
+	exc = dom_element_get_attribute(element,
+					context->interned_gradientTransform,
+					&attr);
+	if (exc == DOM_NO_ERR && attr != NULL) {
+		float a = 1, b = 0, c = 0, d = 1, e = 0, f = 0;
+		const char *s = dom_string_data(attr);
+		svgtiny_parse_transform(s, s + dom_string_byte_length(attr),
+				&a, &b, &c, &d, &e, &f);
 		#ifdef GRADIENT_DEBUG
 		fprintf(stderr, "transform %g %g %g %g %g %g\n",
 			a, b, c, d, e, f);
 		#endif
-		state->gradient_transform.a = a;
-		state->gradient_transform.b = b;
-		state->gradient_transform.c = c;
-		state->gradient_transform.d = d;
-		state->gradient_transform.e = e;
-		state->gradient_transform.f = f;
+		gradient->transform.a = a;
+		gradient->transform.b = b;
+		gradient->transform.c = c;
+		gradient->transform.d = d;
+		gradient->transform.e = e;
+		gradient->transform.f = f;
 		dom_string_unref(attr);
         }
 	
-	exc = dom_element_get_elements_by_tag_name(linear,
-						   state->interned_stop,
+	exc = dom_element_get_elements_by_tag_name(element,
+						   context->interned_stop,
 						   &stops);
 	if (exc == DOM_NO_ERR && stops != NULL) {
 		uint32_t listlen, stopnr;
 		exc = dom_nodelist_get_length(stops, &listlen);
-		if (exc != DOM_NO_ERR) {
+		if (exc != DOM_NO_ERR || listlen == 0) {
+			dom_nodelist_unref(stops);
+			goto no_more_stops;
+		}
+		stop = malloc(listlen * sizeof stop[0]);
+		if (!stop) {
 			dom_nodelist_unref(stops);
 			goto no_more_stops;
 		}
 		
 		for (stopnr = 0; stopnr < listlen; ++stopnr) {
-			dom_element *stop;
+			dom_element *stop_element;
 			float offset = -1;
 			svgtiny_colour color = svgtiny_TRANSPARENT;
-			exc = dom_nodelist_item(stops, stopnr,
-						(dom_node **) (void *) &stop);
+			exc = dom_nodelist_item(stops, stopnr, (dom_node **)
+					(void *) &stop_element);
 			if (exc != DOM_NO_ERR)
 				continue;
-			exc = dom_element_get_attribute(stop,
-							state->interned_offset,
+			exc = dom_element_get_attribute(stop_element,
+							context->interned_offset,
 							&attr);
 			if (exc == DOM_NO_ERR && attr != NULL) {
-				char *s = strndup(dom_string_data(attr),
-						  dom_string_byte_length(attr));
-				offset = svgtiny_parse_gradient_offset(s);
-				free(s);
+				const char *s = dom_string_data(attr);
+				offset = svgtiny_parse_gradient_offset(s,
+						s + dom_string_byte_length(attr));
 				dom_string_unref(attr);
 			}
-			exc = dom_element_get_attribute(stop,
-							state->interned_stop_color,
+			exc = dom_element_get_attribute(stop_element,
+							context->interned_stop_color,
 							&attr);
 			if (exc == DOM_NO_ERR && attr != NULL) {
-				svgtiny_parse_color(attr, &color, state);
+				svgtiny_parse_color(attr, &color, &state);
 				dom_string_unref(attr);
 			}
-			exc = dom_element_get_attribute(stop,
-							state->interned_style,
+			exc = dom_element_get_attribute(stop_element,
+							context->interned_style,
 							&attr);
 			if (exc == DOM_NO_ERR && attr != NULL) {
 				char *content = strndup(dom_string_data(attr),
@@ -237,7 +827,7 @@ svgtiny_code svgtiny_parse_linear_gradient(dom_element *linear,
 					    value != NULL) {
 						svgtiny_parse_color(value,
 								    &color,
-								    state);
+								    &state);
 						dom_string_unref(value);
 					}
 				}
@@ -248,34 +838,65 @@ svgtiny_code svgtiny_parse_linear_gradient(dom_element *linear,
 				#ifdef GRADIENT_DEBUG
 				fprintf(stderr, "stop %g %x\n", offset, color);
 				#endif
-				state->gradient_stop[i].offset = offset;
-				state->gradient_stop[i].color = color;
+				stop[i].offset = offset;
+				stop[i].color = color;
 				i++;
 			}
-			dom_node_unref(stop);
-			if (i == svgtiny_MAX_STOPS)
-				break;
+			dom_node_unref(stop_element);
 		}
 		
 		dom_nodelist_unref(stops);
 	}
 no_more_stops:	
-	if (i > 0)
-		state->linear_gradient_stop_count = i;
+	if (i > 0) {
+		struct svgtiny_gradient_ramp *ramp;
+		ramp = svgtiny_ramp_create(stop, i);
+		if (ramp) {
+			svgtiny_ramp_unref(gradient->ramp);
+			gradient->ramp = ramp;
+		}
+	}
+	free(stop);
+
+	svgtiny_cleanup_state_local(&state);
 
 	return svgtiny_OK;
 }
 
 
-float svgtiny_parse_gradient_offset(const char *s)
+/**
+ * Parse a spreadMethod attribute.
+ *
+ * \return  svgtiny_SPREAD_REFLECT, svgtiny_SPREAD_REPEAT, or
+ *          svgtiny_SPREAD_PAD for pad or anything not understood
+ */
+
+int svgtiny_parse_spread(const char *s)
+{
+	if (strcmp(s, "reflect") == 0)
+		return svgtiny_SPREAD_REFLECT;
+	if (strcmp(s, "repeat") == 0)
+		return svgtiny_SPREAD_REPEAT;
+	return svgtiny_SPREAD_PAD;
+}
+
+
+/**
+ * Parse a gradient stop offset, a number or a percentage.
+ */
+
+float svgtiny_parse_gradient_offset(const char *s, const char *end)
 {
-	size_t num_length = strspn(s, "0123456789+-.");
-	const char *unit = s + num_length;
-	float n = atof((const char *) s);
+	float n;
+	svgtiny_unit unit;
+
+	s = svgtiny_skip_wsp(s, end);
+	if (!svgtiny_parse_dimension(&s, end, &n, &unit))
+		return -1;
 
-	if (unit[0] == 0)
+	if (unit == svgtiny_UNIT_NONE)
 		;
-	else if (unit[0] == '%')
+	else if (unit == svgtiny_UNIT_PERCENT)
 		n /= 100.0;
 	else
 		return -1;
@@ -295,59 +916,60 @@ float svgtiny_parse_gradient_offset(const char *s)
 svgtiny_code svgtiny_add_path_linear_gradient(float *p, unsigned int n,
 		struct svgtiny_parse_state *state)
 {
-	struct grad_point {
-		float x, y, r;
-	};
+	const struct svgtiny_gradient *gradient = state->gradient;
+	const struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(state->context->diagram);
 	float object_x0, object_y0, object_x1, object_y1;
 	float gradient_x0, gradient_y0, gradient_x1, gradient_y1,
 	      gradient_dx, gradient_dy;
 	float trans[6];
-	unsigned int steps = 10;
-	float x0 = 0, y0 = 0, x0_trans, y0_trans, r0; /* segment start point */
-	float x1, y1, x1_trans, y1_trans, r1; /* segment end point */
+	float vector[5];
+	unsigned int steps;
+	float x0 = 0, y0 = 0; /* segment start point */
+	float x1, y1; /* segment end point */
 	/* segment control points (beziers only) */
 	float c0x = 0, c0y = 0, c1x = 0, c1y = 0;
-	float gradient_norm_squared;
+	float point[2 * svgtiny_BEZIER_STEPS_MAX]; /* ends of the lines */
+	struct svgtiny_gradient_ramp *ramp = gradient->ramp;
+	struct svgtiny_gradient_stop *bend;
+	unsigned int bend_count;
 	struct svgtiny_list *pts;
 	float min_r = 1000;
 	unsigned int min_pt = 0;
 	unsigned int j;
-	unsigned int stop_count;
-	unsigned int current_stop;
-	float last_stop_r;
-	float current_stop_r;
-	int red0, green0, blue0, red1, green1, blue1;
+	unsigned int vertex_count;
 	unsigned int t, a, b;
 
 	/* determine object bounding box */
-	svgtiny_path_bbox(p, n, &object_x0, &object_y0, &object_x1, &object_y1);
+	svgtiny_path_extent(p, n, 0,
+			&object_x0, &object_y0, &object_x1, &object_y1);
 	#ifdef GRADIENT_DEBUG
 	fprintf(stderr, "object bbox: (%g %g) (%g %g)\n",
 			object_x0, object_y0, object_x1, object_y1);
 	#endif
 
-	if (!state->gradient_user_space_on_use) {
+	if (!gradient->user_space_on_use) {
 		gradient_x0 = object_x0 +
-				svgtiny_parse_length(state->gradient_x1,
-					object_x1 - object_x0, *state);
+				svgtiny_parse_length(gradient->x1,
+					object_x1 - object_x0);
 		gradient_y0 = object_y0 +
-				svgtiny_parse_length(state->gradient_y1,
-					object_y1 - object_y0, *state);
+				svgtiny_parse_length(gradient->y1,
+					object_y1 - object_y0);
 		gradient_x1 = object_x0 +
-				svgtiny_parse_length(state->gradient_x2,
-					object_x1 - object_x0, *state);
+				svgtiny_parse_length(gradient->x2,
+					object_x1 - object_x0);
 		gradient_y1 = object_y0 +
-				svgtiny_parse_length(state->gradient_y2,
-					object_y1 - object_y0, *state);
+				svgtiny_parse_length(gradient->y2,
+					object_y1 - object_y0);
 	} else {
-		gradient_x0 = svgtiny_parse_length(state->gradient_x1,
-				state->viewport_width, *state);
-		gradient_y0 = svgtiny_parse_length(state->gradient_y1,
-				state->viewport_height, *state);
-		gradient_x1 = svgtiny_parse_length(state->gradient_x2,
-				state->viewport_width, *state);
-		gradient_y1 = svgtiny_parse_length(state->gradient_y2,
-				state->viewport_height, *state);
+		gradient_x0 = svgtiny_parse_length(gradient->x1,
+				state->viewport_width);
+		gradient_y0 = svgtiny_parse_length(gradient->y1,
+				state->viewport_height);
+		gradient_x1 = svgtiny_parse_length(gradient->x2,
+				state->viewport_width);
+		gradient_y1 = svgtiny_parse_length(gradient->y2,
+				state->viewport_height);
 	}
 	gradient_dx = gradient_x1 - gradient_x0;
 	gradient_dy = gradient_y1 - gradient_y0;
@@ -356,6 +978,11 @@ svgtiny_code svgtiny_add_path_linear_gradient(float *p, unsigned int n,
 			gradient_x0, gradient_y0, gradient_x1, gradient_y1);
 	#endif
 
+	if (internal->options & svgtiny_NATIVE_GRADIENTS)
+		return svgtiny_add_path_native_gradient(p, n,
+				gradient_x0, gradient_y0,
+				gradient_x1, gradient_y1, state);
+
 	/* show theoretical gradient strips for debugging */
 	/*unsigned int strips = 10;
 	for (unsigned int z = 0; z != strips; z++) {
@@ -395,11 +1022,11 @@ svgtiny_code svgtiny_add_path_linear_gradient(float *p, unsigned int n,
 		shape->path_length = 13;
 		shape->fill = svgtiny_TRANSPARENT;
 		shape->stroke = svgtiny_RGB(0, 0xff, 0);
-		state->diagram->shape_count++;
+		state->context->diagram->shape_count++;
 	}*/
 
 	/* invert gradient transform for applying to vertices */
-	svgtiny_invert_matrix(&state->gradient_transform.a, trans);
+	svgtiny_invert_matrix(&gradient->transform.a, trans);
 	#ifdef GRADIENT_DEBUG
 	fprintf(stderr, "inverse transform %g %g %g %g %g %g\n",
 			trans[0], trans[1], trans[2], trans[3],
@@ -407,16 +1034,40 @@ svgtiny_code svgtiny_add_path_linear_gradient(float *p, unsigned int n,
 	#endif
 
 	/* compute points on the path for triangle vertices */
-	/* r, r0, r1 are distance along gradient vector */
-	gradient_norm_squared = gradient_dx * gradient_dx +
-	                              gradient_dy * gradient_dy;
+	/* r is distance along gradient vector */
+	vector[0] = gradient_x0;
+	vector[1] = gradient_y0;
+	vector[2] = gradient_dx;
+	vector[3] = gradient_dy;
+	vector[4] = gradient_dx * gradient_dx + gradient_dy * gradient_dy;
+
+	/* the mesh shades linearly between vertices, so vertices are needed
+	 * only where the colour bends by more than the tolerance */
+	assert(ramp && 2 <= ramp->stop_count);
+	if (svgtiny_ramp_lut(ramp, internal->options &
+			svgtiny_LINEAR_RGB_GRADIENTS) != svgtiny_OK) {
+		free(p);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+	bend = malloc((ramp->stop_count + svgtiny_RAMP_SIZE) * sizeof bend[0]);
+	if (!bend) {
+		free(p);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+	bend_count = svgtiny_gradient_bends(bend,
+			svgtiny_ramp_knots(ramp, bend),
+			internal->colour_tolerance, bend);
+
 	pts = svgtiny_list_create(
-			sizeof (struct grad_point));
-	if (!pts)
+			sizeof (struct svgtiny_gradient_point));
+	if (!pts) {
+		free(p);
+		free(bend);
 		return svgtiny_OUT_OF_MEMORY;
+	}
 	for (j = 0; j != n; ) {
 		int segment_type = (int) p[j];
-		struct grad_point *point;
+		struct svgtiny_gradient_point from, to;
 		unsigned int z;
 
 		if (segment_type == svgtiny_PATH_MOVE) {
@@ -431,23 +1082,12 @@ svgtiny_code svgtiny_add_path_linear_gradient(float *p, unsigned int n,
 				segment_type == svgtiny_PATH_BEZIER);
 
 		/* start point (x0, y0) */
-		x0_trans = trans[0]*x0 + trans[2]*y0 + trans[4];
-		y0_trans = trans[1]*x0 + trans[3]*y0 + trans[5];
-		r0 = ((x0_trans - gradient_x0) * gradient_dx +
-				(y0_trans - gradient_y0) * gradient_dy) /
-				gradient_norm_squared;
-		point = svgtiny_list_push(pts);
-		if (!point) {
-			svgtiny_list_free(pts);
-			return svgtiny_OUT_OF_MEMORY;
-		}
-		point->x = x0;
-		point->y = y0;
-		point->r = r0;
-		if (r0 < min_r) {
-			min_r = r0;
-			min_pt = svgtiny_list_size(pts) - 1;
-		}
+		from.x = x0;
+		from.y = y0;
+		from.r = svgtiny_gradient_position(trans, vector, x0, y0);
+		from.colour = svgtiny_ramp_colour(ramp, from.r);
+		if (!svgtiny_gradient_push(pts, &from))
+			goto no_memory;
 
 		/* end point (x1, y1) */
 		if (segment_type == svgtiny_PATH_LINE) {
@@ -467,203 +1107,145 @@ svgtiny_code svgtiny_add_path_linear_gradient(float *p, unsigned int n,
 			y1 = p[j + 6];
 			j += 7;
 		}
-		x1_trans = trans[0]*x1 + trans[2]*y1 + trans[4];
-		y1_trans = trans[1]*x1 + trans[3]*y1 + trans[5];
-		r1 = ((x1_trans - gradient_x0) * gradient_dx +
-				(y1_trans - gradient_y0) * gradient_dy) /
-				gradient_norm_squared;
-
-		/* determine steps from change in r */
-
-		if(isnan(r0) || isnan(r1)) {
-			steps = 1;
-		} else {
-			steps = ceilf(fabsf(r1 - r0) / 0.05);
-		}
 
-		if (steps == 0)
-			steps = 1;
+		/* a curve is divided into lines which stay within the
+		 * flatness tolerance of it on the device */
+		steps = 1;
+		point[0] = x1;
+		point[1] = y1;
+		if (segment_type == svgtiny_PATH_BEZIER)
+			steps = svgtiny_gradient_bezier(x0, y0, c0x, c0y,
+					c1x, c1y, x1, y1, point,
+					internal->flatness, state);
 		#ifdef GRADIENT_DEBUG
-		fprintf(stderr, "r0 %g, r1 %g, steps %i\n",
-				r0, r1, steps);
+		fprintf(stderr, "steps %i\n", steps);
 		#endif
 
-		/* loop through intermediate points */
-		for (z = 1; z != steps; z++) {
-			float t, x, y, x_trans, y_trans, r;
-			struct grad_point *point;
-			t = (float) z / (float) steps;
-			if (segment_type == svgtiny_PATH_BEZIER) {
-				x = (1-t) * (1-t) * (1-t) * x0 +
-					3 * t * (1-t) * (1-t) * c0x +
-					3 * t * t * (1-t) * c1x +
-					t * t * t * x1;
-				y = (1-t) * (1-t) * (1-t) * y0 +
-					3 * t * (1-t) * (1-t) * c0y +
-					3 * t * t * (1-t) * c1y +
-					t * t * t * y1;
-			} else {
-				x = (1-t) * x0 + t * x1;
-				y = (1-t) * y0 + t * y1;
-			}
-			x_trans = trans[0]*x + trans[2]*y + trans[4];
-			y_trans = trans[1]*x + trans[3]*y + trans[5];
-			r = ((x_trans - gradient_x0) * gradient_dx +
-					(y_trans - gradient_y0) * gradient_dy) /
-					gradient_norm_squared;
-			#ifdef GRADIENT_DEBUG
-			fprintf(stderr, "(%g %g [%g]) ", x, y, r);
-			#endif
-			point = svgtiny_list_push(pts);
-			if (!point) {
-				svgtiny_list_free(pts);
-				return svgtiny_OUT_OF_MEMORY;
-			}
-			point->x = x;
-			point->y = y;
-			point->r = r;
-			if (r < min_r) {
-				min_r = r;
-				min_pt = svgtiny_list_size(pts) - 1;
-			}
+		/* loop through the lines, adding a point where each crosses
+		 * a bend in the colour */
+		for (z = 1; z <= steps; z++) {
+			to.x = point[2 * z - 2];
+			to.y = point[2 * z - 1];
+			to.r = svgtiny_gradient_position(trans, vector,
+					to.x, to.y);
+			to.colour = svgtiny_ramp_colour(ramp, to.r);
+			if (!svgtiny_gradient_crossings(pts, &from, &to,
+					bend, bend_count))
+				goto no_memory;
+			if (z != steps && !svgtiny_gradient_push(pts, &to))
+				goto no_memory;
+			from = to;
 		}
-		#ifdef GRADIENT_DEBUG
-		fprintf(stderr, "\n");
-		#endif
 
 		/* next segment start point is this segment end point */
 		x0 = x1;
 		y0 = y1;
 	}
+	free(bend);
+
+	/* the zip starts from the point with least r */
+	for (j = 0; j != svgtiny_list_size(pts); j++) {
+		struct svgtiny_gradient_point *point =
+				svgtiny_list_get(pts, j);
+		if (point->r < min_r) {
+			min_r = point->r;
+			min_pt = j;
+		}
+	}
 	#ifdef GRADIENT_DEBUG
 	fprintf(stderr, "pts size %i, min_pt %i, min_r %.3f\n",
 			svgtiny_list_size(pts), min_pt, min_r);
 	#endif
 
-	/* render triangles */
-	stop_count = state->linear_gradient_stop_count;
-	assert(2 <= stop_count);
-	current_stop = 0;
-	last_stop_r = 0;
-	current_stop_r = state->gradient_stop[0].offset;
-	red0 = red1 = svgtiny_RED(state->gradient_stop[0].color);
-	green0 = green1 = svgtiny_GREEN(state->gradient_stop[0].color);
-	blue0 = blue1 = svgtiny_BLUE(state->gradient_stop[0].color);
-	t = min_pt;
-	a = (min_pt + 1) % svgtiny_list_size(pts);
-	b = min_pt == 0 ? svgtiny_list_size(pts) - 1 : min_pt - 1;
-	while (a != b) {
-		struct grad_point *point_t = svgtiny_list_get(pts, t);
-		struct grad_point *point_a = svgtiny_list_get(pts, a);
-		struct grad_point *point_b = svgtiny_list_get(pts, b);
-		float mean_r = (point_t->r + point_a->r + point_b->r) / 3;
-		float *p;
-		struct svgtiny_shape *shape;
-		/*fprintf(stderr, "triangle: t %i %.3f a %i %.3f b %i %.3f "
-				"mean_r %.3f\n",
-				t, pts[t].r, a, pts[a].r, b, pts[b].r,
-				mean_r);*/
-		while (current_stop != stop_count && current_stop_r < mean_r) {
-			current_stop++;
-			if (current_stop == stop_count)
-				break;
-			red0 = red1;
-			green0 = green1;
-			blue0 = blue1;
-			red1 = svgtiny_RED(state->
-					gradient_stop[current_stop].color);
-			green1 = svgtiny_GREEN(state->
-					gradient_stop[current_stop].color);
-			blue1 = svgtiny_BLUE(state->
-					gradient_stop[current_stop].color);
-			last_stop_r = current_stop_r;
-			current_stop_r = state->
-					gradient_stop[current_stop].offset;
-		}
-		p = malloc(10 * sizeof p[0]);
-		if (!p)
-			return svgtiny_OUT_OF_MEMORY;
-		p[0] = svgtiny_PATH_MOVE;
-		p[1] = point_t->x;
-		p[2] = point_t->y;
-		p[3] = svgtiny_PATH_LINE;
-		p[4] = point_a->x;
-		p[5] = point_a->y;
-		p[6] = svgtiny_PATH_LINE;
-		p[7] = point_b->x;
-		p[8] = point_b->y;
-		p[9] = svgtiny_PATH_CLOSE;
-		svgtiny_transform_path(p, 10, state);
-		shape = svgtiny_add_shape(state);
-		if (!shape) {
+	/* render triangles, as one mesh shaded between vertex colours */
+	vertex_count = svgtiny_list_size(pts);
+	if (3 <= vertex_count) {
+		struct svgtiny_mesh *mesh;
+		unsigned int k = 0;
+
+		mesh = svgtiny_gradient_mesh(state,
+				vertex_count, 3 * (vertex_count - 2));
+		if (!mesh) {
 			free(p);
+			svgtiny_list_free(pts);
 			return svgtiny_OUT_OF_MEMORY;
 		}
-		shape->path = p;
-		shape->path_length = 10;
-		/*shape->fill = svgtiny_TRANSPARENT;*/
-		if (current_stop == 0)
-			shape->fill = state->gradient_stop[0].color;
-		else if (current_stop == stop_count)
-			shape->fill = state->
-					gradient_stop[stop_count - 1].color;
-		else {
-			float stop_r = (mean_r - last_stop_r) /
-				(current_stop_r - last_stop_r);
-			shape->fill = svgtiny_RGB(
-				(int) ((1 - stop_r) * red0 + stop_r * red1),
-				(int) ((1 - stop_r) * green0 + stop_r * green1),
-				(int) ((1 - stop_r) * blue0 + stop_r * blue1));
+		for (j = 0; j != vertex_count; j++) {
+			struct svgtiny_gradient_point *point =
+					svgtiny_list_get(pts, j);
+			mesh->vertex[2 * j] = state->ctm.a * point->x +
+					state->ctm.c * point->y + state->ctm.e;
+			mesh->vertex[2 * j + 1] = state->ctm.b * point->x +
+					state->ctm.d * point->y + state->ctm.f;
+			mesh->colour[j] = point->colour;
 		}
-		shape->stroke = svgtiny_TRANSPARENT;
-		#ifdef GRADIENT_DEBUG
-		shape->stroke = svgtiny_RGB(0, 0, 0xff);
-		#endif
-		state->diagram->shape_count++;
-		if (point_a->r < point_b->r) {
-			t = a;
-			a = (a + 1) % svgtiny_list_size(pts);
-		} else {
-			t = b;
-			b = b == 0 ? svgtiny_list_size(pts) - 1 : b - 1;
+
+		/* zip up the two sides of the outline from the point with
+		 * least r, always advancing the side with less r */
+		t = min_pt;
+		a = (min_pt + 1) % vertex_count;
+		b = min_pt == 0 ? vertex_count - 1 : min_pt - 1;
+		while (a != b) {
+			struct svgtiny_gradient_point *point_a =
+					svgtiny_list_get(pts, a);
+			struct svgtiny_gradient_point *point_b =
+					svgtiny_list_get(pts, b);
+			mesh->index[k++] = t;
+			mesh->index[k++] = a;
+			mesh->index[k++] = b;
+			if (point_a->r < point_b->r) {
+				t = a;
+				a = (a + 1) % vertex_count;
+			} else {
+				t = b;
+				b = b == 0 ? vertex_count - 1 : b - 1;
+			}
+		}
+		mesh->index_count = k;
+
+		if (svgtiny_gradient_add_mesh(mesh, pts, state) !=
+				svgtiny_OK) {
+			free(p);
+			svgtiny_list_free(pts);
+			return svgtiny_OUT_OF_MEMORY;
 		}
 	}
 
 	/* render gradient vector for debugging */
 	#ifdef GRADIENT_DEBUG
 	{
-		float *p = malloc(7 * sizeof p[0]);
-		if (!p)
+		float *v = svgtiny_arena_alloc(state->context->diagram,
+				7 * sizeof v[0]);
+		if (!v)
 			return svgtiny_OUT_OF_MEMORY;
-		p[0] = svgtiny_PATH_MOVE;
-		p[1] = gradient_x0;
-		p[2] = gradient_y0;
-		p[3] = svgtiny_PATH_LINE;
-		p[4] = gradient_x1;
-		p[5] = gradient_y1;
-		p[6] = svgtiny_PATH_CLOSE;
-		svgtiny_transform_path(p, 7, state);
+		v[0] = svgtiny_PATH_MOVE;
+		v[1] = gradient_x0;
+		v[2] = gradient_y0;
+		v[3] = svgtiny_PATH_LINE;
+		v[4] = gradient_x1;
+		v[5] = gradient_y1;
+		v[6] = svgtiny_PATH_CLOSE;
+		svgtiny_transform_path(v, 7, state);
 		struct svgtiny_shape *shape = svgtiny_add_shape(state);
-		if (!shape) {
-			free(p);
+		if (!shape)
 			return svgtiny_OUT_OF_MEMORY;
-		}
-		shape->path = p;
+		shape->path = v;
 		shape->path_length = 7;
 		shape->fill = svgtiny_TRANSPARENT;
 		shape->stroke = svgtiny_RGB(0xff, 0, 0);
-		state->diagram->shape_count++;
+		state->context->diagram->shape_count++;
 	}
 	#endif
 
 	/* render triangle vertices with r values for debugging */
 	#ifdef GRADIENT_DEBUG
 	for (unsigned int i = 0; i != svgtiny_list_size(pts); i++) {
-		struct grad_point *point = svgtiny_list_get(pts, i);
+		struct svgtiny_gradient_point *point =
+				svgtiny_list_get(pts, i);
 		struct svgtiny_shape *shape = svgtiny_add_shape(state);
 		if (!shape)
 			return svgtiny_OUT_OF_MEMORY;
-		char *text = malloc(20);
+		char *text = svgtiny_arena_alloc(state->context->diagram, 20);
 		if (!text)
 			return svgtiny_OUT_OF_MEMORY;
 		sprintf(text, "%i=%.3f", i, point->r);
@@ -674,84 +1256,1571 @@ svgtiny_code svgtiny_add_path_linear_gradient(float *p, unsigned int n,
 				state->ctm.d * point->y + state->ctm.f;
 		shape->fill = svgtiny_RGB(0, 0, 0);
 		shape->stroke = svgtiny_TRANSPARENT;
-		state->diagram->shape_count++;
+		state->context->diagram->shape_count++;
 	}
 	#endif
 
 	/* plot actual path outline */
 	if (state->stroke != svgtiny_TRANSPARENT) {
 		struct svgtiny_shape *shape;
-		svgtiny_transform_path(p, n, state);
 
 		shape = svgtiny_add_shape(state);
-		if (!shape) {
+		if (!shape || svgtiny_shape_path(shape, p, n, state) !=
+				svgtiny_OK) {
 			free(p);
+			svgtiny_list_free(pts);
 			return svgtiny_OUT_OF_MEMORY;
 		}
-		shape->path = p;
-		shape->path_length = n;
 		shape->fill = svgtiny_TRANSPARENT;
-		state->diagram->shape_count++;
-	} else {
-		free(p);
+		state->context->diagram->shape_count++;
 	}
 
+	free(p);
 	svgtiny_list_free(pts);
 
 	return svgtiny_OK;
+
+no_memory:
+	free(p);
+	free(bend);
+	svgtiny_list_free(pts);
+	return svgtiny_OUT_OF_MEMORY;
 }
 
 
 /**
- * Get the bounding box of path.
+ * Add a path filled with a linear gradient, for the renderer to draw.
+ *
+ * The vector (x0, y0) - (x1, y1) is in user space before gradientTransform.
+ * It is replaced by a vector in pixels that gives the same colour at every
+ * point, which is not simply the transformed vector when the transformation
+ * skews or scales unevenly.
  */
 
-void svgtiny_path_bbox(float *p, unsigned int n,
-		float *x0, float *y0, float *x1, float *y1)
+svgtiny_code svgtiny_add_path_native_gradient(float *p, unsigned int n,
+		float x0, float y0, float x1, float y1,
+		struct svgtiny_parse_state *state)
 {
-	unsigned int j;
+	const struct svgtiny_gradient *gradient = state->gradient;
+	const struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(state->context->diagram);
+	const float *t = &gradient->transform.a;
+	struct svgtiny_gradient_ramp *ramp = gradient->ramp;
+	const struct svgtiny_gradient_stop *stop = ramp->stop;
+	unsigned int stop_count = ramp->stop_count;
+	struct svgtiny_gradient_stop *knot = NULL;
+	struct svgtiny_linear_gradient *fill;
+	struct svgtiny_shape *shape;
+	svgtiny_code code;
+	float dx = x1 - x0, dy = y1 - y0;
+	float norm = dx * dx + dy * dy;
+	float m[6], inv[6];
+	float wx, wy, w;
+
+	/* renderers interpolate sRGB values, so a gradient in linear light
+	 * is given as the stops of one in sRGB within tolerance of it */
+	if (internal->options & svgtiny_LINEAR_RGB_GRADIENTS) {
+		struct svgtiny_gradient_stop first, last;
+		unsigned int count, bend_count, i;
+
+		if (svgtiny_ramp_lut(ramp, true) != svgtiny_OK) {
+			free(p);
+			return svgtiny_OUT_OF_MEMORY;
+		}
+		knot = malloc((stop_count + svgtiny_RAMP_SIZE + 2) *
+				sizeof knot[0]);
+		if (!knot) {
+			free(p);
+			return svgtiny_OUT_OF_MEMORY;
+		}
+		count = svgtiny_ramp_knots(ramp, knot);
+		first = knot[0];
+		last = knot[count - 1];
+		bend_count = svgtiny_gradient_bends(knot, count,
+				internal->colour_tolerance, knot);
+
+		/* the first and last stops are kept for padding */
+		memmove(knot + 1, knot, bend_count * sizeof knot[0]);
+		knot[0] = first;
+		stop_count = 1;
+		for (i = 1; i <= bend_count; i++)
+			if (first.offset < knot[i].offset &&
+					knot[i].offset < last.offset)
+				knot[stop_count++] = knot[i];
+		knot[stop_count++] = last;
+		stop = knot;
+	}
+
+	/* m maps gradient space to pixels: the ctm after gradientTransform */
+	m[0] = state->ctm.a * t[0] + state->ctm.c * t[1];
+	m[1] = state->ctm.b * t[0] + state->ctm.d * t[1];
+	m[2] = state->ctm.a * t[2] + state->ctm.c * t[3];
+	m[3] = state->ctm.b * t[2] + state->ctm.d * t[3];
+	m[4] = state->ctm.a * t[4] + state->ctm.c * t[5] + state->ctm.e;
+	m[5] = state->ctm.b * t[4] + state->ctm.d * t[5] + state->ctm.f;
+	svgtiny_invert_matrix(m, inv);
 
-	*x0 = *x1 = p[1];
-	*y0 = *y1 = p[2];
+	/* the position along the gradient of pixel (x, y) is
+	 * ((inv (x, y) - (x0, y0)) . (dx, dy)) / norm, which increases
+	 * fastest in direction w */
+	wx = (inv[0] * dx + inv[1] * dy) / norm;
+	wy = (inv[2] * dx + inv[3] * dy) / norm;
+	w = wx * wx + wy * wy;
 
+	shape = svgtiny_add_shape(state);
+	if (!shape) {
+		free(p);
+		free(knot);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+	code = svgtiny_shape_path(shape, p, n, state);
+	free(p);
+	fill = svgtiny_arena_linear_gradient(state->context->diagram,
+			stop_count);
+	if (code != svgtiny_OK || !fill) {
+		free(knot);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+
+	fill->x1 = m[0] * x0 + m[2] * y0 + m[4];
+	fill->y1 = m[1] * x0 + m[3] * y0 + m[5];
+	if (0 < w && isfinite(w)) {
+		fill->x2 = fill->x1 + wx / w;
+		fill->y2 = fill->y1 + wy / w;
+	} else {
+		/* no vector: the last stop colour fills the path */
+		fill->x2 = fill->x1;
+		fill->y2 = fill->y1;
+	}
+	memcpy(fill->stop, stop, stop_count * sizeof fill->stop[0]);
+	fill->spread = gradient->spread;
+	free(knot);
+
+	shape->fill = svgtiny_TRANSPARENT;
+	shape->fill_gradient = fill;
+	state->context->diagram->shape_count++;
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Add a path with a radial gradient fill to the svgtiny_diagram.
+ *
+ * The gradient is seen from its focal point, where it is simple: along each
+ * ray from there the position along the gradient grows linearly, and so the
+ * colour changes only at the rings through the bends in the colour. The path
+ * is cut into wedges around the focal point between the angles of its
+ * vertices, within which each interval inside the path along a ray is bounded
+ * by the same two edges. Each such cell is filled with a strip of triangles
+ * between rays, with vertices where the rays cross the rings, and with rays
+ * added until the chords between them are within tolerance of the rings. So
+ * the number of triangles grows with the size of the gradient on the device
+ * and with tighter tolerances.
+ *
+ * http://www.w3.org/TR/SVG11/pservers#RadialGradients
+ */
+
+svgtiny_code svgtiny_add_path_radial_gradient(float *p, unsigned int n,
+		struct svgtiny_parse_state *state)
+{
+	const struct svgtiny_gradient *gradient = state->gradient;
+	const struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(state->context->diagram);
+	struct svgtiny_gradient_ramp *ramp = gradient->ramp;
+	const float *t = &gradient->transform.a;
+	float object_x0, object_y0, object_x1, object_y1;
+	float cx, cy, r, fx, fy, e;
+	float u[6], inv[6];	/* gradient space to user space, and back */
+	float start_x = 0, start_y = 0; /* subpath start point */
+	float x0 = 0, y0 = 0; /* segment start point */
+	float x1, y1; /* segment end point */
+	struct svgtiny_radial radial;
+	struct svgtiny_list *edges = NULL;
+	struct svgtiny_radial_edge *edge;
+	struct svgtiny_gradient_stop *bend = NULL;
+	float *slope = NULL, *angle = NULL;
+	struct svgtiny_radial_edge **active = NULL;
+	struct svgtiny_radial_vertex *vertices = NULL;
+	unsigned int edge_count, angle_count, active_count, next;
+	unsigned int bend_count, i, j;
+	svgtiny_code code = svgtiny_OUT_OF_MEMORY;
+
+	assert(ramp && 2 <= ramp->stop_count);
+
+	/* find the transformation from gradient space to user space, and
+	 * the end circle and focal point in gradient space */
+	svgtiny_path_extent(p, n, 0,
+			&object_x0, &object_y0, &object_x1, &object_y1);
+	if (!gradient->user_space_on_use) {
+		float w = object_x1 - object_x0, h = object_y1 - object_y0;
+		/* gradientTransform applies within the bounding box, which
+		 * maps the unit square to the object */
+		u[0] = w * t[0];
+		u[1] = h * t[1];
+		u[2] = w * t[2];
+		u[3] = h * t[3];
+		u[4] = w * t[4] + object_x0;
+		u[5] = h * t[5] + object_y0;
+		cx = svgtiny_parse_length(gradient->cx, 1);
+		cy = svgtiny_parse_length(gradient->cy, 1);
+		r = svgtiny_parse_length(gradient->r, 1);
+		fx = gradient->fx ? svgtiny_parse_length(gradient->fx, 1) : cx;
+		fy = gradient->fy ? svgtiny_parse_length(gradient->fy, 1) : cy;
+	} else {
+		float diagonal = sqrtf((state->viewport_width *
+				state->viewport_width +
+				state->viewport_height *
+				state->viewport_height) / 2);
+		memcpy(u, t, sizeof u);
+		cx = svgtiny_parse_length(gradient->cx, state->viewport_width);
+		cy = svgtiny_parse_length(gradient->cy,
+				state->viewport_height);
+		r = svgtiny_parse_length(gradient->r, diagonal);
+		fx = gradient->fx ? svgtiny_parse_length(gradient->fx,
+				state->viewport_width) : cx;
+		fy = gradient->fy ? svgtiny_parse_length(gradient->fy,
+				state->viewport_height) : cy;
+	}
+	svgtiny_invert_matrix(u, inv);
+
+	if (!(0 < r) || !isfinite(inv[0] + inv[1] + inv[2] + inv[3] +
+			inv[4] + inv[5])) {
+		/* no circle: the last stop colour fills the path */
+		svgtiny_colour fill = state->fill;
+		state->fill = ramp->stop[ramp->stop_count - 1].color;
+		code = svgtiny_add_path(p, n, state);
+		state->fill = fill;
+		return code;
+	}
+
+	/* a focal point outside the end circle is moved inside it */
+	radial.ex = cx - fx;
+	radial.ey = cy - fy;
+	e = sqrtf(radial.ex * radial.ex + radial.ey * radial.ey);
+	if (svgtiny_RADIAL_FOCAL_MAX * r < e) {
+		radial.ex *= svgtiny_RADIAL_FOCAL_MAX * r / e;
+		radial.ey *= svgtiny_RADIAL_FOCAL_MAX * r / e;
+		fx = cx - radial.ex;
+		fy = cy - radial.ey;
+	}
+	radial.r2 = r * r;
+	radial.a = radial.ex * radial.ex + radial.ey * radial.ey - radial.r2;
+
+	/* m maps gradient space relative to the focal point to pixels */
+	radial.m[0] = state->ctm.a * u[0] + state->ctm.c * u[1];
+	radial.m[1] = state->ctm.b * u[0] + state->ctm.d * u[1];
+	radial.m[2] = state->ctm.a * u[2] + state->ctm.c * u[3];
+	radial.m[3] = state->ctm.b * u[2] + state->ctm.d * u[3];
+	radial.m[4] = state->ctm.a * u[4] + state->ctm.c * u[5] +
+			state->ctm.e + radial.m[0] * fx + radial.m[2] * fy;
+	radial.m[5] = state->ctm.b * u[4] + state->ctm.d * u[5] +
+			state->ctm.f + radial.m[1] * fx + radial.m[3] * fy;
+
+	/* the mesh shades linearly between vertices, so rings are needed
+	 * only where the colour bends by more than the tolerance */
+	if (svgtiny_ramp_lut(ramp, internal->options &
+			svgtiny_LINEAR_RGB_GRADIENTS) != svgtiny_OK) {
+		free(p);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+	bend = malloc((ramp->stop_count + svgtiny_RAMP_SIZE) * sizeof bend[0]);
+	if (!bend) {
+		free(p);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+	bend_count = svgtiny_gradient_bends(bend,
+			svgtiny_ramp_knots(ramp, bend),
+			internal->colour_tolerance, bend);
+
+	/* the rate of change of colour between bends, for estimating the
+	 * error of chords */
+	radial.pts = radial.tris = NULL;
+	radial.crossing = NULL;
+	radial.order = NULL;
+	slope = malloc((bend_count + 1) * sizeof slope[0]);
+	if (!slope)
+		goto done;
+	slope[0] = 0;
+	for (i = 1; i < bend_count; i++) {
+		float dt = bend[i].offset - bend[i - 1].offset;
+		svgtiny_colour c0 = bend[i - 1].color, c1 = bend[i].color;
+		float dc = abs(svgtiny_RED(c1) - svgtiny_RED(c0));
+		if (dc < abs(svgtiny_GREEN(c1) - svgtiny_GREEN(c0)))
+			dc = abs(svgtiny_GREEN(c1) - svgtiny_GREEN(c0));
+		if (dc < abs(svgtiny_BLUE(c1) - svgtiny_BLUE(c0)))
+			dc = abs(svgtiny_BLUE(c1) - svgtiny_BLUE(c0));
+		slope[i] = 0 < dt ? dc / dt : 0;
+	}
+
+	radial.ramp = ramp;
+	radial.bend = bend;
+	radial.bend_count = bend_count;
+	radial.slope = slope;
+	radial.colour_tolerance = internal->colour_tolerance;
+	radial.flatness = internal->flatness;
+	radial.focal = -1;
+	radial.last_count = 0;
+	radial.pts = svgtiny_list_create(
+			sizeof (struct svgtiny_gradient_point));
+	radial.tris = svgtiny_list_create(3 * sizeof (unsigned int));
+	vertices = malloc(2 * (bend_count + 2) * sizeof vertices[0]);
+	radial.crossing = malloc((4 * bend_count + 1) *
+			sizeof radial.crossing[0]);
+	edges = svgtiny_list_create(sizeof (struct svgtiny_radial_edge));
+	if (!radial.pts || !radial.tris || !vertices || !radial.crossing ||
+			!edges)
+		goto done;
+	radial.last = vertices;
+	radial.next = vertices + bend_count + 2;
+
+	/* find the edges of the outline, relative to the focal point */
 	for (j = 0; j != n; ) {
-		unsigned int points = 0;
-		unsigned int k;
-		switch ((int) p[j]) {
-		case svgtiny_PATH_MOVE:
-		case svgtiny_PATH_LINE:
-			points = 1;
-			break;
-		case svgtiny_PATH_CLOSE:
-			points = 0;
-			break;
-		case svgtiny_PATH_BEZIER:
-			points = 3;
+		int segment_type = (int) p[j];
+		unsigned int steps = 1, z;
+		float c0x = 0, c0y = 0, c1x = 0, c1y = 0;
+		float px, py;	/* start point of each line */
+		float point[2 * svgtiny_BEZIER_STEPS_MAX];
+
+		if (segment_type == svgtiny_PATH_MOVE) {
+			/* a fill closes the previous subpath */
+			if (j != 0 && !svgtiny_radial_edge(edges, inv, fx, fy,
+					x0, y0, start_x, start_y))
+				goto done;
+			x0 = start_x = p[j + 1];
+			y0 = start_y = p[j + 2];
+			j += 3;
+			continue;
+		}
+
+		assert(segment_type == svgtiny_PATH_CLOSE ||
+				segment_type == svgtiny_PATH_LINE ||
+				segment_type == svgtiny_PATH_BEZIER);
+
+		if (segment_type == svgtiny_PATH_LINE) {
+			x1 = p[j + 1];
+			y1 = p[j + 2];
+			j += 3;
+		} else if (segment_type == svgtiny_PATH_CLOSE) {
+			x1 = start_x;
+			y1 = start_y;
+			j++;
+		} else /* svgtiny_PATH_BEZIER */ {
+			c0x = p[j + 1];
+			c0y = p[j + 2];
+			c1x = p[j + 3];
+			c1y = p[j + 4];
+			x1 = p[j + 5];
+			y1 = p[j + 6];
+			j += 7;
+		}
+		point[0] = x1;
+		point[1] = y1;
+		if (segment_type == svgtiny_PATH_BEZIER)
+			steps = svgtiny_gradient_bezier(x0, y0, c0x, c0y,
+					c1x, c1y, x1, y1, point,
+					internal->flatness, state);
+
+		for (z = 1, px = x0, py = y0; z <= steps; z++) {
+			float x = point[2 * z - 2], y = point[2 * z - 1];
+			if (!svgtiny_radial_edge(edges, inv, fx, fy,
+					px, py, x, y))
+				goto done;
+			px = x;
+			py = y;
+		}
+
+		/* next segment start point is this segment end point */
+		x0 = x1;
+		y0 = y1;
+	}
+	if (n != 0 && !svgtiny_radial_edge(edges, inv, fx, fy,
+			x0, y0, start_x, start_y))
+		goto done;
+
+	/* the angles at which the edges start and end bound the wedges */
+	edge_count = svgtiny_list_size(edges);
+	angle = malloc((2 * edge_count + 2) * sizeof angle[0]);
+	active = malloc((edge_count + 1) * sizeof active[0]);
+	radial.order = malloc((edge_count + 1) * sizeof radial.order[0]);
+	if (!angle || !active || !radial.order)
+		goto done;
+	angle[0] = -M_PI;
+	angle[1] = M_PI;
+	angle_count = 2;
+	edge = NULL;
+	if (edge_count) {
+		edge = svgtiny_list_get(edges, 0);
+		qsort(edge, edge_count, sizeof edge[0],
+				svgtiny_radial_compare_edges);
+	}
+	for (i = 0; i != edge_count; i++) {
+		angle[angle_count++] = edge[i].angle0;
+		angle[angle_count++] = edge[i].angle1;
+	}
+	qsort(angle, angle_count, sizeof angle[0],
+			svgtiny_radial_compare_angles);
+
+	/* sweep around the focal point, keeping the edges seen in each
+	 * wedge in active */
+	active_count = 0;
+	next = 0;
+	for (i = 0; i + 1 < angle_count; i++) {
+		float middle = (angle[i] + angle[i + 1]) / 2;
+		unsigned int k, kept = 0;
+
+		if (angle[i + 1] - angle[i] < svgtiny_RADIAL_ANGLE_MIN)
+			continue;
+		while (next != edge_count && edge[next].angle0 < middle)
+			active[active_count++] = &edge[next++];
+		for (k = 0; k != active_count; k++)
+			if (middle < active[k]->angle1)
+				active[kept++] = active[k];
+		active_count = kept;
+
+		if (active_count && !svgtiny_radial_wedge(&radial,
+				active, active_count,
+				angle[i], angle[i + 1], 0))
+			goto done;
+	}
+
+	/* render triangles, as one mesh shaded between vertex colours */
+	if (svgtiny_list_size(radial.tris)) {
+		struct svgtiny_mesh *mesh;
+		unsigned int vertex_count = svgtiny_list_size(radial.pts);
+		unsigned int index_count = 3 * svgtiny_list_size(radial.tris);
+
+		mesh = svgtiny_gradient_mesh(state, vertex_count, index_count);
+		if (!mesh)
+			goto done;
+		for (j = 0; j != vertex_count; j++) {
+			struct svgtiny_gradient_point *point =
+					svgtiny_list_get(radial.pts, j);
+			mesh->vertex[2 * j] = point->x;
+			mesh->vertex[2 * j + 1] = point->y;
+			mesh->colour[j] = point->colour;
+		}
+		memcpy(mesh->index, svgtiny_list_get(radial.tris, 0),
+				index_count * sizeof mesh->index[0]);
+
+		if (svgtiny_gradient_add_mesh(mesh, radial.pts, state) !=
+				svgtiny_OK)
+			goto done;
+	}
+
+	/* plot actual path outline */
+	if (state->stroke != svgtiny_TRANSPARENT) {
+		struct svgtiny_shape *shape;
+
+		shape = svgtiny_add_shape(state);
+		if (!shape || svgtiny_shape_path(shape, p, n, state) !=
+				svgtiny_OK)
+			goto done;
+		shape->fill = svgtiny_TRANSPARENT;
+		state->context->diagram->shape_count++;
+	}
+
+	code = svgtiny_OK;
+
+done:
+	free(p);
+	free(bend);
+	free(slope);
+	free(angle);
+	free(active);
+	free(radial.order);
+	free(vertices);
+	free(radial.crossing);
+	if (radial.pts)
+		svgtiny_list_free(radial.pts);
+	if (radial.tris)
+		svgtiny_list_free(radial.tris);
+	if (edges)
+		svgtiny_list_free(edges);
+	return code;
+}
+
+
+/**
+ * Add an edge of the outline of a path to a radial gradient.
+ *
+ * The ends are in user space, and the edge is stored in gradient space
+ * relative to the focal point (fx, fy). Edges which pass through the focal
+ * point are left out, as they cover no angle. An edge which crosses the
+ * negative x axis is split there, so that its angles are increasing.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_radial_edge(struct svgtiny_list *edges, const float *inv,
+		float fx, float fy, float x0, float y0, float x1, float y1)
+{
+	struct svgtiny_radial_edge edge, *item;
+	float cross, a0, a1;
+
+	edge.x0 = inv[0] * x0 + inv[2] * y0 + inv[4] - fx;
+	edge.y0 = inv[1] * x0 + inv[3] * y0 + inv[5] - fy;
+	edge.x1 = inv[0] * x1 + inv[2] * y1 + inv[4] - fx;
+	edge.y1 = inv[1] * x1 + inv[3] * y1 + inv[5] - fy;
+	cross = edge.x0 * edge.y1 - edge.y0 * edge.x1;
+	if (cross == 0 || !isfinite(cross))
+		return true;
+
+	a0 = atan2f(edge.y0, edge.x0);
+	a1 = atan2f(edge.y1, edge.x1);
+	edge.winding = 1;
+	if (cross < 0) {
+		float swap = a0;
+		a0 = a1;
+		a1 = swap;
+		edge.winding = -1;
+	}
+
+	edge.angle0 = a0;
+	edge.angle1 = a1;
+	if (a1 < a0) {
+		edge.angle1 = M_PI;
+		item = svgtiny_list_push(edges);
+		if (!item)
+			return false;
+		*item = edge;
+		edge.angle0 = -M_PI;
+		edge.angle1 = a1;
+	}
+	item = svgtiny_list_push(edges);
+	if (!item)
+		return false;
+	*item = edge;
+	return true;
+}
+
+
+/**
+ * Fill the cells of a wedge around the focal point of a radial gradient.
+ *
+ * The edges seen in the wedge are sorted by distance from the focal point
+ * along its middle, and the nonzero rule gives the intervals inside the path.
+ * Where two edges cross within the wedge it is split at the crossing, so that
+ * the order of the edges is the same across each part.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_radial_wedge(struct svgtiny_radial *radial,
+		struct svgtiny_radial_edge **active, unsigned int count,
+		float angle0, float angle1, unsigned int depth)
+{
+	struct svgtiny_radial_hit *order = radial->order;
+	float middle = (angle0 + angle1) / 2;
+	const struct svgtiny_radial_edge *near = NULL;
+	int winding = 0;
+	unsigned int i, k;
+
+	/* sort the edges by distance along the middle of the wedge */
+	for (i = 0; i != count; i++) {
+		struct svgtiny_radial_hit hit;
+		hit.edge = active[i];
+		hit.distance = svgtiny_radial_distance(active[i], middle);
+		for (k = i; k != 0 && hit.distance < order[k - 1].distance;
+				k--)
+			order[k] = order[k - 1];
+		order[k] = hit;
+		winding += active[i]->winding;
+	}
+
+	/* split the wedge where neighbouring edges cross */
+	for (i = 0; i + 1 < count && depth != svgtiny_RADIAL_DEPTH_MAX; i++) {
+		const struct svgtiny_radial_edge *a = order[i].edge;
+		const struct svgtiny_radial_edge *b = order[i + 1].edge;
+		float crossing;
+		if (svgtiny_radial_distance(a, angle0) <=
+				svgtiny_radial_distance(b, angle0) &&
+				svgtiny_radial_distance(a, angle1) <=
+				svgtiny_radial_distance(b, angle1))
+			continue;
+		crossing = svgtiny_radial_crossing(a, b);
+		if (angle0 + svgtiny_RADIAL_ANGLE_MIN < crossing &&
+				crossing + svgtiny_RADIAL_ANGLE_MIN < angle1)
+			return svgtiny_radial_wedge(radial, active, count,
+					angle0, crossing, depth + 1) &&
+					svgtiny_radial_wedge(radial,
+					active, count, crossing, angle1,
+					depth + 1);
+	}
+
+	/* the winding number is the sum of the windings of the edges
+	 * further out, so starts at the total at the focal point */
+	for (i = 0; i != count; i++) {
+		const struct svgtiny_radial_edge *edge = order[i].edge;
+		bool inside = winding != 0;
+		winding -= edge->winding;
+		if (inside && winding == 0) {
+			if (!svgtiny_radial_cell(radial, near, edge,
+					angle0, angle1))
+				return false;
+		} else if (!inside && winding != 0) {
+			near = edge;
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ * Find the distance from the focal point to an edge at an angle.
+ */
+
+float svgtiny_radial_distance(const struct svgtiny_radial_edge *edge,
+		float angle)
+{
+	float dx = cosf(angle), dy = sinf(angle);
+	float wx = edge->x1 - edge->x0, wy = edge->y1 - edge->y0;
+	return (edge->x0 * wy - edge->y0 * wx) / (dx * wy - dy * wx);
+}
+
+
+/**
+ * Find the angle from the focal point of the crossing of two edges.
+ */
+
+float svgtiny_radial_crossing(const struct svgtiny_radial_edge *a,
+		const struct svgtiny_radial_edge *b)
+{
+	float awx = a->x1 - a->x0, awy = a->y1 - a->y0;
+	float bwx = b->x1 - b->x0, bwy = b->y1 - b->y0;
+	float s = ((b->x0 - a->x0) * bwy - (b->y0 - a->y0) * bwx) /
+			(awx * bwy - awy * bwx);
+	return atan2f(a->y0 + s * awy, a->x0 + s * awx);
+}
+
+
+/**
+ * Fill the part of a wedge between two edges, or between the focal point and
+ * an edge if near is NULL.
+ *
+ * Rays are added where the edges cross rings, so that the colour along the
+ * edges is linear between rays, and then between those rays as needed to
+ * keep within tolerance.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_radial_cell(struct svgtiny_radial *radial,
+		const struct svgtiny_radial_edge *near,
+		const struct svgtiny_radial_edge *far,
+		float angle0, float angle1)
+{
+	struct svgtiny_radial_ray a, b;
+	float angle_a = angle0;
+	float *crossing = radial->crossing;
+	unsigned int crossing_count = 0;
+	unsigned int i, k;
+
+	svgtiny_radial_ray(radial, near, far, angle0, &a);
+	svgtiny_radial_ray(radial, near, far, angle1, &b);
+
+	for (k = 0; k != radial->bend_count; k++) {
+		float ring = radial->bend[k].offset;
+		if (ring <= 0 || (k != 0 && radial->bend[k - 1].offset == ring))
+			continue;
+		crossing_count += svgtiny_radial_rings(radial,
+				a.fx, a.fy, b.fx, b.fy, ring,
+				crossing + crossing_count);
+		if (near)
+			crossing_count += svgtiny_radial_rings(radial,
+					a.nx, a.ny, b.nx, b.ny, ring,
+					crossing + crossing_count);
+	}
+	qsort(crossing, crossing_count, sizeof crossing[0],
+			svgtiny_radial_compare_angles);
+
+	radial->last_count = 0;
+	if (!svgtiny_radial_emit(radial, &a))
+		return false;
+	for (i = 0; i != crossing_count; i++) {
+		struct svgtiny_radial_ray c;
+		if (!(angle_a + svgtiny_RADIAL_ANGLE_MIN < crossing[i] &&
+				crossing[i] + svgtiny_RADIAL_ANGLE_MIN <
+				angle1))
+			continue;
+		svgtiny_radial_ray(radial, near, far, crossing[i], &c);
+		if (!svgtiny_radial_span(radial, near, far,
+				angle_a, &a, crossing[i], &c, 0))
+			return false;
+		angle_a = crossing[i];
+		a = c;
+	}
+	return svgtiny_radial_span(radial, near, far, angle_a, &a,
+			angle1, &b, 0);
+}
+
+
+/**
+ * Find the angles at which a line crosses a ring of a radial gradient.
+ *
+ * \param  x0, y0, x1, y1  line, relative to the focal point
+ * \param  ring            position along the gradient of the ring
+ * \param  angle           array of 2 updated with the angles
+ * \return  number of crossings strictly within the line
+ */
+
+unsigned int svgtiny_radial_rings(const struct svgtiny_radial *radial,
+		float x0, float y0, float x1, float y1, float ring,
+		float *angle)
+{
+	/* the ring is the circle of radius ring * r about ring * (ex, ey) */
+	float gx = x0 - ring * radial->ex, gy = y0 - ring * radial->ey;
+	float wx = x1 - x0, wy = y1 - y0;
+	float a = wx * wx + wy * wy;
+	float b = gx * wx + gy * wy;
+	float c = gx * gx + gy * gy - ring * ring * radial->r2;
+	float d = b * b - a * c;
+	unsigned int count = 0;
+	int sign;
+
+	if (!(0 < a && 0 < d))
+		return 0;
+	for (sign = -1; sign <= 1; sign += 2) {
+		float s = (-b + sign * sqrtf(d)) / a;
+		if (0 < s && s < 1)
+			angle[count++] = atan2f(y0 + s * wy, x0 + s * wx);
+	}
+	return count;
+}
+
+
+/**
+ * Find the ends of a ray from the focal point across a cell.
+ */
+
+void svgtiny_radial_ray(const struct svgtiny_radial *radial,
+		const struct svgtiny_radial_edge *near,
+		const struct svgtiny_radial_edge *far,
+		float angle, struct svgtiny_radial_ray *ray)
+{
+	float dx = cosf(angle), dy = sinf(angle);
+	float s = svgtiny_radial_distance(far, angle);
+
+	ray->fx = s * dx;
+	ray->fy = s * dy;
+	ray->ft = svgtiny_radial_position(radial, ray->fx, ray->fy);
+	ray->focal = near == NULL;
+	ray->nx = ray->ny = ray->nt = 0;
+	if (near) {
+		s = svgtiny_radial_distance(near, angle);
+		ray->nx = s * dx;
+		ray->ny = s * dy;
+		ray->nt = svgtiny_radial_position(radial, ray->nx, ray->ny);
+	}
+}
+
+
+/**
+ * Fill between two rays of a cell, adding rays between them while the mesh
+ * would be out of tolerance.
+ *
+ * The ray a has been emitted already.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_radial_span(struct svgtiny_radial *radial,
+		const struct svgtiny_radial_edge *near,
+		const struct svgtiny_radial_edge *far,
+		float angle_a, const struct svgtiny_radial_ray *a,
+		float angle_b, const struct svgtiny_radial_ray *b,
+		unsigned int depth)
+{
+	float angle_m = (angle_a + angle_b) / 2;
+	struct svgtiny_radial_ray m;
+
+	if (depth != svgtiny_RADIAL_DEPTH_MAX) {
+		svgtiny_radial_ray(radial, near, far, angle_m, &m);
+		if (svgtiny_radial_split(radial, a, &m, b))
+			return svgtiny_radial_span(radial, near, far,
+					angle_a, a, angle_m, &m, depth + 1) &&
+					svgtiny_radial_span(radial, near, far,
+					angle_m, &m, angle_b, b, depth + 1);
+	}
+
+	return svgtiny_radial_emit(radial, b);
+}
+
+
+/**
+ * Test if a ray is needed between two others.
+ *
+ * \param  a  ray on one side
+ * \param  m  ray half way between a and b
+ * \param  b  ray on the other side
+ * \return  true if the mesh without m would be out of tolerance
+ */
+
+bool svgtiny_radial_split(const struct svgtiny_radial *radial,
+		const struct svgtiny_radial_ray *a,
+		const struct svgtiny_radial_ray *m,
+		const struct svgtiny_radial_ray *b)
+{
+	float outer = a->ft < b->ft ? a->ft : b->ft;
+	float inner = a->nt < b->nt ? b->nt : a->nt;
+	float qx, qy, miss;
+	unsigned int k;
+
+	if (svgtiny_radial_length(radial, b->fx - a->fx, b->fy - a->fy) <
+			radial->flatness)
+		return false;
+
+	/* the edges are straight, but the colour along them is not linear */
+	if (radial->colour_tolerance < svgtiny_radial_edge_error(radial,
+			a->fx, a->fy, a->ft, m->fx, m->fy, m->ft,
+			b->fx, b->fy, b->ft))
+		return true;
+	if (!a->focal && radial->colour_tolerance <
+			svgtiny_radial_edge_error(radial,
+			a->nx, a->ny, a->nt, m->nx, m->ny, m->nt,
+			b->nx, b->ny, b->nt))
+		return true;
+
+	if (!(inner < outer && 0 < a->ft && 0 < b->ft))
+		return false;
+
+	/* the rings are copies of the unit ring scaled about the focal point,
+	 * and so are their chords across the cell, which fall short of each
+	 * ring by the same fraction of its position */
+	qx = (a->fx / a->ft + b->fx / b->ft) / 2;
+	qy = (a->fy / a->ft + b->fy / b->ft) / 2;
+	miss = 1 - svgtiny_radial_position(radial, qx, qy);
+	for (k = 1; k < radial->bend_count; k++) {
+		float lo = radial->bend[k - 1].offset;
+		float hi = radial->bend[k].offset;
+		if (hi <= inner || outer <= lo)
+			continue;
+		if (radial->colour_tolerance < miss * radial->slope[k] *
+				(hi < outer ? hi : outer))
+			return true;
+	}
+
+	/* and the outermost ring in the cell is furthest from its chord */
+	for (k = radial->bend_count; k-- != 0; ) {
+		float ring = radial->bend[k].offset;
+		if (outer < ring)
+			continue;
+		if (ring <= inner)
 			break;
-		default:
-			assert(0);
+		return radial->flatness < svgtiny_radial_length(radial,
+				(m->fx / m->ft - qx) * ring,
+				(m->fy / m->ft - qy) * ring);
+	}
+
+	return false;
+}
+
+
+/**
+ * Estimate the colour error at the middle of an edge between two rays.
+ *
+ * \return  largest channel error if the colour is linear between a and b
+ */
+
+float svgtiny_radial_edge_error(const struct svgtiny_radial *radial,
+		float ax, float ay, float at, float mx, float my, float mt,
+		float bx, float by, float bt)
+{
+	float dx = bx - ax, dy = by - ay;
+	float d = dx * dx + dy * dy;
+	float s, t;
+
+	if (!(0 < d))
+		return 0;
+	s = ((mx - ax) * dx + (my - ay) * dy) / d;
+	t = at + s * (bt - at);
+	return fabsf(mt - t) * svgtiny_radial_slope(radial, mt, t);
+}
+
+
+/**
+ * Find the largest rate of change of colour with position along a radial
+ * gradient at either of two positions.
+ */
+
+float svgtiny_radial_slope(const struct svgtiny_radial *radial,
+		float t0, float t1)
+{
+	float slope = 0;
+	unsigned int k;
+
+	for (k = 1; k < radial->bend_count; k++) {
+		float lo = radial->bend[k - 1].offset;
+		float hi = radial->bend[k].offset;
+		if (((lo <= t0 && t0 <= hi) || (lo <= t1 && t1 <= hi)) &&
+				slope < radial->slope[k])
+			slope = radial->slope[k];
+	}
+	return slope;
+}
+
+
+/**
+ * Find the position along a radial gradient of a point relative to its focal
+ * point.
+ *
+ * The point lies on the circle of radius t r about t (ex, ey), which gives a
+ * quadratic in t with one positive root, as the focal point is inside the end
+ * circle.
+ */
+
+float svgtiny_radial_position(const struct svgtiny_radial *radial,
+		float x, float y)
+{
+	float d = x * x + y * y;
+	float b = x * radial->ex + y * radial->ey;
+
+	if (d == 0)
+		return 0;
+	return d / (b + sqrtf(b * b - radial->a * d));
+}
+
+
+/**
+ * Find the length in pixels of a vector in the space of a radial gradient.
+ */
+
+float svgtiny_radial_length(const struct svgtiny_radial *radial,
+		float dx, float dy)
+{
+	float x = radial->m[0] * dx + radial->m[2] * dy;
+	float y = radial->m[1] * dx + radial->m[3] * dy;
+	return sqrtf(x * x + y * y);
+}
+
+
+/**
+ * Add the vertices of a ray to a radial gradient mesh, and the triangles
+ * between it and the last ray.
+ *
+ * Vertices are added at each end and where the ray crosses a ring. As for a
+ * linear gradient, two stops with the same offset give two vertices, the
+ * second with a slightly larger position.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_radial_emit(struct svgtiny_radial *radial,
+		const struct svgtiny_radial_ray *ray)
+{
+	struct svgtiny_radial_vertex *vertex = radial->next;
+	unsigned int count = 0, i, j, k;
+
+	if (ray->focal) {
+		if (radial->focal == -1) {
+			radial->focal = svgtiny_list_size(radial->pts);
+			if (!svgtiny_radial_point(radial, 0, 0, 0,
+					svgtiny_ramp_colour(radial->ramp, 0)))
+				return false;
+		}
+		vertex[count].index = radial->focal;
+		vertex[count++].t = 0;
+	} else {
+		vertex[count].index = svgtiny_list_size(radial->pts);
+		vertex[count++].t = ray->nt;
+		if (!svgtiny_radial_point(radial, ray->nx, ray->ny, ray->nt,
+				svgtiny_ramp_colour(radial->ramp, ray->nt)))
+			return false;
+	}
+
+	for (k = 0; k != radial->bend_count; k++) {
+		const struct svgtiny_gradient_stop *bend = &radial->bend[k];
+		float t = bend->offset;
+		if (!(ray->nt < t && t < ray->ft))
+			continue;
+		if (k != 0 && bend[-1].offset == t) {
+			if (bend[-1].color == bend->color)
+				continue;
+			t = nextafterf(t, 2);
+		}
+		vertex[count].index = svgtiny_list_size(radial->pts);
+		vertex[count++].t = t;
+		if (!svgtiny_radial_point(radial,
+				ray->fx * bend->offset / ray->ft,
+				ray->fy * bend->offset / ray->ft, t,
+				bend->color))
+			return false;
+	}
+
+	vertex[count].index = svgtiny_list_size(radial->pts);
+	vertex[count++].t = ray->ft;
+	if (!svgtiny_radial_point(radial, ray->fx, ray->fy, ray->ft,
+			svgtiny_ramp_colour(radial->ramp, ray->ft)))
+		return false;
+
+	/* zip up the last ray and this one from the near ends, always
+	 * advancing the side with less t */
+	i = j = 0;
+	while (radial->last_count &&
+			(i + 1 < radial->last_count || j + 1 < count)) {
+		const struct svgtiny_radial_vertex *last = radial->last;
+		unsigned int a = last[i].index, b = vertex[j].index, c;
+		unsigned int *tri;
+		if (j + 1 == count || (i + 1 < radial->last_count &&
+				last[i + 1].t < vertex[j + 1].t))
+			c = last[++i].index;
+		else
+			c = vertex[++j].index;
+		if (a == b)
+			continue;
+		tri = svgtiny_list_push(radial->tris);
+		if (!tri)
+			return false;
+		tri[0] = a;
+		tri[1] = b;
+		tri[2] = c;
+	}
+
+	radial->next = radial->last;
+	radial->last = vertex;
+	radial->last_count = count;
+	return true;
+}
+
+
+/**
+ * Add a vertex to a radial gradient mesh, at position t along the gradient.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_radial_point(struct svgtiny_radial *radial, float x, float y,
+		float t, svgtiny_colour colour)
+{
+	struct svgtiny_gradient_point *point = svgtiny_list_push(radial->pts);
+	if (!point)
+		return false;
+	point->x = radial->m[0] * x + radial->m[2] * y + radial->m[4];
+	point->y = radial->m[1] * x + radial->m[3] * y + radial->m[5];
+	point->r = t;
+	point->colour = colour;
+	return true;
+}
+
+
+/**
+ * Compare radial gradient edges by the angle at which they start, for qsort.
+ */
+
+int svgtiny_radial_compare_edges(const void *a, const void *b)
+{
+	float a0 = ((const struct svgtiny_radial_edge *) a)->angle0;
+	float b0 = ((const struct svgtiny_radial_edge *) b)->angle0;
+	return a0 < b0 ? -1 : b0 < a0;
+}
+
+
+/**
+ * Compare angles, for qsort.
+ */
+
+int svgtiny_radial_compare_angles(const void *a, const void *b)
+{
+	float a0 = *(const float *) a, b0 = *(const float *) b;
+	return a0 < b0 ? -1 : b0 < a0;
+}
+
+
+/**
+ * Find the points of a gradient where its colour bends.
+ *
+ * Points are dropped while the colour stays within tolerance of a linear ramp
+ * between the last point kept and the next one, so stops of one colour
+ * collapse, as do stops between nearly equal colours. The colour is constant
+ * before the first point and after the last, as if ramping to far away
+ * points of the same colour.
+ *
+ * \param  knot       points between which the colour changes linearly
+ * \param  count      number of points, at least 1
+ * \param  tolerance  largest error allowed in each channel, from 0 to 255
+ * \param  bend       array of count, updated with the points kept, and which
+ *                    may be knot
+ * \return  number of points stored in bend
+ */
+
+unsigned int svgtiny_gradient_bends(const struct svgtiny_gradient_stop *knot,
+		unsigned int count, float tolerance,
+		struct svgtiny_gradient_stop *bend)
+{
+	struct svgtiny_gradient_stop last = knot[0];
+	unsigned int first = 0;	/* first point after the last kept */
+	unsigned int bend_count = 0;
+	unsigned int i, j;
+
+	last.offset -= 1000;
+	for (i = 0; i != count; i++) {
+		struct svgtiny_gradient_stop next = knot[count - 1];
+		if (i + 1 != count)
+			next = knot[i + 1];
+		else
+			next.offset += 1000;
+
+		/* keep point i if the ramp to the next point misses any of
+		 * the points since the last kept */
+		for (j = first; j <= i; j++)
+			if (tolerance < svgtiny_ramp_error(last.offset,
+					last.color, next.offset, next.color,
+					&knot[j]))
+				break;
+		if (j <= i) {
+			last = knot[i];
+			bend[bend_count++] = last;
+			first = i + 1;
+		}
+	}
+
+	return bend_count;
+}
+
+
+/**
+ * Find the largest channel difference between a stop and a linear ramp.
+ */
+
+float svgtiny_ramp_error(float offset0, svgtiny_colour colour0,
+		float offset1, svgtiny_colour colour1,
+		const struct svgtiny_gradient_stop *stop)
+{
+	float f, error, e;
+
+	if (offset1 <= offset0)
+		return colour0 == stop->color && colour1 == stop->color ?
+				0 : 255;
+
+	f = (stop->offset - offset0) / (offset1 - offset0);
+	error = fabsf((1 - f) * svgtiny_RED(colour0) +
+			f * svgtiny_RED(colour1) - svgtiny_RED(stop->color));
+	e = fabsf((1 - f) * svgtiny_GREEN(colour0) +
+			f * svgtiny_GREEN(colour1) -
+			svgtiny_GREEN(stop->color));
+	if (error < e)
+		error = e;
+	e = fabsf((1 - f) * svgtiny_BLUE(colour0) +
+			f * svgtiny_BLUE(colour1) - svgtiny_BLUE(stop->color));
+	if (error < e)
+		error = e;
+	return error;
+}
+
+
+/**
+ * Find the distance of a point along a gradient vector.
+ *
+ * \param  trans   inverse of the gradient transform
+ * \param  vector  start x, y, delta x, y, and squared length of the vector
+ * \return  0 at the start of the vector and 1 at the end
+ */
+
+float svgtiny_gradient_position(const float *trans, const float *vector,
+		float x, float y)
+{
+	float x_trans = trans[0]*x + trans[2]*y + trans[4];
+	float y_trans = trans[1]*x + trans[3]*y + trans[5];
+	return ((x_trans - vector[0]) * vector[2] +
+			(y_trans - vector[1]) * vector[3]) / vector[4];
+}
+
+
+/**
+ * Divide a bezier into lines which stay within a flatness of it on the device.
+ *
+ * \param  point  updated with x, y of the end of each line, with room for
+ *                svgtiny_BEZIER_STEPS_MAX
+ * \return  number of lines, at most svgtiny_BEZIER_STEPS_MAX
+ */
+
+unsigned int svgtiny_gradient_bezier(float x0, float y0,
+		float c0x, float c0y, float c1x, float c1y, float x1, float y1,
+		float *point, float flatness,
+		const struct svgtiny_parse_state *state)
+{
+	const float curve[8] = { x0, y0, c0x, c0y, c1x, c1y, x1, y1 };
+	unsigned int steps = svgtiny_bezier_steps(curve, &state->ctm.a,
+			flatness);
+
+	if (svgtiny_BEZIER_STEPS_MAX < steps)
+		steps = svgtiny_BEZIER_STEPS_MAX;
+	svgtiny_bezier_points(curve, steps, point);
+	return steps;
+}
+
+
+/**
+ * Add the points where a line crosses bends in the colour of a gradient.
+ *
+ * The points are added in order from the start of the line to the end,
+ * neither of which is added. Where two stops have the same offset, a point is
+ * added for each, and the second is given a slightly larger distance along
+ * the gradient, so that the mesh keeps the sharp change in colour.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_gradient_crossings(struct svgtiny_list *pts,
+		const struct svgtiny_gradient_point *from,
+		const struct svgtiny_gradient_point *to,
+		const struct svgtiny_gradient_stop *bend,
+		unsigned int bend_count)
+{
+	float dx = to->x - from->x, dy = to->y - from->y;
+	float dr = to->r - from->r;
+	unsigned int i;
+
+	if (dr == 0 || isnan(dr))
+		return true;
+
+	for (i = 0; i != bend_count; i++) {
+		struct svgtiny_gradient_point point;
+		unsigned int k = 0 < dr ? i : bend_count - 1 - i;
+		float t = (bend[k].offset - from->r) / dr;
+
+		if (t <= 0 || 1 <= t)
+			continue;
+		point.x = from->x + t * dx;
+		point.y = from->y + t * dy;
+		point.r = bend[k].offset;
+		point.colour = bend[k].color;
+		if (k != 0 && bend[k - 1].offset == bend[k].offset) {
+			if (bend[k - 1].color == bend[k].color)
+				continue;
+			point.r = nextafterf(point.r, 2);
+		}
+		if (!svgtiny_gradient_push(pts, &point))
+			return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Add a point to the end of a list of gradient mesh vertices.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_gradient_push(struct svgtiny_list *pts,
+		const struct svgtiny_gradient_point *point)
+{
+	struct svgtiny_gradient_point *item = svgtiny_list_push(pts);
+	if (!item)
+		return false;
+	*item = *point;
+	return true;
+}
+
+
+/**
+ * Allocate the mesh of a gradient fill.
+ *
+ * The mesh is allocated in the diagram with svgtiny_MESH_GRADIENTS, where it
+ * is kept, and otherwise on the heap, as it is only needed until
+ * svgtiny_gradient_add_mesh() has added its bands.
+ *
+ * \return  the mesh, or NULL if memory runs out
+ */
+
+struct svgtiny_mesh *svgtiny_gradient_mesh(
+		const struct svgtiny_parse_state *state,
+		unsigned int vertex_count, unsigned int index_count)
+{
+	struct svgtiny_diagram *diagram = state->context->diagram;
+
+	if (svgtiny_diagram_internal(diagram)->options &
+			svgtiny_MESH_GRADIENTS)
+		return svgtiny_arena_mesh(diagram, vertex_count, index_count);
+	return svgtiny_mesh_create(vertex_count, index_count);
+}
+
+
+/**
+ * Add the mesh of a gradient fill to the diagram.
+ *
+ * With svgtiny_MESH_GRADIENTS the mesh is added as one shape. Otherwise it is
+ * added as paths filled with flat colours, and freed. The ramp is cut into
+ * bands across which the colour changes by at most twice the colour
+ * tolerance, and each band is filled with the colour at its middle, so is
+ * within the tolerance of the gradient. All the triangles of a band are one
+ * path, so that no gaps are seen between them.
+ *
+ * \param  mesh   mesh from svgtiny_gradient_mesh(), with vertices in pixels
+ * \param  pts    position along the gradient of each vertex, in the r of
+ *                struct svgtiny_gradient_point
+ * \param  state  state of the path filled with the gradient
+ * \return  svgtiny_OK, or svgtiny_OUT_OF_MEMORY
+ */
+
+svgtiny_code svgtiny_gradient_add_mesh(struct svgtiny_mesh *mesh,
+		struct svgtiny_list *pts, struct svgtiny_parse_state *state)
+{
+	const struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(state->context->diagram);
+	const struct svgtiny_gradient_ramp *ramp = state->gradient->ramp;
+	struct svgtiny_parse_state device = *state;
+	struct svgtiny_gradient_stop *knot;
+	unsigned int knot_count;
+	svgtiny_code code = svgtiny_OK;
+	float split;
+	float r0 = INFINITY, r1 = -INFINITY;
+	bool first = true;
+	unsigned int i, k;
+
+	if (internal->options & svgtiny_MESH_GRADIENTS) {
+		struct svgtiny_shape *shape = svgtiny_add_shape(state);
+		if (!shape)
+			return svgtiny_OUT_OF_MEMORY;
+		shape->mesh = mesh;
+		svgtiny_mesh_extent(shape);
+		shape->fill = svgtiny_TRANSPARENT;
+		shape->stroke = svgtiny_TRANSPARENT;
+		state->context->diagram->shape_count++;
+		return svgtiny_OK;
+	}
+
+	knot = malloc((ramp->stop_count + svgtiny_RAMP_SIZE) *
+			sizeof knot[0]);
+	if (!knot) {
+		free(mesh);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+	knot_count = svgtiny_ramp_knots(ramp, knot);
+
+	/* the layers are in pixels, and only filled */
+	device.ctm.a = 1;
+	device.ctm.b = 0;
+	device.ctm.c = 0;
+	device.ctm.d = 1;
+	device.ctm.e = 0;
+	device.ctm.f = 0;
+	device.stroke = svgtiny_TRANSPARENT;
+	device.stroke_width = 0;
+	device.fill_rule = svgtiny_FILL_NONZERO;
+
+	split = 2 * internal->colour_tolerance;
+	if (split < 1)
+		split = 1;
+
+	for (i = 0; i != svgtiny_list_size(pts); i++) {
+		const struct svgtiny_gradient_point *point =
+				svgtiny_list_get(pts, i);
+		if (point->r < r0)
+			r0 = point->r;
+		if (r1 < point->r)
+			r1 = point->r;
+	}
+
+	/* the colour is constant before the first knot and after the last,
+	 * and linear between knots */
+	for (k = 0; k <= knot_count && code == svgtiny_OK; k++) {
+		float s0 = k == 0 ? -INFINITY : knot[k - 1].offset;
+		float s1 = k == knot_count ? INFINITY : knot[k].offset;
+		unsigned int bands, band;
+
+		if (s0 < r0)
+			s0 = r0;
+		if (r1 < s1)
+			s1 = r1;
+		if (s1 < s0 || (s1 == s0 && !first))
+			continue;
+
+		bands = ceilf(svgtiny_colour_difference(
+				svgtiny_ramp_colour(ramp, s0),
+				svgtiny_ramp_colour(ramp, s1)) / split);
+		if (bands == 0)
+			bands = 1;
+		for (band = 0; band != bands && code == svgtiny_OK; band++) {
+			float start = s0 + (s1 - s0) * band / bands;
+			float end = s0 + (s1 - s0) * (band + 1) / bands;
+			float middle = s0 + (s1 - s0) * (band + 0.5f) / bands;
+			code = svgtiny_gradient_band(mesh, pts,
+					first ? -INFINITY : start,
+					end == r1 ? INFINITY : end,
+					svgtiny_ramp_colour(ramp, middle),
+					&device);
+			first = false;
 		}
-		j++;
-		for (k = 0; k != points; k++) {
-			float x = p[j], y = p[j + 1];
-			if (x < *x0)
-				*x0 = x;
-			else if (*x1 < x)
-				*x1 = x;
-			if (y < *y0)
-				*y0 = y;
-			else if (*y1 < y)
-				*y1 = y;
-			j += 2;
+	}
+
+	/* positions are NaN where the gradient vector has no length */
+	if (first && mesh->vertex_count)
+		code = svgtiny_gradient_band(mesh, pts, -INFINITY, INFINITY,
+				mesh->colour[0], &device);
+
+	free(knot);
+	free(mesh);
+	return code;
+}
+
+
+/**
+ * Add the part of a gradient mesh between two positions along the gradient
+ * as a path filled with a flat colour.
+ *
+ * The part is grown past the end position by svgtiny_GRADIENT_OVERLAP pixels,
+ * to be covered by the next band, so that the background is not seen where
+ * they meet. Every piece winds the same way, so that pieces which meet in
+ * the path cover the pixels along their edge exactly once.
+ *
+ * \param  mesh    mesh with vertices in pixels
+ * \param  pts     position along the gradient of each vertex
+ * \param  start   position where the part starts, or -INFINITY
+ * \param  end     position where the part ends, or INFINITY
+ * \param  colour  colour to fill the part with
+ * \param  state   state with the identity transformation and no stroke
+ * \return  svgtiny_OK, or svgtiny_OUT_OF_MEMORY
+ */
+
+svgtiny_code svgtiny_gradient_band(const struct svgtiny_mesh *mesh,
+		struct svgtiny_list *pts, float start, float end,
+		svgtiny_colour colour, struct svgtiny_parse_state *state)
+{
+	unsigned int triangles = mesh->index_count / 3;
+	unsigned int n = 0;
+	unsigned int i, j;
+	float *p;
+
+	if (triangles == 0)
+		return svgtiny_OK;
+	p = malloc(16 * triangles * sizeof p[0]);
+	if (!p)
+		return svgtiny_OUT_OF_MEMORY;
+
+	for (i = 0; i != triangles; i++) {
+		float point[10], r[5], clipped[10], clipped_r[5];
+		unsigned int count = 3;
+		float ax, ay, bx, by, gx, gy, area;
+
+		for (j = 0; j != 3; j++) {
+			unsigned int k = mesh->index[3 * i + j];
+			const struct svgtiny_gradient_point *vertex =
+					svgtiny_list_get(pts, k);
+			point[2 * j] = mesh->vertex[2 * k];
+			point[2 * j + 1] = mesh->vertex[2 * k + 1];
+			r[j] = vertex->r;
+		}
+		ax = point[2] - point[0];
+		ay = point[3] - point[1];
+		bx = point[4] - point[0];
+		by = point[5] - point[1];
+		area = ax * by - ay * bx;
+		if (area == 0)
+			continue;
+
+		/* the position changes by the length of its gradient across
+		 * the triangle in a pixel */
+		gx = (r[1] - r[0]) * by - (r[2] - r[0]) * ay;
+		gy = (r[2] - r[0]) * ax - (r[1] - r[0]) * bx;
+
+		if (start != -INFINITY) {
+			count = svgtiny_gradient_clip(point, r, count, start, 1,
+					clipped, clipped_r);
+			memcpy(point, clipped, 2 * count * sizeof point[0]);
+			memcpy(r, clipped_r, count * sizeof r[0]);
+		}
+		if (end != INFINITY && 3 <= count) {
+			count = svgtiny_gradient_clip(point, r, count,
+					end + svgtiny_GRADIENT_OVERLAP *
+					sqrtf(gx * gx + gy * gy) / fabsf(area),
+					-1, clipped, clipped_r);
+			memcpy(point, clipped, 2 * count * sizeof point[0]);
+		}
+		if (count < 3)
+			continue;
+
+		for (j = 0; j != count; j++) {
+			unsigned int k = 0 < area ? j : count - 1 - j;
+			p[n++] = j == 0 ? svgtiny_PATH_MOVE :
+					svgtiny_PATH_LINE;
+			p[n++] = point[2 * k];
+			p[n++] = point[2 * k + 1];
+		}
+		p[n++] = svgtiny_PATH_CLOSE;
+	}
+
+	if (n == 0) {
+		free(p);
+		return svgtiny_OK;
+	}
+	state->fill = colour;
+	return svgtiny_add_path(p, n, state);
+}
+
+
+/**
+ * Clip a convex polygon to one side of a position along the gradient.
+ *
+ * \param  point      x, y of the count vertices
+ * \param  r          position of each vertex
+ * \param  count      number of vertices, at most 4
+ * \param  level      position to clip at
+ * \param  side       1 to keep where the position is at least level, -1 for
+ *                    at most
+ * \param  clipped    updated with x, y of the vertices kept and made
+ * \param  clipped_r  updated with their positions
+ * \return  number of vertices in clipped, at most count + 1
+ */
+
+unsigned int svgtiny_gradient_clip(const float *point, const float *r,
+		unsigned int count, float level, float side,
+		float *clipped, float *clipped_r)
+{
+	unsigned int kept = 0;
+	unsigned int i;
+
+	for (i = 0; i != count; i++) {
+		unsigned int j = (i + 1) % count;
+		float di = side * (r[i] - level), dj = side * (r[j] - level);
+
+		if (0 <= di) {
+			clipped[2 * kept] = point[2 * i];
+			clipped[2 * kept + 1] = point[2 * i + 1];
+			clipped_r[kept++] = r[i];
+		}
+		if ((0 <= di) != (0 <= dj)) {
+			float t = di / (di - dj);
+			clipped[2 * kept] = point[2 * i] +
+					t * (point[2 * j] - point[2 * i]);
+			clipped[2 * kept + 1] = point[2 * i + 1] +
+					t * (point[2 * j + 1] -
+					point[2 * i + 1]);
+			clipped_r[kept++] = level;
 		}
 	}
+
+	return kept;
+}
+
+
+/**
+ * Find the largest difference between the channels of two colours.
+ */
+
+unsigned int svgtiny_colour_difference(svgtiny_colour colour0,
+		svgtiny_colour colour1)
+{
+	int red = svgtiny_RED(colour0) - svgtiny_RED(colour1);
+	int green = svgtiny_GREEN(colour0) - svgtiny_GREEN(colour1);
+	int blue = svgtiny_BLUE(colour0) - svgtiny_BLUE(colour1);
+	unsigned int most = red < 0 ? -red : red;
+
+	if (most < (unsigned int) (green < 0 ? -green : green))
+		most = green < 0 ? -green : green;
+	if (most < (unsigned int) (blue < 0 ? -blue : blue))
+		most = blue < 0 ? -blue : blue;
+	return most;
 }
 
 
 /**
  * Invert a transformation matrix.
  */
-void svgtiny_invert_matrix(float *m, float *inv)
+void svgtiny_invert_matrix(const float *m, float *inv)
 {
 	float determinant = m[0]*m[3] - m[1]*m[2];
 	inv[0] = m[3] / determinant;
@@ -0,0 +1,501 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Shape extents and the spatial index.
+ *
+ * Every shape has the bounding box of its geometry in pixels, found as it is
+ * added. Bezier segments are bounded by their extremes rather than their
+ * control points.
+ *
+ * svgtiny_index_create() builds a uniform grid over a parsed diagram. Each
+ * cell lists the shapes whose bounding boxes overlap it, in order, and shapes
+ * covering many cells are kept in one list instead, so that backgrounds don't
+ * fill every cell. A query visits the cells under a rectangle, and reports a
+ * shape only from the first of its cells which is visited, so no marks are
+ * needed and an index may be queried from several threads at once.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* cells along each side of the grid, at most */
+#define svgtiny_INDEX_SIDE_MAX 256
+/* shapes overlapping more cells than this are in the large list */
+#define svgtiny_INDEX_LARGE 64
+
+struct svgtiny_index {
+	unsigned int shape_count;
+	/* x0, y0, x1, y1 of each shape, grown by its stroke width */
+	float *bbox;
+
+	/* the grid covers x0, y0 to x0 + columns / scale_x,
+	 * y0 + rows / scale_y */
+	float x0, y0;
+	float scale_x, scale_y;		/* cells per pixel */
+	unsigned int columns, rows;
+
+	/* shapes of cell i are cell_shape[cell_start[i] ..
+	 * cell_start[i + 1] - 1] */
+	unsigned int *cell_start;
+	unsigned int *cell_shape;
+
+	/* shapes in no cell, as they are large or not finite */
+	unsigned int *large;
+	unsigned int large_count;
+};
+
+static void svgtiny_extent_point(float *bbox, float x, float y);
+static void svgtiny_extent_cubic(float *bbox, float q0, float q1, float q2,
+		float q3);
+static bool svgtiny_index_in_grid(const struct svgtiny_index *index,
+		const float *bbox, unsigned int *cx0, unsigned int *cy0,
+		unsigned int *cx1, unsigned int *cy1);
+static void svgtiny_index_cells(const struct svgtiny_index *index,
+		const float *bbox, unsigned int *cx0, unsigned int *cy0,
+		unsigned int *cx1, unsigned int *cy1);
+static int svgtiny_index_compare(const void *a, const void *b);
+
+
+/**
+ * Find the bounding box of a path, after a transformation.
+ *
+ * \param  p   path in the float layout
+ * \param  n   length of p
+ * \param  m   transformation matrix a, b, c, d, e, f, or 0 for none
+ * \param  x0  updated with the left edge of the box
+ * \param  y0  updated with the top edge
+ * \param  x1  updated with the right edge
+ * \param  y1  updated with the bottom edge
+ */
+
+void svgtiny_path_extent(const float *p, unsigned int n, const float *m,
+		float *x0, float *y0, float *x1, float *y1)
+{
+	static const float identity[6] = { 1, 0, 0, 1, 0, 0 };
+	float bbox[4] = { 0, 0, 0, 0 };
+	float x = 0, y = 0, start_x = 0, start_y = 0;
+	unsigned int j;
+
+	if (!m)
+		m = identity;
+
+	if (2 < n) {
+		bbox[0] = bbox[2] = m[0] * p[1] + m[2] * p[2] + m[4];
+		bbox[1] = bbox[3] = m[1] * p[1] + m[3] * p[2] + m[5];
+	}
+
+	for (j = 0; j != n; ) {
+		float cx[3], cy[3];
+		unsigned int k;
+
+		switch ((int) p[j]) {
+		case svgtiny_PATH_MOVE:
+		case svgtiny_PATH_LINE:
+			x = m[0] * p[j + 1] + m[2] * p[j + 2] + m[4];
+			y = m[1] * p[j + 1] + m[3] * p[j + 2] + m[5];
+			svgtiny_extent_point(bbox, x, y);
+			if ((int) p[j] == svgtiny_PATH_MOVE) {
+				start_x = x;
+				start_y = y;
+			}
+			j += 3;
+			break;
+		case svgtiny_PATH_CLOSE:
+			x = start_x;
+			y = start_y;
+			j++;
+			break;
+		case svgtiny_PATH_BEZIER:
+			for (k = 0; k != 3; k++) {
+				float px = p[j + 1 + 2 * k];
+				float py = p[j + 2 + 2 * k];
+				cx[k] = m[0] * px + m[2] * py + m[4];
+				cy[k] = m[1] * px + m[3] * py + m[5];
+			}
+			svgtiny_extent_point(bbox, cx[2], cy[2]);
+			svgtiny_extent_cubic(bbox, x, cx[0], cx[1], cx[2]);
+			svgtiny_extent_cubic(bbox + 1, y, cy[0], cy[1], cy[2]);
+			x = cx[2];
+			y = cy[2];
+			j += 7;
+			break;
+		default:
+			/* not a path from this library */
+			j = n;
+			break;
+		}
+	}
+
+	*x0 = bbox[0];
+	*y0 = bbox[1];
+	*x1 = bbox[2];
+	*y1 = bbox[3];
+}
+
+
+/**
+ * Set the bounding box of a mesh shape from its vertices.
+ */
+
+void svgtiny_mesh_extent(struct svgtiny_shape *shape)
+{
+	const struct svgtiny_mesh *mesh = shape->mesh;
+	float bbox[4] = { 0, 0, 0, 0 };
+	unsigned int i;
+
+	if (mesh->vertex_count) {
+		bbox[0] = bbox[2] = mesh->vertex[0];
+		bbox[1] = bbox[3] = mesh->vertex[1];
+	}
+	for (i = 1; i < mesh->vertex_count; i++)
+		svgtiny_extent_point(bbox, mesh->vertex[2 * i],
+				mesh->vertex[2 * i + 1]);
+
+	shape->bbox_x0 = bbox[0];
+	shape->bbox_y0 = bbox[1];
+	shape->bbox_x1 = bbox[2];
+	shape->bbox_y1 = bbox[3];
+}
+
+
+/**
+ * Grow a bounding box x0, y0, x1, y1 to include a point.
+ */
+
+void svgtiny_extent_point(float *bbox, float x, float y)
+{
+	if (x < bbox[0])
+		bbox[0] = x;
+	if (bbox[2] < x)
+		bbox[2] = x;
+	if (y < bbox[1])
+		bbox[1] = y;
+	if (bbox[3] < y)
+		bbox[3] = y;
+}
+
+
+/**
+ * Grow one axis of a bounding box to include the extremes of a cubic
+ * Bezier between its end points.
+ *
+ * \param  bbox  the minimum, and at bbox[2] the maximum, of the axis
+ * \param  q0    coordinate of the start point
+ * \param  q1    coordinate of the first control point
+ * \param  q2    coordinate of the second control point
+ * \param  q3    coordinate of the end point
+ */
+
+void svgtiny_extent_cubic(float *bbox, float q0, float q1, float q2,
+		float q3)
+{
+	/* the derivative over 3 is a t^2 + b t + c */
+	float a = -q0 + 3 * q1 - 3 * q2 + q3;
+	float b = 2 * (q0 - 2 * q1 + q2);
+	float c = q1 - q0;
+	float t[2];
+	unsigned int count = 0, i;
+
+	/* the curve stays between its end points when the control points
+	 * do, and those are already in the box */
+	if (bbox[0] <= q1 && q1 <= bbox[2] && bbox[0] <= q2 && q2 <= bbox[2])
+		return;
+
+	if (fabsf(a) < 1e-6f * (fabsf(b) + fabsf(c))) {
+		if (b != 0)
+			t[count++] = -c / b;
+	} else {
+		float d = b * b - 4 * a * c;
+		if (0 <= d) {
+			d = sqrtf(d);
+			t[count++] = (-b + d) / (2 * a);
+			t[count++] = (-b - d) / (2 * a);
+		}
+	}
+
+	for (i = 0; i != count; i++) {
+		float s = t[i], ms = 1 - s, q;
+		if (!(0 < s && s < 1))
+			continue;
+		q = ms * ms * ms * q0 + 3 * ms * ms * s * q1 +
+				3 * ms * s * s * q2 + s * s * s * q3;
+		if (q < bbox[0])
+			bbox[0] = q;
+		if (bbox[2] < q)
+			bbox[2] = q;
+	}
+}
+
+
+/**
+ * Build a spatial index of the shapes of a diagram.
+ *
+ * The bounding box of each stroked shape is grown by the reach of a miter at
+ * svgtiny_MITER_LIMIT, as svgtiny_render() draws it, which is twice the stroke
+ * width.
+ *
+ * The index is a copy, so it stays valid until it is freed, but it describes
+ * the diagram as it was when it was built.
+ *
+ * \param  diagram  diagram after parsing
+ * \return  the index, or 0 if memory runs out
+ */
+
+struct svgtiny_index *svgtiny_index_create(
+		const struct svgtiny_diagram *diagram)
+{
+	unsigned int count = diagram->shape_count;
+	struct svgtiny_index *index;
+	float x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+	float width, height;
+	unsigned int cells, i;
+	bool found = false;
+
+	index = calloc(1, sizeof *index);
+	if (!index)
+		return 0;
+	index->shape_count = count;
+	index->bbox = malloc((count ? count : 1) * 4 * sizeof index->bbox[0]);
+	index->large = malloc((count ? count : 1) * sizeof index->large[0]);
+	if (!index->bbox || !index->large)
+		goto error;
+
+	/* bounding boxes, and their union for the extent of the grid */
+	for (i = 0; i != count; i++) {
+		const struct svgtiny_shape *shape = &diagram->shape[i];
+		float *bbox = index->bbox + 4 * i;
+		float grow = 0;
+		if (shape->stroke != svgtiny_TRANSPARENT)
+			grow = 0.5f * svgtiny_MITER_LIMIT *
+					shape->stroke_width;
+		bbox[0] = shape->bbox_x0 - grow;
+		bbox[1] = shape->bbox_y0 - grow;
+		bbox[2] = shape->bbox_x1 + grow;
+		bbox[3] = shape->bbox_y1 + grow;
+		if (!(isfinite(bbox[0]) && isfinite(bbox[1]) &&
+				isfinite(bbox[2]) && isfinite(bbox[3])))
+			continue;
+		if (!found || bbox[0] < x0)
+			x0 = bbox[0];
+		if (!found || bbox[1] < y0)
+			y0 = bbox[1];
+		if (!found || x1 < bbox[2])
+			x1 = bbox[2];
+		if (!found || y1 < bbox[3])
+			y1 = bbox[3];
+		found = true;
+	}
+
+	/* about one cell for each shape, roughly square */
+	width = x1 - x0 < 1 ? 1 : x1 - x0;
+	height = y1 - y0 < 1 ? 1 : y1 - y0;
+	index->columns = (unsigned int) sqrtf(count * width / height) + 1;
+	if (svgtiny_INDEX_SIDE_MAX < index->columns)
+		index->columns = svgtiny_INDEX_SIDE_MAX;
+	index->rows = count / index->columns + 1;
+	if (svgtiny_INDEX_SIDE_MAX < index->rows)
+		index->rows = svgtiny_INDEX_SIDE_MAX;
+	index->x0 = x0;
+	index->y0 = y0;
+	index->scale_x = index->columns / width;
+	index->scale_y = index->rows / height;
+	cells = index->columns * index->rows;
+
+	index->cell_start = calloc(cells + 1, sizeof index->cell_start[0]);
+	if (!index->cell_start)
+		goto error;
+
+	/* count the shapes of each cell, then fill the cells in order */
+	for (i = 0; i != count; i++) {
+		const float *bbox = index->bbox + 4 * i;
+		unsigned int cx0, cy0, cx1, cy1, cx, cy;
+		if (!svgtiny_index_in_grid(index, bbox,
+				&cx0, &cy0, &cx1, &cy1)) {
+			index->large[index->large_count++] = i;
+			continue;
+		}
+		for (cy = cy0; cy <= cy1; cy++)
+			for (cx = cx0; cx <= cx1; cx++)
+				index->cell_start[cy * index->columns + cx +
+						1]++;
+	}
+	for (i = 0; i != cells; i++)
+		index->cell_start[i + 1] += index->cell_start[i];
+
+	index->cell_shape = malloc((index->cell_start[cells] ?
+			index->cell_start[cells] : 1) *
+			sizeof index->cell_shape[0]);
+	if (!index->cell_shape)
+		goto error;
+
+	for (i = 0; i != count; i++) {
+		const float *bbox = index->bbox + 4 * i;
+		unsigned int cx0, cy0, cx1, cy1, cx, cy;
+		if (!svgtiny_index_in_grid(index, bbox,
+				&cx0, &cy0, &cx1, &cy1))
+			continue;
+		for (cy = cy0; cy <= cy1; cy++)
+			for (cx = cx0; cx <= cx1; cx++)
+				index->cell_shape[index->cell_start[
+						cy * index->columns + cx]++] =
+						i;
+	}
+	/* filling advanced each start to the next cell's */
+	memmove(index->cell_start + 1, index->cell_start,
+			cells * sizeof index->cell_start[0]);
+	index->cell_start[0] = 0;
+
+	return index;
+
+error:
+	svgtiny_index_free(index);
+	return 0;
+}
+
+
+/**
+ * Find the shapes whose bounding boxes intersect a rectangle.
+ *
+ * \param  index  index returned by svgtiny_index_create()
+ * \param  x0     left edge of the rectangle, in pixels
+ * \param  y0     top edge
+ * \param  x1     right edge
+ * \param  y1     bottom edge
+ * \param  shape  updated with the numbers of the shapes found, in the order
+ *                they are drawn, with room for every shape of the diagram
+ * \return  number of shapes found
+ */
+
+unsigned int svgtiny_index_query(const struct svgtiny_index *index,
+		float x0, float y0, float x1, float y1, unsigned int *shape)
+{
+	const float rect[4] = { x0, y0, x1, y1 };
+	unsigned int qx0, qy0, qx1, qy1, cx, cy;
+	unsigned int count = 0, i;
+	bool sorted = true;
+
+	/* the grid, if the rectangle overlaps it */
+	svgtiny_index_cells(index, rect, &qx0, &qy0, &qx1, &qy1);
+	if (!(x1 < index->x0 || y1 < index->y0 ||
+			index->x0 + index->columns / index->scale_x < x0 ||
+			index->y0 + index->rows / index->scale_y < y0)) {
+		for (cy = qy0; cy <= qy1; cy++) {
+			for (cx = qx0; cx <= qx1; cx++) {
+				unsigned int cell = cy * index->columns + cx;
+				unsigned int j = index->cell_start[cell];
+				unsigned int end = index->cell_start[cell + 1];
+				for (; j != end; j++) {
+					unsigned int s = index->cell_shape[j];
+					const float *bbox = index->bbox + 4 * s;
+					unsigned int sx0, sy0, sx1, sy1;
+					if (x1 < bbox[0] || bbox[2] < x0 ||
+							y1 < bbox[1] ||
+							bbox[3] < y0)
+						continue;
+					/* report only from the first cell
+					 * of the shape which is visited */
+					svgtiny_index_cells(index, bbox,
+							&sx0, &sy0, &sx1, &sy1);
+					if (cx != (sx0 < qx0 ? qx0 : sx0) ||
+							cy != (sy0 < qy0 ?
+							qy0 : sy0))
+						continue;
+					if (count && s < shape[count - 1])
+						sorted = false;
+					shape[count++] = s;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i != index->large_count; i++) {
+		unsigned int s = index->large[i];
+		const float *bbox = index->bbox + 4 * s;
+		if (x1 < bbox[0] || bbox[2] < x0 || y1 < bbox[1] ||
+				bbox[3] < y0)
+			continue;
+		if (count && s < shape[count - 1])
+			sorted = false;
+		shape[count++] = s;
+	}
+
+	if (!sorted)
+		qsort(shape, count, sizeof shape[0], svgtiny_index_compare);
+
+	return count;
+}
+
+
+/**
+ * Free an index returned by svgtiny_index_create().
+ */
+
+void svgtiny_index_free(struct svgtiny_index *index)
+{
+	if (!index)
+		return;
+	free(index->bbox);
+	free(index->cell_start);
+	free(index->cell_shape);
+	free(index->large);
+	free(index);
+}
+
+
+/**
+ * Find the range of cells of a shape, and whether it is listed in them
+ * rather than in the large list.
+ */
+
+bool svgtiny_index_in_grid(const struct svgtiny_index *index,
+		const float *bbox, unsigned int *cx0, unsigned int *cy0,
+		unsigned int *cx1, unsigned int *cy1)
+{
+	if (!(isfinite(bbox[0]) && isfinite(bbox[1]) &&
+			isfinite(bbox[2]) && isfinite(bbox[3])))
+		return false;
+	svgtiny_index_cells(index, bbox, cx0, cy0, cx1, cy1);
+	return (*cx1 - *cx0 + 1) * (*cy1 - *cy0 + 1) <= svgtiny_INDEX_LARGE;
+}
+
+
+/**
+ * Find the range of cells which a box overlaps, clamped to the grid.
+ */
+
+void svgtiny_index_cells(const struct svgtiny_index *index,
+		const float *bbox, unsigned int *cx0, unsigned int *cy0,
+		unsigned int *cx1, unsigned int *cy1)
+{
+	float fx0 = (bbox[0] - index->x0) * index->scale_x;
+	float fy0 = (bbox[1] - index->y0) * index->scale_y;
+	float fx1 = (bbox[2] - index->x0) * index->scale_x;
+	float fy1 = (bbox[3] - index->y0) * index->scale_y;
+	float columns = index->columns - 1, rows = index->rows - 1;
+
+	/* written so that NaN clamps to 0 */
+	*cx0 = 0 < fx0 ? (fx0 < columns ? (unsigned int) fx0 : columns) : 0;
+	*cy0 = 0 < fy0 ? (fy0 < rows ? (unsigned int) fy0 : rows) : 0;
+	*cx1 = 0 < fx1 ? (fx1 < columns ? (unsigned int) fx1 : columns) : 0;
+	*cy1 = 0 < fy1 ? (fy1 < rows ? (unsigned int) fy1 : rows) : 0;
+}
+
+
+/**
+ * Compare shape numbers for qsort().
+ */
+
+int svgtiny_index_compare(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *) a;
+	unsigned int y = *(const unsigned int *) b;
+	return x < y ? -1 : y < x ? 1 : 0;
+}
@@ -16,18 +16,129 @@
 #define UNUSED(x) ((void) (x))
 #endif
 
-struct svgtiny_gradient_stop {
-	float offset;
-	svgtiny_colour color;
+/* a diagram as allocated by svgtiny_create(), with private fields */
+struct svgtiny_diagram_internal {
+	struct svgtiny_diagram diagram;
+
+	unsigned int shape_allocated;	/* slots allocated in diagram.shape */
+
+	/* blocks holding paths and text while parsing (svgtiny_arena.c) */
+	struct svgtiny_arena_block *arena;
+	/* bytes of meshes, paths, and text held by the diagram, at most */
+	size_t data_size;
+	/* previous compacted block, still holding paths and text */
+	struct svgtiny_shape *retired;
+	/* diagram.shape is a compacted block, holding paths and text */
+	bool compact;
+
+	unsigned int options;		/* from svgtiny_set_options() */
+	/* from svgtiny_set_tolerance() */
+	float colour_tolerance;		/* largest channel error */
+	float flatness;			/* largest distance in pixels */
+	/* from svgtiny_set_fixed_point() */
+	unsigned int fraction_bits;
+	/* from svgtiny_set_clip(), in pixels */
+	bool clip;
+	float clip_x0, clip_y0, clip_x1, clip_y1;
+	/* from svgtiny_set_threads() */
+	unsigned int threads;
 };
 
-#define svgtiny_MAX_STOPS 10
+#define svgtiny_diagram_internal(d) \
+		((struct svgtiny_diagram_internal *) (void *) (d))
+
+/* tolerances of gradient meshes, see svgtiny_set_tolerance() */
+#define svgtiny_DEFAULT_COLOUR_TOLERANCE 1
+#define svgtiny_DEFAULT_FLATNESS 0.5
+#define svgtiny_MIN_FLATNESS 0.01
+
+/* fraction bits of fixed point paths, see svgtiny_set_fixed_point() */
+#define svgtiny_DEFAULT_FRACTION_BITS 8
+#define svgtiny_MAX_FRACTION_BITS 16
+
+/* longest miter at a join, as a multiple of the stroke width, as the SVG
+ * default stroke-miterlimit, so a stroke reaches up to half this times its
+ * width from the path */
+#define svgtiny_MITER_LIMIT 4
+
 #define svgtiny_LINEAR_GRADIENT 0x2000000
+#define svgtiny_RADIAL_GRADIENT 0x3000000
 
-struct svgtiny_parse_state {
+/* entries in the colour lookup table of a gradient ramp */
+#define svgtiny_RAMP_SIZE 256
+
+/* the stops of a gradient, shared between gradients (svgtiny_ramp.c) */
+struct svgtiny_gradient_ramp {
+	unsigned int refcount;
+	unsigned int stop_count;
+	struct svgtiny_gradient_stop *stop;
+	/* colours from offset 0 to 1, or NULL until svgtiny_ramp_lut() */
+	svgtiny_colour *lut;
+	bool lut_linear;	/* lut interpolated in linear light */
+};
+
+/* a gradient referenced by a fill or stroke */
+struct svgtiny_gradient {
+	struct svgtiny_gradient_ramp *ramp;	/* NULL if no stops */
+	bool radial;		/* <radialGradient>, else <linearGradient> */
+	dom_string *x1, *y1, *x2, *y2;
+	dom_string *cx, *cy, *r;
+	dom_string *fx, *fy;	/* NULL if at the centre */
+	bool user_space_on_use;
+	int spread;
+	struct {
+		float a, b, c, d, e, f;
+	} transform;
+};
+
+/* a path being flattened to subpaths of points in pixels, for drawing
+ * (svgtiny_path.c) */
+struct svgtiny_lines {
+	float scale;			/* pixels for each pixel of the diagram */
+	float fixed_scale;		/* fixed point units per pixel */
+	float flatness;			/* largest distance in pixels between a
+					   curve and its lines */
+	/* called with each subpath of 2 or more points, which it may change,
+	 * and whether it ended in a close, returning false if memory runs
+	 * out */
+	bool (*subpath)(void *pw, float *point, unsigned int count,
+			bool closed);
+	void *pw;
+	/* points of the subpath being flattened */
+	float *point;
+	unsigned int point_count, point_allocated;
+};
+
+struct svgtiny_gradient_cache;
+struct svgtiny_threads;
+
+/* data shared by every element of one parse, unchanged while parsing, of
+ * which each thread of a parallel parse has a copy with its own diagram */
+struct svgtiny_parse_context {
 	struct svgtiny_diagram *diagram;
 	dom_document *document;
 
+	/* gradients of the document, parsed when first used */
+	struct svgtiny_gradient_cache *gradient_cache;
+
+	/* streaming parser, or NULL when walking a dom_document */
+	struct svgtiny_stream *stream;
+
+	/* threads parsing subtrees of the root, or NULL when parsing on
+	 * one */
+	struct svgtiny_threads *threads;
+
+	/* Interned strings */
+#define SVGTINY_STRING_ACTION2(n,nn) dom_string *interned_##n;
+#include "svgtiny_strings.h"
+#undef SVGTINY_STRING_ACTION2
+
+};
+
+/* state inherited from an element by its children */
+struct svgtiny_parse_state {
+	const struct svgtiny_parse_context *context;
+
 	float viewport_width;
 	float viewport_height;
 
@@ -42,32 +153,86 @@ struct svgtiny_parse_state {
 	svgtiny_colour fill;
 	svgtiny_colour stroke;
 	int stroke_width;
+	int fill_rule;
 
-	/* gradients */
-	unsigned int linear_gradient_stop_count;
-	dom_string *gradient_x1, *gradient_y1, *gradient_x2, *gradient_y2;
-	struct svgtiny_gradient_stop gradient_stop[svgtiny_MAX_STOPS];
-	bool gradient_user_space_on_use;
-	struct {
-		float a, b, c, d, e, f;
-	} gradient_transform;
+	/* last gradient found for fill or stroke, owned by the state which
+	 * found it and borrowed by copies made for child elements */
+	struct svgtiny_gradient *gradient;
+	bool gradient_owned;
 
-	/* Interned strings */
-#define SVGTINY_STRING_ACTION2(n,nn) dom_string *interned_##n;
-#include "svgtiny_strings.h"
-#undef SVGTINY_STRING_ACTION2
+	/* ids of fill and stroke gradients referenced before their
+	 * definition was seen (streaming parser only) */
+	const char *fill_pending, *stroke_pending;
+};
+
+typedef enum {
+	svgtiny_UNIT_NONE,
+	svgtiny_UNIT_PERCENT,
+	svgtiny_UNIT_EM,
+	svgtiny_UNIT_EX,
+	svgtiny_UNIT_PX,
+	svgtiny_UNIT_PT,
+	svgtiny_UNIT_PC,
+	svgtiny_UNIT_MM,
+	svgtiny_UNIT_CM,
+	svgtiny_UNIT_IN,
+	svgtiny_UNIT_UNKNOWN
+} svgtiny_unit;
+
+/* elements which are drawn or contain drawn elements */
+typedef enum {
+	svgtiny_ELEMENT_SVG,
+	svgtiny_ELEMENT_G,
+	svgtiny_ELEMENT_A,
+	svgtiny_ELEMENT_PATH,
+	svgtiny_ELEMENT_RECT,
+	svgtiny_ELEMENT_CIRCLE,
+	svgtiny_ELEMENT_ELLIPSE,
+	svgtiny_ELEMENT_LINE,
+	svgtiny_ELEMENT_POLYLINE,
+	svgtiny_ELEMENT_POLYGON,
+	svgtiny_ELEMENT_TEXT,
+	svgtiny_ELEMENT_TSPAN
+} svgtiny_element;
 
+struct svgtiny_element_name {
+	const char *name;
+	svgtiny_element element;
 };
 
 struct svgtiny_list;
 
 /* svgtiny.c */
-float svgtiny_parse_length(dom_string *s, int viewport_size,
-		const struct svgtiny_parse_state state);
+void svgtiny_setup_state_local(struct svgtiny_parse_state *state);
+void svgtiny_cleanup_state_local(struct svgtiny_parse_state *state);
+float _svgtiny_parse_length(const char *s, const char *end,
+		int viewport_size);
+float svgtiny_parse_length(dom_string *s, int viewport_size);
+void _svgtiny_parse_color(const char *s, svgtiny_colour *c,
+		struct svgtiny_parse_state *state);
 void svgtiny_parse_color(dom_string *s, svgtiny_colour *c,
 		struct svgtiny_parse_state *state);
-void svgtiny_parse_transform(char *s, float *ma, float *mb,
-		float *mc, float *md, float *me, float *mf);
+void svgtiny_parse_fill_rule(const char *s, const char *end, int *rule);
+const char *svgtiny_style_value(const char *style, const char *property,
+		size_t *len);
+void svgtiny_parse_viewbox(const char *s, const char *end,
+		struct svgtiny_parse_state *state);
+svgtiny_code svgtiny_add_path_data(const char *s, const char *end,
+		struct svgtiny_parse_state *state);
+svgtiny_code svgtiny_add_rect(float x, float y, float width, float height,
+		struct svgtiny_parse_state *state);
+svgtiny_code svgtiny_add_ellipse(float x, float y, float rx, float ry,
+		struct svgtiny_parse_state *state);
+svgtiny_code svgtiny_add_line(float x1, float y1, float x2, float y2,
+		struct svgtiny_parse_state *state);
+svgtiny_code svgtiny_add_poly(const char *s, const char *end, bool polygon,
+		struct svgtiny_parse_state *state);
+svgtiny_code svgtiny_add_text(const char *text, size_t len, float x, float y,
+		struct svgtiny_parse_state *state);
+svgtiny_code svgtiny_add_path(float *p, unsigned int n,
+		struct svgtiny_parse_state *state);
+void svgtiny_parse_transform(const char *s, const char *end,
+		float *ma, float *mb, float *mc, float *md, float *me, float *mf);
 struct svgtiny_shape *svgtiny_add_shape(struct svgtiny_parse_state *state);
 void svgtiny_transform_path(float *p, unsigned int n,
 		struct svgtiny_parse_state *state);
@@ -79,10 +244,99 @@ char *svgtiny_strndup(const char *s, size_t n);
 #define strndup svgtiny_strndup
 #endif
 
+/* svgtiny_bezier.c */
+unsigned int svgtiny_bezier_steps(const float *c, const float *m,
+		float flatness);
+void svgtiny_bezier_points(const float *c, unsigned int steps, float *out);
+
+/* svgtiny_clip.c */
+svgtiny_code svgtiny_clip_path(const float *p, unsigned int n,
+		const struct svgtiny_parse_state *state,
+		float **clipped, unsigned int *length);
+
+/* svgtiny_index.c */
+void svgtiny_path_extent(const float *p, unsigned int n, const float *m,
+		float *x0, float *y0, float *x1, float *y1);
+void svgtiny_mesh_extent(struct svgtiny_shape *shape);
+
+/* svgtiny_path.c */
+svgtiny_code svgtiny_shape_path(struct svgtiny_shape *shape, float *p,
+		unsigned int n, struct svgtiny_parse_state *state);
+bool svgtiny_lines_flatten(struct svgtiny_lines *lines,
+		const struct svgtiny_shape *shape);
+
+/* svgtiny_arena.c */
+void *svgtiny_arena_alloc(struct svgtiny_diagram *diagram, size_t size);
+void *svgtiny_arena_copy(struct svgtiny_diagram *diagram, const void *data,
+		size_t size);
+struct svgtiny_mesh *svgtiny_arena_mesh(struct svgtiny_diagram *diagram,
+		unsigned int vertex_count, unsigned int index_count);
+struct svgtiny_mesh *svgtiny_mesh_create(unsigned int vertex_count,
+		unsigned int index_count);
+struct svgtiny_linear_gradient *svgtiny_arena_linear_gradient(
+		struct svgtiny_diagram *diagram, unsigned int stop_count);
+void svgtiny_compact_diagram(struct svgtiny_diagram *diagram);
+svgtiny_code svgtiny_arena_detach(struct svgtiny_diagram *diagram,
+		unsigned int shape_count);
+svgtiny_code svgtiny_arena_join(struct svgtiny_diagram *diagram,
+		struct svgtiny_diagram *part);
+void svgtiny_arena_free(struct svgtiny_diagram *diagram);
+
 /* svgtiny_gradient.c */
-void svgtiny_find_gradient(const char *id, struct svgtiny_parse_state *state);
+void svgtiny_find_gradient(const char *id, struct svgtiny_gradient *gradient,
+		const struct svgtiny_parse_context *context);
+struct svgtiny_gradient *svgtiny_gradient_copy(
+		const struct svgtiny_gradient *gradient);
+void svgtiny_gradient_free(struct svgtiny_gradient *gradient);
+void svgtiny_gradient_clear(struct svgtiny_gradient *gradient);
+struct svgtiny_gradient_cache *svgtiny_gradient_cache_create(void);
+void svgtiny_gradient_cache_free(struct svgtiny_gradient_cache *cache);
+int svgtiny_parse_spread(const char *s);
+float svgtiny_parse_gradient_offset(const char *s, const char *end);
 svgtiny_code svgtiny_add_path_linear_gradient(float *p, unsigned int n,
 		struct svgtiny_parse_state *state);
+svgtiny_code svgtiny_add_path_radial_gradient(float *p, unsigned int n,
+		struct svgtiny_parse_state *state);
+
+/* svgtiny_ramp.c */
+struct svgtiny_gradient_ramp *svgtiny_ramp_create(
+		const struct svgtiny_gradient_stop *stop,
+		unsigned int stop_count);
+struct svgtiny_gradient_ramp *svgtiny_ramp_ref(
+		struct svgtiny_gradient_ramp *ramp);
+void svgtiny_ramp_unref(struct svgtiny_gradient_ramp *ramp);
+svgtiny_code svgtiny_ramp_lut(struct svgtiny_gradient_ramp *ramp,
+		bool linear);
+svgtiny_colour svgtiny_ramp_colour(const struct svgtiny_gradient_ramp *ramp,
+		float r);
+unsigned int svgtiny_ramp_knots(const struct svgtiny_gradient_ramp *ramp,
+		struct svgtiny_gradient_stop *knot);
+
+/* svgtiny_stream.c */
+void svgtiny_stream_find_gradient(const char *id,
+		struct svgtiny_gradient *gradient,
+		const struct svgtiny_parse_context *context);
+svgtiny_code svgtiny_stream_defer_path(float *p, unsigned int n,
+		struct svgtiny_parse_state *state);
+svgtiny_code svgtiny_stream_defer_text(const char *text, size_t len,
+		float x, float y, struct svgtiny_parse_state *state);
+
+/* svgtiny_threads.c */
+unsigned int svgtiny_threads_count(unsigned int threads);
+svgtiny_code svgtiny_threads_run(unsigned int threads, unsigned int count,
+		void (*work)(struct svgtiny_threads *threads, void *pw),
+		void *pw);
+bool svgtiny_threads_next(struct svgtiny_threads *threads,
+		unsigned int *item, svgtiny_code code);
+void svgtiny_threads_lock(struct svgtiny_threads *threads);
+void svgtiny_threads_unlock(struct svgtiny_threads *threads);
+
+/* svgtiny_number.c */
+const char *svgtiny_skip_wsp(const char *s, const char *end);
+const char *svgtiny_skip_comma_wsp(const char *s, const char *end);
+bool svgtiny_parse_number(const char **sp, const char *end, float *value);
+bool svgtiny_parse_dimension(const char **sp, const char *end, float *value,
+		svgtiny_unit *unit);
 
 /* svgtiny_list.c */
 struct svgtiny_list *svgtiny_list_create(size_t item_size);
@@ -99,4 +353,9 @@ const struct svgtiny_named_color *
 		svgtiny_color_lookup(register const char *str,
 				register unsigned int len);
 
+/* elements.gperf */
+const struct svgtiny_element_name *
+		svgtiny_element_lookup(register const char *str,
+				register unsigned int len);
+
 #endif
@@ -0,0 +1,326 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Locale independent lexer for numbers, lengths and percentages.
+ *
+ * All functions work on a span of characters (start, end), which need not be
+ * NUL terminated, so attribute values can be lexed straight from a dom_string.
+ */
+
+#include <locale.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* powers of ten which are exact as doubles */
+static const double svgtiny_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/**
+ * Skip whitespace.
+ */
+
+const char *svgtiny_skip_wsp(const char *s, const char *end)
+{
+	while (s != end && (*s == ' ' || *s == '\t' || *s == '\n' ||
+			*s == '\r' || *s == '\f' || *s == '\v'))
+		s++;
+	return s;
+}
+
+
+/**
+ * Skip whitespace and commas, as found between numbers in a list.
+ */
+
+const char *svgtiny_skip_comma_wsp(const char *s, const char *end)
+{
+	while (s != end && (*s == ' ' || *s == ',' || *s == '\t' ||
+			*s == '\n' || *s == '\r' || *s == '\f' || *s == '\v'))
+		s++;
+	return s;
+}
+
+
+/**
+ * Load 8 bytes as a little endian word, whatever the host byte order.
+ */
+
+static uint64_t svgtiny_load8(const char *s)
+{
+	const unsigned char *u = (const unsigned char *) s;
+	return (uint64_t) u[0] | (uint64_t) u[1] << 8 |
+			(uint64_t) u[2] << 16 | (uint64_t) u[3] << 24 |
+			(uint64_t) u[4] << 32 | (uint64_t) u[5] << 40 |
+			(uint64_t) u[6] << 48 | (uint64_t) u[7] << 56;
+}
+
+
+/**
+ * Test if all 8 bytes of a word are ASCII digits.
+ */
+
+static bool svgtiny_is_eight_digits(uint64_t v)
+{
+	return ((v & 0xf0f0f0f0f0f0f0f0ULL) |
+			(((v + 0x0606060606060606ULL) &
+			0xf0f0f0f0f0f0f0f0ULL) >> 4)) ==
+			0x3333333333333333ULL;
+}
+
+
+/**
+ * Convert a word of 8 ASCII digits to its value, most significant first.
+ */
+
+static uint32_t svgtiny_eight_digits(uint64_t v)
+{
+	const uint64_t mask = 0x000000ff000000ffULL;
+	const uint64_t mul1 = 0x000f424000000064ULL; /* 100 + (1000000 << 32) */
+	const uint64_t mul2 = 0x0000271000000001ULL; /* 1 + (10000 << 32) */
+	v -= 0x3030303030303030ULL;
+	v = (v * 10) + (v >> 8);
+	v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+	return (uint32_t) v;
+}
+
+
+/**
+ * Accumulate a run of digits into a mantissa.
+ *
+ * Runs of 8 digits, as in long coordinate lists, are converted a word at a
+ * time. Digits which no longer fit the mantissa clear *exact.
+ */
+
+static const char *svgtiny_digits(const char *s, const char *end,
+		uint64_t *mantissa, bool *exact)
+{
+	uint64_t m = *mantissa;
+
+	while (8 <= end - s && m < 100000000000ULL) {
+		uint64_t v = svgtiny_load8(s);
+		if (!svgtiny_is_eight_digits(v))
+			break;
+		m = m * 100000000 + svgtiny_eight_digits(v);
+		s += 8;
+	}
+	while (s != end && '0' <= *s && *s <= '9') {
+		if (m < 1000000000000000000ULL)
+			m = m * 10 + (*s - '0');
+		else
+			*exact = false;
+		s++;
+	}
+
+	*mantissa = m;
+	return s;
+}
+
+
+/**
+ * Convert a number which the fast path can't handle exactly.
+ *
+ * strtof() expects the locale's decimal point, so substitute it for '.'.
+ */
+
+static float svgtiny_number_slow(const char *s, const char *end)
+{
+	const char *point = localeconv()->decimal_point;
+	size_t point_len = strlen(point);
+	size_t len = end - s;
+	char buf[64];
+	char *copy = buf;
+	char *d;
+	float value;
+
+	if (sizeof buf < len * point_len + 1) {
+		copy = malloc(len * point_len + 1);
+		if (!copy)
+			return 0;
+	}
+
+	for (d = copy; s != end; s++) {
+		if (*s == '.') {
+			memcpy(d, point, point_len);
+			d += point_len;
+		} else {
+			*d++ = *s;
+		}
+	}
+	*d = 0;
+
+	value = strtof(copy, NULL);
+
+	if (copy != buf)
+		free(copy);
+	return value;
+}
+
+
+/**
+ * Parse a number.
+ *
+ * Accepts the SVG number grammar only, independent of the C locale: an
+ * optional sign, digits with an optional fraction, and an optional exponent.
+ * So "1.5.5" and "1-2" are two numbers each, and the 'e' of "1em" is a unit.
+ *
+ * Conversion is exact. The common case takes Clinger's fast path: the
+ * mantissa and a power of ten are both exact doubles, so one correctly
+ * rounded operation gives the result, and the limits below ensure that
+ * rounding the double to a float can't round twice.
+ *
+ * \param  sp     start of number, updated to the end on success
+ * \param  end    end of span
+ * \param  value  updated with number on success
+ * \return  true on success, false if there is no number at *sp
+ */
+
+bool svgtiny_parse_number(const char **sp, const char *end, float *value)
+{
+	const char *s = *sp;
+	const char *start = s;
+	const char *digits;
+	bool negative = false;
+	bool exact = true;
+	bool have_digits;
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	double d;
+
+	if (s != end && (*s == '+' || *s == '-')) {
+		negative = *s == '-';
+		s++;
+	}
+
+	digits = s;
+	s = svgtiny_digits(s, end, &mantissa, &exact);
+	have_digits = s != digits;
+	if (s != end && *s == '.') {
+		s++;
+		digits = s;
+		s = svgtiny_digits(s, end, &mantissa, &exact);
+		have_digits = have_digits || s != digits;
+		exponent = -(int) (s - digits);
+	}
+	if (!have_digits)
+		return false;
+
+	if (s != end && (*s == 'e' || *s == 'E')) {
+		const char *e = s + 1;
+		bool negative_exponent = false;
+		int n = 0;
+		if (e != end && (*e == '+' || *e == '-')) {
+			negative_exponent = *e == '-';
+			e++;
+		}
+		if (e != end && '0' <= *e && *e <= '9') {
+			while (e != end && '0' <= *e && *e <= '9') {
+				if (n < 100000)
+					n = n * 10 + (*e - '0');
+				e++;
+			}
+			exponent += negative_exponent ? -n : n;
+			s = e;
+		}
+	}
+
+	*sp = s;
+
+	if (mantissa == 0 && exact) {
+		*value = negative ? -0.0f : 0.0f;
+		return true;
+	}
+
+	if (!exact || (((uint64_t) 1) << 53) < mantissa) {
+		*value = svgtiny_number_slow(start, s);
+		return true;
+	}
+
+	if (exponent == 0) {
+		d = (double) mantissa;
+	} else if (0 < exponent && exponent <= 22 &&
+			(double) mantissa * svgtiny_pow10[exponent] <
+			9007199254740992.0) {
+		d = (double) mantissa * svgtiny_pow10[exponent];
+	} else if (-8 <= exponent && exponent < 0 &&
+			mantissa <= (((uint64_t) 1) << 52)) {
+		d = (double) mantissa / svgtiny_pow10[-exponent];
+	} else {
+		*value = svgtiny_number_slow(start, s);
+		return true;
+	}
+
+	*value = (float) (negative ? -d : d);
+	return true;
+}
+
+
+/**
+ * Parse a number followed by an optional unit.
+ *
+ * \param  sp     start of dimension, updated to the end on success
+ * \param  end    end of span
+ * \param  value  updated with number on success
+ * \param  unit   updated with unit on success
+ * \return  true on success, false if there is no number at *sp
+ */
+
+bool svgtiny_parse_dimension(const char **sp, const char *end, float *value,
+		svgtiny_unit *unit)
+{
+	static const struct {
+		char name[3];
+		svgtiny_unit unit;
+	} units[] = {
+		{ "em", svgtiny_UNIT_EM },
+		{ "ex", svgtiny_UNIT_EX },
+		{ "px", svgtiny_UNIT_PX },
+		{ "pt", svgtiny_UNIT_PT },
+		{ "pc", svgtiny_UNIT_PC },
+		{ "mm", svgtiny_UNIT_MM },
+		{ "cm", svgtiny_UNIT_CM },
+		{ "in", svgtiny_UNIT_IN }
+	};
+	const char *s = *sp;
+	const char *u;
+	unsigned int i;
+
+	if (!svgtiny_parse_number(&s, end, value))
+		return false;
+
+	*unit = svgtiny_UNIT_NONE;
+	if (s != end && *s == '%') {
+		*unit = svgtiny_UNIT_PERCENT;
+		s++;
+	} else {
+		for (u = s; s != end && (('a' <= *s && *s <= 'z') ||
+				('A' <= *s && *s <= 'Z')); s++)
+			;
+		if (s - u == 2) {
+			*unit = svgtiny_UNIT_UNKNOWN;
+			for (i = 0; i != sizeof units / sizeof units[0]; i++) {
+				if (u[0] == units[i].name[0] &&
+						u[1] == units[i].name[1]) {
+					*unit = units[i].unit;
+					break;
+				}
+			}
+		} else if (s != u) {
+			*unit = svgtiny_UNIT_UNKNOWN;
+		}
+	}
+
+	*sp = s;
+	return true;
+}
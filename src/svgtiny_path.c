@@ -0,0 +1,856 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Path layouts.
+ *
+ * A path is stored in its shape in one of two layouts. By default it is one
+ * array of floats, in which each segment type code is followed by the
+ * coordinates of the segment's points. With svgtiny_PACKED_PATHS the type
+ * codes are bytes in one array and the points are packed in another, so that
+ * the coordinates can be processed in one loop without decoding segments.
+ * svgtiny_path_next() reads a path in either layout.
+ *
+ * svgtiny_FIXED_PATHS and svgtiny_SHORT_FIXED_PATHS pack paths in the same
+ * way, but with the points as fixed point integers, rounded as they are
+ * transformed to pixels.
+ *
+ * svgtiny_flatten() replaces the beziers of paths in any layout with lines,
+ * for renderers which only draw polygons. svgtiny_lines_flatten() reads a
+ * path in any layout as subpaths of points in pixels, for svgtiny_render()
+ * and svgtiny_render_sdf().
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* number of points following each segment type */
+static const unsigned char svgtiny_path_points[] = {
+	1,	/* svgtiny_PATH_MOVE */
+	0,	/* svgtiny_PATH_CLOSE */
+	1,	/* svgtiny_PATH_LINE */
+	3	/* svgtiny_PATH_BEZIER */
+};
+
+/* fixed point coordinates are clamped to +/- this, so that the difference
+ * of two fits in an int32_t */
+#define svgtiny_FIXED_MAX 1073741824.0f
+
+static svgtiny_code svgtiny_store_path(struct svgtiny_shape *shape, float *p,
+		unsigned int n, struct svgtiny_parse_state *state);
+static void svgtiny_transform_points(float *out, const float *point,
+		unsigned int count, const struct svgtiny_parse_state *state);
+static void svgtiny_transform_fixed(int32_t *out, const float *point,
+		unsigned int count, const struct svgtiny_parse_state *state);
+static int32_t svgtiny_round_fixed(float v);
+static bool svgtiny_fixed_short(struct svgtiny_shape *shape,
+		const int32_t *fixed, unsigned int count,
+		struct svgtiny_diagram *diagram);
+static void svgtiny_lines_pixels(const struct svgtiny_lines *lines,
+		const struct svgtiny_shape *shape,
+		const struct svgtiny_path_segment *segment, float *xy);
+static bool svgtiny_lines_push(struct svgtiny_lines *lines,
+		unsigned int count);
+static bool svgtiny_lines_end(struct svgtiny_lines *lines, bool closed);
+static bool svgtiny_path_curved(const struct svgtiny_shape *shape);
+static svgtiny_code svgtiny_flatten_shape(struct svgtiny_shape *shape,
+		float tolerance, struct svgtiny_diagram *diagram);
+static unsigned int svgtiny_flatten_path(const float *p, unsigned int n,
+		float flatness, float *out);
+static unsigned int svgtiny_flatten_packed(const struct svgtiny_shape *shape,
+		float flatness, struct svgtiny_shape *out, float *line);
+static void svgtiny_packed_get(const struct svgtiny_shape *shape,
+		unsigned int i, float *xy);
+static void svgtiny_packed_copy(const struct svgtiny_shape *shape,
+		unsigned int i, unsigned int count, struct svgtiny_shape *out);
+static void svgtiny_packed_lines(const float *curve, unsigned int steps,
+		struct svgtiny_shape *out, float *line);
+
+
+/**
+ * Transform a path to pixels and store it in a shape.
+ *
+ * The path is copied into the diagram as it is or, with svgtiny_PACKED_PATHS,
+ * svgtiny_FIXED_PATHS, or svgtiny_SHORT_FIXED_PATHS, as segment types and
+ * points, and its bounding box is set. With svgtiny_CLIP_PATHS it is first
+ * clipped to the clip rectangle. p is changed, but not freed.
+ *
+ * \return  svgtiny_OK, or svgtiny_OUT_OF_MEMORY
+ */
+
+svgtiny_code svgtiny_shape_path(struct svgtiny_shape *shape, float *p,
+		unsigned int n, struct svgtiny_parse_state *state)
+{
+	const struct svgtiny_diagram_internal *internal =
+			svgtiny_diagram_internal(state->context->diagram);
+	float *clipped;
+	svgtiny_code code;
+
+	if (!(internal->options & svgtiny_CLIP_PATHS) || !internal->clip)
+		return svgtiny_store_path(shape, p, n, state);
+
+	code = svgtiny_clip_path(p, n, state, &clipped, &n);
+	if (code != svgtiny_OK)
+		return code;
+	code = svgtiny_store_path(shape, clipped, n, state);
+	free(clipped);
+	return code;
+}
+
+
+/**
+ * Transform a path to pixels and store it in a shape, in the layout given
+ * by the options.
+ */
+
+svgtiny_code svgtiny_store_path(struct svgtiny_shape *shape, float *p,
+		unsigned int n, struct svgtiny_parse_state *state)
+{
+	struct svgtiny_diagram *diagram = state->context->diagram;
+	unsigned int options = svgtiny_diagram_internal(diagram)->options;
+	unsigned int op_count = 0, point_count = 0;
+	unsigned int i, j, k;
+	unsigned char *op;
+
+	svgtiny_path_extent(p, n, &state->ctm.a, &shape->bbox_x0,
+			&shape->bbox_y0, &shape->bbox_x1, &shape->bbox_y1);
+
+	if (!(options & (svgtiny_PACKED_PATHS | svgtiny_FIXED_PATHS |
+			svgtiny_SHORT_FIXED_PATHS))) {
+		svgtiny_transform_path(p, n, state);
+		shape->path = svgtiny_arena_copy(diagram, p, n * sizeof p[0]);
+		if (!shape->path)
+			return svgtiny_OUT_OF_MEMORY;
+		shape->path_length = n;
+		return svgtiny_OK;
+	}
+
+	for (j = 0; j != n; ) {
+		unsigned int type = (unsigned int) p[j];
+		assert(type <= svgtiny_PATH_BEZIER);
+		op_count++;
+		point_count += svgtiny_path_points[type];
+		j += 1 + 2 * svgtiny_path_points[type];
+	}
+
+	op = svgtiny_arena_alloc(diagram, op_count);
+	if (!op)
+		return svgtiny_OUT_OF_MEMORY;
+
+	/* move the points together at the start of p */
+	for (i = 0, j = 0, k = 0; j != n; i++) {
+		unsigned int type = (unsigned int) p[j];
+		unsigned int coordinates = 2 * svgtiny_path_points[type];
+		op[i] = type;
+		memmove(p + k, p + j + 1, coordinates * sizeof p[0]);
+		k += coordinates;
+		j += 1 + coordinates;
+	}
+
+	if (options & (svgtiny_FIXED_PATHS | svgtiny_SHORT_FIXED_PATHS)) {
+		int32_t *fixed = svgtiny_arena_alloc(diagram,
+				2 * point_count * sizeof fixed[0]);
+		if (!fixed)
+			return svgtiny_OUT_OF_MEMORY;
+		svgtiny_transform_fixed(fixed, p, point_count, state);
+		if (!(options & svgtiny_SHORT_FIXED_PATHS) ||
+				!svgtiny_fixed_short(shape, fixed, point_count,
+				diagram))
+			shape->path_fixed = fixed;
+	} else {
+		float *point = svgtiny_arena_alloc(diagram,
+				2 * point_count * sizeof point[0]);
+		if (!point)
+			return svgtiny_OUT_OF_MEMORY;
+		svgtiny_transform_points(point, p, point_count, state);
+		shape->path_point = point;
+	}
+
+	shape->path_op = op;
+	shape->path_op_count = op_count;
+	shape->path_point_count = point_count;
+	return svgtiny_OK;
+}
+
+
+/**
+ * Apply the current transformation matrix to an array of points.
+ */
+
+void svgtiny_transform_points(float *out, const float *point,
+		unsigned int count, const struct svgtiny_parse_state *state)
+{
+	/* copied so that the compiler knows they don't alias out */
+	const float a = state->ctm.a, b = state->ctm.b, c = state->ctm.c,
+			d = state->ctm.d, e = state->ctm.e, f = state->ctm.f;
+	/* a size_t index can't wrap, so the loads and stores are seen as
+	 * consecutive and x and y go in the lanes of one vector */
+	size_t i;
+
+	for (i = 0; i != 2 * (size_t) count; i += 2) {
+		float x = point[i], y = point[i + 1];
+		out[i] = a * x + c * y + e;
+		out[i + 1] = b * x + d * y + f;
+	}
+}
+
+
+/**
+ * Apply the current transformation matrix to an array of points, and round
+ * them to fixed point.
+ *
+ * The scale of the fixed point is folded into the matrix, so each coordinate
+ * takes one multiply-add per term and a rounding.
+ */
+
+void svgtiny_transform_fixed(int32_t *out, const float *point,
+		unsigned int count, const struct svgtiny_parse_state *state)
+{
+	const float scale = (float) (1 << svgtiny_diagram_internal(
+			state->context->diagram)->fraction_bits);
+	const float a = state->ctm.a * scale, b = state->ctm.b * scale,
+			c = state->ctm.c * scale, d = state->ctm.d * scale,
+			e = state->ctm.e * scale, f = state->ctm.f * scale;
+	size_t i;
+
+	for (i = 0; i != 2 * (size_t) count; i += 2) {
+		float x = point[i], y = point[i + 1];
+		out[i] = svgtiny_round_fixed(a * x + c * y + e);
+		out[i + 1] = svgtiny_round_fixed(b * x + d * y + f);
+	}
+}
+
+
+/**
+ * Round a coordinate to the nearest fixed point value, clamped to range.
+ */
+
+int32_t svgtiny_round_fixed(float v)
+{
+	/* gcc won't vectorize fminf() or ?: on floats without -ffast-math,
+	 * but will a comparison giving an int, so the value is selected with
+	 * masks; a NaN becomes -svgtiny_FIXED_MAX */
+	int32_t inside = -(int32_t) (fabsf(v) <= svgtiny_FIXED_MAX);
+	int32_t limit = (2 * (int32_t) (0 < v) - 1) *
+			(int32_t) svgtiny_FIXED_MAX;
+	int32_t bits;
+
+	/* 0 if out of range, which converts safely */
+	memcpy(&bits, &v, sizeof bits);
+	bits &= inside;
+	memcpy(&v, &bits, sizeof v);
+
+	return ((int32_t) (v + copysignf(0.5f, v)) & inside) |
+			(limit & ~inside);
+}
+
+
+/**
+ * Store fixed point coordinates as 16 bits from an origin, if they fit.
+ *
+ * \return  true if shape->path_short was set, false if the coordinates span
+ *          too far or memory runs out
+ */
+
+bool svgtiny_fixed_short(struct svgtiny_shape *shape, const int32_t *fixed,
+		unsigned int count, struct svgtiny_diagram *diagram)
+{
+	int32_t min_x = INT32_MAX, min_y = INT32_MAX;
+	int32_t max_x = INT32_MIN, max_y = INT32_MIN;
+	int32_t origin_x, origin_y;
+	int16_t *out;
+	unsigned int i;
+
+	for (i = 0; i != count; i++) {
+		int32_t x = fixed[2 * i], y = fixed[2 * i + 1];
+		min_x = x < min_x ? x : min_x;
+		max_x = max_x < x ? x : max_x;
+		min_y = y < min_y ? y : min_y;
+		max_y = max_y < y ? y : max_y;
+	}
+	if (count == 0)
+		min_x = max_x = min_y = max_y = 0;
+	if (65535 < max_x - min_x || 65535 < max_y - min_y)
+		return false;
+
+	out = svgtiny_arena_alloc(diagram, 2 * count * sizeof out[0]);
+	if (!out)
+		return false;
+
+	origin_x = min_x + 32768;
+	origin_y = min_y + 32768;
+	for (i = 0; i != count; i++) {
+		out[2 * i] = (int16_t) (fixed[2 * i] - origin_x);
+		out[2 * i + 1] = (int16_t) (fixed[2 * i + 1] - origin_y);
+	}
+
+	shape->path_short = out;
+	shape->path_origin_x = origin_x;
+	shape->path_origin_y = origin_y;
+	return true;
+}
+
+
+/**
+ * Start reading the path of a shape, in either layout.
+ */
+
+void svgtiny_path_begin(struct svgtiny_path_iterator *iterator,
+		const struct svgtiny_shape *shape)
+{
+	iterator->path = iterator->path_end = shape->path;
+	if (shape->path)
+		iterator->path_end += shape->path_length;
+	iterator->op = iterator->op_end = shape->path_op;
+	if (shape->path_op)
+		iterator->op_end += shape->path_op_count;
+	iterator->point = shape->path_point;
+	iterator->fixed = shape->path_fixed;
+	iterator->fixed_short = shape->path_short;
+}
+
+
+/**
+ * Read the next segment of a path.
+ *
+ * \param  iterator  position in the path, from svgtiny_path_begin()
+ * \param  segment   updated with the segment type and its points, in the
+ *                   member for the layout of the path, which are valid as
+ *                   long as the diagram
+ * \return  1 if segment was updated, or 0 at the end of the path
+ */
+
+int svgtiny_path_next(struct svgtiny_path_iterator *iterator,
+		struct svgtiny_path_segment *segment)
+{
+	int type;
+
+	if (iterator->op != iterator->op_end) {
+		unsigned int coordinates;
+		type = *iterator->op++;
+		coordinates = 2 * svgtiny_path_points[type];
+		segment->type = type;
+		segment->point = iterator->point;
+		segment->fixed = iterator->fixed;
+		segment->fixed_short = iterator->fixed_short;
+		if (iterator->point)
+			iterator->point += coordinates;
+		else if (iterator->fixed)
+			iterator->fixed += coordinates;
+		else
+			iterator->fixed_short += coordinates;
+		return 1;
+	}
+
+	if (iterator->path == iterator->path_end)
+		return 0;
+	type = (int) iterator->path[0];
+	if (type < svgtiny_PATH_MOVE || svgtiny_PATH_BEZIER < type ||
+			iterator->path_end - iterator->path <
+			1 + 2 * svgtiny_path_points[type]) {
+		/* not a path from this library */
+		iterator->path = iterator->path_end;
+		return 0;
+	}
+	segment->type = type;
+	segment->point = iterator->path + 1;
+	segment->fixed = 0;
+	segment->fixed_short = 0;
+	iterator->path += 1 + 2 * svgtiny_path_points[type];
+	return 1;
+}
+
+
+/**
+ * Flatten the path of a shape to subpaths of points in pixels.
+ *
+ * Beziers are divided into lines within lines->flatness of the curve, and
+ * lines->subpath() is called for each subpath as it ends. A subpath which
+ * ends in a close is followed by one starting at the same point.
+ *
+ * \param  lines  scales, flatness, and callback, and the points, which are
+ *                reused from call to call, and freed by the caller
+ * \return  false if memory runs out, or the callback returned false
+ */
+
+bool svgtiny_lines_flatten(struct svgtiny_lines *lines,
+		const struct svgtiny_shape *shape)
+{
+	struct svgtiny_path_iterator iterator;
+	struct svgtiny_path_segment segment;
+	float start[2] = { 0, 0 };
+
+	lines->point_count = 0;
+	svgtiny_path_begin(&iterator, shape);
+	while (svgtiny_path_next(&iterator, &segment)) {
+		float xy[6];
+		float curve[8];
+		unsigned int steps;
+
+		svgtiny_lines_pixels(lines, shape, &segment, xy);
+		switch (segment.type) {
+		case svgtiny_PATH_MOVE:
+			if (!svgtiny_lines_end(lines, false))
+				return false;
+			start[0] = xy[0];
+			start[1] = xy[1];
+			/* fall through */
+		case svgtiny_PATH_LINE:
+			if (!svgtiny_lines_push(lines, 1))
+				return false;
+			lines->point[2 * lines->point_count - 2] = xy[0];
+			lines->point[2 * lines->point_count - 1] = xy[1];
+			break;
+		case svgtiny_PATH_CLOSE:
+			if (!svgtiny_lines_end(lines, true))
+				return false;
+			/* a new subpath starts where the last started */
+			if (!svgtiny_lines_push(lines, 1))
+				return false;
+			lines->point[0] = start[0];
+			lines->point[1] = start[1];
+			break;
+		case svgtiny_PATH_BEZIER:
+			if (lines->point_count == 0)
+				break;
+			memcpy(curve, lines->point + 2 * lines->point_count - 2,
+					2 * sizeof curve[0]);
+			memcpy(curve + 2, xy, 6 * sizeof curve[0]);
+			steps = svgtiny_bezier_steps(curve, NULL,
+					lines->flatness);
+			if (!svgtiny_lines_push(lines, steps))
+				return false;
+			svgtiny_bezier_points(curve, steps, lines->point +
+					2 * (lines->point_count - steps));
+			break;
+		}
+	}
+
+	return svgtiny_lines_end(lines, false);
+}
+
+
+/**
+ * Get the points of a path segment in pixels.
+ */
+
+void svgtiny_lines_pixels(const struct svgtiny_lines *lines,
+		const struct svgtiny_shape *shape,
+		const struct svgtiny_path_segment *segment, float *xy)
+{
+	unsigned int count = segment->type == svgtiny_PATH_BEZIER ? 6 :
+			segment->type == svgtiny_PATH_CLOSE ? 0 : 2;
+	unsigned int i;
+
+	if (segment->point) {
+		for (i = 0; i != count; i++)
+			xy[i] = segment->point[i] * lines->scale;
+	} else if (segment->fixed) {
+		for (i = 0; i != count; i++)
+			xy[i] = segment->fixed[i] / lines->fixed_scale *
+					lines->scale;
+	} else if (segment->fixed_short) {
+		for (i = 0; i != count; i += 2) {
+			xy[i] = (segment->fixed_short[i] +
+					shape->path_origin_x) /
+					lines->fixed_scale * lines->scale;
+			xy[i + 1] = (segment->fixed_short[i + 1] +
+					shape->path_origin_y) /
+					lines->fixed_scale * lines->scale;
+		}
+	}
+}
+
+
+/**
+ * Make room for more points at the end of the subpath.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_lines_push(struct svgtiny_lines *lines, unsigned int count)
+{
+	if (lines->point_allocated - lines->point_count < count) {
+		unsigned int allocated = lines->point_allocated * 2;
+		float *point;
+		if (allocated < lines->point_count + count)
+			allocated = lines->point_count + count + 64;
+		point = realloc(lines->point,
+				2 * allocated * sizeof point[0]);
+		if (!point)
+			return false;
+		lines->point = point;
+		lines->point_allocated = allocated;
+	}
+	lines->point_count += count;
+	return true;
+}
+
+
+/**
+ * Pass the subpath to the callback, if it has 2 or more points, and start a
+ * new subpath.
+ *
+ * \param  closed  the subpath ended in a close
+ * \return  false if the callback returned false
+ */
+
+bool svgtiny_lines_end(struct svgtiny_lines *lines, bool closed)
+{
+	unsigned int n = lines->point_count;
+
+	lines->point_count = 0;
+	if (n < 2)
+		return true;
+	return lines->subpath(lines->pw, lines->point, n, closed);
+}
+
+
+/**
+ * Replace the beziers of every path in a diagram with lines.
+ *
+ * Each bezier is divided into lines between points at equal steps along it,
+ * as few as keep every line within tolerance of the curve. Paths stay in the
+ * layout they were stored in, and their bounding boxes are unchanged.
+ *
+ * \param  diagram    a parsed diagram
+ * \param  tolerance  largest distance of the lines from the curves, in
+ *                    pixels
+ * \return  svgtiny_OK, or svgtiny_OUT_OF_MEMORY, in which case some paths may
+ *          still have beziers, but the diagram is valid
+ */
+
+svgtiny_code svgtiny_flatten(struct svgtiny_diagram *diagram, float tolerance)
+{
+	svgtiny_code code = svgtiny_OK;
+	unsigned int i;
+
+	if (!(svgtiny_MIN_FLATNESS <= tolerance))
+		tolerance = svgtiny_MIN_FLATNESS;
+
+	for (i = 0; i != diagram->shape_count &&
+			!svgtiny_path_curved(&diagram->shape[i]); i++)
+		;
+	if (i == diagram->shape_count)
+		return svgtiny_OK;
+
+	/* the new paths are allocated as while parsing, and then compacted
+	 * with the rest in place of the old */
+	if (svgtiny_diagram_internal(diagram)->compact) {
+		code = svgtiny_arena_detach(diagram, diagram->shape_count);
+		if (code != svgtiny_OK)
+			return code;
+	}
+
+	for (; i != diagram->shape_count && code == svgtiny_OK; i++) {
+		if (svgtiny_path_curved(&diagram->shape[i]))
+			code = svgtiny_flatten_shape(&diagram->shape[i],
+					tolerance, diagram);
+	}
+
+	svgtiny_compact_diagram(diagram);
+	return code;
+}
+
+
+/**
+ * Find if a shape has a path with any beziers.
+ */
+
+bool svgtiny_path_curved(const struct svgtiny_shape *shape)
+{
+	unsigned int j;
+
+	if (shape->path_op)
+		return memchr(shape->path_op, svgtiny_PATH_BEZIER,
+				shape->path_op_count) != NULL;
+
+	for (j = 0; j != shape->path_length; ) {
+		unsigned int type = (unsigned int) shape->path[j];
+		assert(type <= svgtiny_PATH_BEZIER);
+		if (type == svgtiny_PATH_BEZIER)
+			return true;
+		j += 1 + 2 * svgtiny_path_points[type];
+	}
+	return false;
+}
+
+
+/**
+ * Replace the beziers of the path of a shape with lines.
+ *
+ * \return  svgtiny_OK, or svgtiny_OUT_OF_MEMORY, in which case the shape is
+ *          unchanged
+ */
+
+svgtiny_code svgtiny_flatten_shape(struct svgtiny_shape *shape,
+		float tolerance, struct svgtiny_diagram *diagram)
+{
+	struct svgtiny_shape flat = *shape;
+	unsigned int most;
+	float *line = NULL;
+	float scale = 1;
+	size_t size = sizeof flat.path_point[0];
+
+	if (shape->path) {
+		flat.path_length = svgtiny_flatten_path(shape->path,
+				shape->path_length, tolerance, NULL);
+		flat.path = svgtiny_arena_alloc(diagram,
+				flat.path_length * sizeof flat.path[0]);
+		if (!flat.path)
+			return svgtiny_OUT_OF_MEMORY;
+		svgtiny_flatten_path(shape->path, shape->path_length,
+				tolerance, flat.path);
+		*shape = flat;
+		return svgtiny_OK;
+	}
+
+	/* fixed point curves are flattened in fixed point units */
+	if (!shape->path_point)
+		scale = (float) (1 << svgtiny_diagram_internal(
+				diagram)->fraction_bits);
+	if (shape->path_fixed)
+		size = sizeof flat.path_fixed[0];
+	else if (shape->path_short)
+		size = sizeof flat.path_short[0];
+
+	flat.path_op = NULL;
+	most = svgtiny_flatten_packed(shape, tolerance * scale, &flat,
+			NULL);
+	flat.path_op = svgtiny_arena_alloc(diagram, flat.path_op_count);
+	if (!flat.path_op)
+		return svgtiny_OUT_OF_MEMORY;
+	if (shape->path_point)
+		flat.path_point = svgtiny_arena_alloc(diagram,
+				2 * flat.path_point_count * size);
+	else if (shape->path_fixed)
+		flat.path_fixed = svgtiny_arena_alloc(diagram,
+				2 * flat.path_point_count * size);
+	else
+		flat.path_short = svgtiny_arena_alloc(diagram,
+				2 * flat.path_point_count * size);
+	if (!shape->path_point)
+		line = malloc(2 * most * sizeof line[0]);
+	if (!(flat.path_point || flat.path_fixed || flat.path_short) ||
+			(!shape->path_point && !line)) {
+		free(line);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+
+	svgtiny_flatten_packed(shape, tolerance * scale, &flat, line);
+	free(line);
+	*shape = flat;
+	return svgtiny_OK;
+}
+
+
+/**
+ * Replace the beziers of a path in the default layout with lines.
+ *
+ * \param  p         the path
+ * \param  n         length of the path
+ * \param  flatness  largest distance of the lines from the curves
+ * \param  out       updated with the new path, or NULL to find its length
+ * \return  length of the new path
+ */
+
+unsigned int svgtiny_flatten_path(const float *p, unsigned int n,
+		float flatness, float *out)
+{
+	float x = 0, y = 0;		/* current point */
+	float start_x = 0, start_y = 0;	/* start of the subpath */
+	unsigned int length = 0;
+	unsigned int j, k;
+
+	for (j = 0; j != n; ) {
+		unsigned int type = (unsigned int) p[j];
+		unsigned int coordinates = 2 * svgtiny_path_points[type];
+		float curve[8];
+		unsigned int steps;
+
+		if (type != svgtiny_PATH_BEZIER) {
+			if (out)
+				memcpy(out + length, p + j,
+						(1 + coordinates) * sizeof p[0]);
+			length += 1 + coordinates;
+			if (type == svgtiny_PATH_MOVE) {
+				start_x = p[j + 1];
+				start_y = p[j + 2];
+			}
+			x = type == svgtiny_PATH_CLOSE ? start_x : p[j + 1];
+			y = type == svgtiny_PATH_CLOSE ? start_y : p[j + 2];
+			j += 1 + coordinates;
+			continue;
+		}
+
+		curve[0] = x;
+		curve[1] = y;
+		memcpy(curve + 2, p + j + 1, 6 * sizeof p[0]);
+		steps = svgtiny_bezier_steps(curve, NULL, flatness);
+		if (out) {
+			/* the points are found after the space for the
+			 * lines, and spread out from the first to make room
+			 * for the type codes */
+			float *point = out + length + steps;
+			svgtiny_bezier_points(curve, steps, point);
+			for (k = 0; k != steps; k++) {
+				float point_x = point[2 * k];
+				float point_y = point[2 * k + 1];
+				out[length + 3 * k] = svgtiny_PATH_LINE;
+				out[length + 3 * k + 1] = point_x;
+				out[length + 3 * k + 2] = point_y;
+			}
+		}
+		length += 3 * steps;
+		x = p[j + 5];
+		y = p[j + 6];
+		j += 7;
+	}
+
+	return length;
+}
+
+
+/**
+ * Replace the beziers of a path in a packed layout with lines.
+ *
+ * \param  shape     shape with a packed path
+ * \param  flatness  largest distance of the lines from the curves, in the
+ *                   units of the points
+ * \param  out       updated with the counts of the new segments and points,
+ *                   and with the segments and points if out->path_op is not
+ *                   NULL, in the layout of shape
+ * \param  line      space for the points of the longest curve, for fixed
+ *                   point paths
+ * \return  most lines for one curve
+ */
+
+unsigned int svgtiny_flatten_packed(const struct svgtiny_shape *shape,
+		float flatness, struct svgtiny_shape *out, float *line)
+{
+	unsigned int i, j = 0, k;
+	unsigned int start = 0, current = 0;	/* indices of points */
+	unsigned int most = 0;
+
+	out->path_op_count = 0;
+	out->path_point_count = 0;
+	for (i = 0; i != shape->path_op_count; i++) {
+		unsigned int type = shape->path_op[i];
+		unsigned int count = svgtiny_path_points[type];
+		float curve[8];
+		unsigned int steps;
+
+		if (type != svgtiny_PATH_BEZIER) {
+			if (out->path_op) {
+				out->path_op[out->path_op_count] = type;
+				svgtiny_packed_copy(shape, j, count, out);
+			}
+			out->path_op_count++;
+			out->path_point_count += count;
+			if (type == svgtiny_PATH_MOVE)
+				start = j;
+			current = type == svgtiny_PATH_CLOSE ? start : j;
+			j += count;
+			continue;
+		}
+
+		svgtiny_packed_get(shape, current, curve);
+		for (k = 0; k != 3; k++)
+			svgtiny_packed_get(shape, j + k, curve + 2 + 2 * k);
+		steps = svgtiny_bezier_steps(curve, NULL, flatness);
+		if (out->path_op) {
+			memset(out->path_op + out->path_op_count,
+					svgtiny_PATH_LINE, steps);
+			svgtiny_packed_lines(curve, steps, out, line);
+		}
+		out->path_op_count += steps;
+		out->path_point_count += steps;
+		if (most < steps)
+			most = steps;
+		current = j + 2;
+		j += 3;
+	}
+
+	return most;
+}
+
+
+/**
+ * Read a point of a packed path as floats, in the units it is stored in.
+ */
+
+void svgtiny_packed_get(const struct svgtiny_shape *shape, unsigned int i,
+		float *xy)
+{
+	if (shape->path_point) {
+		xy[0] = shape->path_point[2 * i];
+		xy[1] = shape->path_point[2 * i + 1];
+	} else if (shape->path_fixed) {
+		xy[0] = (float) shape->path_fixed[2 * i];
+		xy[1] = (float) shape->path_fixed[2 * i + 1];
+	} else {
+		xy[0] = (float) shape->path_short[2 * i];
+		xy[1] = (float) shape->path_short[2 * i + 1];
+	}
+}
+
+
+/**
+ * Copy points of a packed path to the end of the points of another.
+ */
+
+void svgtiny_packed_copy(const struct svgtiny_shape *shape, unsigned int i,
+		unsigned int count, struct svgtiny_shape *out)
+{
+	unsigned int k = out->path_point_count;
+
+	if (shape->path_point)
+		memcpy(out->path_point + 2 * k, shape->path_point + 2 * i,
+				2 * count * sizeof out->path_point[0]);
+	else if (shape->path_fixed)
+		memcpy(out->path_fixed + 2 * k, shape->path_fixed + 2 * i,
+				2 * count * sizeof out->path_fixed[0]);
+	else
+		memcpy(out->path_short + 2 * k, shape->path_short + 2 * i,
+				2 * count * sizeof out->path_short[0]);
+}
+
+
+/**
+ * Add the ends of the lines approximating a curve to the end of the points
+ * of a packed path.
+ */
+
+void svgtiny_packed_lines(const float *curve, unsigned int steps,
+		struct svgtiny_shape *out, float *line)
+{
+	unsigned int k = out->path_point_count;
+	unsigned int i;
+
+	if (out->path_point) {
+		svgtiny_bezier_points(curve, steps, out->path_point + 2 * k);
+		return;
+	}
+
+	/* the points are within the hull of the curve's, so they fit in the
+	 * same type */
+	svgtiny_bezier_points(curve, steps, line);
+	if (out->path_fixed) {
+		for (i = 0; i != 2 * steps; i++)
+			out->path_fixed[2 * k + i] =
+					svgtiny_round_fixed(line[i]);
+	} else {
+		for (i = 0; i != 2 * steps; i++)
+			out->path_short[2 * k + i] =
+					(int16_t) svgtiny_round_fixed(line[i]);
+	}
+}
@@ -0,0 +1,324 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Gradient colour ramps.
+ *
+ * The stops of a gradient are held in a ramp, which is shared by reference
+ * counting between the gradients which inherit them, so that its colour
+ * lookup table is made once however often the gradient is used. The table
+ * holds the colour at svgtiny_RAMP_SIZE even steps from offset 0 to 1, so
+ * finding the colour at a point needs no search of the stops.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+static svgtiny_colour svgtiny_ramp_lerp(svgtiny_colour colour0,
+		svgtiny_colour colour1, float f, bool linear);
+static unsigned int svgtiny_linear_to_srgb(float linear);
+
+/* sRGB channel values converted to linear light */
+static const float svgtiny_srgb_to_linear[256] = {
+	0.0, 0.000303526984, 0.000607053967, 0.000910580951,
+	0.00121410793, 0.00151763492, 0.0018211619, 0.00212468888,
+	0.00242821587, 0.00273174285, 0.00303526984, 0.00334653576,
+	0.00367650732, 0.00402471702, 0.00439144204, 0.00477695348,
+	0.0051815167, 0.00560539162, 0.00604883302, 0.00651209079,
+	0.00699541019, 0.00749903204, 0.00802319299, 0.00856812562,
+	0.0091340587, 0.00972121732, 0.010329823, 0.010960094,
+	0.0116122452, 0.0122864884, 0.0129830323, 0.013702083,
+	0.0144438436, 0.0152085144, 0.0159962934, 0.0168073758,
+	0.0176419545, 0.0185002201, 0.019382361, 0.0202885631,
+	0.0212190104, 0.0221738848, 0.0231533662, 0.0241576324,
+	0.0251868596, 0.0262412219, 0.0273208916, 0.0284260395,
+	0.0295568344, 0.0307134437, 0.0318960331, 0.0331047666,
+	0.0343398068, 0.0356013149, 0.0368894504, 0.0382043716,
+	0.0395462353, 0.0409151969, 0.0423114106, 0.0437350293,
+	0.0451862044, 0.0466650863, 0.0481718242, 0.049706566,
+	0.0512694584, 0.052860647, 0.0544802764, 0.05612849,
+	0.0578054302, 0.0595112382, 0.0612460542, 0.0630100177,
+	0.0648032667, 0.0666259386, 0.0684781698, 0.0703600957,
+	0.0722718507, 0.0742135684, 0.0761853815, 0.0781874218,
+	0.0802198203, 0.0822827071, 0.0843762115, 0.086500462,
+	0.0886555863, 0.0908417112, 0.0930589628, 0.0953074666,
+	0.0975873471, 0.0998987282, 0.102241733, 0.104616484,
+	0.107023103, 0.109461711, 0.111932428, 0.114435374,
+	0.116970668, 0.119538428, 0.122138772, 0.124771818,
+	0.12743768, 0.130136477, 0.132868322, 0.13563333,
+	0.138431615, 0.141263291, 0.144128471, 0.147027266,
+	0.14995979, 0.152926152, 0.155926464, 0.158960835,
+	0.162029376, 0.165132195, 0.1682694, 0.171441101,
+	0.174647404, 0.177888416, 0.181164244, 0.184474995,
+	0.187820772, 0.191201683, 0.19461783, 0.19806932,
+	0.201556254, 0.205078736, 0.20863687, 0.212230757,
+	0.2158605, 0.2195262, 0.223227957, 0.226965874,
+	0.230740049, 0.234550582, 0.238397574, 0.242281122,
+	0.246201327, 0.250158285, 0.254152094, 0.258182853,
+	0.262250658, 0.266355605, 0.270497791, 0.274677312,
+	0.278894263, 0.28314874, 0.287440838, 0.29177065,
+	0.296138271, 0.300543794, 0.304987314, 0.309468923,
+	0.313988713, 0.318546778, 0.323143209, 0.327778098,
+	0.332451536, 0.337163615, 0.341914425, 0.346704056,
+	0.3515326, 0.356400144, 0.36130678, 0.366252596,
+	0.37123768, 0.376262123, 0.381326011, 0.386429434,
+	0.391572478, 0.396755231, 0.40197778, 0.407240212,
+	0.412542613, 0.417885071, 0.42326767, 0.428690497,
+	0.434153636, 0.439657174, 0.445201195, 0.450785783,
+	0.456411023, 0.462077, 0.467783796, 0.473531496,
+	0.479320183, 0.48514994, 0.49102085, 0.496932995,
+	0.502886458, 0.508881321, 0.514917665, 0.520995573,
+	0.527115126, 0.533276404, 0.539479489, 0.545724461,
+	0.552011402, 0.55834039, 0.564711506, 0.571124829,
+	0.57758044, 0.584078418, 0.590618841, 0.597201788,
+	0.603827339, 0.610495571, 0.617206562, 0.623960392,
+	0.630757136, 0.637596874, 0.644479682, 0.651405637,
+	0.658374817, 0.665387298, 0.672443157, 0.67954247,
+	0.686685312, 0.693871761, 0.701101892, 0.70837578,
+	0.715693501, 0.723055129, 0.73046074, 0.737910409,
+	0.74540421, 0.752942217, 0.760524505, 0.768151147,
+	0.775822218, 0.783537792, 0.79129794, 0.799102738,
+	0.806952258, 0.814846572, 0.822785754, 0.830769877,
+	0.838799012, 0.846873232, 0.854992608, 0.863157213,
+	0.871367119, 0.879622397, 0.887923118, 0.896269353,
+	0.904661174, 0.913098652, 0.921581856, 0.930110858,
+	0.938685728, 0.947306537, 0.955973353, 0.964686248,
+	0.97344529, 0.98225055, 0.991102097, 1.0,
+};
+
+
+/**
+ * Create a ramp from a list of stops.
+ *
+ * Offsets less than that of an earlier stop are raised to it, as the
+ * specification requires.
+ *
+ * \param  stop        stops, in document order
+ * \param  stop_count  number of stops, at least 1
+ * \return  ramp with a reference count of 1, or NULL if memory runs out
+ */
+
+struct svgtiny_gradient_ramp *svgtiny_ramp_create(
+		const struct svgtiny_gradient_stop *stop,
+		unsigned int stop_count)
+{
+	struct svgtiny_gradient_ramp *ramp;
+	unsigned int i;
+
+	ramp = malloc(sizeof *ramp + stop_count * sizeof stop[0]);
+	if (!ramp)
+		return NULL;
+	ramp->refcount = 1;
+	ramp->stop_count = stop_count;
+	ramp->stop = (struct svgtiny_gradient_stop *) (void *) (ramp + 1);
+	ramp->lut = NULL;
+	ramp->lut_linear = false;
+
+	memcpy(ramp->stop, stop, stop_count * sizeof stop[0]);
+	for (i = 1; i != stop_count; i++)
+		if (ramp->stop[i].offset < ramp->stop[i - 1].offset)
+			ramp->stop[i].offset = ramp->stop[i - 1].offset;
+
+	return ramp;
+}
+
+
+/**
+ * Take a reference to a ramp.
+ */
+
+struct svgtiny_gradient_ramp *svgtiny_ramp_ref(
+		struct svgtiny_gradient_ramp *ramp)
+{
+	if (ramp)
+		ramp->refcount++;
+	return ramp;
+}
+
+
+/**
+ * Release a reference to a ramp, freeing it if it was the last.
+ */
+
+void svgtiny_ramp_unref(struct svgtiny_gradient_ramp *ramp)
+{
+	if (!ramp || --ramp->refcount != 0)
+		return;
+	free(ramp->lut);
+	free(ramp);
+}
+
+
+/**
+ * Make the colour lookup table of a ramp, unless it has been made already.
+ *
+ * \param  ramp    ramp to make the table for
+ * \param  linear  interpolate in linear light, instead of sRGB values
+ * \return  svgtiny_OK or svgtiny_OUT_OF_MEMORY
+ */
+
+svgtiny_code svgtiny_ramp_lut(struct svgtiny_gradient_ramp *ramp,
+		bool linear)
+{
+	const struct svgtiny_gradient_stop *stop = ramp->stop;
+	unsigned int count = ramp->stop_count;
+	unsigned int i, k = 0;
+
+	if (ramp->lut && ramp->lut_linear == linear)
+		return svgtiny_OK;
+
+	if (!ramp->lut) {
+		ramp->lut = malloc(svgtiny_RAMP_SIZE * sizeof ramp->lut[0]);
+		if (!ramp->lut)
+			return svgtiny_OUT_OF_MEMORY;
+	}
+	ramp->lut_linear = linear;
+
+	for (i = 0; i != svgtiny_RAMP_SIZE; i++) {
+		float r = (float) i / (svgtiny_RAMP_SIZE - 1);
+		float f;
+
+		/* stop k is the first with offset at least r */
+		while (k != count && stop[k].offset < r)
+			k++;
+		if (k == 0) {
+			ramp->lut[i] = stop[0].color;
+			continue;
+		}
+		if (k == count) {
+			ramp->lut[i] = stop[count - 1].color;
+			continue;
+		}
+		f = (r - stop[k - 1].offset) /
+				(stop[k].offset - stop[k - 1].offset);
+		ramp->lut[i] = svgtiny_ramp_lerp(stop[k - 1].color,
+				stop[k].color, f, linear);
+	}
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Find the colour of a ramp at a distance along its gradient vector.
+ *
+ * The colour lookup table must have been made by svgtiny_ramp_lut(). The
+ * colour is blended from the two nearest entries, which keeps it within
+ * about a level of the exact colour however steep the ramp. The first and
+ * last stop colours pad the ramp outside 0 to 1.
+ */
+
+svgtiny_colour svgtiny_ramp_colour(const struct svgtiny_gradient_ramp *ramp,
+		float r)
+{
+	unsigned int i;
+	float f;
+
+	if (!(0 < r))
+		return ramp->lut[0];
+	if (1 <= r)
+		return ramp->lut[svgtiny_RAMP_SIZE - 1];
+	f = r * (svgtiny_RAMP_SIZE - 1);
+	i = (unsigned int) f;
+	return svgtiny_ramp_lerp(ramp->lut[i], ramp->lut[i + 1], f - i, false);
+}
+
+
+/**
+ * Find the points between which the colour of a ramp changes linearly.
+ *
+ * Between stops interpolated in sRGB values the colour is linear, so the
+ * points are the stops. In linear light it curves, so the entries of the
+ * lookup table between the stops are added.
+ *
+ * \param  ramp  ramp, with its colour lookup table made
+ * \param  knot  array of ramp->stop_count + svgtiny_RAMP_SIZE, updated
+ * \return  number of points stored in knot
+ */
+
+unsigned int svgtiny_ramp_knots(const struct svgtiny_gradient_ramp *ramp,
+		struct svgtiny_gradient_stop *knot)
+{
+	const struct svgtiny_gradient_stop *stop = ramp->stop;
+	unsigned int count = ramp->stop_count;
+	unsigned int i, k = 0, n = 0;
+
+	if (!ramp->lut_linear) {
+		memcpy(knot, stop, count * sizeof stop[0]);
+		return count;
+	}
+
+	for (i = 0; i != svgtiny_RAMP_SIZE; i++) {
+		float r = (float) i / (svgtiny_RAMP_SIZE - 1);
+		for (; k != count && stop[k].offset <= r; k++)
+			knot[n++] = stop[k];
+		if (k != 0 && k != count && stop[k - 1].offset < r) {
+			knot[n].offset = r;
+			knot[n].color = ramp->lut[i];
+			n++;
+		}
+	}
+	for (; k != count; k++)
+		knot[n++] = stop[k];
+
+	return n;
+}
+
+
+/**
+ * Interpolate between two colours.
+ */
+
+svgtiny_colour svgtiny_ramp_lerp(svgtiny_colour colour0,
+		svgtiny_colour colour1, float f, bool linear)
+{
+	unsigned int r0 = svgtiny_RED(colour0), r1 = svgtiny_RED(colour1);
+	unsigned int g0 = svgtiny_GREEN(colour0), g1 = svgtiny_GREEN(colour1);
+	unsigned int b0 = svgtiny_BLUE(colour0), b1 = svgtiny_BLUE(colour1);
+
+	if (!linear)
+		return svgtiny_RGB(
+				(int) ((1 - f) * r0 + f * r1 + 0.5f),
+				(int) ((1 - f) * g0 + f * g1 + 0.5f),
+				(int) ((1 - f) * b0 + f * b1 + 0.5f));
+
+	return svgtiny_RGB(
+			svgtiny_linear_to_srgb((1 - f) *
+					svgtiny_srgb_to_linear[r0] +
+					f * svgtiny_srgb_to_linear[r1]),
+			svgtiny_linear_to_srgb((1 - f) *
+					svgtiny_srgb_to_linear[g0] +
+					f * svgtiny_srgb_to_linear[g1]),
+			svgtiny_linear_to_srgb((1 - f) *
+					svgtiny_srgb_to_linear[b0] +
+					f * svgtiny_srgb_to_linear[b1]));
+}
+
+
+/**
+ * Convert a channel in linear light to the nearest sRGB value.
+ */
+
+unsigned int svgtiny_linear_to_srgb(float linear)
+{
+	unsigned int low = 0, high = 255;
+
+	/* find the first value converting to at least linear */
+	while (low != high) {
+		unsigned int mid = (low + high) / 2;
+		if (svgtiny_srgb_to_linear[mid] < linear)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low != 0 && linear - svgtiny_srgb_to_linear[low - 1] <
+			svgtiny_srgb_to_linear[low] - linear)
+		low--;
+	return low;
+}
@@ -0,0 +1,1064 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Rendering.
+ *
+ * svgtiny_render() draws a diagram into an RGBA buffer, for programs which
+ * have no graphics library of their own.
+ *
+ * Paths are flattened to lines in pixels. Each line adds the area between
+ * it and the left of the buffer to a grid of cells, signed by whether it goes
+ * up or down, so that summing a row of cells from the left gives the winding
+ * number of each pixel weighted by how much of the pixel is inside. The fill
+ * rule turns that into the coverage of the pixel, so edges are anti-aliased
+ * exactly, without sampling. Only the columns of each row between the cells
+ * which lines added to are summed, and the pixels are then composited a few
+ * at a time with vector instructions, where the compiler has them.
+ *
+ * The buffer is drawn in bands of rows, which keeps the cells small, and lets
+ * svgtiny_render_threads() draw bands at once in several threads. Each band
+ * only draws the shapes whose bounding boxes, grown by the stroke, overlap
+ * it.
+ *
+ * A stroke is the union of a quadrilateral along each line and a miter or
+ * bevel at each join, all wound the same way and filled with the non-zero
+ * rule. The triangles of a mesh are covered one at a time, but their colours
+ * are summed weighted by coverage before the mesh is composited, so no seams
+ * show between them.
+ *
+ * Text is not drawn.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* largest distance in pixels between a curve and its lines */
+#define svgtiny_RENDER_FLATNESS 0.1f
+
+/* pixels composited together, 4 filling 16 bytes */
+#define svgtiny_RENDER_LANES 4
+
+/* entries in the colour table of a linear gradient */
+#define svgtiny_RENDER_RAMP 256
+
+/* rows of the buffer in each band drawn by svgtiny_render_threads() */
+#define svgtiny_RENDER_BAND 64
+
+/* a call of svgtiny_render_threads(), shared by its threads */
+struct svgtiny_render_job {
+	const struct svgtiny_diagram *diagram;
+	unsigned char *buffer;
+	unsigned int stride;
+	int width, height;
+	float scale;
+	int band_height;
+	unsigned int band_count;
+	/* first and last + 1 row which each shape may draw in, or NULL if
+	 * there is only one band */
+	int *rows;
+};
+
+/* the state of one thread drawing bands of a svgtiny_render_job */
+struct svgtiny_render {
+	unsigned char *buffer;
+	unsigned int stride;
+	int width, height;
+	float scale;
+
+	/* rows of the band being drawn */
+	int band_y0, band_y1;
+	/* area cells, width + 2 for each row of the band, all zero between
+	 * shapes */
+	float *cell;
+	/* rows of cells which may be non-zero, and the columns of each row,
+	 * 2 for each row of the band */
+	int y0, y1;
+	int *span;
+	/* coverage of each pixel of a row */
+	float *cover;
+	/* colours of a row of a gradient, 4 for each pixel */
+	float *paint;
+
+	/* the path being drawn, and half the width of its stroke in pixels,
+	 * or 0 for its fill */
+	struct svgtiny_lines lines;
+	float half_width;
+
+	/* premultiplied colour and coverage summed over the triangles of a
+	 * mesh, 4 for each pixel of mesh_width by mesh_height from mesh_x,
+	 * mesh_y */
+	float *mesh;
+	size_t mesh_allocated;
+	int mesh_x, mesh_y, mesh_width, mesh_height;
+};
+
+static int *svgtiny_render_bin(const struct svgtiny_render_job *job);
+static void svgtiny_render_work(struct svgtiny_threads *threads, void *pw);
+static svgtiny_code svgtiny_render_band(struct svgtiny_render *r,
+		const struct svgtiny_render_job *job, unsigned int band);
+static svgtiny_code svgtiny_render_path(struct svgtiny_render *r,
+		const struct svgtiny_shape *shape);
+static bool svgtiny_render_outline(struct svgtiny_render *r,
+		const struct svgtiny_shape *shape, float half_width);
+static bool svgtiny_render_subpath(void *r, float *p, unsigned int n,
+		bool closed);
+static void svgtiny_render_stroke(struct svgtiny_render *r, float *p,
+		unsigned int n, bool closed, float half_width);
+static void svgtiny_render_join(struct svgtiny_render *r, const float *p,
+		const float *d0, const float *d1, float half_width);
+static void svgtiny_render_polygon(struct svgtiny_render *r, const float *p,
+		unsigned int n);
+static void svgtiny_render_line(struct svgtiny_render *r,
+		float x0, float y0, float x1, float y1);
+static void svgtiny_render_cells(struct svgtiny_render *r,
+		float x0, float y0, float x1, float y1);
+static unsigned int svgtiny_render_row(struct svgtiny_render *r, int y,
+		int fill_rule, int *x0);
+static void svgtiny_render_fill(struct svgtiny_render *r,
+		svgtiny_colour colour, int fill_rule);
+static void svgtiny_render_gradient(struct svgtiny_render *r,
+		const struct svgtiny_linear_gradient *gradient,
+		int fill_rule);
+static void svgtiny_render_ramp(
+		const struct svgtiny_linear_gradient *gradient, float *ramp);
+static void svgtiny_render_span(unsigned char *row, const float *cover,
+		unsigned int n, const float *colour);
+static void svgtiny_render_span_paint(unsigned char *row,
+		const float *cover, unsigned int n, const float *paint);
+static svgtiny_code svgtiny_render_mesh(struct svgtiny_render *r,
+		const struct svgtiny_shape *shape);
+static void svgtiny_render_triangle(struct svgtiny_render *r,
+		const float *v, const svgtiny_colour *colour);
+
+
+/**
+ * Draw a diagram into an RGBA buffer.
+ *
+ * The shapes are drawn over what the buffer holds, so it should be cleared
+ * first, for example to transparent or to white. Each pixel is 4 bytes, red,
+ * green, blue, and alpha, with the colour premultiplied by the alpha.
+ *
+ * \param  diagram  a parsed diagram
+ * \param  buffer   top left pixel of the buffer
+ * \param  stride   bytes from each row of the buffer to the next
+ * \param  width    width of the buffer in pixels
+ * \param  height   height of the buffer in pixels
+ * \param  scale    pixels of the buffer for each pixel of the diagram
+ * \return  svgtiny_OK, or svgtiny_OUT_OF_MEMORY, in which case the buffer may
+ *          have been partly drawn
+ */
+
+svgtiny_code svgtiny_render(const struct svgtiny_diagram *diagram,
+		unsigned char *buffer, unsigned int stride,
+		unsigned int width, unsigned int height, float scale)
+{
+	return svgtiny_render_threads(diagram, buffer, stride, width, height,
+			scale, 1);
+}
+
+
+/**
+ * Draw a diagram into an RGBA buffer using several threads.
+ *
+ * Each thread takes the next band of rows not yet taken and draws the shapes
+ * in the band in order, until all the bands are drawn. Every pixel is found
+ * by the same arithmetic whichever thread draws it, so the buffer is the same
+ * for any number of threads.
+ *
+ * \param  threads  number of threads to draw with, including the calling
+ *                  thread, or 0 for one for each processor
+ * \return  as svgtiny_render()
+ */
+
+svgtiny_code svgtiny_render_threads(const struct svgtiny_diagram *diagram,
+		unsigned char *buffer, unsigned int stride,
+		unsigned int width, unsigned int height, float scale,
+		unsigned int threads)
+{
+	struct svgtiny_render_job job;
+	svgtiny_code code;
+
+	if (width == 0 || height == 0 || !(0 < scale) ||
+			INT_MAX - 2 < width ||
+			INT_MAX / (width + 2) < height)
+		return svgtiny_OK;
+
+	job.diagram = diagram;
+	job.buffer = buffer;
+	job.stride = stride;
+	job.width = width;
+	job.height = height;
+	job.scale = scale;
+	job.band_height = svgtiny_RENDER_BAND < height ?
+			svgtiny_RENDER_BAND : (int) height;
+	job.band_count = (height + job.band_height - 1) / job.band_height;
+	job.rows = NULL;
+	if (1 < job.band_count) {
+		job.rows = svgtiny_render_bin(&job);
+		if (!job.rows)
+			return svgtiny_OUT_OF_MEMORY;
+	}
+
+	code = svgtiny_threads_run(threads, job.band_count,
+			svgtiny_render_work, &job);
+
+	free(job.rows);
+	return code;
+}
+
+
+/**
+ * Find the rows of the buffer which each shape may draw in.
+ *
+ * \return  first and last + 1 row for each shape, or NULL if memory runs out
+ */
+
+int *svgtiny_render_bin(const struct svgtiny_render_job *job)
+{
+	const struct svgtiny_diagram *diagram = job->diagram;
+	float fixed_scale = (float) (1 << svgtiny_diagram_internal(
+			diagram)->fraction_bits);
+	int *rows;
+	unsigned int i;
+
+	rows = malloc((2 * (size_t) diagram->shape_count + 1) *
+			sizeof rows[0]);
+	if (!rows)
+		return NULL;
+
+	for (i = 0; i != diagram->shape_count; i++) {
+		const struct svgtiny_shape *shape = &diagram->shape[i];
+		/* miters reach up to twice the stroke width from the path,
+		 * and fixed point paths are rounded, so the box is grown by
+		 * those and a pixel */
+		float grow = 1 + job->scale / fixed_scale;
+		float y0, y1;
+		/* a NaN box is in every row */
+		if (shape->stroke != svgtiny_TRANSPARENT &&
+				0 < shape->stroke_width)
+			grow += 0.5f * svgtiny_MITER_LIMIT *
+					shape->stroke_width * job->scale;
+		y0 = floorf(shape->bbox_y0 * job->scale - grow);
+		y1 = ceilf(shape->bbox_y1 * job->scale + grow);
+		rows[2 * i] = 0 < y0 ? (y0 < job->height ?
+				(int) y0 : job->height) : 0;
+		rows[2 * i + 1] = y1 < job->height ? (0 < y1 ?
+				(int) y1 : 0) : job->height;
+	}
+
+	return rows;
+}
+
+
+/**
+ * Draw bands of a svgtiny_render_job until there are none left.
+ */
+
+void svgtiny_render_work(struct svgtiny_threads *threads, void *pw)
+{
+	const struct svgtiny_render_job *job = pw;
+	struct svgtiny_render r;
+	svgtiny_code code = svgtiny_OK;
+	unsigned int band, i;
+
+	r.buffer = job->buffer;
+	r.stride = job->stride;
+	r.width = job->width;
+	r.height = job->height;
+	r.scale = job->scale;
+	r.cell = calloc((size_t) (job->width + 2) * job->band_height,
+			sizeof r.cell[0]);
+	r.span = malloc(2 * (size_t) job->band_height * sizeof r.span[0]);
+	r.cover = malloc((job->width + 2) * sizeof r.cover[0]);
+	r.paint = malloc(4 * (job->width + 2) * sizeof r.paint[0]);
+	r.y0 = INT_MAX;
+	r.y1 = 0;
+	r.lines.scale = job->scale;
+	r.lines.fixed_scale = (float) (1 << svgtiny_diagram_internal(
+			job->diagram)->fraction_bits);
+	r.lines.flatness = svgtiny_RENDER_FLATNESS;
+	r.lines.subpath = svgtiny_render_subpath;
+	r.lines.pw = &r;
+	r.lines.point = NULL;
+	r.lines.point_count = r.lines.point_allocated = 0;
+	r.mesh = NULL;
+	r.mesh_allocated = 0;
+	if (!r.cell || !r.span || !r.cover || !r.paint) {
+		code = svgtiny_OUT_OF_MEMORY;
+	} else {
+		for (i = 0; i != (unsigned int) job->band_height; i++) {
+			r.span[2 * i] = INT_MAX;
+			r.span[2 * i + 1] = 0;
+		}
+	}
+
+	while (svgtiny_threads_next(threads, &band, code))
+		code = svgtiny_render_band(&r, job, band);
+
+	free(r.cell);
+	free(r.span);
+	free(r.cover);
+	free(r.paint);
+	free(r.lines.point);
+	free(r.mesh);
+}
+
+
+/**
+ * Draw the shapes of a diagram in a band of rows of the buffer.
+ */
+
+svgtiny_code svgtiny_render_band(struct svgtiny_render *r,
+		const struct svgtiny_render_job *job, unsigned int band)
+{
+	const struct svgtiny_diagram *diagram = job->diagram;
+	svgtiny_code code = svgtiny_OK;
+	unsigned int i;
+
+	r->band_y0 = band * job->band_height;
+	r->band_y1 = r->band_y0 + job->band_height < job->height ?
+			r->band_y0 + job->band_height : job->height;
+
+	for (i = 0; i != diagram->shape_count && code == svgtiny_OK; i++) {
+		const struct svgtiny_shape *shape = &diagram->shape[i];
+		if (job->rows && (job->rows[2 * i + 1] <= r->band_y0 ||
+				r->band_y1 <= job->rows[2 * i]))
+			continue;
+		if (shape->path || shape->path_op)
+			code = svgtiny_render_path(r, shape);
+		else if (shape->mesh)
+			code = svgtiny_render_mesh(r, shape);
+	}
+
+	return code;
+}
+
+
+/**
+ * Fill and stroke a path.
+ */
+
+svgtiny_code svgtiny_render_path(struct svgtiny_render *r,
+		const struct svgtiny_shape *shape)
+{
+	if (shape->fill_gradient ||
+			shape->fill != svgtiny_TRANSPARENT) {
+		if (!svgtiny_render_outline(r, shape, 0))
+			return svgtiny_OUT_OF_MEMORY;
+		if (shape->fill_gradient)
+			svgtiny_render_gradient(r, shape->fill_gradient,
+					shape->fill_rule);
+		else
+			svgtiny_render_fill(r, shape->fill, shape->fill_rule);
+	}
+
+	if (shape->stroke != svgtiny_TRANSPARENT &&
+			0 < shape->stroke_width) {
+		if (!svgtiny_render_outline(r, shape,
+				0.5f * shape->stroke_width * r->scale))
+			return svgtiny_OUT_OF_MEMORY;
+		svgtiny_render_fill(r, shape->stroke, svgtiny_FILL_NONZERO);
+	}
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Add the area inside a path, or inside its stroke, to the cells.
+ *
+ * \param  half_width  half the width of the stroke in pixels, or 0 for the
+ *                     fill
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_render_outline(struct svgtiny_render *r,
+		const struct svgtiny_shape *shape, float half_width)
+{
+	r->half_width = half_width;
+	return svgtiny_lines_flatten(&r->lines, shape);
+}
+
+
+/**
+ * Add the area inside a subpath, or inside its stroke, to the cells.
+ *
+ * Called by svgtiny_lines_flatten().
+ */
+
+bool svgtiny_render_subpath(void *pw, float *p, unsigned int n, bool closed)
+{
+	struct svgtiny_render *r = pw;
+	unsigned int i;
+
+	if (r->half_width != 0) {
+		svgtiny_render_stroke(r, p, n, closed, r->half_width);
+		return true;
+	}
+
+	/* a fill closes every subpath */
+	for (i = 0; i + 1 != n; i++)
+		svgtiny_render_line(r, p[2 * i], p[2 * i + 1],
+				p[2 * i + 2], p[2 * i + 3]);
+	svgtiny_render_line(r, p[2 * n - 2], p[2 * n - 1], p[0], p[1]);
+	return true;
+}
+
+
+/**
+ * Add the area inside the stroke of a subpath to the cells.
+ *
+ * The ends of open subpaths are butt capped, and joins are mitered, or
+ * bevelled where the miter would be too long.
+ */
+
+void svgtiny_render_stroke(struct svgtiny_render *r, float *p,
+		unsigned int n, bool closed, float half_width)
+{
+	float *q = p;		/* compacted in place */
+	float d0[2] = { 0, 0 }, d1[2], first[2] = { 0, 0 };
+	unsigned int m = 1, i;
+
+	/* leave out repeated points, which have no direction */
+	for (i = 1; i != n; i++) {
+		if (p[2 * i] == q[2 * m - 2] && p[2 * i + 1] == q[2 * m - 1])
+			continue;
+		q[2 * m] = p[2 * i];
+		q[2 * m + 1] = p[2 * i + 1];
+		m++;
+	}
+	if (closed && 2 < m && q[2 * m - 2] == q[0] && q[2 * m - 1] == q[1])
+		m--;
+	if (m < 2)
+		return;
+
+	for (i = 0; i != m; i++) {
+		unsigned int j = i + 1 == m ? 0 : i + 1;
+		float dx, dy, length, nx, ny;
+		float quad[8];
+		if (j == 0 && (!closed || m == 2))
+			break;
+		dx = q[2 * j] - q[2 * i];
+		dy = q[2 * j + 1] - q[2 * i + 1];
+		length = sqrtf(dx * dx + dy * dy);
+		d1[0] = dx / length;
+		d1[1] = dy / length;
+		nx = -d1[1] * half_width;
+		ny = d1[0] * half_width;
+		quad[0] = q[2 * i] + nx;
+		quad[1] = q[2 * i + 1] + ny;
+		quad[2] = q[2 * j] + nx;
+		quad[3] = q[2 * j + 1] + ny;
+		quad[4] = q[2 * j] - nx;
+		quad[5] = q[2 * j + 1] - ny;
+		quad[6] = q[2 * i] - nx;
+		quad[7] = q[2 * i + 1] - ny;
+		svgtiny_render_polygon(r, quad, 4);
+
+		if (i == 0) {
+			first[0] = d1[0];
+			first[1] = d1[1];
+		} else {
+			svgtiny_render_join(r, q + 2 * i, d0, d1, half_width);
+		}
+		d0[0] = d1[0];
+		d0[1] = d1[1];
+	}
+	if (closed && 2 < m)
+		svgtiny_render_join(r, q, d0, first, half_width);
+}
+
+
+/**
+ * Add the area of a join between two lines of a stroke to the cells.
+ *
+ * \param  p   the point where the lines meet
+ * \param  d0  unit direction of the line ending at p
+ * \param  d1  unit direction of the line starting at p
+ */
+
+void svgtiny_render_join(struct svgtiny_render *r, const float *p,
+		const float *d0, const float *d1, float half_width)
+{
+	float cross = d0[0] * d1[1] - d0[1] * d1[0];
+	float dot = d0[0] * d1[0] + d0[1] * d1[1];
+	/* offset to the outside of the turn */
+	float side = cross < 0 ? half_width : -half_width;
+	float join[8];
+	float limit = 1.0f / (svgtiny_MITER_LIMIT * svgtiny_MITER_LIMIT);
+
+	if (cross == 0 && 0 < dot)
+		return;
+
+	join[0] = p[0];
+	join[1] = p[1];
+	join[2] = p[0] - d0[1] * side;
+	join[3] = p[1] + d0[0] * side;
+	/* the miter length is the width over sin(angle / 2), and the
+	 * squared sine is (1 + dot) / 2 */
+	if (limit <= (1 + dot) / 2) {
+		join[4] = p[0] - (d0[1] + d1[1]) * side / (1 + dot);
+		join[5] = p[1] + (d0[0] + d1[0]) * side / (1 + dot);
+		join[6] = p[0] - d1[1] * side;
+		join[7] = p[1] + d1[0] * side;
+		svgtiny_render_polygon(r, join, 4);
+	} else {
+		join[4] = p[0] - d1[1] * side;
+		join[5] = p[1] + d1[0] * side;
+		svgtiny_render_polygon(r, join, 3);
+	}
+}
+
+
+/**
+ * Add the area inside a polygon to the cells, wound so that it adds to the
+ * area of the rest of a stroke.
+ */
+
+void svgtiny_render_polygon(struct svgtiny_render *r, const float *p,
+		unsigned int n)
+{
+	float area = 0;
+	unsigned int i;
+
+	for (i = 0; i != n; i++) {
+		unsigned int j = i + 1 == n ? 0 : i + 1;
+		area += p[2 * i] * p[2 * j + 1] - p[2 * j] * p[2 * i + 1];
+	}
+
+	for (i = 0; i != n; i++) {
+		unsigned int j = i + 1 == n ? 0 : i + 1;
+		if (0 <= area)
+			svgtiny_render_line(r, p[2 * i], p[2 * i + 1],
+					p[2 * j], p[2 * j + 1]);
+		else
+			svgtiny_render_line(r, p[2 * j], p[2 * j + 1],
+					p[2 * i], p[2 * i + 1]);
+	}
+}
+
+
+/**
+ * Add the signed area to the left of a line to the cells.
+ *
+ * Parts of the line left of the buffer are moved onto its left edge, which
+ * covers the pixels to their right the same, and parts right of the buffer
+ * are left out, as they cover none of it.
+ */
+
+void svgtiny_render_line(struct svgtiny_render *r,
+		float x0, float y0, float x1, float y1)
+{
+	float width = r->width;
+	float y;
+
+	if (!isfinite(x0) || !isfinite(y0) || !isfinite(x1) ||
+			!isfinite(y1))
+		return;
+
+	if (width <= x0 && width <= x1)
+		return;
+	if (width < x0) {
+		y0 += (y1 - y0) * (width - x0) / (x1 - x0);
+		x0 = width;
+	} else if (width < x1) {
+		y1 += (y1 - y0) * (width - x1) / (x1 - x0);
+		x1 = width;
+	}
+
+	if (x0 <= 0 && x1 <= 0) {
+		svgtiny_render_cells(r, 0, y0, 0, y1);
+		return;
+	}
+	if (x0 < 0 || x1 < 0) {
+		y = y0 + (y1 - y0) * -x0 / (x1 - x0);
+		if (x0 < 0) {
+			svgtiny_render_cells(r, 0, y0, 0, y);
+			svgtiny_render_cells(r, 0, y, x1, y1);
+		} else {
+			svgtiny_render_cells(r, x0, y0, 0, y);
+			svgtiny_render_cells(r, 0, y, 0, y1);
+		}
+		return;
+	}
+	svgtiny_render_cells(r, x0, y0, x1, y1);
+}
+
+
+/**
+ * Add the signed area to the left of a line within the buffer's columns to
+ * the cells.
+ */
+
+void svgtiny_render_cells(struct svgtiny_render *r,
+		float x0, float y0, float x1, float y1)
+{
+	const unsigned int row_cells = r->width + 2;
+	float dir = 1, dxdy, t;
+	int y, y_end;
+
+	if (y0 == y1)
+		return;
+	if (y1 < y0) {
+		t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+		dir = -1;
+	}
+	if (y1 <= 0 || r->height <= y0)
+		return;
+
+	dxdy = (x1 - x0) / (y1 - y0);
+	if (y0 < 0) {
+		x0 -= y0 * dxdy;
+		y0 = 0;
+	}
+	if (r->height < y1)
+		y1 = r->height;
+
+	y = (int) y0;
+	y_end = (int) ceilf(y1);
+	if (y < r->band_y0)
+		y = r->band_y0;
+	if (r->band_y1 < y_end)
+		y_end = r->band_y1;
+	if (y_end <= y)
+		return;
+	if (y < r->y0)
+		r->y0 = y;
+	if (r->y1 < y_end)
+		r->y1 = y_end;
+
+	/* x is found from the start of the line for each row, rather than
+	 * stepped from row to row, so that every row has the same cells
+	 * whichever band it is drawn in */
+	for (; y != y_end; y++) {
+		float *cell = r->cell + (y - r->band_y0) * row_cells;
+		int *span = r->span + 2 * (y - r->band_y0);
+		float ya = fmaxf(y, y0), yb = fminf(y + 1, y1);
+		float x = fminf(fmaxf(x0 + (ya - y0) * dxdy, 0), r->width);
+		float x_next = fminf(fmaxf(x0 + (yb - y0) * dxdy, 0),
+				r->width);
+		float d = (yb - ya) * dir;
+		float xa = fminf(x, x_next), xb = fmaxf(x, x_next);
+		float xa_floor = floorf(xa), xb_ceil = ceilf(xb);
+		int xa_i = (int) xa_floor, xb_i = (int) xb_ceil;
+
+		if (xa_i < span[0])
+			span[0] = xa_i;
+		if (span[1] < xb_i + 1)
+			span[1] = xb_i + 1;
+
+		if (xb_i <= xa_i + 1) {
+			/* within one pixel: the area to its right is split
+			 * by where the line crosses it on average */
+			float xm = 0.5f * (x + x_next) - xa_floor;
+			cell[xa_i] += d - d * xm;
+			cell[xa_i + 1] += d * xm;
+		} else {
+			/* across pixels: the area under the line grows
+			 * linearly between a triangle at each end */
+			float s = 1 / (xb - xa);
+			float xa_f = xa - xa_floor;
+			float a0 = 0.5f * s * (1 - xa_f) * (1 - xa_f);
+			float xb_f = xb - xb_ceil + 1;
+			float am = 0.5f * s * xb_f * xb_f;
+			int i;
+			cell[xa_i] += d * a0;
+			if (xb_i == xa_i + 2) {
+				cell[xa_i + 1] += d * (1 - a0 - am);
+			} else {
+				float a1 = s * (1.5f - xa_f);
+				float a2;
+				cell[xa_i + 1] += d * (a1 - a0);
+				for (i = xa_i + 2; i < xb_i - 1; i++)
+					cell[i] += d * s;
+				a2 = a1 + (xb_i - xa_i - 3) * s;
+				cell[xb_i - 1] += d * (1 - a2 - am);
+			}
+			cell[xb_i] += d * am;
+		}
+	}
+}
+
+
+/**
+ * Sum a row of cells into the coverage of its pixels, and clear the cells.
+ *
+ * The coverage right of the last cell of the row which was added to is the
+ * same as at that cell, so it is only found as far as the buffer if it is not
+ * 0, as where a shape goes off the right of the buffer.
+ *
+ * \param  x0  updated with the first column with coverage
+ * \return  number of pixels from x0 with coverage from 0 to 1 in r->cover
+ */
+
+unsigned int svgtiny_render_row(struct svgtiny_render *r, int y,
+		int fill_rule, int *x0)
+{
+	float *cell = r->cell + (y - r->band_y0) * (r->width + 2);
+	float *cover = r->cover;
+	int *span = r->span + 2 * (y - r->band_y0);
+	int start = span[0], end = span[1];
+	float sum = 0, c = 0;
+	int x;
+
+	span[0] = INT_MAX;
+	span[1] = 0;
+	*x0 = start;
+	if (end <= start)
+		return 0;
+
+	if (fill_rule == svgtiny_FILL_EVENODD) {
+		for (x = start; x != end; x++) {
+			float w;
+			sum += cell[x];
+			cell[x] = 0;
+			w = fabsf(sum);
+			w -= 2 * floorf(0.5f * w);
+			cover[x - start] = c = 1 - fabsf(1 - w);
+		}
+	} else {
+		for (x = start; x != end; x++) {
+			sum += cell[x];
+			cell[x] = 0;
+			cover[x - start] = c = fminf(fabsf(sum), 1);
+		}
+	}
+
+	if (1.0f / 512 <= c) {
+		for (; x < r->width; x++)
+			cover[x - start] = c;
+		end = r->width;
+	}
+	if (r->width < end)
+		end = r->width;
+	return start < end ? end - start : 0;
+}
+
+
+/**
+ * Composite the area in the cells with a colour, and clear the cells.
+ */
+
+void svgtiny_render_fill(struct svgtiny_render *r,
+		svgtiny_colour colour, int fill_rule)
+{
+	const float rgba[4] = { svgtiny_RED(colour), svgtiny_GREEN(colour),
+			svgtiny_BLUE(colour), 255 };
+	int x0, y;
+
+	for (y = r->y0; y < r->y1; y++) {
+		unsigned int n = svgtiny_render_row(r, y, fill_rule, &x0);
+		if (n)
+			svgtiny_render_span(r->buffer + (size_t) y * r->stride +
+					4 * x0, r->cover, n, rgba);
+	}
+	r->y0 = INT_MAX;
+	r->y1 = 0;
+}
+
+
+/**
+ * Composite the area in the cells with a linear gradient, and clear the
+ * cells.
+ */
+
+void svgtiny_render_gradient(struct svgtiny_render *r,
+		const struct svgtiny_linear_gradient *gradient,
+		int fill_rule)
+{
+	float ramp[4 * svgtiny_RENDER_RAMP];
+	float x1 = gradient->x1 * r->scale, y1 = gradient->y1 * r->scale;
+	float dx = gradient->x2 * r->scale - x1;
+	float dy = gradient->y2 * r->scale - y1;
+	float length = dx * dx + dy * dy;
+	int x0, y, k;
+	unsigned int i, n;
+
+	svgtiny_render_ramp(gradient, ramp);
+	if (length == 0)
+		length = 1;
+	dx /= length;
+	dy /= length;
+
+	for (y = r->y0; y < r->y1; y++) {
+		n = svgtiny_render_row(r, y, fill_rule, &x0);
+		/* offset along the gradient of each pixel centre */
+		for (i = 0; i != n; i++) {
+			float t = (x0 + i + 0.5f - x1) * dx +
+					(y + 0.5f - y1) * dy;
+			int j;
+			if (gradient->spread == svgtiny_SPREAD_REPEAT)
+				t -= floorf(t);
+			else if (gradient->spread == svgtiny_SPREAD_REFLECT)
+				t = 1 - fabsf(t - 2 * floorf(0.5f * t) - 1);
+			t = fminf(fmaxf(t, 0), 1);
+			j = (int) (t * (svgtiny_RENDER_RAMP - 1) + 0.5f);
+			for (k = 0; k != 4; k++)
+				r->paint[4 * i + k] = ramp[4 * j + k];
+		}
+		if (n)
+			svgtiny_render_span_paint(r->buffer +
+					(size_t) y * r->stride + 4 * x0,
+					r->cover, n, r->paint);
+	}
+	r->y0 = INT_MAX;
+	r->y1 = 0;
+}
+
+
+/**
+ * Make a table of the colours of a linear gradient from offset 0 to 1.
+ */
+
+void svgtiny_render_ramp(const struct svgtiny_linear_gradient *gradient,
+		float *ramp)
+{
+	const struct svgtiny_gradient_stop *stop = gradient->stop;
+	unsigned int count = gradient->stop_count;
+	unsigned int i, j = 0;
+
+	for (i = 0; i != svgtiny_RENDER_RAMP; i++) {
+		float t = (float) i / (svgtiny_RENDER_RAMP - 1);
+		svgtiny_colour c0, c1;
+		float f = 0;
+
+		if (count == 0) {
+			ramp[4 * i] = ramp[4 * i + 1] = ramp[4 * i + 2] = 0;
+			ramp[4 * i + 3] = 255;
+			continue;
+		}
+		while (j != count && stop[j].offset <= t)
+			j++;
+		if (j == 0) {
+			c0 = c1 = stop[0].color;
+		} else if (j == count) {
+			c0 = c1 = stop[count - 1].color;
+		} else {
+			c0 = stop[j - 1].color;
+			c1 = stop[j].color;
+			if (stop[j - 1].offset < stop[j].offset)
+				f = (t - stop[j - 1].offset) /
+					(stop[j].offset - stop[j - 1].offset);
+		}
+		ramp[4 * i] = svgtiny_RED(c0) +
+				(svgtiny_RED(c1) - svgtiny_RED(c0)) * f;
+		ramp[4 * i + 1] = svgtiny_GREEN(c0) +
+				(svgtiny_GREEN(c1) - svgtiny_GREEN(c0)) * f;
+		ramp[4 * i + 2] = svgtiny_BLUE(c0) +
+				(svgtiny_BLUE(c1) - svgtiny_BLUE(c0)) * f;
+		ramp[4 * i + 3] = 255;
+	}
+}
+
+
+/**
+ * Composite a colour into a span of pixels by coverage.
+ *
+ * Pixels are done svgtiny_RENDER_LANES at a time from copies of their
+ * coverage, so that the compiler can do each block with vector instructions
+ * without the rows of the buffer overlapping the coverage.
+ *
+ * \param  colour  red, green, blue, and alpha, from 0 to 255
+ */
+
+void svgtiny_render_span(unsigned char *row, const float *cover,
+		unsigned int n, const float *colour)
+{
+	float c[4 * svgtiny_RENDER_LANES], s[4 * svgtiny_RENDER_LANES];
+	unsigned int i = 0, k;
+
+	for (k = 0; k != 4 * svgtiny_RENDER_LANES; k++)
+		s[k] = colour[k % 4];
+	for (; i + svgtiny_RENDER_LANES <= n; i += svgtiny_RENDER_LANES) {
+		unsigned char *d = row + 4 * i;
+		for (k = 0; k != 4 * svgtiny_RENDER_LANES; k++)
+			c[k] = cover[i + k / 4];
+		for (k = 0; k != 4 * svgtiny_RENDER_LANES; k++)
+			d[k] = (unsigned char) (d[k] + (s[k] - d[k]) * c[k] +
+					0.5f);
+	}
+	for (; i != n; i++)
+		for (k = 0; k != 4; k++)
+			row[4 * i + k] = (unsigned char) (row[4 * i + k] +
+					(colour[k] - row[4 * i + k]) *
+					cover[i] + 0.5f);
+}
+
+
+/**
+ * Composite a colour for each pixel into a span of pixels by coverage.
+ *
+ * \param  paint  red, green, blue, and alpha of each pixel, from 0 to 255
+ */
+
+void svgtiny_render_span_paint(unsigned char *row, const float *cover,
+		unsigned int n, const float *paint)
+{
+	float c[4 * svgtiny_RENDER_LANES], s[4 * svgtiny_RENDER_LANES];
+	unsigned int i = 0, k;
+
+	for (; i + svgtiny_RENDER_LANES <= n; i += svgtiny_RENDER_LANES) {
+		unsigned char *d = row + 4 * i;
+		for (k = 0; k != 4 * svgtiny_RENDER_LANES; k++) {
+			c[k] = cover[i + k / 4];
+			s[k] = paint[4 * i + k];
+		}
+		for (k = 0; k != 4 * svgtiny_RENDER_LANES; k++)
+			d[k] = (unsigned char) (d[k] + (s[k] - d[k]) * c[k] +
+					0.5f);
+	}
+	for (; i != n; i++)
+		for (k = 0; k != 4; k++)
+			row[4 * i + k] = (unsigned char) (row[4 * i + k] +
+					(paint[4 * i + k] - row[4 * i + k]) *
+					cover[i] + 0.5f);
+}
+
+
+/**
+ * Draw a triangle mesh, shading each triangle between its vertex colours.
+ */
+
+svgtiny_code svgtiny_render_mesh(struct svgtiny_render *r,
+		const struct svgtiny_shape *shape)
+{
+	const struct svgtiny_mesh *mesh = shape->mesh;
+	float fx0 = floorf(fmaxf(shape->bbox_x0 * r->scale - 1, 0));
+	float fy0 = floorf(fmaxf(shape->bbox_y0 * r->scale - 1,
+			r->band_y0));
+	float fx1 = ceilf(fminf(shape->bbox_x1 * r->scale + 1, r->width));
+	float fy1 = ceilf(fminf(shape->bbox_y1 * r->scale + 1,
+			r->band_y1));
+	size_t size;
+	unsigned int i, k;
+	int x, y;
+
+	if (!(fx0 < fx1 && fy0 < fy1))
+		return svgtiny_OK;
+	r->mesh_x = fx0;
+	r->mesh_y = fy0;
+	r->mesh_width = fx1 - fx0;
+	r->mesh_height = fy1 - fy0;
+
+	size = 4 * (size_t) r->mesh_width * r->mesh_height;
+	if (r->mesh_allocated < size) {
+		free(r->mesh);
+		r->mesh = calloc(size, sizeof r->mesh[0]);
+		r->mesh_allocated = r->mesh ? size : 0;
+		if (!r->mesh)
+			return svgtiny_OUT_OF_MEMORY;
+	}
+
+	for (i = 0; i + 2 < mesh->index_count; i += 3) {
+		float v[6];
+		svgtiny_colour colour[3];
+		for (k = 0; k != 3; k++) {
+			unsigned int j = mesh->index[i + k];
+			v[2 * k] = mesh->vertex[2 * j] * r->scale;
+			v[2 * k + 1] = mesh->vertex[2 * j + 1] * r->scale;
+			colour[k] = mesh->colour[j];
+		}
+		svgtiny_render_triangle(r, v, colour);
+	}
+
+	/* the summed colours are premultiplied by their coverage */
+	for (y = 0; y != r->mesh_height; y++) {
+		unsigned char *row = r->buffer + (size_t) (r->mesh_y + y) *
+				r->stride + 4 * r->mesh_x;
+		float *sum = r->mesh + 4 * (size_t) y * r->mesh_width;
+		for (x = 0; x != r->mesh_width; x++) {
+			float *s = sum + 4 * x;
+			unsigned char *d = row + 4 * x;
+			/* where triangles overlap, scale their sum to the
+			 * average colour */
+			float c = fminf(s[3], 1);
+			float f = 1 < s[3] ? 1 / s[3] : 1;
+			for (k = 0; k != 3; k++)
+				d[k] = (unsigned char) (s[k] * f +
+						d[k] * (1 - c) + 0.5f);
+			d[3] = (unsigned char) (255 * c + d[3] * (1 - c) +
+					0.5f);
+			s[0] = s[1] = s[2] = s[3] = 0;
+		}
+	}
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Add the colour of a triangle, weighted by the coverage of each pixel, to
+ * the sums for a mesh.
+ *
+ * \param  v       x, y of each vertex in pixels of the buffer
+ * \param  colour  colour of each vertex
+ */
+
+void svgtiny_render_triangle(struct svgtiny_render *r, const float *v,
+		const svgtiny_colour *colour)
+{
+	float ex1 = v[2] - v[0], ey1 = v[3] - v[1];
+	float ex2 = v[4] - v[0], ey2 = v[5] - v[1];
+	float det = ex1 * ey2 - ex2 * ey1;
+	float plane[3][3];	/* each channel as a x + b y + c */
+	int x0, y, k;
+
+	if (fabsf(det) < 1e-6f)
+		return;
+
+	for (k = 0; k != 3; k++) {
+		float c0, c1, c2;
+		c0 = k == 0 ? svgtiny_RED(colour[0]) : k == 1 ?
+				svgtiny_GREEN(colour[0]) :
+				svgtiny_BLUE(colour[0]);
+		c1 = k == 0 ? svgtiny_RED(colour[1]) : k == 1 ?
+				svgtiny_GREEN(colour[1]) :
+				svgtiny_BLUE(colour[1]);
+		c2 = k == 0 ? svgtiny_RED(colour[2]) : k == 1 ?
+				svgtiny_GREEN(colour[2]) :
+				svgtiny_BLUE(colour[2]);
+		plane[k][0] = ((c1 - c0) * ey2 - (c2 - c0) * ey1) / det;
+		plane[k][1] = ((c2 - c0) * ex1 - (c1 - c0) * ex2) / det;
+		plane[k][2] = c0 - plane[k][0] * v[0] - plane[k][1] * v[1];
+	}
+
+	svgtiny_render_line(r, v[0], v[1], v[2], v[3]);
+	svgtiny_render_line(r, v[2], v[3], v[4], v[5]);
+	svgtiny_render_line(r, v[4], v[5], v[0], v[1]);
+
+	for (y = r->y0; y < r->y1; y++) {
+		unsigned int n = svgtiny_render_row(r, y,
+				svgtiny_FILL_NONZERO, &x0);
+		int x_start = x0 < r->mesh_x ? r->mesh_x : x0;
+		int x_end = r->mesh_x + r->mesh_width;
+		float *sum;
+		int x;
+		if (y < r->mesh_y || r->mesh_y + r->mesh_height <= y)
+			continue;
+		if (x0 + (int) n < x_end)
+			x_end = x0 + n;
+		sum = r->mesh + 4 * (size_t) (y - r->mesh_y) * r->mesh_width;
+		for (x = x_start; x < x_end; x++) {
+			float c = r->cover[x - x0];
+			float *s = sum + 4 * (x - r->mesh_x);
+			float px = x + 0.5f, py = y + 0.5f;
+			for (k = 0; k != 3; k++) {
+				float value = plane[k][0] * px +
+						plane[k][1] * py + plane[k][2];
+				s[k] += c * fminf(fmaxf(value, 0), 255);
+			}
+			s[3] += c;
+		}
+	}
+	r->y0 = INT_MAX;
+	r->y1 = 0;
+}
@@ -0,0 +1,675 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Signed distance fields.
+ *
+ * svgtiny_render_sdf() finds for each pixel of a buffer the distance from its
+ * centre to the nearest edge of the shapes of a diagram, for drawing them at
+ * any size from a small texture, as in icon atlases.
+ *
+ * Paths are first flattened to lines in pixels, once for the whole buffer,
+ * giving an outline for the fill and another for the stroke of each shape,
+ * and each line is listed in the rows of tiles it may change. The buffer is
+ * then found in square tiles, which threads take in turn. For each tile,
+ * only the outlines whose boxes reach it are visited, and of those only the
+ * lines listed in its row and near enough to change a pixel of it. The
+ * distance from each of these lines to a row of the tile is found for all the
+ * pixels of the row together, which the compiler can do with vector
+ * instructions. Whether a pixel is inside a fill is found from the winding
+ * number of the lines crossing its row to the left of it.
+ *
+ * The distance from a stroke is the distance from its lines less half the
+ * stroke width, which rounds its joins and caps. Where shapes overlap, each
+ * pixel takes the least of their distances, so that the field is exact
+ * outside the shapes and a little short inside where they overlap. Gradient
+ * meshes and text are left out.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* largest distance in pixels between a curve and its lines */
+#define svgtiny_SDF_FLATNESS 0.05f
+
+/* width and height of a tile in pixels */
+#define svgtiny_SDF_TILE 32
+
+/* the lines of the fill or the stroke of a shape */
+struct svgtiny_sdf_outline {
+	/* index in svgtiny_sdf_job.line of the first line, and the count */
+	unsigned int first, count;
+	/* box of the lines in pixels */
+	float x0, y0, x1, y1;
+	/* half the width of the stroke in pixels, or 0 for a fill */
+	float half_width;
+	int fill_rule;			/* svgtiny_FILL_* for a fill */
+};
+
+/* a call of svgtiny_render_sdf(), shared by its threads */
+struct svgtiny_sdf_job {
+	unsigned char *buffer;
+	unsigned int stride;
+	int width, height;
+	float range;
+
+	/* outlines of the shapes in pixels */
+	struct svgtiny_sdf_outline *outline;
+	unsigned int outline_count, outline_allocated;
+	/* x0, y0, x1, y1 of each line of the outlines */
+	float *line;
+	unsigned int line_count, line_allocated;
+
+	unsigned int tiles_x, tiles_y, tile_count;
+	/* indices of the lines which may change each row of tiles, in order,
+	 * from row_first[row] to row_first[row + 1] */
+	unsigned int *row_line;
+	size_t *row_first;
+};
+
+/* the state of one thread finding tiles of a svgtiny_sdf_job */
+struct svgtiny_sdf {
+	/* lines near the tile, as the start, the direction, and 1 over the
+	 * squared length, and the rows they are near */
+	float *x0, *y0, *dx, *dy, *scale;
+	int *row0, *row1;
+	/* lines of the outline crossing rows of the tile, as x at the top of
+	 * the tile and the change in x for each row, the rows crossed, and
+	 * +1 if going down or -1 if up */
+	float *cross_x, *cross_dxdy;
+	int *cross_row0, *cross_row1, *cross_dir;
+	unsigned int allocated;
+
+	/* least squared distance to the lines of an outline, and winding
+	 * number, of each pixel of the tile */
+	float d2[svgtiny_SDF_TILE * svgtiny_SDF_TILE];
+	int winding[svgtiny_SDF_TILE * (svgtiny_SDF_TILE + 1)];
+	/* least signed distance to the outlines so far */
+	float distance[svgtiny_SDF_TILE * svgtiny_SDF_TILE];
+};
+
+static svgtiny_code svgtiny_sdf_outlines(struct svgtiny_sdf_job *job,
+		const struct svgtiny_diagram *diagram, float scale);
+static bool svgtiny_sdf_outline(struct svgtiny_sdf_job *job,
+		struct svgtiny_lines *lines,
+		const struct svgtiny_shape *shape, float half_width);
+static bool svgtiny_sdf_subpath(void *pw, float *p, unsigned int n,
+		bool closed);
+static bool svgtiny_sdf_bin(struct svgtiny_sdf_job *job);
+static void svgtiny_sdf_work(struct svgtiny_threads *threads, void *pw);
+static svgtiny_code svgtiny_sdf_tile(struct svgtiny_sdf *s,
+		const struct svgtiny_sdf_job *job, unsigned int tile);
+static bool svgtiny_sdf_reserve(struct svgtiny_sdf *s, unsigned int count);
+static void svgtiny_sdf_distance(struct svgtiny_sdf *s, unsigned int n,
+		float tx, float ty);
+static void svgtiny_sdf_winding(struct svgtiny_sdf *s, unsigned int n,
+		float tx);
+
+
+/**
+ * Find the signed distance field of a diagram.
+ *
+ * Each pixel of the buffer is one byte, which is 128 on the edges of the
+ * shapes, rises to 255 at range pixels inside them, and falls to 0 at range
+ * pixels outside. The distance is from the centre of the pixel to the fills
+ * and strokes of the paths, flattened to within a small fraction of a pixel.
+ * Tiles of the buffer are found by several threads at once, and the buffer
+ * is the same for any number of threads.
+ *
+ * \param  diagram  a parsed diagram
+ * \param  buffer   top left pixel of the buffer
+ * \param  stride   bytes from each row of the buffer to the next
+ * \param  width    width of the buffer in pixels
+ * \param  height   height of the buffer in pixels
+ * \param  scale    pixels of the buffer for each pixel of the diagram
+ * \param  range    distance in pixels of the buffer from an edge at which the
+ *                  field reaches 0 or 255
+ * \param  threads  number of threads to use, including the calling thread,
+ *                  or 0 for one for each processor
+ * \return  svgtiny_OK, or svgtiny_OUT_OF_MEMORY, in which case the buffer may
+ *          have been partly written
+ */
+
+svgtiny_code svgtiny_render_sdf(const struct svgtiny_diagram *diagram,
+		unsigned char *buffer, unsigned int stride,
+		unsigned int width, unsigned int height, float scale,
+		float range, unsigned int threads)
+{
+	struct svgtiny_sdf_job job;
+	svgtiny_code code;
+
+	if (width == 0 || height == 0 || !(0 < scale) || !(0 < range) ||
+			INT_MAX - svgtiny_SDF_TILE < width ||
+			INT_MAX - svgtiny_SDF_TILE < height)
+		return svgtiny_OK;
+
+	job.buffer = buffer;
+	job.stride = stride;
+	job.width = width;
+	job.height = height;
+	job.range = range;
+	job.outline = NULL;
+	job.outline_count = job.outline_allocated = 0;
+	job.line = NULL;
+	job.line_count = job.line_allocated = 0;
+	job.tiles_x = (width + svgtiny_SDF_TILE - 1) / svgtiny_SDF_TILE;
+	job.tiles_y = (height + svgtiny_SDF_TILE - 1) / svgtiny_SDF_TILE;
+	job.tile_count = job.tiles_x * job.tiles_y;
+	job.row_line = NULL;
+	job.row_first = NULL;
+
+	code = svgtiny_sdf_outlines(&job, diagram, scale);
+	if (code == svgtiny_OK && !svgtiny_sdf_bin(&job))
+		code = svgtiny_OUT_OF_MEMORY;
+	if (code == svgtiny_OK)
+		code = svgtiny_threads_run(threads, job.tile_count,
+				svgtiny_sdf_work, &job);
+
+	free(job.outline);
+	free(job.line);
+	free(job.row_line);
+	free(job.row_first);
+	return code;
+}
+
+
+/**
+ * Flatten the fills and strokes of the paths of a diagram to outlines.
+ */
+
+svgtiny_code svgtiny_sdf_outlines(struct svgtiny_sdf_job *job,
+		const struct svgtiny_diagram *diagram, float scale)
+{
+	struct svgtiny_lines lines;
+	svgtiny_code code = svgtiny_OK;
+	unsigned int i;
+
+	lines.scale = scale;
+	lines.fixed_scale = (float) (1 << svgtiny_diagram_internal(
+			diagram)->fraction_bits);
+	lines.flatness = svgtiny_SDF_FLATNESS;
+	lines.subpath = svgtiny_sdf_subpath;
+	lines.pw = job;
+	lines.point = NULL;
+	lines.point_count = lines.point_allocated = 0;
+
+	for (i = 0; i != diagram->shape_count && code == svgtiny_OK; i++) {
+		const struct svgtiny_shape *shape = &diagram->shape[i];
+		if (!shape->path && !shape->path_op)
+			continue;
+		if ((shape->fill_gradient ||
+				shape->fill != svgtiny_TRANSPARENT) &&
+				!svgtiny_sdf_outline(job, &lines, shape, 0))
+			code = svgtiny_OUT_OF_MEMORY;
+		if (code == svgtiny_OK &&
+				shape->stroke != svgtiny_TRANSPARENT &&
+				0 < shape->stroke_width &&
+				!svgtiny_sdf_outline(job, &lines, shape,
+				0.5f * shape->stroke_width * scale))
+			code = svgtiny_OUT_OF_MEMORY;
+	}
+
+	free(lines.point);
+	return code;
+}
+
+
+/**
+ * Flatten the fill or the stroke of a path to an outline.
+ *
+ * \param  half_width  half the width of the stroke in pixels, or 0 for the
+ *                     fill
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_sdf_outline(struct svgtiny_sdf_job *job,
+		struct svgtiny_lines *lines,
+		const struct svgtiny_shape *shape, float half_width)
+{
+	struct svgtiny_sdf_outline *outline;
+	unsigned int i;
+
+	if (job->outline_count == job->outline_allocated) {
+		unsigned int allocated = job->outline_allocated * 2 + 16;
+		outline = realloc(job->outline,
+				allocated * sizeof outline[0]);
+		if (!outline)
+			return false;
+		job->outline = outline;
+		job->outline_allocated = allocated;
+	}
+	outline = &job->outline[job->outline_count];
+	outline->first = job->line_count;
+	outline->half_width = half_width;
+	outline->fill_rule = shape->fill_rule;
+
+	if (!svgtiny_lines_flatten(lines, shape))
+		return false;
+
+	outline->count = job->line_count - outline->first;
+	if (outline->count == 0)
+		return true;
+	outline->x0 = outline->y0 = INFINITY;
+	outline->x1 = outline->y1 = -INFINITY;
+	for (i = outline->first; i != job->line_count; i++) {
+		const float *l = job->line + 4 * i;
+		outline->x0 = fminf(outline->x0, fminf(l[0], l[2]));
+		outline->y0 = fminf(outline->y0, fminf(l[1], l[3]));
+		outline->x1 = fmaxf(outline->x1, fmaxf(l[0], l[2]));
+		outline->y1 = fmaxf(outline->y1, fmaxf(l[1], l[3]));
+	}
+	job->outline_count++;
+
+	return true;
+}
+
+
+/**
+ * Add the lines between the points of a subpath to the outline being built.
+ *
+ * Called by svgtiny_lines_flatten().
+ *
+ * \param  closed  add a line from the last point back to the first
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_sdf_subpath(void *pw, float *p, unsigned int n, bool closed)
+{
+	struct svgtiny_sdf_job *job = pw;
+	unsigned int i;
+
+	/* subpaths of fills are closed whether they end in a close or not */
+	if (job->outline[job->outline_count].half_width == 0)
+		closed = true;
+
+	if (job->line_allocated - job->line_count < n) {
+		unsigned int allocated = job->line_allocated * 2;
+		float *line;
+		if (allocated < job->line_count + n)
+			allocated = job->line_count + n + 64;
+		line = realloc(job->line, 4 * allocated * sizeof line[0]);
+		if (!line)
+			return false;
+		job->line = line;
+		job->line_allocated = allocated;
+	}
+
+	for (i = 0; i != n; i++) {
+		unsigned int j = i + 1 == n ? 0 : i + 1;
+		float *l = job->line + 4 * job->line_count;
+		if (i + 1 == n && !closed)
+			break;
+		if (p[2 * i] == p[2 * j] && p[2 * i + 1] == p[2 * j + 1] &&
+				(i + 1 != n || job->line_count != 0))
+			continue;
+		l[0] = p[2 * i];
+		l[1] = p[2 * i + 1];
+		l[2] = p[2 * j];
+		l[3] = p[2 * j + 1];
+		job->line_count++;
+	}
+
+	return true;
+}
+
+
+/**
+ * Find the lines which may change each row of tiles.
+ *
+ * A line may change the distance of the pixels within range, and half the
+ * width of its stroke, of it, and the winding number of the pixels in the
+ * rows it crosses.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_sdf_bin(struct svgtiny_sdf_job *job)
+{
+	const float size = svgtiny_SDF_TILE;
+	unsigned int pass, i, j, row;
+
+	job->row_first = calloc(job->tiles_y + 1, sizeof job->row_first[0]);
+	if (!job->row_first)
+		return false;
+
+	/* count the lines of each row, then place them */
+	for (pass = 0; pass != 2; pass++) {
+		if (pass == 1) {
+			for (row = 0; row != job->tiles_y; row++)
+				job->row_first[row + 1] += job->row_first[row];
+			job->row_line = malloc((job->row_first[job->tiles_y] +
+					1) * sizeof job->row_line[0]);
+			if (!job->row_line)
+				return false;
+		}
+		for (i = 0; i != job->outline_count; i++) {
+			const struct svgtiny_sdf_outline *outline =
+					&job->outline[i];
+			float reach = job->range + outline->half_width;
+			for (j = outline->first;
+					j != outline->first + outline->count;
+					j++) {
+				const float *l = job->line + 4 * j;
+				float row0 = floorf((fminf(l[1], l[3]) - reach -
+						0.5f) / size);
+				float row1 = floorf((fmaxf(l[1], l[3]) + reach -
+						0.5f) / size);
+				unsigned int r0, r1;
+				/* lines with NaNs are in no rows */
+				if (!(row0 < job->tiles_y) || !(0 <= row1))
+					continue;
+				r0 = 0 < row0 ? row0 : 0;
+				r1 = row1 < job->tiles_y - 1 ? row1 :
+						job->tiles_y - 1;
+				for (row = r0; row <= r1; row++) {
+					if (pass == 0)
+						job->row_first[row + 1]++;
+					else
+						job->row_line[
+							job->row_first[row]++]
+							= j;
+				}
+			}
+		}
+	}
+	/* placing moved each start to the next, so move them back */
+	for (row = job->tiles_y; row != 0; row--)
+		job->row_first[row] = job->row_first[row - 1];
+	job->row_first[0] = 0;
+
+	return true;
+}
+
+
+/**
+ * Find tiles of a svgtiny_sdf_job until there are none left.
+ */
+
+void svgtiny_sdf_work(struct svgtiny_threads *threads, void *pw)
+{
+	const struct svgtiny_sdf_job *job = pw;
+	struct svgtiny_sdf *s;
+	svgtiny_code code = svgtiny_OK;
+	unsigned int tile;
+
+	s = malloc(sizeof *s);
+	if (s) {
+		s->x0 = s->y0 = s->dx = s->dy = s->scale = NULL;
+		s->row0 = s->row1 = NULL;
+		s->cross_x = s->cross_dxdy = NULL;
+		s->cross_row0 = s->cross_row1 = s->cross_dir = NULL;
+		s->allocated = 0;
+	} else {
+		code = svgtiny_OUT_OF_MEMORY;
+	}
+
+	while (svgtiny_threads_next(threads, &tile, code))
+		code = svgtiny_sdf_tile(s, job, tile);
+
+	if (s) {
+		free(s->x0);
+		free(s->y0);
+		free(s->dx);
+		free(s->dy);
+		free(s->scale);
+		free(s->row0);
+		free(s->row1);
+		free(s->cross_x);
+		free(s->cross_dxdy);
+		free(s->cross_row0);
+		free(s->cross_row1);
+		free(s->cross_dir);
+		free(s);
+	}
+}
+
+
+/**
+ * Find the signed distance field in a tile of the buffer.
+ */
+
+svgtiny_code svgtiny_sdf_tile(struct svgtiny_sdf *s,
+		const struct svgtiny_sdf_job *job, unsigned int tile)
+{
+	const int size = svgtiny_SDF_TILE;
+	int x = (tile % job->tiles_x) * size, y = (tile / job->tiles_x) * size;
+	/* centres of the first and last pixels of the tile */
+	float cx0 = x + 0.5f, cy0 = y + 0.5f;
+	float cx1 = cx0 + size - 1, cy1 = cy0 + size - 1;
+	int width = job->width - x < size ? job->width - x : size;
+	int height = job->height - y < size ? job->height - y : size;
+	/* the lines which may change this row of tiles */
+	const unsigned int *line = job->row_line +
+			job->row_first[tile / job->tiles_x];
+	const unsigned int *end = job->row_line +
+			job->row_first[tile / job->tiles_x + 1];
+	unsigned int i, j, k;
+
+	if (!svgtiny_sdf_reserve(s, end - line))
+		return svgtiny_OUT_OF_MEMORY;
+
+	for (k = 0; k != size * size; k++)
+		s->distance[k] = job->range;
+
+	for (i = 0; i != job->outline_count; i++) {
+		const struct svgtiny_sdf_outline *outline = &job->outline[i];
+		/* lines further than this from every pixel can not change
+		 * the field */
+		float reach = job->range + outline->half_width;
+		bool fill = outline->half_width == 0;
+		unsigned int near = 0, cross = 0;
+
+		while (line != end && *line < outline->first)
+			line++;
+		if (outline->x1 + reach < cx0 || cx1 < outline->x0 - reach ||
+				outline->y1 + reach < cy0 ||
+				cy1 < outline->y0 - reach)
+			continue;
+
+		for (; line != end && *line < outline->first + outline->count;
+				line++) {
+			const float *l = job->line + 4 * *line;
+			float lx0 = fminf(l[0], l[2]), lx1 = fmaxf(l[0], l[2]);
+			float ly0 = fminf(l[1], l[3]), ly1 = fmaxf(l[1], l[3]);
+			float dx = l[2] - l[0], dy = l[3] - l[1];
+			float length2 = dx * dx + dy * dy;
+
+			/* rows whose centres the line crosses, counted from
+			 * the first up to but not including the last */
+			if (fill && l[1] != l[3] && lx0 <= cx1 &&
+					cy0 - 1 < ly1 && ly0 < cy1 + 1) {
+				float r0 = ceilf(ly0 - cy0);
+				float r1 = ceilf(ly1 - cy0);
+				s->cross_row0[cross] = 0 < r0 ?
+						(r0 < size ? r0 : size) : 0;
+				s->cross_row1[cross] = 0 < r1 ?
+						(r1 < size ? r1 : size) : 0;
+				s->cross_dxdy[cross] = dx / dy;
+				s->cross_x[cross] = l[0] +
+						(cy0 - l[1]) * (dx / dy);
+				s->cross_dir[cross] = l[1] < l[3] ? 1 : -1;
+				if (s->cross_row0[cross] <
+						s->cross_row1[cross])
+					cross++;
+			}
+
+			if (lx1 + reach < cx0 || cx1 < lx0 - reach ||
+					ly1 + reach < cy0 || cy1 < ly0 - reach)
+				continue;
+			s->x0[near] = l[0];
+			s->y0[near] = l[1];
+			s->dx[near] = dx;
+			s->dy[near] = dy;
+			s->scale[near] = 0 < length2 ? 1 / length2 : 0;
+			s->row0[near] = ly0 - reach - cy0 < 0 ? 0 :
+					(int) ceilf(ly0 - reach - cy0);
+			s->row1[near] = ly1 + reach - cy0 < size - 1 ?
+					(int) floorf(ly1 + reach - cy0) + 1 :
+					size;
+			near++;
+		}
+
+		/* with no lines in reach and none crossing, the tile is
+		 * outside by at least the range */
+		if (near == 0 && cross == 0)
+			continue;
+
+		for (k = 0; k != size * size; k++)
+			s->d2[k] = reach * reach;
+		svgtiny_sdf_distance(s, near, cx0, cy0);
+		if (fill) {
+			bool evenodd = outline->fill_rule ==
+					svgtiny_FILL_EVENODD;
+			svgtiny_sdf_winding(s, cross, cx0);
+			for (j = 0; j != (unsigned int) size; j++) {
+				const int *w = s->winding + j * (size + 1);
+				const float *d2 = s->d2 + j * size;
+				float *d = s->distance + j * size;
+				for (k = 0; k != (unsigned int) size; k++) {
+					bool inside = evenodd ? (w[k] & 1) :
+							w[k] != 0;
+					float e = sqrtf(d2[k]);
+					d[k] = fminf(d[k], inside ? -e : e);
+				}
+			}
+		} else {
+			for (k = 0; k != size * size; k++)
+				s->distance[k] = fminf(s->distance[k],
+						sqrtf(s->d2[k]) -
+						outline->half_width);
+		}
+	}
+
+	for (j = 0; j != (unsigned int) height; j++) {
+		unsigned char *row = job->buffer +
+				(size_t) (y + j) * job->stride + x;
+		const float *d = s->distance + j * size;
+		for (k = 0; k != (unsigned int) width; k++) {
+			float v = 0.5f - 0.5f * d[k] / job->range;
+			v = v < 0 ? 0 : v < 1 ? v : 1;
+			row[k] = (unsigned char) (v * 255 + 0.5f);
+		}
+	}
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Make room for the lines of an outline in the state of a thread.
+ *
+ * \return  false if memory runs out
+ */
+
+bool svgtiny_sdf_reserve(struct svgtiny_sdf *s, unsigned int count)
+{
+	float **f[] = { &s->x0, &s->y0, &s->dx, &s->dy, &s->scale,
+			&s->cross_x, &s->cross_dxdy };
+	int **n[] = { &s->row0, &s->row1, &s->cross_row0, &s->cross_row1,
+			&s->cross_dir };
+	unsigned int i;
+
+	if (count <= s->allocated)
+		return true;
+	count += count / 2;
+	for (i = 0; i != sizeof f / sizeof f[0]; i++) {
+		float *a = realloc(*f[i], count * sizeof a[0]);
+		if (!a)
+			return false;
+		*f[i] = a;
+	}
+	for (i = 0; i != sizeof n / sizeof n[0]; i++) {
+		int *a = realloc(*n[i], count * sizeof a[0]);
+		if (!a)
+			return false;
+		*n[i] = a;
+	}
+	s->allocated = count;
+	return true;
+}
+
+
+/**
+ * Find the least squared distance from each pixel of the tile to the near
+ * lines.
+ *
+ * Each line is taken in turn over the rows it is near, and the distance to
+ * the whole of a row is found at once, with no branches, so that the
+ * compiler can find several pixels together with vector instructions.
+ *
+ * \param  n   number of near lines
+ * \param  tx  x of the centre of the first pixel of the tile
+ * \param  ty  y of the centre of the first pixel of the tile
+ */
+
+void svgtiny_sdf_distance(struct svgtiny_sdf *s, unsigned int n,
+		float tx, float ty)
+{
+	unsigned int i;
+	int y, k;
+
+	for (i = 0; i != n; i++) {
+		float x0 = s->x0[i], dx = s->dx[i], dy = s->dy[i];
+		float scale = s->scale[i];
+		for (y = s->row0[i]; y < s->row1[i]; y++) {
+			float *d2 = s->d2 + y * svgtiny_SDF_TILE;
+			float ay = ty + y - s->y0[i];
+			for (k = 0; k != svgtiny_SDF_TILE; k++) {
+				float ax = tx + k - x0;
+				float t = (ax * dx + ay * dy) * scale;
+				float ex, ey, d;
+				/* t clamped to 0 to 1, and the less of d and
+				 * d2[k], by fabsf(), as fminf() and branches
+				 * are not vectorized without fast maths */
+				t = 0.5f * (fabsf(t) - fabsf(t - 1) + 1);
+				ex = ax - t * dx;
+				ey = ay - t * dy;
+				d = ex * ex + ey * ey;
+				d2[k] = 0.5f * (d + d2[k] - fabsf(d - d2[k]));
+			}
+		}
+	}
+}
+
+
+/**
+ * Find the winding number of each pixel of the tile.
+ *
+ * Each row of the winding numbers has a spare entry at the end. A line
+ * crossing a row adds its direction at the first pixel of the row to the
+ * right of where it crosses, and summing the row from the left then gives
+ * the winding number of each pixel.
+ *
+ * \param  n   number of lines crossing rows of the tile
+ * \param  tx  x of the centre of the first pixel of the tile
+ */
+
+void svgtiny_sdf_winding(struct svgtiny_sdf *s, unsigned int n, float tx)
+{
+	const int size = svgtiny_SDF_TILE;
+	unsigned int i;
+	int y, k;
+
+	memset(s->winding, 0, sizeof s->winding);
+	for (i = 0; i != n; i++) {
+		for (y = s->cross_row0[i]; y < s->cross_row1[i]; y++) {
+			float f = s->cross_x[i] + y * s->cross_dxdy[i] - tx;
+			/* the first pixel whose centre is right of f */
+			k = !(f < size) ? size : f < 0 ? 0 : (int) f + 1;
+			s->winding[y * (size + 1) + k] += s->cross_dir[i];
+		}
+	}
+	for (y = 0; y != size; y++) {
+		int *w = s->winding + y * (size + 1);
+		for (k = 1; k != size; k++)
+			w[k] += w[k - 1];
+	}
+}
@@ -0,0 +1,1735 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Streaming parser.
+ *
+ * Builds the svgtiny_diagram straight from XML start, end, and character data
+ * events, without constructing a dom_document. Only a stack of parse states
+ * for the open elements is kept, so memory use follows the nesting depth of
+ * the document rather than its size.
+ *
+ * Shapes are emitted as soon as their element has been seen. A gradient
+ * referenced by url(#id) before its definition can't be resolved yet, so the
+ * shape is held in a fixup table, and inserted at its place in the diagram
+ * when the gradient is complete, or at the end of the document.
+ *
+ * A svgtiny_context keeps one parser for many documents, so that the
+ * interned strings, the expat parser, and the allocations of the lists below
+ * are made once rather than for every document.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <expat.h>
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* colour returned by _svgtiny_parse_color() never, used to detect values
+ * which it did not understand */
+#define svgtiny_UNSET_COLOUR 0x40000000
+
+/* longest chain of gradient href references followed */
+#define svgtiny_MAX_HREF_DEPTH 16
+
+/* an open element which contributes to the diagram */
+struct svgtiny_stream_frame {
+	bool text;		/* <text> or <tspan>, else <svg>, <g>, <a> */
+	struct svgtiny_parse_state state;
+	char *fill_id, *stroke_id;	/* pending ids set by this element */
+	float text_x, text_y;
+};
+
+/* a complete <linearGradient> or <radialGradient> element */
+struct svgtiny_stream_gradient {
+	char *id;
+	char *href;		/* id from xlink:href, or NULL */
+	bool radial;
+	dom_string *x1, *y1, *x2, *y2;
+	dom_string *cx, *cy, *r, *fx, *fy;
+	int user_space_on_use;	/* -1 if gradientUnits absent */
+	int spread;		/* -1 if spreadMethod absent */
+	bool transform_set;
+	float transform[6];
+	struct svgtiny_gradient_stop *stop;	/* while reading stops */
+	unsigned int stop_count, stop_allocated;
+	struct svgtiny_gradient_ramp *ramp;	/* NULL if no stops */
+};
+
+/* a shape waiting for the definition of a gradient */
+struct svgtiny_stream_fixup {
+	unsigned int index;	/* position in diagram->shape */
+	float *path;		/* untransformed path, or NULL for text */
+	unsigned int path_length;
+	char *text;
+	float text_x, text_y;
+	struct svgtiny_parse_state state;
+	char *fill_id, *stroke_id;
+};
+
+struct svgtiny_stream {
+	XML_Parser parser;
+	struct svgtiny_diagram *diagram;
+	svgtiny_code code;
+
+	/* shared by every state, owns the interned strings */
+	struct svgtiny_parse_context context;
+
+	/* initial state, also used for parsing stop colours */
+	struct svgtiny_parse_state state;
+
+	bool root;		/* the root element has been seen */
+	unsigned int depth;	/* number of open elements */
+	unsigned int skip;	/* depth within an ignored subtree */
+	struct svgtiny_list *frames;
+
+	/* character data for the innermost text frame */
+	char *text;
+	size_t text_length, text_allocated;
+	bool have_text;
+
+	/* gradient definitions, and the one being read */
+	struct svgtiny_list *gradients;
+	struct svgtiny_stream_gradient gradient;
+	unsigned int gradient_depth;	/* 0 if not in a gradient element */
+
+	struct svgtiny_list *fixups;
+	bool missing;		/* a lookup hit an undefined gradient */
+	bool completed;		/* no more definitions will arrive */
+};
+
+struct svgtiny_context {
+	struct svgtiny_stream *stream;
+};
+
+static struct svgtiny_stream *svgtiny_stream_alloc(void);
+static void svgtiny_stream_begin(struct svgtiny_stream *stream,
+		struct svgtiny_diagram *diagram, int width, int height);
+static void svgtiny_stream_clear(struct svgtiny_stream *stream);
+static void svgtiny_stream_handlers(struct svgtiny_stream *stream);
+static void XMLCALL svgtiny_stream_start(void *user_data,
+		const XML_Char *name, const XML_Char **atts);
+static void XMLCALL svgtiny_stream_end(void *user_data,
+		const XML_Char *name);
+static void XMLCALL svgtiny_stream_character_data(void *user_data,
+		const XML_Char *s, int len);
+static void XMLCALL svgtiny_stream_comment(void *user_data,
+		const XML_Char *data);
+static void XMLCALL svgtiny_stream_processing_instruction(void *user_data,
+		const XML_Char *target, const XML_Char *data);
+static void svgtiny_stream_error(struct svgtiny_stream *stream,
+		svgtiny_code code, const char *message);
+static svgtiny_code svgtiny_stream_flush_text(struct svgtiny_stream *stream);
+static struct svgtiny_stream_frame *svgtiny_stream_push(
+		struct svgtiny_stream *stream, bool text);
+static void svgtiny_stream_frame_cleanup(struct svgtiny_stream_frame *frame);
+static svgtiny_code svgtiny_stream_start_root(struct svgtiny_stream *stream,
+		const char *name, const char **atts);
+static svgtiny_code svgtiny_stream_start_svg(struct svgtiny_stream *stream,
+		const char **atts);
+static svgtiny_code svgtiny_stream_start_text(struct svgtiny_stream *stream,
+		const char **atts);
+static svgtiny_code svgtiny_stream_shape(struct svgtiny_stream *stream,
+		svgtiny_element element, const char **atts);
+static const char *svgtiny_stream_attribute(const char **atts,
+		const char *name);
+static float svgtiny_stream_length(const char *s, int viewport_size);
+static void svgtiny_stream_position(const char **atts,
+		const struct svgtiny_parse_state *state,
+		float *x, float *y, float *width, float *height);
+static void svgtiny_stream_paint(struct svgtiny_stream *stream,
+		struct svgtiny_stream_frame *frame, const char **atts);
+static void svgtiny_stream_colour(struct svgtiny_stream *stream,
+		struct svgtiny_stream_frame *frame, const char *s, bool fill);
+static void svgtiny_stream_transform(const char **atts,
+		struct svgtiny_parse_state *state);
+static void svgtiny_stream_gradient_start(struct svgtiny_stream *stream,
+		const char **atts, bool radial);
+static void svgtiny_stream_gradient_stop(struct svgtiny_stream *stream,
+		const char **atts);
+static svgtiny_code svgtiny_stream_gradient_end(struct svgtiny_stream *stream);
+static void svgtiny_stream_gradient_free(
+		struct svgtiny_stream_gradient *gradient);
+static struct svgtiny_stream_gradient *svgtiny_stream_gradient_lookup(
+		struct svgtiny_stream *stream, const char *id);
+static bool svgtiny_stream_gradient_ready(struct svgtiny_stream *stream,
+		const char *id, unsigned int depth);
+static bool svgtiny_stream_gradient_apply(struct svgtiny_stream *stream,
+		const char *id, struct svgtiny_gradient *gradient,
+		unsigned int depth);
+static svgtiny_code svgtiny_stream_defer(float *p, unsigned int n,
+		const char *text, size_t len, float x, float y,
+		struct svgtiny_parse_state *state);
+static svgtiny_code svgtiny_stream_resolve(struct svgtiny_stream *stream);
+static svgtiny_code svgtiny_stream_fixup(struct svgtiny_stream *stream,
+		struct svgtiny_stream_fixup *fixup, unsigned int *added);
+static void svgtiny_stream_fixup_free(struct svgtiny_stream_fixup *fixup);
+
+
+/**
+ * Create a streaming parser for a diagram.
+ *
+ * \param  diagram  diagram returned by svgtiny_create()
+ * \param  url      url that the SVG came from
+ * \param  width    target viewport width in pixels
+ * \param  height   target viewport height in pixels
+ * \return  new parser, or NULL if memory runs out
+ */
+
+struct svgtiny_stream *svgtiny_stream_create(struct svgtiny_diagram *diagram,
+		const char *url, int width, int height)
+{
+	struct svgtiny_stream *stream;
+
+	assert(diagram);
+	assert(url);
+
+	UNUSED(url);
+
+	stream = svgtiny_stream_alloc();
+	if (!stream)
+		return NULL;
+
+	svgtiny_stream_begin(stream, diagram, width, height);
+
+	return stream;
+}
+
+
+/**
+ * Allocate a parser and everything it keeps between documents.
+ */
+
+struct svgtiny_stream *svgtiny_stream_alloc(void)
+{
+	struct svgtiny_stream *stream;
+
+	stream = calloc(1, sizeof *stream);
+	if (!stream)
+		return NULL;
+
+	stream->context.document = NULL;
+	stream->context.stream = stream;
+
+#define SVGTINY_STRING_ACTION2(s,n)					\
+	if (dom_string_create_interned((const uint8_t *) #n,		\
+				       strlen(#n),			\
+				       &stream->context.interned_##s)	\
+	    != DOM_NO_ERR) {						\
+		svgtiny_stream_free(stream);				\
+		return NULL;						\
+	}
+#include "svgtiny_strings.h"
+#undef SVGTINY_STRING_ACTION2
+
+	stream->frames = svgtiny_list_create(
+			sizeof (struct svgtiny_stream_frame));
+	stream->gradients = svgtiny_list_create(
+			sizeof (struct svgtiny_stream_gradient));
+	stream->fixups = svgtiny_list_create(
+			sizeof (struct svgtiny_stream_fixup));
+	stream->parser = XML_ParserCreateNS(NULL, '\n');
+	if (!stream->frames || !stream->gradients || !stream->fixups ||
+			!stream->parser) {
+		svgtiny_stream_free(stream);
+		return NULL;
+	}
+
+	svgtiny_stream_handlers(stream);
+
+	return stream;
+}
+
+
+/**
+ * Prepare a parser with no document in progress to parse into a diagram.
+ */
+
+void svgtiny_stream_begin(struct svgtiny_stream *stream,
+		struct svgtiny_diagram *diagram, int width, int height)
+{
+	stream->diagram = diagram;
+	stream->code = svgtiny_OK;
+	stream->context.diagram = diagram;
+
+	memset(&stream->state, 0, sizeof stream->state);
+	stream->state.context = &stream->context;
+	stream->state.viewport_width = width;
+	stream->state.viewport_height = height;
+
+	stream->root = false;
+	stream->depth = 0;
+	stream->skip = 0;
+	stream->text_length = 0;
+	stream->have_text = false;
+	stream->gradient_depth = 0;
+	stream->missing = false;
+	stream->completed = false;
+}
+
+
+/**
+ * Free everything belonging to the current document, keeping the lists
+ * themselves.
+ */
+
+void svgtiny_stream_clear(struct svgtiny_stream *stream)
+{
+	unsigned int i;
+
+	if (stream->frames) {
+		for (i = 0; i != svgtiny_list_size(stream->frames); i++)
+			svgtiny_stream_frame_cleanup(
+					svgtiny_list_get(stream->frames, i));
+		svgtiny_list_resize(stream->frames, 0);
+	}
+
+	if (stream->gradients) {
+		for (i = 0; i != svgtiny_list_size(stream->gradients); i++)
+			svgtiny_stream_gradient_free(
+					svgtiny_list_get(stream->gradients, i));
+		svgtiny_list_resize(stream->gradients, 0);
+	}
+	svgtiny_stream_gradient_free(&stream->gradient);
+
+	if (stream->fixups) {
+		for (i = 0; i != svgtiny_list_size(stream->fixups); i++)
+			svgtiny_stream_fixup_free(
+					svgtiny_list_get(stream->fixups, i));
+		svgtiny_list_resize(stream->fixups, 0);
+	}
+
+	svgtiny_cleanup_state_local(&stream->state);
+}
+
+
+/**
+ * Set the expat callbacks, which XML_ParserReset() clears.
+ */
+
+void svgtiny_stream_handlers(struct svgtiny_stream *stream)
+{
+	XML_SetUserData(stream->parser, stream);
+	XML_SetElementHandler(stream->parser, svgtiny_stream_start,
+			svgtiny_stream_end);
+	XML_SetCharacterDataHandler(stream->parser,
+			svgtiny_stream_character_data);
+	XML_SetCommentHandler(stream->parser, svgtiny_stream_comment);
+	XML_SetProcessingInstructionHandler(stream->parser,
+			svgtiny_stream_processing_instruction);
+}
+
+
+/**
+ * Parse a chunk of SVG data.
+ *
+ * Chunks may be split anywhere, even within a UTF-8 sequence. Shapes are
+ * added to the diagram as they are parsed.
+ *
+ * \return  svgtiny_OK, or an error code, after which the stream is finished
+ */
+
+svgtiny_code svgtiny_stream_parse_chunk(struct svgtiny_stream *stream,
+		const char *buffer, size_t size)
+{
+	assert(stream);
+	assert(buffer || size == 0);
+
+	if (stream->code != svgtiny_OK || stream->completed)
+		return stream->code;
+
+	while (size) {
+		int n = size < INT_MAX ? (int) size : INT_MAX;
+		if (XML_Parse(stream->parser, buffer, n, XML_FALSE) !=
+				XML_STATUS_OK) {
+			if (stream->code == svgtiny_OK)
+				svgtiny_stream_error(stream,
+						svgtiny_LIBDOM_ERROR,
+						XML_ErrorString(XML_GetErrorCode(
+						stream->parser)));
+			break;
+		}
+		buffer += n;
+		size -= n;
+	}
+
+	if (stream->code != svgtiny_OK) {
+		/* the document ends here: place any shapes that are still
+		 * waiting for a gradient */
+		stream->completed = true;
+		svgtiny_stream_resolve(stream);
+		svgtiny_compact_diagram(stream->diagram);
+	}
+
+	return stream->code;
+}
+
+
+/**
+ * Finish parsing after the last chunk.
+ *
+ * Shapes referring to gradients which were never defined are added now.
+ */
+
+svgtiny_code svgtiny_stream_completed(struct svgtiny_stream *stream)
+{
+	svgtiny_code code;
+
+	assert(stream);
+
+	if (stream->code != svgtiny_OK || stream->completed)
+		return stream->code;
+
+	if (XML_Parse(stream->parser, "", 0, XML_TRUE) != XML_STATUS_OK &&
+			stream->code == svgtiny_OK)
+		svgtiny_stream_error(stream, svgtiny_LIBDOM_ERROR,
+				XML_ErrorString(XML_GetErrorCode(
+				stream->parser)));
+
+	stream->completed = true;
+	code = svgtiny_stream_resolve(stream);
+	if (stream->code == svgtiny_OK)
+		stream->code = code;
+	svgtiny_compact_diagram(stream->diagram);
+
+	return stream->code;
+}
+
+
+/**
+ * Free a streaming parser. The diagram is not affected.
+ */
+
+void svgtiny_stream_free(struct svgtiny_stream *stream)
+{
+	if (!stream)
+		return;
+
+	if (stream->parser)
+		XML_ParserFree(stream->parser);
+
+	svgtiny_stream_clear(stream);
+	if (stream->frames)
+		svgtiny_list_free(stream->frames);
+	if (stream->gradients)
+		svgtiny_list_free(stream->gradients);
+	if (stream->fixups)
+		svgtiny_list_free(stream->fixups);
+
+	free(stream->text);
+
+#define SVGTINY_STRING_ACTION2(s,n)				\
+	if (stream->context.interned_##s != NULL)		\
+		dom_string_unref(stream->context.interned_##s);
+#include "svgtiny_strings.h"
+#undef SVGTINY_STRING_ACTION2
+
+	free(stream);
+}
+
+
+/**
+ * Parse a block of memory into a svgtiny_diagram without building a
+ * dom_document.
+ *
+ * The result is the same as svgtiny_parse().
+ */
+
+svgtiny_code svgtiny_parse_stream(struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height)
+{
+	struct svgtiny_stream *stream;
+	svgtiny_code code;
+
+	assert(buffer);
+
+	stream = svgtiny_stream_create(diagram, url, width, height);
+	if (!stream)
+		return svgtiny_OUT_OF_MEMORY;
+
+	code = svgtiny_stream_parse_chunk(stream, buffer, size);
+	if (code == svgtiny_OK)
+		code = svgtiny_stream_completed(stream);
+
+	svgtiny_stream_free(stream);
+
+	return code;
+}
+
+
+/**
+ * Create a context for parsing many documents.
+ *
+ * \return  new context, or NULL if memory runs out
+ */
+
+struct svgtiny_context *svgtiny_context_create(void)
+{
+	struct svgtiny_context *ctx;
+
+	ctx = malloc(sizeof *ctx);
+	if (!ctx)
+		return NULL;
+
+	ctx->stream = svgtiny_stream_alloc();
+	if (!ctx->stream) {
+		free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+
+/**
+ * Parse a block of memory into a svgtiny_diagram using a context.
+ *
+ * The result is the same as svgtiny_parse_stream(). A context may be used
+ * for any number of documents, one at a time.
+ */
+
+svgtiny_code svgtiny_parse_ctx(struct svgtiny_context *ctx,
+		struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height)
+{
+	struct svgtiny_stream *stream;
+	svgtiny_code code;
+
+	assert(ctx);
+	assert(diagram);
+	assert(buffer);
+	assert(url);
+
+	UNUSED(url);
+
+	if (!ctx->stream) {
+		/* resetting the parser failed after the previous document */
+		ctx->stream = svgtiny_stream_alloc();
+		if (!ctx->stream)
+			return svgtiny_OUT_OF_MEMORY;
+	}
+	stream = ctx->stream;
+	svgtiny_stream_begin(stream, diagram, width, height);
+
+	code = svgtiny_stream_parse_chunk(stream, buffer, size);
+	if (code == svgtiny_OK)
+		code = svgtiny_stream_completed(stream);
+
+	/* ready the parser for the next document */
+	svgtiny_stream_clear(stream);
+	if (XML_ParserReset(stream->parser, NULL) == XML_TRUE) {
+		svgtiny_stream_handlers(stream);
+	} else {
+		svgtiny_stream_free(stream);
+		ctx->stream = NULL;
+	}
+
+	return code;
+}
+
+
+/**
+ * Free a context.
+ */
+
+void svgtiny_context_free(struct svgtiny_context *ctx)
+{
+	if (!ctx)
+		return;
+
+	svgtiny_stream_free(ctx->stream);
+	free(ctx);
+}
+
+
+/**
+ * Handle an element start tag.
+ */
+
+void svgtiny_stream_start(void *user_data, const XML_Char *name,
+		const XML_Char **atts)
+{
+	struct svgtiny_stream *stream = user_data;
+	struct svgtiny_stream_frame *frame;
+	const struct svgtiny_element_name *element;
+	svgtiny_code code = svgtiny_OK;
+	const char *local;
+
+	/* expat may report a few more events after XML_StopParser() */
+	if (stream->code != svgtiny_OK)
+		return;
+
+	stream->depth++;
+
+	code = svgtiny_stream_flush_text(stream);
+	if (code != svgtiny_OK) {
+		svgtiny_stream_error(stream, code, NULL);
+		return;
+	}
+
+	/* names are "namespace\nlocal", or just "local" */
+	local = strrchr(name, '\n');
+	local = local ? local + 1 : name;
+
+	if (!stream->root) {
+		code = svgtiny_stream_start_root(stream, local, atts);
+		if (code != svgtiny_OK)
+			svgtiny_stream_error(stream, code, NULL);
+		return;
+	}
+
+	/* gradients may be referenced from anywhere, so are read even inside
+	 * otherwise ignored elements such as <defs> */
+	if (stream->gradient_depth) {
+		if (strcmp(local, "stop") == 0)
+			svgtiny_stream_gradient_stop(stream, atts);
+	} else if (strcmp(local, "linearGradient") == 0 &&
+			svgtiny_stream_attribute(atts, "id")) {
+		svgtiny_stream_gradient_start(stream, atts, false);
+	} else if (strcmp(local, "radialGradient") == 0 &&
+			svgtiny_stream_attribute(atts, "id")) {
+		svgtiny_stream_gradient_start(stream, atts, true);
+	}
+
+	if (stream->skip) {
+		stream->skip++;
+		return;
+	}
+
+	frame = svgtiny_list_get(stream->frames,
+			svgtiny_list_size(stream->frames) - 1);
+	element = svgtiny_element_lookup(local, strlen(local));
+	if (!element) {
+		stream->skip = 1;
+	} else if (frame->text) {
+		if (element->element == svgtiny_ELEMENT_TSPAN)
+			code = svgtiny_stream_start_text(stream, atts);
+		else
+			stream->skip = 1;
+	} else if (element->element == svgtiny_ELEMENT_SVG ||
+			element->element == svgtiny_ELEMENT_G ||
+			element->element == svgtiny_ELEMENT_A) {
+		code = svgtiny_stream_start_svg(stream, atts);
+	} else if (element->element == svgtiny_ELEMENT_TEXT) {
+		code = svgtiny_stream_start_text(stream, atts);
+	} else {
+		/* shapes have no content of interest */
+		code = svgtiny_stream_shape(stream, element->element, atts);
+		stream->skip = 1;
+	}
+
+	if (code != svgtiny_OK)
+		svgtiny_stream_error(stream, code, NULL);
+}
+
+
+/**
+ * Handle an element end tag.
+ */
+
+void svgtiny_stream_end(void *user_data, const XML_Char *name)
+{
+	struct svgtiny_stream *stream = user_data;
+	svgtiny_code code;
+	unsigned int n;
+
+	UNUSED(name);
+
+	if (stream->code != svgtiny_OK)
+		return;
+
+	code = svgtiny_stream_flush_text(stream);
+	if (code == svgtiny_OK && stream->gradient_depth == stream->depth)
+		code = svgtiny_stream_gradient_end(stream);
+	if (code != svgtiny_OK) {
+		svgtiny_stream_error(stream, code, NULL);
+		return;
+	}
+
+	stream->depth--;
+
+	if (stream->skip) {
+		stream->skip--;
+		return;
+	}
+
+	n = svgtiny_list_size(stream->frames);
+	assert(n != 0);
+	svgtiny_stream_frame_cleanup(svgtiny_list_get(stream->frames, n - 1));
+	svgtiny_list_resize(stream->frames, n - 1);
+}
+
+
+/**
+ * Handle character data, which is kept if it is the content of a text frame.
+ */
+
+void svgtiny_stream_character_data(void *user_data, const XML_Char *s,
+		int len)
+{
+	struct svgtiny_stream *stream = user_data;
+	struct svgtiny_stream_frame *frame;
+	unsigned int n = svgtiny_list_size(stream->frames);
+
+	if (stream->code != svgtiny_OK || stream->skip || n == 0)
+		return;
+	frame = svgtiny_list_get(stream->frames, n - 1);
+	if (!frame->text)
+		return;
+
+	if (stream->text_allocated < stream->text_length + len) {
+		size_t allocated = (stream->text_length + len) * 2;
+		char *text = realloc(stream->text, allocated);
+		if (!text) {
+			svgtiny_stream_error(stream, svgtiny_OUT_OF_MEMORY,
+					NULL);
+			return;
+		}
+		stream->text = text;
+		stream->text_allocated = allocated;
+	}
+	memcpy(stream->text + stream->text_length, s, len);
+	stream->text_length += len;
+	stream->have_text = true;
+}
+
+
+/**
+ * Handle a comment, which separates text nodes.
+ */
+
+void svgtiny_stream_comment(void *user_data, const XML_Char *data)
+{
+	struct svgtiny_stream *stream = user_data;
+	svgtiny_code code;
+
+	UNUSED(data);
+
+	if (stream->code != svgtiny_OK)
+		return;
+
+	code = svgtiny_stream_flush_text(stream);
+	if (code != svgtiny_OK)
+		svgtiny_stream_error(stream, code, NULL);
+}
+
+
+/**
+ * Handle a processing instruction, which separates text nodes.
+ */
+
+void svgtiny_stream_processing_instruction(void *user_data,
+		const XML_Char *target, const XML_Char *data)
+{
+	UNUSED(target);
+	svgtiny_stream_comment(user_data, data);
+}
+
+
+/**
+ * Record an error and stop the XML parser.
+ *
+ * \param  message  error message, or NULL to leave diagram->error_message
+ */
+
+void svgtiny_stream_error(struct svgtiny_stream *stream, svgtiny_code code,
+		const char *message)
+{
+	if (stream->code != svgtiny_OK)
+		return;
+	stream->code = code;
+	if (message) {
+		stream->diagram->error_line =
+				XML_GetCurrentLineNumber(stream->parser);
+		stream->diagram->error_message = message;
+	}
+	XML_StopParser(stream->parser, XML_FALSE);
+}
+
+
+/**
+ * Add the character data collected so far as a text shape.
+ */
+
+svgtiny_code svgtiny_stream_flush_text(struct svgtiny_stream *stream)
+{
+	struct svgtiny_stream_frame *frame;
+	size_t len = stream->text_length;
+
+	if (!stream->have_text)
+		return svgtiny_OK;
+	stream->have_text = false;
+	stream->text_length = 0;
+
+	frame = svgtiny_list_get(stream->frames,
+			svgtiny_list_size(stream->frames) - 1);
+	assert(frame->text);
+	return svgtiny_add_text(stream->text, len,
+			frame->text_x, frame->text_y, &frame->state);
+}
+
+
+/**
+ * Push a frame inheriting the state of the innermost one.
+ */
+
+struct svgtiny_stream_frame *svgtiny_stream_push(
+		struct svgtiny_stream *stream, bool text)
+{
+	struct svgtiny_stream_frame *parent, *frame;
+	unsigned int n = svgtiny_list_size(stream->frames);
+
+	frame = svgtiny_list_push(stream->frames);
+	if (!frame)
+		return NULL;
+	parent = svgtiny_list_get(stream->frames, n - 1);
+
+	frame->text = text;
+	frame->state = parent->state;
+	svgtiny_setup_state_local(&frame->state);
+	frame->fill_id = NULL;
+	frame->stroke_id = NULL;
+	frame->text_x = 0;
+	frame->text_y = 0;
+
+	return frame;
+}
+
+
+/**
+ * Release the contents of a frame.
+ */
+
+void svgtiny_stream_frame_cleanup(struct svgtiny_stream_frame *frame)
+{
+	svgtiny_cleanup_state_local(&frame->state);
+	free(frame->fill_id);
+	free(frame->stroke_id);
+	frame->fill_id = NULL;
+	frame->stroke_id = NULL;
+}
+
+
+/**
+ * Start the root element, which must be <svg>.
+ */
+
+svgtiny_code svgtiny_stream_start_root(struct svgtiny_stream *stream,
+		const char *name, const char **atts)
+{
+	struct svgtiny_stream_frame *frame;
+	const char *view_box;
+	float x, y, width, height;
+
+	if (strcasecmp(name, "svg") != 0)
+		return svgtiny_NOT_SVG;
+	stream->root = true;
+
+	frame = svgtiny_list_push(stream->frames);
+	if (!frame)
+		return svgtiny_OUT_OF_MEMORY;
+	frame->text = false;
+	frame->state = stream->state;
+	frame->fill_id = NULL;
+	frame->stroke_id = NULL;
+
+	/* get graphic dimensions */
+	svgtiny_stream_position(atts, &frame->state, &x, &y, &width, &height);
+	stream->diagram->width = width;
+	stream->diagram->height = height;
+
+	/* set up parsing state */
+	frame->state.viewport_width = width;
+	frame->state.viewport_height = height;
+	frame->state.ctm.a = 1;
+	frame->state.ctm.b = 0;
+	frame->state.ctm.c = 0;
+	frame->state.ctm.d = 1;
+	frame->state.ctm.e = 0;
+	frame->state.ctm.f = 0;
+	frame->state.fill = 0x000000;
+	frame->state.stroke = svgtiny_TRANSPARENT;
+	frame->state.stroke_width = 1;
+	frame->state.fill_rule = svgtiny_FILL_NONZERO;
+	frame->state.gradient = NULL;
+	frame->state.gradient_owned = false;
+
+	svgtiny_stream_paint(stream, frame, atts);
+
+	view_box = svgtiny_stream_attribute(atts, "viewBox");
+	if (view_box)
+		svgtiny_parse_viewbox(view_box, view_box + strlen(view_box),
+				&frame->state);
+
+	svgtiny_stream_transform(atts, &frame->state);
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Start an <svg>, <g>, or <a> element.
+ */
+
+svgtiny_code svgtiny_stream_start_svg(struct svgtiny_stream *stream,
+		const char **atts)
+{
+	struct svgtiny_stream_frame *frame;
+	const char *view_box;
+
+	frame = svgtiny_stream_push(stream, false);
+	if (!frame)
+		return svgtiny_OUT_OF_MEMORY;
+
+	svgtiny_stream_paint(stream, frame, atts);
+
+	view_box = svgtiny_stream_attribute(atts, "viewBox");
+	if (view_box)
+		svgtiny_parse_viewbox(view_box, view_box + strlen(view_box),
+				&frame->state);
+
+	svgtiny_stream_transform(atts, &frame->state);
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Start a <text> or <tspan> element.
+ */
+
+svgtiny_code svgtiny_stream_start_text(struct svgtiny_stream *stream,
+		const char **atts)
+{
+	struct svgtiny_stream_frame *frame;
+	struct svgtiny_parse_state *state;
+	float x, y, width, height;
+
+	frame = svgtiny_stream_push(stream, true);
+	if (!frame)
+		return svgtiny_OUT_OF_MEMORY;
+	state = &frame->state;
+
+	svgtiny_stream_position(atts, state, &x, &y, &width, &height);
+	svgtiny_stream_transform(atts, state);
+
+	frame->text_x = state->ctm.a * x + state->ctm.c * y + state->ctm.e;
+	frame->text_y = state->ctm.b * x + state->ctm.d * y + state->ctm.f;
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Add a basic shape or path element to the diagram.
+ *
+ * \param  element  element type, which is ignored if not a shape
+ */
+
+svgtiny_code svgtiny_stream_shape(struct svgtiny_stream *stream,
+		svgtiny_element element, const char **atts)
+{
+	struct svgtiny_stream_frame frame;
+	struct svgtiny_parse_state *state = &frame.state;
+	svgtiny_code code = svgtiny_OK;
+	const char *s;
+
+	frame = *(struct svgtiny_stream_frame *) svgtiny_list_get(
+			stream->frames, svgtiny_list_size(stream->frames) - 1);
+	frame.fill_id = NULL;
+	frame.stroke_id = NULL;
+	svgtiny_setup_state_local(state);
+
+	if (element == svgtiny_ELEMENT_PATH) {
+		svgtiny_stream_paint(stream, &frame, atts);
+		svgtiny_stream_transform(atts, state);
+
+		s = svgtiny_stream_attribute(atts, "d");
+		if (!s) {
+			svgtiny_stream_error(stream, svgtiny_SVG_ERROR,
+					"path: missing d attribute");
+			code = svgtiny_SVG_ERROR;
+		} else {
+			code = svgtiny_add_path_data(s, s + strlen(s), state);
+		}
+
+	} else if (element == svgtiny_ELEMENT_RECT) {
+		float x, y, width, height;
+
+		svgtiny_stream_position(atts, state, &x, &y, &width, &height);
+		svgtiny_stream_paint(stream, &frame, atts);
+		svgtiny_stream_transform(atts, state);
+
+		code = svgtiny_add_rect(x, y, width, height, state);
+
+	} else if (element == svgtiny_ELEMENT_CIRCLE ||
+			element == svgtiny_ELEMENT_ELLIPSE) {
+		bool circle = element == svgtiny_ELEMENT_CIRCLE;
+		float x = 0, y = 0, rx = -1, ry = -1;
+
+		if ((s = svgtiny_stream_attribute(atts, "cx")))
+			x = svgtiny_stream_length(s, state->viewport_width);
+		if ((s = svgtiny_stream_attribute(atts, "cy")))
+			y = svgtiny_stream_length(s, state->viewport_height);
+		if (circle) {
+			if ((s = svgtiny_stream_attribute(atts, "r")))
+				rx = svgtiny_stream_length(s,
+						state->viewport_width);
+			ry = rx;
+		} else {
+			if ((s = svgtiny_stream_attribute(atts, "rx")))
+				rx = svgtiny_stream_length(s,
+						state->viewport_width);
+			if ((s = svgtiny_stream_attribute(atts, "ry")))
+				ry = svgtiny_stream_length(s,
+						state->viewport_width);
+		}
+		svgtiny_stream_paint(stream, &frame, atts);
+		svgtiny_stream_transform(atts, state);
+
+		if (rx < 0 || ry < 0) {
+			svgtiny_stream_error(stream, svgtiny_SVG_ERROR, circle ?
+					"circle: r missing or negative" :
+					"ellipse: rx or ry missing "
+					"or negative");
+			code = svgtiny_SVG_ERROR;
+		} else if (rx != 0 && ry != 0) {
+			code = svgtiny_add_ellipse(x, y, rx, ry, state);
+		}
+
+	} else if (element == svgtiny_ELEMENT_LINE) {
+		float x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+
+		if ((s = svgtiny_stream_attribute(atts, "x1")))
+			x1 = svgtiny_stream_length(s, state->viewport_width);
+		if ((s = svgtiny_stream_attribute(atts, "y1")))
+			y1 = svgtiny_stream_length(s, state->viewport_height);
+		if ((s = svgtiny_stream_attribute(atts, "x2")))
+			x2 = svgtiny_stream_length(s, state->viewport_width);
+		if ((s = svgtiny_stream_attribute(atts, "y2")))
+			y2 = svgtiny_stream_length(s, state->viewport_height);
+		svgtiny_stream_paint(stream, &frame, atts);
+		svgtiny_stream_transform(atts, state);
+
+		code = svgtiny_add_line(x1, y1, x2, y2, state);
+
+	} else if (element == svgtiny_ELEMENT_POLYLINE ||
+			element == svgtiny_ELEMENT_POLYGON) {
+		bool polygon = element == svgtiny_ELEMENT_POLYGON;
+
+		svgtiny_stream_paint(stream, &frame, atts);
+		svgtiny_stream_transform(atts, state);
+
+		s = svgtiny_stream_attribute(atts, "points");
+		if (!s) {
+			svgtiny_stream_error(stream, svgtiny_SVG_ERROR,
+					"polyline/polygon: missing points "
+					"attribute");
+			code = svgtiny_SVG_ERROR;
+		} else {
+			code = svgtiny_add_poly(s, s + strlen(s), polygon,
+					state);
+		}
+	}
+
+	svgtiny_stream_frame_cleanup(&frame);
+
+	return code;
+}
+
+
+/**
+ * Find an attribute by local name.
+ */
+
+const char *svgtiny_stream_attribute(const char **atts, const char *name)
+{
+	for (; *atts; atts += 2) {
+		const char *local = strrchr(atts[0], '\n');
+		local = local ? local + 1 : atts[0];
+		if (strcmp(local, name) == 0)
+			return atts[1];
+	}
+	return NULL;
+}
+
+
+/**
+ * Parse a length attribute as a number of pixels.
+ */
+
+float svgtiny_stream_length(const char *s, int viewport_size)
+{
+	return _svgtiny_parse_length(s, s + strlen(s), viewport_size);
+}
+
+
+/**
+ * Parse x, y, width, and height attributes, if present.
+ */
+
+void svgtiny_stream_position(const char **atts,
+		const struct svgtiny_parse_state *state,
+		float *x, float *y, float *width, float *height)
+{
+	const char *s;
+
+	*x = 0;
+	*y = 0;
+	*width = state->viewport_width;
+	*height = state->viewport_height;
+
+	if ((s = svgtiny_stream_attribute(atts, "x")))
+		*x = svgtiny_stream_length(s, state->viewport_width);
+	if ((s = svgtiny_stream_attribute(atts, "y")))
+		*y = svgtiny_stream_length(s, state->viewport_height);
+	if ((s = svgtiny_stream_attribute(atts, "width")))
+		*width = svgtiny_stream_length(s, state->viewport_width);
+	if ((s = svgtiny_stream_attribute(atts, "height")))
+		*height = svgtiny_stream_length(s, state->viewport_height);
+}
+
+
+/**
+ * Parse paint attributes, if present.
+ */
+
+void svgtiny_stream_paint(struct svgtiny_stream *stream,
+		struct svgtiny_stream_frame *frame, const char **atts)
+{
+	struct svgtiny_parse_state *state = &frame->state;
+	const char *s;
+
+	if ((s = svgtiny_stream_attribute(atts, "fill")))
+		svgtiny_stream_colour(stream, frame, s, true);
+
+	if ((s = svgtiny_stream_attribute(atts, "stroke")))
+		svgtiny_stream_colour(stream, frame, s, false);
+
+	if ((s = svgtiny_stream_attribute(atts, "stroke-width")))
+		state->stroke_width = svgtiny_stream_length(s,
+				state->viewport_width);
+
+	if ((s = svgtiny_stream_attribute(atts, "fill-rule")))
+		svgtiny_parse_fill_rule(s, s + strlen(s), &state->fill_rule);
+
+	if ((s = svgtiny_stream_attribute(atts, "style"))) {
+		const char *value;
+		char *copy;
+		size_t len;
+		if ((value = svgtiny_style_value(s, "fill:", &len))) {
+			copy = strndup(value, len);
+			if (!copy) {
+				svgtiny_stream_error(stream,
+						svgtiny_OUT_OF_MEMORY, NULL);
+				return;
+			}
+			svgtiny_stream_colour(stream, frame, copy, true);
+			free(copy);
+		}
+		if ((value = svgtiny_style_value(s, "stroke:", &len))) {
+			copy = strndup(value, len);
+			if (!copy) {
+				svgtiny_stream_error(stream,
+						svgtiny_OUT_OF_MEMORY, NULL);
+				return;
+			}
+			svgtiny_stream_colour(stream, frame, copy, false);
+			free(copy);
+		}
+		if ((value = svgtiny_style_value(s, "stroke-width:", &len)))
+			state->stroke_width = _svgtiny_parse_length(value,
+					value + len, state->viewport_width);
+		if ((value = svgtiny_style_value(s, "fill-rule:", &len)))
+			svgtiny_parse_fill_rule(value, value + len,
+					&state->fill_rule);
+	}
+}
+
+
+/**
+ * Parse a fill or stroke colour, noting a reference to an undefined gradient.
+ */
+
+void svgtiny_stream_colour(struct svgtiny_stream *stream,
+		struct svgtiny_stream_frame *frame, const char *s, bool fill)
+{
+	svgtiny_colour *c = fill ? &frame->state.fill : &frame->state.stroke;
+	char **id = fill ? &frame->fill_id : &frame->stroke_id;
+	const char **pending = fill ? &frame->state.fill_pending :
+			&frame->state.stroke_pending;
+	svgtiny_colour previous = *c;
+
+	stream->missing = false;
+	*c = svgtiny_UNSET_COLOUR;
+	_svgtiny_parse_color(s, c, &frame->state);
+	if (*c == svgtiny_UNSET_COLOUR) {
+		/* not understood: the inherited paint stays */
+		*c = previous;
+		return;
+	}
+
+	free(*id);
+	*id = NULL;
+	*pending = NULL;
+
+	if (stream->missing) {
+		/* url(#id): the colour is decided when the gradient is
+		 * defined */
+		s += 5;
+		*id = strndup(s, strcspn(s, ")"));
+		if (!*id) {
+			svgtiny_stream_error(stream, svgtiny_OUT_OF_MEMORY,
+					NULL);
+			return;
+		}
+		*pending = *id;
+	}
+}
+
+
+/**
+ * Parse transform attributes, if present.
+ */
+
+void svgtiny_stream_transform(const char **atts,
+		struct svgtiny_parse_state *state)
+{
+	const char *s = svgtiny_stream_attribute(atts, "transform");
+
+	if (s)
+		svgtiny_parse_transform(s, s + strlen(s),
+				&state->ctm.a, &state->ctm.b,
+				&state->ctm.c, &state->ctm.d,
+				&state->ctm.e, &state->ctm.f);
+}
+
+
+/**
+ * Start reading a <linearGradient> or <radialGradient> element.
+ */
+
+void svgtiny_stream_gradient_start(struct svgtiny_stream *stream,
+		const char **atts, bool radial)
+{
+	struct svgtiny_stream_gradient *gradient = &stream->gradient;
+	const char *s;
+
+	stream->gradient_depth = stream->depth;
+
+	memset(gradient, 0, sizeof *gradient);
+	gradient->user_space_on_use = -1;
+	gradient->spread = -1;
+	gradient->radial = radial;
+	gradient->id = strdup(svgtiny_stream_attribute(atts, "id"));
+
+	if ((s = svgtiny_stream_attribute(atts, "href")) && s[0] == '#')
+		gradient->href = strdup(s + 1);
+
+#define svgtiny_STREAM_COORDINATE(n)					\
+	if ((s = svgtiny_stream_attribute(atts, #n)) &&			\
+			dom_string_create((const uint8_t *) s, strlen(s),\
+			&gradient->n) != DOM_NO_ERR)			\
+		gradient->n = NULL;
+	if (radial) {
+		svgtiny_STREAM_COORDINATE(cx)
+		svgtiny_STREAM_COORDINATE(cy)
+		svgtiny_STREAM_COORDINATE(r)
+		svgtiny_STREAM_COORDINATE(fx)
+		svgtiny_STREAM_COORDINATE(fy)
+	} else {
+		svgtiny_STREAM_COORDINATE(x1)
+		svgtiny_STREAM_COORDINATE(y1)
+		svgtiny_STREAM_COORDINATE(x2)
+		svgtiny_STREAM_COORDINATE(y2)
+	}
+#undef svgtiny_STREAM_COORDINATE
+
+	if ((s = svgtiny_stream_attribute(atts, "gradientUnits")))
+		gradient->user_space_on_use =
+				strcmp(s, "userSpaceOnUse") == 0;
+
+	if ((s = svgtiny_stream_attribute(atts, "spreadMethod")))
+		gradient->spread = svgtiny_parse_spread(s);
+
+	if ((s = svgtiny_stream_attribute(atts, "gradientTransform"))) {
+		float *m = gradient->transform;
+		m[0] = 1; m[1] = 0; m[2] = 0; m[3] = 1; m[4] = 0; m[5] = 0;
+		svgtiny_parse_transform(s, s + strlen(s),
+				&m[0], &m[1], &m[2], &m[3], &m[4], &m[5]);
+		gradient->transform_set = true;
+	}
+}
+
+
+/**
+ * Read a <stop> element within a gradient.
+ */
+
+void svgtiny_stream_gradient_stop(struct svgtiny_stream *stream,
+		const char **atts)
+{
+	struct svgtiny_stream_gradient *gradient = &stream->gradient;
+	float offset = -1;
+	svgtiny_colour color = svgtiny_TRANSPARENT;
+	const char *s;
+
+	if ((s = svgtiny_stream_attribute(atts, "offset")))
+		offset = svgtiny_parse_gradient_offset(s, s + strlen(s));
+
+	if ((s = svgtiny_stream_attribute(atts, "stop-color")))
+		_svgtiny_parse_color(s, &color, &stream->state);
+
+	if ((s = svgtiny_stream_attribute(atts, "style"))) {
+		const char *value;
+		size_t len;
+		if ((value = svgtiny_style_value(s, "stop-color:", &len))) {
+			char *copy = strndup(value, len);
+			if (copy)
+				_svgtiny_parse_color(copy, &color,
+						&stream->state);
+			free(copy);
+		}
+	}
+
+	if (offset == -1 || color == svgtiny_TRANSPARENT)
+		return;
+
+	if (gradient->stop_count == gradient->stop_allocated) {
+		unsigned int allocated = gradient->stop_allocated ?
+				gradient->stop_allocated * 2 : 4;
+		struct svgtiny_gradient_stop *stop;
+		stop = realloc(gradient->stop, allocated * sizeof stop[0]);
+		if (!stop) {
+			svgtiny_stream_error(stream, svgtiny_OUT_OF_MEMORY,
+					NULL);
+			return;
+		}
+		gradient->stop = stop;
+		gradient->stop_allocated = allocated;
+	}
+	gradient->stop[gradient->stop_count].offset = offset;
+	gradient->stop[gradient->stop_count].color = color;
+	gradient->stop_count++;
+}
+
+
+/**
+ * Finish reading a gradient element, and place any shapes which were waiting
+ * for it.
+ */
+
+svgtiny_code svgtiny_stream_gradient_end(struct svgtiny_stream *stream)
+{
+	struct svgtiny_stream_gradient *gradient;
+
+	stream->gradient_depth = 0;
+
+	if (stream->gradient.stop_count) {
+		stream->gradient.ramp = svgtiny_ramp_create(
+				stream->gradient.stop,
+				stream->gradient.stop_count);
+		if (!stream->gradient.ramp) {
+			svgtiny_stream_gradient_free(&stream->gradient);
+			return svgtiny_OUT_OF_MEMORY;
+		}
+	}
+	free(stream->gradient.stop);
+	stream->gradient.stop = NULL;
+	stream->gradient.stop_count = stream->gradient.stop_allocated = 0;
+
+	if (!stream->gradient.id) {
+		svgtiny_stream_gradient_free(&stream->gradient);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+
+	/* as with getElementById(), the first definition of an id wins */
+	if (svgtiny_stream_gradient_lookup(stream, stream->gradient.id)) {
+		svgtiny_stream_gradient_free(&stream->gradient);
+		return svgtiny_OK;
+	}
+
+	gradient = svgtiny_list_push(stream->gradients);
+	if (!gradient) {
+		svgtiny_stream_gradient_free(&stream->gradient);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+	*gradient = stream->gradient;
+	memset(&stream->gradient, 0, sizeof stream->gradient);
+
+	return svgtiny_stream_resolve(stream);
+}
+
+
+/**
+ * Free the contents of a gradient definition.
+ */
+
+void svgtiny_stream_gradient_free(struct svgtiny_stream_gradient *gradient)
+{
+	free(gradient->id);
+	free(gradient->href);
+	if (gradient->x1)
+		dom_string_unref(gradient->x1);
+	if (gradient->y1)
+		dom_string_unref(gradient->y1);
+	if (gradient->x2)
+		dom_string_unref(gradient->x2);
+	if (gradient->y2)
+		dom_string_unref(gradient->y2);
+	if (gradient->cx)
+		dom_string_unref(gradient->cx);
+	if (gradient->cy)
+		dom_string_unref(gradient->cy);
+	if (gradient->r)
+		dom_string_unref(gradient->r);
+	if (gradient->fx)
+		dom_string_unref(gradient->fx);
+	if (gradient->fy)
+		dom_string_unref(gradient->fy);
+	free(gradient->stop);
+	svgtiny_ramp_unref(gradient->ramp);
+	memset(gradient, 0, sizeof *gradient);
+}
+
+
+/**
+ * Find a gradient definition by id.
+ */
+
+struct svgtiny_stream_gradient *svgtiny_stream_gradient_lookup(
+		struct svgtiny_stream *stream, const char *id)
+{
+	unsigned int i;
+
+	for (i = 0; i != svgtiny_list_size(stream->gradients); i++) {
+		struct svgtiny_stream_gradient *gradient =
+				svgtiny_list_get(stream->gradients, i);
+		if (strcmp(gradient->id, id) == 0)
+			return gradient;
+	}
+	return NULL;
+}
+
+
+/**
+ * Test if a gradient and all gradients it refers to are defined.
+ */
+
+bool svgtiny_stream_gradient_ready(struct svgtiny_stream *stream,
+		const char *id, unsigned int depth)
+{
+	struct svgtiny_stream_gradient *gradient;
+
+	if (!id)
+		return true;
+	gradient = svgtiny_stream_gradient_lookup(stream, id);
+	if (!gradient)
+		return false;
+	if (gradient->href && depth != svgtiny_MAX_HREF_DEPTH)
+		return svgtiny_stream_gradient_ready(stream, gradient->href,
+				depth + 1);
+	return true;
+}
+
+
+/**
+ * Find a gradient by id and fill in its definition.
+ *
+ * Called by svgtiny_find_gradient() after it has reset the gradient to the
+ * defaults.
+ */
+
+void svgtiny_stream_find_gradient(const char *id,
+		struct svgtiny_gradient *gradient,
+		const struct svgtiny_parse_context *context)
+{
+	struct svgtiny_stream *stream = context->stream;
+
+	if (!svgtiny_stream_gradient_apply(stream, id, gradient, 0) &&
+			!stream->completed)
+		stream->missing = true;
+}
+
+
+/**
+ * Apply a gradient definition, following its href first.
+ *
+ * \return  false if the gradient or one it refers to is not defined
+ */
+
+bool svgtiny_stream_gradient_apply(struct svgtiny_stream *stream,
+		const char *id, struct svgtiny_gradient *gradient,
+		unsigned int depth)
+{
+	struct svgtiny_stream_gradient *definition;
+	bool found = true;
+
+	definition = svgtiny_stream_gradient_lookup(stream, id);
+	if (!definition)
+		return false;
+
+	if (definition->href && depth != svgtiny_MAX_HREF_DEPTH)
+		found = svgtiny_stream_gradient_apply(stream,
+				definition->href, gradient, depth + 1);
+	gradient->radial = definition->radial;
+
+#define svgtiny_STREAM_COORDINATE(n)					\
+	if (definition->n) {						\
+		if (gradient->n)					\
+			dom_string_unref(gradient->n);			\
+		gradient->n = dom_string_ref(definition->n);		\
+	}
+	svgtiny_STREAM_COORDINATE(x1)
+	svgtiny_STREAM_COORDINATE(y1)
+	svgtiny_STREAM_COORDINATE(x2)
+	svgtiny_STREAM_COORDINATE(y2)
+	svgtiny_STREAM_COORDINATE(cx)
+	svgtiny_STREAM_COORDINATE(cy)
+	svgtiny_STREAM_COORDINATE(r)
+	svgtiny_STREAM_COORDINATE(fx)
+	svgtiny_STREAM_COORDINATE(fy)
+#undef svgtiny_STREAM_COORDINATE
+
+	if (definition->user_space_on_use != -1)
+		gradient->user_space_on_use = definition->user_space_on_use;
+
+	if (definition->spread != -1)
+		gradient->spread = definition->spread;
+
+	if (definition->transform_set) {
+		gradient->transform.a = definition->transform[0];
+		gradient->transform.b = definition->transform[1];
+		gradient->transform.c = definition->transform[2];
+		gradient->transform.d = definition->transform[3];
+		gradient->transform.e = definition->transform[4];
+		gradient->transform.f = definition->transform[5];
+	}
+
+	if (definition->ramp) {
+		svgtiny_ramp_unref(gradient->ramp);
+		gradient->ramp = svgtiny_ramp_ref(definition->ramp);
+	}
+
+	return found;
+}
+
+
+/**
+ * Hold back a path which uses a gradient that is not yet defined.
+ *
+ * Takes ownership of p.
+ */
+
+svgtiny_code svgtiny_stream_defer_path(float *p, unsigned int n,
+		struct svgtiny_parse_state *state)
+{
+	return svgtiny_stream_defer(p, n, NULL, 0, 0, 0, state);
+}
+
+
+/**
+ * Hold back a text fragment which uses a gradient that is not yet defined.
+ */
+
+svgtiny_code svgtiny_stream_defer_text(const char *text, size_t len,
+		float x, float y, struct svgtiny_parse_state *state)
+{
+	return svgtiny_stream_defer(NULL, 0, text, len, x, y, state);
+}
+
+
+/**
+ * Add a shape to the fixup table, to be inserted at the current end of the
+ * diagram when it can be resolved.
+ */
+
+svgtiny_code svgtiny_stream_defer(float *p, unsigned int n,
+		const char *text, size_t len, float x, float y,
+		struct svgtiny_parse_state *state)
+{
+	struct svgtiny_stream *stream = state->context->stream;
+	struct svgtiny_stream_fixup *fixup;
+
+	assert(stream);
+
+	fixup = svgtiny_list_push(stream->fixups);
+	if (!fixup) {
+		free(p);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+
+	fixup->index = stream->diagram->shape_count;
+	fixup->path = p;
+	fixup->path_length = n;
+	fixup->text = p ? NULL : strndup(text, len);
+	fixup->text_x = x;
+	fixup->text_y = y;
+	fixup->state = *state;
+	svgtiny_setup_state_local(&fixup->state);
+	if (state->gradient) {
+		/* the element which found the gradient may be closed before
+		 * the fixup is resolved */
+		fixup->state.gradient = svgtiny_gradient_copy(state->gradient);
+		fixup->state.gradient_owned = fixup->state.gradient != NULL;
+	}
+	fixup->state.fill_pending = NULL;
+	fixup->state.stroke_pending = NULL;
+	fixup->fill_id = state->fill_pending ?
+			strdup(state->fill_pending) : NULL;
+	fixup->stroke_id = state->stroke_pending ?
+			strdup(state->stroke_pending) : NULL;
+
+	if ((!p && !fixup->text) ||
+			(state->gradient && !fixup->state.gradient) ||
+			(state->fill_pending && !fixup->fill_id) ||
+			(state->stroke_pending && !fixup->stroke_id)) {
+		svgtiny_stream_fixup_free(fixup);
+		svgtiny_list_resize(stream->fixups,
+				svgtiny_list_size(stream->fixups) - 1);
+		return svgtiny_OUT_OF_MEMORY;
+	}
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Add the shapes in the fixup table whose gradients are now defined, or all
+ * of them once the document is complete.
+ */
+
+svgtiny_code svgtiny_stream_resolve(struct svgtiny_stream *stream)
+{
+	struct svgtiny_stream_fixup fixup;
+	unsigned int i = 0, j, n, added;
+	svgtiny_code code;
+
+	while (i != svgtiny_list_size(stream->fixups)) {
+		struct svgtiny_stream_fixup *base =
+				svgtiny_list_get(stream->fixups, 0);
+		n = svgtiny_list_size(stream->fixups);
+
+		if (!stream->completed &&
+				(!svgtiny_stream_gradient_ready(stream,
+					base[i].fill_id, 0) ||
+				!svgtiny_stream_gradient_ready(stream,
+					base[i].stroke_id, 0))) {
+			i++;
+			continue;
+		}
+
+		fixup = base[i];
+		memmove(base + i, base + i + 1, (n - i - 1) * sizeof *base);
+		svgtiny_list_resize(stream->fixups, n - 1);
+
+		code = svgtiny_stream_fixup(stream, &fixup, &added);
+		if (code != svgtiny_OK)
+			return code;
+
+		/* later shapes in the table follow this one */
+		for (j = i; j != n - 1; j++)
+			base[j].index += added;
+	}
+
+	return svgtiny_OK;
+}
+
+
+/**
+ * Add a shape from the fixup table at its place in the diagram.
+ *
+ * \param  added  updated with number of shapes added
+ */
+
+svgtiny_code svgtiny_stream_fixup(struct svgtiny_stream *stream,
+		struct svgtiny_stream_fixup *fixup, unsigned int *added)
+{
+	struct svgtiny_diagram *diagram = stream->diagram;
+	struct svgtiny_shape *moved;
+	unsigned int start = diagram->shape_count;
+	unsigned int k;
+	svgtiny_code code;
+	char *url;
+
+	*added = 0;
+
+	if (fixup->fill_id || fixup->stroke_id) {
+		url = malloc(strlen(fixup->fill_id ? fixup->fill_id : "") +
+				strlen(fixup->stroke_id ? fixup->stroke_id : "")
+				+ 7);
+		if (!url) {
+			svgtiny_stream_fixup_free(fixup);
+			return svgtiny_OUT_OF_MEMORY;
+		}
+		if (fixup->stroke_id) {
+			sprintf(url, "url(#%s)", fixup->stroke_id);
+			_svgtiny_parse_color(url, &fixup->state.stroke,
+					&fixup->state);
+		}
+		if (fixup->fill_id) {
+			sprintf(url, "url(#%s)", fixup->fill_id);
+			_svgtiny_parse_color(url, &fixup->state.fill,
+					&fixup->state);
+		}
+		free(url);
+	}
+
+	if (fixup->path) {
+		code = svgtiny_add_path(fixup->path, fixup->path_length,
+				&fixup->state);
+		fixup->path = NULL;
+	} else {
+		code = svgtiny_add_text(fixup->text, strlen(fixup->text),
+				fixup->text_x, fixup->text_y, &fixup->state);
+	}
+	svgtiny_stream_fixup_free(fixup);
+
+	/* rotate the new shapes down to the fixup's place */
+	k = diagram->shape_count - start;
+	if (k != 0 && fixup->index != start) {
+		moved = malloc(k * sizeof *moved);
+		if (!moved)
+			return svgtiny_OUT_OF_MEMORY;
+		memcpy(moved, diagram->shape + start, k * sizeof *moved);
+		memmove(diagram->shape + fixup->index + k,
+				diagram->shape + fixup->index,
+				(start - fixup->index) * sizeof *moved);
+		memcpy(diagram->shape + fixup->index, moved,
+				k * sizeof *moved);
+		free(moved);
+	}
+	*added = k;
+
+	return code;
+}
+
+
+/**
+ * Free the contents of a fixup.
+ */
+
+void svgtiny_stream_fixup_free(struct svgtiny_stream_fixup *fixup)
+{
+	free(fixup->path);
+	free(fixup->text);
+	free(fixup->fill_id);
+	free(fixup->stroke_id);
+	fixup->path = NULL;
+	fixup->text = NULL;
+	fixup->fill_id = NULL;
+	fixup->stroke_id = NULL;
+	svgtiny_cleanup_state_local(&fixup->state);
+}
@@ -0,0 +1,203 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Threads sharing numbered items of work.
+ *
+ * svgtiny_threads_run() starts threads which, with the calling thread, each
+ * call a work function. The work function takes items in turn from
+ * svgtiny_threads_next() until there are none left, or one has failed. This
+ * is used for the bands of svgtiny_render_threads(), the tiles of
+ * svgtiny_render_sdf(), and the subtrees of a parallel parse. Without POSIX
+ * threads, the calling thread does all the work.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef _POSIX_THREADS
+#if 0 < _POSIX_THREADS
+#include <pthread.h>
+#define svgtiny_PTHREADS
+#endif
+#endif
+
+#include "svgtiny.h"
+#include "svgtiny_internal.h"
+
+/* a call of svgtiny_threads_run(), shared by its threads */
+struct svgtiny_threads {
+	void (*work)(struct svgtiny_threads *threads, void *pw);
+	void *pw;
+	/* next item to take, and the number of items, and the result, taken
+	 * and set by each thread with mutex locked */
+	unsigned int next, count;
+	svgtiny_code code;
+#ifdef svgtiny_PTHREADS
+	/* false if the mutex could not be made, and there are no threads */
+	bool locking;
+	pthread_mutex_t mutex;
+#endif
+};
+
+#ifdef svgtiny_PTHREADS
+static void *svgtiny_threads_start(void *threads);
+#endif
+
+
+/**
+ * Find the number of threads to use.
+ *
+ * \param  threads  number of threads asked for, or 0 for one for each
+ *                  processor
+ * \return  number of threads, at least 1, and 1 without POSIX threads
+ */
+
+unsigned int svgtiny_threads_count(unsigned int threads)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	if (threads == 0) {
+		long processors = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = 0 < processors ? processors : 1;
+	}
+#endif
+#ifndef svgtiny_PTHREADS
+	threads = 1;
+#endif
+	if (threads == 0)
+		threads = 1;
+	return threads;
+}
+
+
+/**
+ * Do numbered items of work with several threads.
+ *
+ * The work function is called once by each thread, including the calling
+ * thread, and should take items from svgtiny_threads_next() until it returns
+ * false. No more threads are started than there are items, and if threads
+ * can not be started, the items are shared by fewer. If the mutex can not be
+ * made, the calling thread does all the items.
+ *
+ * \param  threads  number of threads, including the calling thread, or 0 for
+ *                  one for each processor
+ * \param  count    number of items
+ * \param  work     function called by each thread
+ * \param  pw       private word passed to work
+ * \return  svgtiny_OK, or the first failure passed to svgtiny_threads_next()
+ */
+
+svgtiny_code svgtiny_threads_run(unsigned int threads, unsigned int count,
+		void (*work)(struct svgtiny_threads *threads, void *pw),
+		void *pw)
+{
+	struct svgtiny_threads t;
+#ifdef svgtiny_PTHREADS
+	pthread_t *thread = NULL;
+	unsigned int started = 0, i;
+#endif
+
+	threads = svgtiny_threads_count(threads);
+	if (count < threads)
+		threads = count;
+
+	t.work = work;
+	t.pw = pw;
+	t.next = 0;
+	t.count = count;
+	t.code = svgtiny_OK;
+
+#ifdef svgtiny_PTHREADS
+	t.locking = pthread_mutex_init(&t.mutex, NULL) == 0;
+	if (t.locking && 1 < threads)
+		thread = malloc((threads - 1) * sizeof thread[0]);
+	while (thread && started + 1 < threads &&
+			pthread_create(&thread[started], NULL,
+			svgtiny_threads_start, &t) == 0)
+		started++;
+#endif
+
+	work(&t, pw);
+
+#ifdef svgtiny_PTHREADS
+	for (i = 0; i != started; i++)
+		pthread_join(thread[i], NULL);
+	if (t.locking)
+		pthread_mutex_destroy(&t.mutex);
+	free(thread);
+#endif
+	return t.code;
+}
+
+
+#ifdef svgtiny_PTHREADS
+
+/**
+ * Start routine of the threads of svgtiny_threads_run().
+ */
+
+void *svgtiny_threads_start(void *threads)
+{
+	struct svgtiny_threads *t = threads;
+	t->work(t, t->pw);
+	return NULL;
+}
+
+#endif
+
+
+/**
+ * Take the next item of work.
+ *
+ * \param  item  updated with the item
+ * \param  code  result of the item the thread did last, or svgtiny_OK
+ * \return  false if there are no items left, or one has failed
+ */
+
+bool svgtiny_threads_next(struct svgtiny_threads *threads,
+		unsigned int *item, svgtiny_code code)
+{
+	bool taken = false;
+
+	svgtiny_threads_lock(threads);
+	if (code != svgtiny_OK && threads->code == svgtiny_OK)
+		threads->code = code;
+	if (threads->code == svgtiny_OK && threads->next != threads->count) {
+		*item = threads->next++;
+		taken = true;
+	}
+	svgtiny_threads_unlock(threads);
+	return taken;
+}
+
+
+/**
+ * Lock the mutex of the threads, for data the work shares between them.
+ */
+
+void svgtiny_threads_lock(struct svgtiny_threads *threads)
+{
+#ifdef svgtiny_PTHREADS
+	if (threads->locking)
+		pthread_mutex_lock(&threads->mutex);
+#else
+	UNUSED(threads);
+#endif
+}
+
+
+/**
+ * Unlock the mutex of the threads.
+ */
+
+void svgtiny_threads_unlock(struct svgtiny_threads *threads)
+{
+#ifdef svgtiny_PTHREADS
+	if (threads->locking)
+		pthread_mutex_unlock(&threads->mutex);
+#else
+	UNUSED(threads);
+#endif
+}
@@ -0,0 +1,460 @@
+/*
+ * This file is part of Libsvgtiny
+ * Licensed under the MIT License,
+ *                http://opensource.org/licenses/mit-license.php
+ */
+
+/**
+ * Time repeated parsing of one SVG.
+ *
+ * Each parser is run COUNT times on the same document, and the average time
+ * per document is printed. For small documents this is mostly the fixed cost
+ * of setting up a parse, which a svgtiny_context saves.
+ *
+ * With --scale, generated documents of 1000 to MAX shapes are parsed instead,
+ * to check that the time per shape does not grow with the document.
+ *
+ * With --threads, a generated document of 16 layers of curves is parsed with
+ * 1, 2, 4, ... MAX threads, and the elapsed time of each is printed.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "svgtiny.h"
+
+typedef svgtiny_code (*parse_function)(void *pw,
+		struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+
+static svgtiny_code parse_dom(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+static svgtiny_code parse_stream(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+static svgtiny_code parse_ctx(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+static svgtiny_code parse_packed(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+static svgtiny_code parse_short(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+static svgtiny_code parse_clip(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+static svgtiny_code parse_flatten(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height);
+static int bench(const char *name, parse_function parse, void *pw,
+		const char *buffer, size_t size, const char *url,
+		unsigned int count);
+static int scale(struct svgtiny_context *ctx, unsigned int max);
+static char *generate(unsigned int shapes, size_t *size);
+static int threads(unsigned int max);
+static char *generate_layers(unsigned int layers, unsigned int paths,
+		size_t *size);
+
+
+int main(int argc, char *argv[])
+{
+	FILE *fd;
+	struct stat sb;
+	char *buffer;
+	size_t size;
+	size_t n;
+	unsigned int count = 10000;
+	struct svgtiny_context *ctx;
+	int status = 0;
+
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: %s FILE [COUNT]\n"
+				"       %s --scale [MAX]\n"
+				"       %s --threads [MAX]\n",
+				argv[0], argv[0], argv[0]);
+		return 1;
+	}
+
+	if (strcmp(argv[1], "--scale") == 0) {
+		ctx = svgtiny_context_create();
+		if (!ctx) {
+			fprintf(stderr, "svgtiny_context_create failed\n");
+			return 1;
+		}
+		status = scale(ctx, argc == 3 ? atoi(argv[2]) : 1000000);
+		svgtiny_context_free(ctx);
+		return status;
+	}
+
+	if (strcmp(argv[1], "--threads") == 0)
+		return threads(argc == 3 ? atoi(argv[2]) : 8);
+
+	/* load file into memory buffer */
+	fd = fopen(argv[1], "rb");
+	if (!fd) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	if (stat(argv[1], &sb)) {
+		perror(argv[1]);
+		return 1;
+	}
+	size = sb.st_size;
+
+	buffer = malloc(size);
+	if (!buffer) {
+		fprintf(stderr, "Unable to allocate %lld bytes\n",
+				(long long) size);
+		return 1;
+	}
+
+	n = fread(buffer, 1, size, fd);
+	if (n != size) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	fclose(fd);
+
+	/* read count argument */
+	if (argc == 3) {
+		count = atoi(argv[2]);
+		if (count == 0)
+			count = 1;
+	}
+
+	ctx = svgtiny_context_create();
+	if (!ctx) {
+		fprintf(stderr, "svgtiny_context_create failed\n");
+		return 1;
+	}
+
+	status |= bench("svgtiny_parse", parse_dom, NULL,
+			buffer, size, argv[1], count);
+	status |= bench("svgtiny_parse_stream", parse_stream, NULL,
+			buffer, size, argv[1], count);
+	status |= bench("svgtiny_parse_ctx", parse_ctx, ctx,
+			buffer, size, argv[1], count);
+	status |= bench("svgtiny_parse_ctx packed", parse_packed, ctx,
+			buffer, size, argv[1], count);
+	status |= bench("svgtiny_parse_ctx fixed16", parse_short, ctx,
+			buffer, size, argv[1], count);
+	status |= bench("svgtiny_parse_ctx clipped", parse_clip, ctx,
+			buffer, size, argv[1], count);
+	status |= bench("svgtiny_parse_ctx flat", parse_flatten, ctx,
+			buffer, size, argv[1], count);
+
+	svgtiny_context_free(ctx);
+	free(buffer);
+
+	return status;
+}
+
+
+svgtiny_code parse_dom(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height)
+{
+	(void) pw;
+	return svgtiny_parse(diagram, buffer, size, url, width, height);
+}
+
+
+svgtiny_code parse_stream(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height)
+{
+	(void) pw;
+	return svgtiny_parse_stream(diagram, buffer, size, url,
+			width, height);
+}
+
+
+svgtiny_code parse_ctx(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height)
+{
+	return svgtiny_parse_ctx(pw, diagram, buffer, size, url,
+			width, height);
+}
+
+
+svgtiny_code parse_packed(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height)
+{
+	svgtiny_set_options(diagram, svgtiny_PACKED_PATHS);
+	return svgtiny_parse_ctx(pw, diagram, buffer, size, url,
+			width, height);
+}
+
+
+svgtiny_code parse_short(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height)
+{
+	svgtiny_set_options(diagram, svgtiny_SHORT_FIXED_PATHS);
+	return svgtiny_parse_ctx(pw, diagram, buffer, size, url,
+			width, height);
+}
+
+
+svgtiny_code parse_clip(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height)
+{
+	/* a quarter of the width and height of the viewport */
+	svgtiny_set_clip(diagram, 0, 0, width / 4, height / 4);
+	return svgtiny_parse_ctx(pw, diagram, buffer, size, url,
+			width, height);
+}
+
+
+svgtiny_code parse_flatten(void *pw, struct svgtiny_diagram *diagram,
+		const char *buffer, size_t size, const char *url,
+		int width, int height)
+{
+	svgtiny_code code = svgtiny_parse_ctx(pw, diagram, buffer, size, url,
+			width, height);
+	if (code != svgtiny_OK)
+		return code;
+	return svgtiny_flatten(diagram, 0.25);
+}
+
+
+/**
+ * Parse a document count times into a new diagram and print the average
+ * time taken.
+ *
+ * \return  0 on success, 1 if any parse failed
+ */
+
+int bench(const char *name, parse_function parse, void *pw,
+		const char *buffer, size_t size, const char *url,
+		unsigned int count)
+{
+	struct svgtiny_diagram *diagram;
+	svgtiny_code code;
+	unsigned int shapes = 0;
+	clock_t start, end;
+
+	start = clock();
+	for (unsigned int i = 0; i != count; i++) {
+		diagram = svgtiny_create();
+		if (!diagram) {
+			fprintf(stderr, "svgtiny_create failed\n");
+			return 1;
+		}
+		code = parse(pw, diagram, buffer, size, url, 1000, 1000);
+		shapes = diagram->shape_count;
+		svgtiny_free(diagram);
+		if (code != svgtiny_OK) {
+			fprintf(stderr, "%s failed: %i\n", name, code);
+			return 1;
+		}
+	}
+	end = clock();
+
+	printf("%-25s %8.2f us/document (%u shapes, %u runs)\n", name,
+			(double) (end - start) * 1e6 / CLOCKS_PER_SEC / count,
+			shapes, count);
+
+	return 0;
+}
+
+
+/**
+ * Parse generated documents of increasing size and print the time per shape.
+ *
+ * \return  0 on success, 1 on failure
+ */
+
+int scale(struct svgtiny_context *ctx, unsigned int max)
+{
+	unsigned int shapes;
+	int status = 0;
+
+	for (shapes = 1000; shapes <= max && status == 0; shapes *= 10) {
+		struct svgtiny_diagram *diagram;
+		clock_t start, end;
+		svgtiny_code code;
+		size_t size;
+		char *buffer;
+
+		buffer = generate(shapes, &size);
+		if (!buffer) {
+			fprintf(stderr, "Unable to allocate %u shapes\n",
+					shapes);
+			return 1;
+		}
+
+		diagram = svgtiny_create();
+		if (!diagram) {
+			fprintf(stderr, "svgtiny_create failed\n");
+			free(buffer);
+			return 1;
+		}
+
+		start = clock();
+		code = svgtiny_parse_ctx(ctx, diagram, buffer, size,
+				"scale.svg", 1000, 1000);
+		end = clock();
+
+		if (code != svgtiny_OK) {
+			fprintf(stderr, "svgtiny_parse_ctx failed: %i\n", code);
+			status = 1;
+		} else {
+			printf("%8u shapes %10.2f ms %8.1f ns/shape\n",
+					diagram->shape_count,
+					(double) (end - start) * 1e3 /
+					CLOCKS_PER_SEC,
+					(double) (end - start) * 1e9 /
+					CLOCKS_PER_SEC / diagram->shape_count);
+		}
+
+		svgtiny_free(diagram);
+		free(buffer);
+	}
+
+	return status;
+}
+
+
+/**
+ * Generate an SVG containing a number of small rectangles.
+ */
+
+char *generate(unsigned int shapes, size_t *size)
+{
+	static const char header[] = "<svg xmlns='http://www.w3.org/2000/svg' "
+			"width='1000' height='1000'>\n";
+	static const char footer[] = "</svg>\n";
+	size_t allocated = sizeof header + sizeof footer + shapes * 64;
+	char *buffer = malloc(allocated);
+	size_t n;
+	unsigned int i;
+
+	if (!buffer)
+		return NULL;
+
+	n = sprintf(buffer, "%s", header);
+	for (i = 0; i != shapes; i++)
+		n += sprintf(buffer + n, "<rect x='%u' y='%u' width='1' "
+				"height='1' fill='#%.6x'/>\n",
+				i % 1000, i / 1000 % 1000, i & 0xffffff);
+	n += sprintf(buffer + n, "%s", footer);
+
+	*size = n;
+	return buffer;
+}
+
+
+/**
+ * Parse a generated document of layers with increasing numbers of threads
+ * and print the elapsed time of each.
+ *
+ * \return  0 on success, 1 on failure
+ */
+
+int threads(unsigned int max)
+{
+	unsigned int thread_count;
+	size_t size;
+	char *buffer;
+	int status = 0;
+
+	buffer = generate_layers(16, 2000, &size);
+	if (!buffer) {
+		fprintf(stderr, "Unable to allocate layers\n");
+		return 1;
+	}
+
+	for (thread_count = 1; thread_count <= max && status == 0;
+			thread_count *= 2) {
+		struct svgtiny_diagram *diagram;
+		struct timespec start, end;
+		svgtiny_code code;
+		double ms;
+
+		diagram = svgtiny_create();
+		if (!diagram) {
+			fprintf(stderr, "svgtiny_create failed\n");
+			free(buffer);
+			return 1;
+		}
+		svgtiny_set_threads(diagram, thread_count);
+
+		/* elapsed rather than processor time, which the threads add
+		 * up */
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		code = svgtiny_parse(diagram, buffer, size, "layers.svg",
+				1000, 1000);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ms = (end.tv_sec - start.tv_sec) * 1e3 +
+				(end.tv_nsec - start.tv_nsec) / 1e6;
+
+		if (code != svgtiny_OK) {
+			fprintf(stderr, "svgtiny_parse failed: %i\n", code);
+			status = 1;
+		} else {
+			printf("%3u threads %10.2f ms (%u shapes)\n",
+					thread_count, ms,
+					diagram->shape_count);
+		}
+
+		svgtiny_free(diagram);
+	}
+
+	free(buffer);
+
+	return status;
+}
+
+
+/**
+ * Generate an SVG containing layers of paths of curves.
+ */
+
+char *generate_layers(unsigned int layers, unsigned int paths, size_t *size)
+{
+	static const char header[] = "<svg xmlns='http://www.w3.org/2000/svg' "
+			"width='1000' height='1000'>\n";
+	static const char layer_header[] = "<g stroke='black' "
+			"transform='translate(10 10)'>\n";
+	static const char layer_footer[] = "</g>\n";
+	static const char footer[] = "</svg>\n";
+	size_t allocated = sizeof header + sizeof footer + layers *
+			(sizeof layer_header + sizeof layer_footer +
+			paths * 160);
+	char *buffer = malloc(allocated);
+	size_t n;
+	unsigned int i, j;
+
+	if (!buffer)
+		return NULL;
+
+	n = sprintf(buffer, "%s", header);
+	for (i = 0; i != layers; i++) {
+		n += sprintf(buffer + n, "%s", layer_header);
+		for (j = 0; j != paths; j++) {
+			unsigned int x = (i * 61 + j * 7) % 960;
+			unsigned int y = (i * 37 + j * 13) % 960;
+			n += sprintf(buffer + n, "<path fill='#%.6x' "
+					"d='M%u %uc10-20 30-20 40 0"
+					"s-10 40-20 40-30-20-20-40z'/>\n",
+					(i * 4099 + j) & 0xffffff, x, y);
+		}
+		n += sprintf(buffer + n, "%s", layer_footer);
+	}
+	n += sprintf(buffer + n, "%s", footer);
+
+	*size = n;
+	return buffer;
+}
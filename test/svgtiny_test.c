@@ -10,8 +10,16 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include "svgtiny.h"
 
+static const float *segment_points(const struct svgtiny_shape *shape,
+		const struct svgtiny_path_segment *segment, float *fixed);
+static void render(const struct svgtiny_diagram *diagram, float scale,
+		const char *path, unsigned int threads);
+static void render_sdf(const struct svgtiny_diagram *diagram, float scale,
+		const char *path, unsigned int threads);
+
 
 int main(int argc, char *argv[])
 {
@@ -23,9 +31,81 @@ int main(int argc, char *argv[])
 	size_t n;
 	struct svgtiny_diagram *diagram;
 	svgtiny_code code;
+	unsigned int options = 0;
+	int print_bbox = 0;
+	int clip = 0;
+	float clip_x0, clip_y0, clip_x1, clip_y1;
+	int flatten = 0;
+	float tolerance;
+	const char *render_path = NULL;
+	const char *sdf_path = NULL;
+	unsigned int threads = 1;
+
+	/* -g: ask for gradient fills as descriptors,
+	 * -l: interpolate gradients in linear light,
+	 * -m: ask for gradient fills as meshes,
+	 * -p: ask for packed paths,
+	 * -x: ask for 24.8 fixed point paths,
+	 * -s: ask for 16 bit fixed point paths where they fit,
+	 * -b: print the bounding box of each shape,
+	 * -cX0,Y0,X1,Y1: leave out shapes outside a clip rectangle,
+	 * -C: clip paths to the clip rectangle,
+	 * -fTOLERANCE: flatten curves to lines after parsing,
+	 * -rFILE: render to a PPM image on white,
+	 * -dFILE: write a signed distance field to a PGM image,
+	 * -tTHREADS: parse and render with THREADS threads, 0 for one per
+	 *            processor */
+	while (argc != 1 && (strcmp(argv[1], "-g") == 0 ||
+			strcmp(argv[1], "-l") == 0 ||
+			strcmp(argv[1], "-m") == 0 ||
+			strcmp(argv[1], "-p") == 0 ||
+			strcmp(argv[1], "-x") == 0 ||
+			strcmp(argv[1], "-s") == 0 ||
+			strcmp(argv[1], "-b") == 0 ||
+			strcmp(argv[1], "-C") == 0 ||
+			(strncmp(argv[1], "-c", 2) == 0 &&
+			sscanf(argv[1] + 2, "%g,%g,%g,%g", &clip_x0, &clip_y0,
+			&clip_x1, &clip_y1) == 4) ||
+			(strncmp(argv[1], "-f", 2) == 0 &&
+			sscanf(argv[1] + 2, "%g", &tolerance) == 1) ||
+			(strncmp(argv[1], "-r", 2) == 0 && argv[1][2]) ||
+			(strncmp(argv[1], "-d", 2) == 0 && argv[1][2]) ||
+			(strncmp(argv[1], "-t", 2) == 0 &&
+			sscanf(argv[1] + 2, "%u", &threads) == 1))) {
+		if (argv[1][1] == 'g')
+			options |= svgtiny_NATIVE_GRADIENTS;
+		else if (argv[1][1] == 'l')
+			options |= svgtiny_LINEAR_RGB_GRADIENTS;
+		else if (argv[1][1] == 'm')
+			options |= svgtiny_MESH_GRADIENTS;
+		else if (argv[1][1] == 'p')
+			options |= svgtiny_PACKED_PATHS;
+		else if (argv[1][1] == 'x')
+			options |= svgtiny_FIXED_PATHS;
+		else if (argv[1][1] == 's')
+			options |= svgtiny_SHORT_FIXED_PATHS;
+		else if (argv[1][1] == 'b')
+			print_bbox = 1;
+		else if (argv[1][1] == 'C')
+			options |= svgtiny_CLIP_PATHS;
+		else if (argv[1][1] == 'f')
+			flatten = 1;
+		else if (argv[1][1] == 'r')
+			render_path = argv[1] + 2;
+		else if (argv[1][1] == 'd')
+			sdf_path = argv[1] + 2;
+		else if (argv[1][1] == 'c')
+			clip = 1;
+		argv[1] = argv[0];
+		argc--;
+		argv++;
+	}
 
 	if (argc != 2 && argc != 3) {
-		fprintf(stderr, "Usage: %s FILE [SCALE]\n", argv[0]);
+		fprintf(stderr, "Usage: %s [-g] [-l] [-m] [-p] [-x] [-s] [-b] "
+				"[-cX0,Y0,X1,Y1] [-C] [-fTOLERANCE] "
+				"[-rFILE] [-dFILE] [-tTHREADS] FILE [SCALE]\n",
+				argv[0]);
 		return 1;
 	}
 
@@ -70,6 +150,10 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "svgtiny_create failed\n");
 		return 1;
 	}
+	svgtiny_set_options(diagram, options);
+	if (clip)
+		svgtiny_set_clip(diagram, clip_x0, clip_y0, clip_x1, clip_y1);
+	svgtiny_set_threads(diagram, threads);
 
 	/* parse */
 	code = svgtiny_parse(diagram, buffer, size, argv[1], 1000, 1000);
@@ -99,6 +183,9 @@ int main(int argc, char *argv[])
 
 	free(buffer);
 
+	if (flatten && svgtiny_flatten(diagram, tolerance) != svgtiny_OK)
+		fprintf(stderr, "svgtiny_flatten failed\n");
+
 	printf("viewbox 0 0 %g %g\n",
 			scale * diagram->width, scale * diagram->height);
 
@@ -113,54 +200,192 @@ int main(int argc, char *argv[])
 			printf("stroke #%.6x ", diagram->shape[i].stroke);
 		printf("stroke-width %g ",
 				scale * diagram->shape[i].stroke_width);
-		if (diagram->shape[i].path) {
+		if (diagram->shape[i].fill_rule == svgtiny_FILL_EVENODD)
+			printf("fill-rule evenodd ");
+		if (diagram->shape[i].fill_gradient) {
+			const struct svgtiny_linear_gradient *gradient =
+					diagram->shape[i].fill_gradient;
+			printf("fill-gradient %g %g %g %g spread %i stops '",
+					scale * gradient->x1,
+					scale * gradient->y1,
+					scale * gradient->x2,
+					scale * gradient->y2,
+					gradient->spread);
+			for (unsigned int j = 0; j != gradient->stop_count; j++)
+				printf("%g #%.6x ", gradient->stop[j].offset,
+						gradient->stop[j].color);
+			printf("' ");
+		}
+		if (diagram->shape[i].path || diagram->shape[i].path_op) {
+			struct svgtiny_path_iterator path;
+			struct svgtiny_path_segment segment;
 			printf("path '");
-			for (unsigned int j = 0;
-					j != diagram->shape[i].path_length; ) {
-				switch ((int) diagram->shape[i].path[j]) {
+			svgtiny_path_begin(&path, &diagram->shape[i]);
+			while (svgtiny_path_next(&path, &segment)) {
+				float fixed[6];
+				const float *point = segment_points(
+						&diagram->shape[i], &segment,
+						fixed);
+				switch (segment.type) {
 				case svgtiny_PATH_MOVE:
 					printf("M %g %g ",
-					scale * diagram->shape[i].path[j + 1],
-					scale * diagram->shape[i].path[j + 2]);
-					j += 3;
+							scale * point[0],
+							scale * point[1]);
 					break;
 				case svgtiny_PATH_CLOSE:
 					printf("Z ");
-					j += 1;
 					break;
 				case svgtiny_PATH_LINE:
 					printf("L %g %g ",
-					scale * diagram->shape[i].path[j + 1],
-					scale * diagram->shape[i].path[j + 2]);
-					j += 3;
+							scale * point[0],
+							scale * point[1]);
 					break;
 				case svgtiny_PATH_BEZIER:
 					printf("C %g %g %g %g %g %g ",
-					scale * diagram->shape[i].path[j + 1],
-					scale * diagram->shape[i].path[j + 2],
-					scale * diagram->shape[i].path[j + 3],
-					scale * diagram->shape[i].path[j + 4],
-					scale * diagram->shape[i].path[j + 5],
-					scale * diagram->shape[i].path[j + 6]);
-					j += 7;
+							scale * point[0],
+							scale * point[1],
+							scale * point[2],
+							scale * point[3],
+							scale * point[4],
+							scale * point[5]);
 					break;
-				default:
-					printf("error ");
-					j += 1;
 				}
 			}
 			printf("' ");
+		} else if (diagram->shape[i].mesh) {
+			const struct svgtiny_mesh *mesh =
+					diagram->shape[i].mesh;
+			printf("mesh '");
+			for (unsigned int j = 0; j != mesh->index_count; j++) {
+				unsigned int v = mesh->index[j];
+				printf("%g %g #%.6x ",
+						scale * mesh->vertex[2 * v],
+						scale * mesh->vertex[2 * v + 1],
+						mesh->colour[v]);
+			}
+			printf("' ");
 		} else if (diagram->shape[i].text) {
 			printf("text %g %g '%s' ",
 					scale * diagram->shape[i].text_x,
 					scale * diagram->shape[i].text_y,
 					diagram->shape[i].text);
 		}
+		if (print_bbox)
+			printf("bbox %g %g %g %g ",
+					scale * diagram->shape[i].bbox_x0,
+					scale * diagram->shape[i].bbox_y0,
+					scale * diagram->shape[i].bbox_x1,
+					scale * diagram->shape[i].bbox_y1);
 		printf("\n");
 	}
 
+	if (render_path)
+		render(diagram, scale, render_path, threads);
+	if (sdf_path)
+		render_sdf(diagram, scale, sdf_path, threads);
+
 	svgtiny_free(diagram);
 
 	return 0;
 }
 
+
+/**
+ * Render a diagram on white with svgtiny_render_threads() and write it as a
+ * PPM.
+ */
+
+void render(const struct svgtiny_diagram *diagram, float scale,
+		const char *path, unsigned int threads)
+{
+	unsigned int width = scale * diagram->width + 0.5;
+	unsigned int height = scale * diagram->height + 0.5;
+	unsigned char *image;
+	FILE *ppm;
+
+	if (width == 0 || height == 0)
+		return;
+	image = malloc((size_t) width * height * 4);
+	if (!image) {
+		fprintf(stderr, "Unable to allocate image\n");
+		return;
+	}
+	memset(image, 0xff, (size_t) width * height * 4);
+	if (svgtiny_render_threads(diagram, image, width * 4, width, height,
+			scale, threads) != svgtiny_OK)
+		fprintf(stderr, "svgtiny_render_threads failed\n");
+
+	ppm = fopen(path, "wb");
+	if (!ppm) {
+		perror(path);
+		free(image);
+		return;
+	}
+	fprintf(ppm, "P6\n%u %u\n255\n", width, height);
+	for (size_t i = 0; i != (size_t) width * height; i++)
+		fwrite(image + 4 * i, 1, 3, ppm);
+	fclose(ppm);
+	free(image);
+}
+
+
+/**
+ * Find the signed distance field of a diagram with svgtiny_render_sdf(),
+ * reaching 0 and 255 at 8 pixels from the edges, and write it as a PGM.
+ */
+
+void render_sdf(const struct svgtiny_diagram *diagram, float scale,
+		const char *path, unsigned int threads)
+{
+	unsigned int width = scale * diagram->width + 0.5;
+	unsigned int height = scale * diagram->height + 0.5;
+	unsigned char *image;
+	FILE *pgm;
+
+	if (width == 0 || height == 0)
+		return;
+	image = malloc((size_t) width * height);
+	if (!image) {
+		fprintf(stderr, "Unable to allocate image\n");
+		return;
+	}
+	if (svgtiny_render_sdf(diagram, image, width, width, height, scale,
+			8, threads) != svgtiny_OK)
+		fprintf(stderr, "svgtiny_render_sdf failed\n");
+
+	pgm = fopen(path, "wb");
+	if (!pgm) {
+		perror(path);
+		free(image);
+		return;
+	}
+	fprintf(pgm, "P5\n%u %u\n255\n", width, height);
+	fwrite(image, 1, (size_t) width * height, pgm);
+	fclose(pgm);
+	free(image);
+}
+
+
+/**
+ * Get the points of a path segment in pixels, converting fixed point paths
+ * (with the default 8 bits of fraction) into fixed.
+ */
+
+const float *segment_points(const struct svgtiny_shape *shape,
+		const struct svgtiny_path_segment *segment, float *fixed)
+{
+	unsigned int count = segment->type == svgtiny_PATH_BEZIER ? 6 :
+			segment->type == svgtiny_PATH_CLOSE ? 0 : 2;
+
+	if (segment->point)
+		return segment->point;
+	for (unsigned int k = 0; k != count; k++) {
+		if (segment->fixed)
+			fixed[k] = segment->fixed[k] / 256.0f;
+		else if (segment->fixed_short)
+			fixed[k] = (segment->fixed_short[k] + (k % 2 ?
+					shape->path_origin_y :
+					shape->path_origin_x)) / 256.0f;
+	}
+	return fixed;
+}